@@ -0,0 +1,133 @@
+// Use of this source code is governed by a BSD-style license
+// that can be found in the License file.
+
+#ifndef MUDUO_BASE_MPSCQUEUE_H
+#define MUDUO_BASE_MPSCQUEUE_H
+
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+
+#include <algorithm>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace muduo
+{
+
+///
+/// Bounded lock-free queue, many producers and a single consumer.
+///
+/// Array of cells, each tagged with a sequence number, after Dmitry Vyukov's
+/// bounded MPMC queue.  A producer claims a slot with one CAS on the enqueue
+/// position and publishes it by bumping the cell's sequence; the consumer
+/// needs no atomic read-modify-write at all.  Items of one producer come
+/// out in the order they went in.
+///
+/// tryPush() fails when the queue is full, it never blocks.
+/// Requires gcc >= 4.7 for the __atomic builtins.
+template<typename T>
+class MpscQueue : boost::noncopyable
+{
+ public:
+  /// capacity must be a power of 2
+  explicit MpscQueue(size_t capacity)
+    : cells_(new Cell[capacity]),
+      mask_(capacity - 1),
+      enqueuePos_(0),
+      dequeuePos_(0)
+  {
+    assert(capacity >= 2 && (capacity & mask_) == 0);
+    for (size_t i = 0; i < capacity; ++i)
+    {
+      cells_[i].sequence = i;
+    }
+  }
+
+  /// Safe to call from any thread.
+  bool tryPush(const T& x)
+  {
+    Cell* cell = NULL;
+    size_t pos = __atomic_load_n(&enqueuePos_, __ATOMIC_RELAXED);
+    for (;;)
+    {
+      cell = &cells_[pos & mask_];
+      size_t seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+      intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (dif == 0)
+      {
+        if (__atomic_compare_exchange_n(&enqueuePos_, &pos, pos + 1, true,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        {
+          break;
+        }
+      }
+      else if (dif < 0)
+      {
+        return false;  // full
+      }
+      else
+      {
+        pos = __atomic_load_n(&enqueuePos_, __ATOMIC_RELAXED);
+      }
+    }
+    cell->data = x;
+    __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  /// Consumer thread only.
+  /// Fails when empty, or when the next slot is claimed but not yet filled.
+  bool tryPop(T* x)
+  {
+    Cell* cell = &cells_[dequeuePos_ & mask_];
+    size_t seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    if (seq != dequeuePos_ + 1)
+    {
+      return false;
+    }
+    using std::swap;
+    swap(*x, cell->data);
+    cell->data = T();
+    __atomic_store_n(&cell->sequence, dequeuePos_ + mask_ + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&dequeuePos_, dequeuePos_ + 1, __ATOMIC_RELAXED);
+    return true;
+  }
+
+  /// Number of slots claimed so far, including ones still being filled.
+  size_t pushCount() const
+  { return __atomic_load_n(&enqueuePos_, __ATOMIC_SEQ_CST); }
+
+  /// Consumer thread only.
+  size_t popCount() const
+  { return dequeuePos_; }
+
+  /// Approximate when called concurrently with tryPush().
+  size_t size() const
+  { return pushCount() - __atomic_load_n(&dequeuePos_, __ATOMIC_RELAXED); }
+
+  size_t capacity() const
+  { return mask_ + 1; }
+
+ private:
+  struct Cell
+  {
+    size_t sequence;
+    T data;
+  };
+
+  enum { kCacheLineSize = 64 };
+
+  boost::scoped_array<Cell> cells_;
+  const size_t mask_;
+  char pad0_[kCacheLineSize];
+  size_t enqueuePos_;
+  char pad1_[kCacheLineSize];
+  size_t dequeuePos_;
+  char pad2_[kCacheLineSize];
+};
+
+}
+
+#endif  // MUDUO_BASE_MPSCQUEUE_H
@@ -0,0 +1,194 @@
+#include <muduo/base/MpscQueue.h>
+#include <muduo/base/CountDownLatch.h>
+#include <muduo/base/Mutex.h>
+#include <muduo/base/Thread.h>
+#include <muduo/base/Timestamp.h>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+
+// Many producers hand functors to one consumer, the way IO threads call
+// EventLoop::queueInLoop() on each other.  Compares a mutex-guarded vector
+// swapped out by the consumer (the old pendingFunctors_) with MpscQueue.
+
+typedef boost::function<void()> Functor;
+
+class Consumer
+{
+ public:
+  explicit Consumer(int producers)
+    : next_(producers, 0),
+      count_(0),
+      errors_(0)
+  {
+  }
+
+  void onItem(int producer, int seq)
+  {
+    if (next_[producer] != seq)
+    {
+      ++errors_;
+    }
+    next_[producer] = seq + 1;
+    ++count_;
+  }
+
+  int64_t count() const { return count_; }
+  int64_t errors() const { return errors_; }
+
+ private:
+  std::vector<int> next_;
+  int64_t count_;
+  int64_t errors_;
+};
+
+class MutexVectorQueue
+{
+ public:
+  explicit MutexVectorQueue(size_t)
+  {
+  }
+
+  void put(const Functor& f)
+  {
+    muduo::MutexLockGuard lock(mutex_);
+    functors_.push_back(f);
+  }
+
+  size_t drain()
+  {
+    std::vector<Functor> functors;
+    {
+    muduo::MutexLockGuard lock(mutex_);
+    functors.swap(functors_);
+    }
+    for (size_t i = 0; i < functors.size(); ++i)
+    {
+      functors[i]();
+    }
+    return functors.size();
+  }
+
+ private:
+  muduo::MutexLock mutex_;
+  std::vector<Functor> functors_;
+};
+
+class LockFreeQueue
+{
+ public:
+  explicit LockFreeQueue(size_t capacity)
+    : queue_(capacity)
+  {
+  }
+
+  void put(const Functor& f)
+  {
+    while (!queue_.tryPush(f))
+    {
+      sched_yield();
+    }
+  }
+
+  size_t drain()
+  {
+    size_t n = 0;
+    Functor f;
+    while (queue_.tryPop(&f))
+    {
+      f();
+      ++n;
+    }
+    return n;
+  }
+
+ private:
+  muduo::MpscQueue<Functor> queue_;
+};
+
+template<typename Queue>
+class Bench
+{
+ public:
+  Bench(int numThreads, int times, size_t capacity)
+    : consumer_(numThreads),
+      queue_(capacity),
+      latch_(1),
+      times_(times)
+  {
+    for (int i = 0; i < numThreads; ++i)
+    {
+      char name[32];
+      snprintf(name, sizeof name, "producer %d", i);
+      threads_.push_back(new muduo::Thread(
+            boost::bind(&Bench::threadFunc, this, i), muduo::string(name)));
+    }
+  }
+
+  void run(const char* name)
+  {
+    const int64_t total = static_cast<int64_t>(times_) * threads_.size();
+    for (size_t i = 0; i < threads_.size(); ++i)
+    {
+      threads_[i].start();
+    }
+
+    muduo::Timestamp start(muduo::Timestamp::now());
+    latch_.countDown();
+    int64_t drains = 0;
+    while (consumer_.count() < total)
+    {
+      if (queue_.drain() > 0)
+      {
+        ++drains;
+      }
+    }
+    double seconds = timeDifference(muduo::Timestamp::now(), start);
+
+    for (size_t i = 0; i < threads_.size(); ++i)
+    {
+      threads_[i].join();
+    }
+    printf("%-12s %zd producers: %.3f s, %.2f M functors/s, %.1f per drain, %lld out of order\n",
+           name, threads_.size(), seconds, static_cast<double>(total) / seconds / 1e6,
+           static_cast<double>(total) / static_cast<double>(drains),
+           static_cast<long long>(consumer_.errors()));
+  }
+
+ private:
+  void threadFunc(int producer)
+  {
+    latch_.wait();
+    for (int i = 0; i < times_; ++i)
+    {
+      queue_.put(boost::bind(&Consumer::onItem, &consumer_, producer, i));
+    }
+  }
+
+  Consumer consumer_;
+  Queue queue_;
+  muduo::CountDownLatch latch_;
+  boost::ptr_vector<muduo::Thread> threads_;
+  const int times_;
+};
+
+int main(int argc, char* argv[])
+{
+  int threads = argc > 1 ? atoi(argv[1]) : 4;
+  int times = argc > 2 ? atoi(argv[2]) : 1000000;
+  size_t capacity = argc > 3 ? atoi(argv[3]) : 65536;
+
+  {
+    Bench<MutexVectorQueue> bench(threads, times, capacity);
+    bench.run("mutex+vector");
+  }
+  {
+    Bench<LockFreeQueue> bench(threads, times, capacity);
+    bench.run("MpscQueue");
+  }
+}
@@ -40,10 +40,15 @@ class Acceptor : boost::noncopyable
   void setNewConnectionCallback(const NewConnectionCallback& cb)
   { newConnectionCallback_ = cb; }
 
+  EventLoop* getLoop() const { return loop_; }
   bool listenning() const { return listenning_; }
   void listen();
 
  private:
+  // accept() calls per readable event at most, so one busy listening
+  // socket cannot starve the rest of the loop
+  static const int kMaxAcceptsPerRead = 64;
+
   void handleRead();
 
   EventLoop* loop_;
@@ -15,8 +15,11 @@
 #include <muduo/base/StringPiece.h>
 #include <muduo/base/Types.h>
 
+#include <muduo/net/BufferChunk.h>
 #include <muduo/net/Endian.h>
 
+#include <boost/shared_ptr.hpp>
+
 #include <algorithm>
 #include <vector>
 
@@ -169,6 +172,34 @@ class Buffer : public muduo::copyable
     return result;
   }
 
+  ///
+  /// Retrieve len bytes as a refcounted chunk.
+  ///
+  /// When the chunk makes up most of the storage, the storage itself is
+  /// handed over to the chunk and only the bytes after it are copied into
+  /// fresh storage, so a large payload is never duplicated.  Small slices
+  /// are copied, they would otherwise pin a much larger buffer.
+  BufferChunk retrieveAsChunk(size_t len)
+  {
+    assert(len <= readableBytes());
+    if (len < kInitialSize || 2 * len < buffer_.size())
+    {
+      BufferChunk result(StringPiece(peek(), static_cast<int>(len)));
+      retrieve(len);
+      return result;
+    }
+
+    boost::shared_ptr<std::vector<char> > owner(new std::vector<char>);
+    owner->swap(buffer_);
+    const char* data = &*owner->begin() + readerIndex_;
+    size_t rest = readableBytes() - len;
+    buffer_.resize(kCheapPrepend + std::max(rest, kInitialSize));
+    std::copy(data + len, data + len + rest, begin() + kCheapPrepend);
+    readerIndex_ = kCheapPrepend;
+    writerIndex_ = kCheapPrepend + rest;
+    return BufferChunk(owner, data, len);
+  }
+
   StringPiece toStringPiece() const
   {
     return StringPiece(peek(), static_cast<int>(readableBytes()));
@@ -0,0 +1,89 @@
+// Use of this source code is governed by a BSD-style license
+// that can be found in the License file.
+//
+// This is a public header file, it must only include public header files.
+
+#ifndef MUDUO_NET_BUFFERCHUNK_H
+#define MUDUO_NET_BUFFERCHUNK_H
+
+#include <muduo/base/copyable.h>
+#include <muduo/base/StringPiece.h>
+#include <muduo/base/Types.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+
+#include <assert.h>
+
+namespace muduo
+{
+namespace net
+{
+
+///
+/// Refcounted, immutable slice of bytes.
+///
+/// The bytes are kept alive by a shared owner, so copying a chunk, or
+/// taking a slice of it, never copies the data.  Used to hand one encoded
+/// frame to many connections, see TcpConnection::send(header, body).
+class BufferChunk : public muduo::copyable
+{
+ public:
+  BufferChunk()
+    : data_(NULL),
+      len_(0)
+  { }
+
+  /// Copies data into a new owner.
+  explicit BufferChunk(const StringPiece& data)
+  {
+    boost::shared_ptr<string> owner(new string(data.data(), data.size()));
+    owner_ = owner;
+    data_ = owner->data();
+    len_ = owner->size();
+  }
+
+  /// Shares bytes that owner keeps alive; they must not change afterwards.
+  BufferChunk(const boost::shared_ptr<const void>& owner, const char* data, size_t len)
+    : owner_(owner),
+      data_(data),
+      len_(len)
+  { }
+
+  const char* data() const { return data_; }
+  size_t size() const { return len_; }
+  bool empty() const { return len_ == 0; }
+
+  StringPiece toStringPiece() const
+  { return StringPiece(data_, static_cast<int>(len_)); }
+
+  string toString() const
+  { return string(data_, len_); }
+
+  BufferChunk slice(size_t offset, size_t len) const
+  {
+    assert(offset + len <= len_);
+    return BufferChunk(owner_, data_ + offset, len);
+  }
+
+  BufferChunk slice(size_t offset) const
+  { return slice(offset, len_ - offset); }
+
+  void swap(BufferChunk& rhs)
+  {
+    owner_.swap(rhs.owner_);
+    std::swap(data_, rhs.data_);
+    std::swap(len_, rhs.len_);
+  }
+
+ private:
+  boost::shared_ptr<const void> owner_;
+  const char* data_;
+  size_t len_;
+};
+
+}
+}
+
+#endif  // MUDUO_NET_BUFFERCHUNK_H
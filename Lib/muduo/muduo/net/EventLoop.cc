@@ -14,9 +14,11 @@
 #include <muduo/net/Poller.h>
 #include <muduo/net/SocketsOps.h>
 #include <muduo/net/TimerQueue.h>
+#include <muduo/net/TimingWheel.h>
 
 #include <boost/bind.hpp>
 
+#include <sched.h>
 #include <signal.h>
 #include <sys/eventfd.h>
 #include <unistd.h>
@@ -29,6 +31,7 @@ namespace
 __thread EventLoop* t_loopInThisThread = 0;
 
 const int kPollTimeMs = 10000;
+const size_t kPendingQueueSize = 4096;
 
 int createEventfd()
 {
@@ -70,9 +73,13 @@ EventLoop::EventLoop()
     threadId_(CurrentThread::tid()),
     poller_(Poller::newDefaultPoller(this)),
     timerQueue_(new TimerQueue(this)),
+    timingWheel_(new TimingWheel(this)),
     wakeupFd_(createEventfd()),
     wakeupChannel_(new Channel(this, wakeupFd_)),
-    currentActiveChannel_(NULL)
+    currentActiveChannel_(NULL),
+    pendingQueue_(kPendingQueueSize),
+    overflowing_(0),
+    wakeupPending_(0)
 {
   LOG_DEBUG << "EventLoop created " << this << " in thread " << threadId_;
   if (t_loopInThisThread)
@@ -160,21 +167,33 @@ void EventLoop::runInLoop(const Functor& cb)
 
 void EventLoop::queueInLoop(const Functor& cb)
 {
+  pushPendingFunctor(cb);
+
+  // only the first functor after a drain writes the eventfd
+  if ((!isInLoopThread() || callingPendingFunctors_)
+      && __atomic_exchange_n(&wakeupPending_, 1, __ATOMIC_SEQ_CST) == 0)
   {
-  MutexLockGuard lock(mutex_);
-  pendingFunctors_.push_back(cb);
+    wakeup();
   }
+}
 
-  if (!isInLoopThread() || callingPendingFunctors_)
+void EventLoop::pushPendingFunctor(const Functor& cb)
+{
+  if (__atomic_load_n(&overflowing_, __ATOMIC_SEQ_CST) == 0
+      && pendingQueue_.tryPush(cb))
   {
-    wakeup();
+    return;
   }
+
+  MutexLockGuard lock(mutex_);
+  __atomic_store_n(&overflowing_, 1, __ATOMIC_SEQ_CST);
+  pendingFunctors_.push_back(cb);
 }
 
 size_t EventLoop::queueSize() const
 {
   MutexLockGuard lock(mutex_);
-  return pendingFunctors_.size();
+  return pendingQueue_.size() + pendingFunctors_.size();
 }
 
 TimerId EventLoop::runAt(const Timestamp& time, const TimerCallback& cb)
@@ -194,6 +213,16 @@ TimerId EventLoop::runEvery(double interval, const TimerCallback& cb)
   return timerQueue_->addTimer(cb, time, interval);
 }
 
+TimerId EventLoop::runAfterCoarse(double delay, const TimerCallback& cb)
+{
+  return timingWheel_->addTimer(cb, delay, 0.0);
+}
+
+TimerId EventLoop::runEveryCoarse(double interval, const TimerCallback& cb)
+{
+  return timingWheel_->addTimer(cb, interval, interval);
+}
+
 #ifdef __GXX_EXPERIMENTAL_CXX0X__
 // FIXME: remove duplication
 void EventLoop::runInLoop(Functor&& cb)
@@ -210,15 +239,7 @@ void EventLoop::runInLoop(Functor&& cb)
 
 void EventLoop::queueInLoop(Functor&& cb)
 {
-  {
-  MutexLockGuard lock(mutex_);
-  pendingFunctors_.push_back(std::move(cb));  // emplace_back
-  }
-
-  if (!isInLoopThread() || callingPendingFunctors_)
-  {
-    wakeup();
-  }
+  queueInLoop(static_cast<const Functor&>(cb));
 }
 
 TimerId EventLoop::runAt(const Timestamp& time, TimerCallback&& cb)
@@ -241,7 +262,14 @@ TimerId EventLoop::runEvery(double interval, TimerCallback&& cb)
 
 void EventLoop::cancel(TimerId timerId)
 {
-  return timerQueue_->cancel(timerId);
+  if (timerId.wheelTimer_)
+  {
+    timingWheel_->cancel(timerId);
+  }
+  else
+  {
+    timerQueue_->cancel(timerId);
+  }
 }
 
 void EventLoop::updateChannel(Channel* channel)
@@ -301,10 +329,43 @@ void EventLoop::doPendingFunctors()
 {
   std::vector<Functor> functors;
   callingPendingFunctors_ = true;
+  // functors queued from now on write the eventfd again
+  __atomic_store_n(&wakeupPending_, 0, __ATOMIC_SEQ_CST);
+
+  // Run what was queued so far, not what the functors queue themselves.
+  // Read the end before clearing overflowing_: a producer that sees it
+  // cleared claims a slot after end, so its functors run after the
+  // overflow ones it queued earlier.
+  size_t end;
+  if (__atomic_load_n(&overflowing_, __ATOMIC_SEQ_CST) != 0)
+  {
+    MutexLockGuard lock(mutex_);
+    end = pendingQueue_.pushCount();
+    functors.swap(pendingFunctors_);
+    __atomic_store_n(&overflowing_, 0, __ATOMIC_SEQ_CST);
+  }
+  else
+  {
+    end = pendingQueue_.pushCount();
+  }
 
+  Functor functor;
+  while (pendingQueue_.popCount() != end)
   {
-  MutexLockGuard lock(mutex_);
-  functors.swap(pendingFunctors_);
+    if (pendingQueue_.tryPop(&functor))
+    {
+      functor();
+    }
+    else if (functors.empty())
+    {
+      // a producer is still filling its slot; it wakes us up when done
+      break;
+    }
+    else
+    {
+      // overflow functors must wait for the slots claimed before them
+      sched_yield();
+    }
   }
 
   for (size_t i = 0; i < functors.size(); ++i)
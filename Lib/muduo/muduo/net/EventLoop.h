@@ -19,6 +19,7 @@
 #include <boost/scoped_ptr.hpp>
 
 #include <muduo/base/Mutex.h>
+#include <muduo/base/MpscQueue.h>
 #include <muduo/base/CurrentThread.h>
 #include <muduo/base/Timestamp.h>
 #include <muduo/net/Callbacks.h>
@@ -32,6 +33,7 @@ namespace net
 class Channel;
 class Poller;
 class TimerQueue;
+class TimingWheel;
 
 ///
 /// Reactor, at most one per thread.
@@ -100,6 +102,18 @@ class EventLoop : boost::noncopyable
   ///
   TimerId runEvery(double interval, const TimerCallback& cb);
   ///
+  /// Runs callback after @c delay seconds, on the timing wheel.
+  /// O(1) to add and cancel, but only accurate to TimingWheel::kTickMs.
+  /// Meant for timeouts that are mostly cancelled, keepalive and the like.
+  /// Safe to call from other threads.
+  ///
+  TimerId runAfterCoarse(double delay, const TimerCallback& cb);
+  ///
+  /// Runs callback every @c interval seconds, on the timing wheel.
+  /// Safe to call from other threads.
+  ///
+  TimerId runEveryCoarse(double interval, const TimerCallback& cb);
+  ///
   /// Cancels the timer.
   /// Safe to call from other threads.
   ///
@@ -144,6 +158,7 @@ class EventLoop : boost::noncopyable
   void abortNotInLoopThread();
   void handleRead();  // waked up
   void doPendingFunctors();
+  void pushPendingFunctor(const Functor& cb);
 
   void printActiveChannels() const; // DEBUG
 
@@ -158,6 +173,7 @@ class EventLoop : boost::noncopyable
   Timestamp pollReturnTime_;
   boost::scoped_ptr<Poller> poller_;
   boost::scoped_ptr<TimerQueue> timerQueue_;
+  boost::scoped_ptr<TimingWheel> timingWheel_;
   int wakeupFd_;
   // unlike in TimerQueue, which is an internal class,
   // we don't expose Channel to client.
@@ -168,6 +184,12 @@ class EventLoop : boost::noncopyable
   ChannelList activeChannels_;
   Channel* currentActiveChannel_;
 
+  // Functors from other threads go through a lock-free queue; mutex_ is
+  // only taken when it is full, then everything goes to the overflow
+  // vector until the loop drains it, so each thread's functors keep order.
+  MpscQueue<Functor> pendingQueue_;
+  int overflowing_; /* atomic */
+  int wakeupPending_; /* atomic, eventfd written and not yet drained */
   mutable MutexLock mutex_;
   std::vector<Functor> pendingFunctors_; // @GuardedBy mutex_
 };
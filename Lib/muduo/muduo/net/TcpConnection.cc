@@ -18,6 +18,7 @@
 #include <boost/bind.hpp>
 
 #include <errno.h>
+#include <sys/uio.h>
 
 using namespace muduo;
 using namespace muduo::net;
@@ -50,7 +51,9 @@ TcpConnection::TcpConnection(EventLoop* loop,
       channel_(new Channel(loop, sockfd)),
       localAddr_(localAddr),
       peerAddr_(peerAddr),
-      highWaterMark_(64*1024*1024)
+      highWaterMark_(64*1024*1024),
+      outputChunkBytes_(0),
+      outputBlockUsed_(0)
 {
     channel_->setReadCallback(
                 boost::bind(&TcpConnection::handleRead, this, _1));
@@ -131,6 +134,26 @@ void TcpConnection::send(Buffer* buf)
     }
 }
 
+void TcpConnection::send(const StringPiece& header, const BufferChunk& body)
+{
+    if (state_ == kConnected)
+    {
+        if (loop_->isInLoopThread())
+        {
+            sendChunkInLoop(header, body);
+        }
+        else
+        {
+            void (TcpConnection::*fp)(const string&, const BufferChunk&) = &TcpConnection::sendChunkInLoop;
+            loop_->runInLoop(
+                        boost::bind(fp,
+                                    this,     // FIXME
+                                    header.as_string(),
+                                    body));
+        }
+    }
+}
+
 void TcpConnection::sendInLoop(const StringPiece& message)
 {
     sendInLoop(message.data(), message.size());
@@ -148,7 +171,7 @@ void TcpConnection::sendInLoop(const void* data, size_t len)
         return;
     }
     // if no thing in output queue, try writing directly
-    if (!channel_->isWriting() && outputBuffer_.readableBytes() == 0)
+    if (!channel_->isWriting() && outputBytes() == 0)
     {
         nwrote = sockets::write(channel_->fd(), data, len);
         if (nwrote >= 0)
@@ -176,14 +199,81 @@ void TcpConnection::sendInLoop(const void* data, size_t len)
     assert(remaining <= len);
     if (!faultError && remaining > 0)
     {
-        size_t oldLen = outputBuffer_.readableBytes();
-        if (oldLen + remaining >= highWaterMark_
-                && oldLen < highWaterMark_
-                && highWaterMarkCallback_)
+        checkHighWaterMark(remaining);
+        appendOutput(static_cast<const char*>(data)+nwrote, remaining);
+        if (!channel_->isWriting())
         {
-            loop_->queueInLoop(boost::bind(highWaterMarkCallback_, shared_from_this(), oldLen + remaining));
+            channel_->enableWriting();
+        }
+    }
+}
+
+void TcpConnection::sendChunkInLoop(const string& header, const BufferChunk& body)
+{
+    sendChunkInLoop(StringPiece(header), body);
+}
+
+void TcpConnection::sendChunkInLoop(const StringPiece& header, const BufferChunk& body)
+{
+    loop_->assertInLoopThread();
+    const size_t headerLen = header.size();
+    const size_t len = headerLen + body.size();
+    ssize_t nwrote = 0;
+    size_t remaining = len;
+    bool faultError = false;
+    if (state_ == kDisconnected)
+    {
+        LOG_WARN << "disconnected, give up writing";
+        return;
+    }
+    // if no thing in output queue, try writing directly
+    if (!channel_->isWriting() && outputBytes() == 0)
+    {
+        struct iovec vec[2];
+        vec[0].iov_base = const_cast<char*>(header.data());
+        vec[0].iov_len = headerLen;
+        vec[1].iov_base = const_cast<char*>(body.data());
+        vec[1].iov_len = body.size();
+        nwrote = sockets::writev(channel_->fd(), vec, 2);
+        if (nwrote >= 0)
+        {
+            remaining = len - nwrote;
+            if (remaining == 0 && writeCompleteCallback_)
+            {
+                loop_->queueInLoop(boost::bind(writeCompleteCallback_, shared_from_this()));
+            }
+        }
+        else // nwrote < 0
+        {
+            nwrote = 0;
+            if (errno != EWOULDBLOCK)
+            {
+                LOG_SYSERR << "TcpConnection::sendChunkInLoop";
+                if (errno == EPIPE || errno == ECONNRESET) // FIXME: any others?
+                {
+                    faultError = true;
+                }
+            }
+        }
+    }
+
+    assert(remaining <= len);
+    if (!faultError && remaining > 0)
+    {
+        checkHighWaterMark(remaining);
+        size_t written = len - remaining;
+        if (written < headerLen)
+        {
+            appendOutput(header.data() + written, headerLen - written);
+            written = headerLen;
+        }
+        // the body is queued by reference, never copied
+        BufferChunk rest = body.slice(written - headerLen);
+        if (!rest.empty())
+        {
+            outputChunkBytes_ += rest.size();
+            outputChunks_.push_back(rest);
         }
-        outputBuffer_.append(static_cast<const char*>(data)+nwrote, remaining);
         if (!channel_->isWriting())
         {
             channel_->enableWriting();
@@ -191,6 +281,113 @@ void TcpConnection::sendInLoop(const void* data, size_t len)
     }
 }
 
+namespace
+{
+const size_t kOutputBlockSize = 4096;
+}
+
+// bytes in outputBuffer_ always go out before outputChunks_,
+// so once a chunk is queued, later data is queued after it.
+// Small writes (PUBLISH headers, acks) are copied into a shared block
+// instead of one allocation each; a write right after the previous one
+// in the block grows that chunk, so it also takes no extra iovec.
+void TcpConnection::appendOutput(const char* data, size_t len)
+{
+    if (outputChunks_.empty())
+    {
+        outputBuffer_.append(data, len);
+        return;
+    }
+
+    outputChunkBytes_ += len;
+    if (!outputBlock_ || outputBlockUsed_ + len > outputBlock_->size())
+    {
+        if (len > kOutputBlockSize / 2)
+        {
+            outputChunks_.push_back(BufferChunk(StringPiece(data, static_cast<int>(len))));
+            return;
+        }
+        outputBlock_.reset(new std::vector<char>(kOutputBlockSize));
+        outputBlockUsed_ = 0;
+    }
+
+    // queued chunks only read the bytes before outputBlockUsed_
+    char* dest = &(*outputBlock_)[0] + outputBlockUsed_;
+    std::copy(data, data + len, dest);
+    BufferChunk& tail = outputChunks_.back();
+    if (outputBlockUsed_ > 0 && tail.data() + tail.size() == dest)
+    {
+        tail = BufferChunk(outputBlock_, tail.data(), tail.size() + len);
+    }
+    else
+    {
+        outputChunks_.push_back(BufferChunk(outputBlock_, dest, len));
+    }
+    outputBlockUsed_ += len;
+}
+
+void TcpConnection::checkHighWaterMark(size_t appending)
+{
+    size_t oldLen = outputBytes();
+    if (oldLen + appending >= highWaterMark_
+            && oldLen < highWaterMark_
+            && highWaterMarkCallback_)
+    {
+        loop_->queueInLoop(boost::bind(highWaterMarkCallback_, shared_from_this(), oldLen + appending));
+    }
+}
+
+ssize_t TcpConnection::writeOutputChunks()
+{
+    const int kMaxIov = 64;
+    struct iovec vec[kMaxIov];
+    int iovcnt = 0;
+    if (outputBuffer_.readableBytes() > 0)
+    {
+        vec[iovcnt].iov_base = const_cast<char*>(outputBuffer_.peek());
+        vec[iovcnt].iov_len = outputBuffer_.readableBytes();
+        ++iovcnt;
+    }
+    for (std::deque<BufferChunk>::const_iterator it = outputChunks_.begin();
+         it != outputChunks_.end() && iovcnt < kMaxIov; ++it)
+    {
+        vec[iovcnt].iov_base = const_cast<char*>(it->data());
+        vec[iovcnt].iov_len = it->size();
+        ++iovcnt;
+    }
+
+    ssize_t n = sockets::writev(channel_->fd(), vec, iovcnt);
+    if (n > 0)
+    {
+        size_t left = n;
+        size_t fromBuffer = std::min(left, outputBuffer_.readableBytes());
+        outputBuffer_.retrieve(fromBuffer);
+        left -= fromBuffer;
+        while (left > 0)
+        {
+            BufferChunk& front = outputChunks_.front();
+            if (left >= front.size())
+            {
+                left -= front.size();
+                outputChunkBytes_ -= front.size();
+                outputChunks_.pop_front();
+            }
+            else
+            {
+                front = front.slice(left);
+                outputChunkBytes_ -= left;
+                left = 0;
+            }
+        }
+        if (outputChunks_.empty())
+        {
+            // an idle connection keeps no block
+            outputBlock_.reset();
+        }
+    }
+    return n;
+}
+
 void TcpConnection::shutdown()
 {
     // FIXME: use compare and swap
@@ -370,13 +567,24 @@ void TcpConnection::handleWrite()
     loop_->assertInLoopThread();
     if (channel_->isWriting())
     {
-        ssize_t n = sockets::write(channel_->fd(),
-                                   outputBuffer_.peek(),
-                                   outputBuffer_.readableBytes());
+        ssize_t n = 0;
+        if (outputChunks_.empty())
+        {
+            n = sockets::write(channel_->fd(),
+                               outputBuffer_.peek(),
+                               outputBuffer_.readableBytes());
+            if (n > 0)
+            {
+                outputBuffer_.retrieve(n);
+            }
+        }
+        else
+        {
+            n = writeOutputChunks();
+        }
         if (n > 0)
         {
-            outputBuffer_.retrieve(n);
-            if (outputBuffer_.readableBytes() == 0)
+            if (outputBytes() == 0)
             {
                 channel_->disableWriting();
                 if (writeCompleteCallback_)
@@ -430,8 +638,8 @@ void TcpConnection::handleError()
 
 void muduo::net::TcpConnection::enableCloseAfter(double delay)
 {
-    timerId_ = loop_->runAfter(delay, makeWeakCallback(shared_from_this(),
-                                                       &TcpConnection::forceClose));
+    timerId_ = loop_->runAfterCoarse(delay, makeWeakCallback(shared_from_this(),
+                                                             &TcpConnection::forceClose));
 }
 
 void TcpConnection::cancelCloseAfter()
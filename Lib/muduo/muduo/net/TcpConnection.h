@@ -15,6 +15,7 @@
 #include <muduo/base/Types.h>
 #include <muduo/net/Callbacks.h>
 #include <muduo/net/Buffer.h>
+#include <muduo/net/BufferChunk.h>
 #include <muduo/net/InetAddress.h>
 #include <muduo/net/TimerId.h>
 
@@ -24,6 +25,9 @@
 #include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
 
+#include <deque>
+#include <vector>
+
 // struct tcp_info is in <netinet/tcp.h>
 struct tcp_info;
 
@@ -69,6 +73,9 @@ class TcpConnection : boost::noncopyable,
   void send(const StringPiece& message);
   // void send(Buffer&& message); // C++11
   void send(Buffer* message);  // this one will swap data
+  // header is copied, body is referenced and written with writev(2),
+  // so one body can be shared by many connections.
+  void send(const StringPiece& header, const BufferChunk& body);
   void shutdown(); // NOT thread safe, no simultaneous calling
   // void shutdownAndForceCloseAfter(double seconds); // NOT thread safe, no simultaneous calling
   void forceClose();
@@ -107,6 +114,11 @@ class TcpConnection : boost::noncopyable,
   Buffer* outputBuffer()
   { return &outputBuffer_; }
 
+  /// Bytes not yet written to the socket, outputBuffer() plus queued chunks.
+  /// Must be called in the loop thread.
+  size_t outputBytes() const
+  { return outputBuffer_.readableBytes() + outputChunkBytes_; }
+
   /// Internal use only.
   void setCloseCallback(const CloseCallback& cb)
   { closeCallback_ = cb; }
@@ -128,6 +140,11 @@ class TcpConnection : boost::noncopyable,
   // void sendInLoop(string&& message);
   void sendInLoop(const StringPiece& message);
   void sendInLoop(const void* message, size_t len);
+  void sendChunkInLoop(const string& header, const BufferChunk& body);
+  void sendChunkInLoop(const StringPiece& header, const BufferChunk& body);
+  void appendOutput(const char* data, size_t len);
+  void checkHighWaterMark(size_t appending);
+  ssize_t writeOutputChunks();
   void shutdownInLoop();
   // void shutdownAndForceCloseInLoop(double seconds);
   void forceCloseInLoop();
@@ -153,6 +170,12 @@ class TcpConnection : boost::noncopyable,
   size_t highWaterMark_;
   Buffer inputBuffer_;
   Buffer outputBuffer_; // FIXME: use list<Buffer> as output buffer.
+  // written after outputBuffer_, see send(header, body)
+  std::deque<BufferChunk> outputChunks_;
+  size_t outputChunkBytes_;
+  // small writes queued behind a chunk are copied here, see appendOutput
+  boost::shared_ptr<std::vector<char> > outputBlock_;
+  size_t outputBlockUsed_;
   boost::any context_;
   // FIXME: creationTime_, lastReceiveTime_
   //        bytesReceived_, bytesSent_
@@ -8,6 +8,7 @@
 
 #include <muduo/net/TcpServer.h>
 
+#include <muduo/base/CountDownLatch.h>
 #include <muduo/base/Logging.h>
 #include <muduo/net/Acceptor.h>
 #include <muduo/net/EventLoop.h>
@@ -21,18 +22,31 @@
 using namespace muduo;
 using namespace muduo::net;
 
+namespace
+{
+
+// a Channel must be removed in its own loop
+void destroyAcceptor(Acceptor* acceptor, CountDownLatch* latch)
+{
+  delete acceptor;
+  latch->countDown();
+}
+
+}
+
 TcpServer::TcpServer(EventLoop* loop,
                      const InetAddress& listenAddr,
                      const string& nameArg,
                      Option option)
   : loop_(CHECK_NOTNULL(loop)),
+    listenAddr_(listenAddr),
     ipPort_(listenAddr.toIpPort()),
     name_(nameArg),
-    acceptor_(new Acceptor(loop, listenAddr, option == kReusePort)),
+    acceptPerLoop_(option == kReusePortPerLoop),
+    acceptor_(new Acceptor(loop, listenAddr, option != kNoReusePort)),
     threadPool_(new EventLoopThreadPool(loop, name_)),
     connectionCallback_(defaultConnectionCallback),
-    messageCallback_(defaultMessageCallback),
-    nextConnId_(1)
+    messageCallback_(defaultMessageCallback)
 {
   acceptor_->setNewConnectionCallback(
       boost::bind(&TcpServer::newConnection, this, _1, _2));
@@ -43,6 +57,18 @@ TcpServer::~TcpServer()
   loop_->assertInLoopThread();
   LOG_TRACE << "TcpServer::~TcpServer [" << name_ << "] destructing";
 
+  if (!loopAcceptors_.empty())
+  {
+    CountDownLatch latch(static_cast<int>(loopAcceptors_.size()));
+    for (size_t i = 0; i < loopAcceptors_.size(); ++i)
+    {
+      loopAcceptors_[i]->getLoop()->runInLoop(
+          boost::bind(&destroyAcceptor, loopAcceptors_[i], &latch));
+    }
+    latch.wait();
+  }
+
+  MutexLockGuard lock(mutex_);
   for (ConnectionMap::iterator it(connections_.begin());
       it != connections_.end(); ++it)
   {
@@ -66,6 +92,30 @@ void TcpServer::start()
     threadPool_->start(threadInitCallback_);
 
     assert(!acceptor_->listenning());
+    if (acceptPerLoop_)
+    {
+      std::vector<EventLoop*> loops = threadPool_->getAllLoops();
+      bool baseLoopAccepts = false;
+      for (size_t i = 0; i < loops.size(); ++i)
+      {
+        if (loops[i] == loop_)
+        {
+          baseLoopAccepts = true;
+          continue;
+        }
+        Acceptor* acceptor = new Acceptor(loops[i], listenAddr_, true);
+        acceptor->setNewConnectionCallback(
+            boost::bind(&TcpServer::newConnectionInLoop, this, loops[i], _1, _2));
+        loopAcceptors_.push_back(acceptor);
+        loops[i]->runInLoop(boost::bind(&Acceptor::listen, acceptor));
+      }
+      if (!baseLoopAccepts)
+      {
+        // bound but never listening, it would take no connections anyway
+        acceptor_.reset();
+        return;
+      }
+    }
     loop_->runInLoop(
         boost::bind(&Acceptor::listen, get_pointer(acceptor_)));
   }
@@ -74,10 +124,20 @@ void TcpServer::start()
 void TcpServer::newConnection(int sockfd, const InetAddress& peerAddr)
 {
   loop_->assertInLoopThread();
-  EventLoop* ioLoop = threadPool_->getNextLoop();
+  EventLoop* ioLoop = acceptPerLoop_ ? loop_ : threadPool_->getNextLoop();
+  createConnection(ioLoop, sockfd, peerAddr);
+}
+
+void TcpServer::newConnectionInLoop(EventLoop* ioLoop, int sockfd, const InetAddress& peerAddr)
+{
+  ioLoop->assertInLoopThread();
+  createConnection(ioLoop, sockfd, peerAddr);
+}
+
+void TcpServer::createConnection(EventLoop* ioLoop, int sockfd, const InetAddress& peerAddr)
+{
   char buf[64];
-  snprintf(buf, sizeof buf, "-%s#%d", ipPort_.c_str(), nextConnId_);
-  ++nextConnId_;
+  snprintf(buf, sizeof buf, "-%s#%d", ipPort_.c_str(), nextConnId_.incrementAndGet());
   string connName = name_ + buf;
 
   LOG_INFO << "TcpServer::newConnection [" << name_
@@ -91,7 +151,10 @@ void TcpServer::newConnection(int sockfd, const InetAddress& peerAddr)
                                           sockfd,
                                           localAddr,
                                           peerAddr));
+  {
+  MutexLockGuard lock(mutex_);
   connections_[connName] = conn;
+  }
   conn->setConnectionCallback(connectionCallback_);
   conn->setMessageCallback(messageCallback_);
   conn->setWriteCompleteCallback(writeCompleteCallback_);
@@ -103,15 +166,21 @@ void TcpServer::newConnection(int sockfd, const InetAddress& peerAddr)
 void TcpServer::removeConnection(const TcpConnectionPtr& conn)
 {
   // FIXME: unsafe
-  loop_->runInLoop(boost::bind(&TcpServer::removeConnectionInLoop, this, conn));
+  // with kReusePortPerLoop the accepting loop is the connection's own
+  EventLoop* loop = acceptPerLoop_ ? conn->getLoop() : loop_;
+  loop->runInLoop(boost::bind(&TcpServer::removeConnectionInLoop, this, conn));
 }
 
 void TcpServer::removeConnectionInLoop(const TcpConnectionPtr& conn)
 {
-  loop_->assertInLoopThread();
+  (acceptPerLoop_ ? conn->getLoop() : loop_)->assertInLoopThread();
   LOG_INFO << "TcpServer::removeConnectionInLoop [" << name_
            << "] - connection " << conn->name();
-  size_t n = connections_.erase(conn->name());
+  size_t n = 0;
+  {
+  MutexLockGuard lock(mutex_);
+  n = connections_.erase(conn->name());
+  }
   (void)n;
   assert(n == 1);
   EventLoop* ioLoop = conn->getLoop();
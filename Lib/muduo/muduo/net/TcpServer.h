@@ -12,10 +12,12 @@
 #define MUDUO_NET_TCPSERVER_H
 
 #include <muduo/base/Atomic.h>
+#include <muduo/base/Mutex.h>
 #include <muduo/base/Types.h>
 #include <muduo/net/TcpConnection.h>
 
 #include <map>
+#include <vector>
 #include <boost/noncopyable.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
@@ -41,6 +43,10 @@ class TcpServer : boost::noncopyable
   {
     kNoReusePort,
     kReusePort,
+    /// Every I/O loop listens on its own SO_REUSEPORT socket and keeps
+    /// the connections it accepts, the kernel spreads them across loops.
+    /// No single accepting thread to queue behind in a connection storm.
+    kReusePortPerLoop,
   };
 
   //TcpServer(EventLoop* loop, const InetAddress& listenAddr);
@@ -56,7 +62,8 @@ class TcpServer : boost::noncopyable
 
   /// Set the number of threads for handling input.
   ///
-  /// Always accepts new connection in loop's thread.
+  /// Always accepts new connection in loop's thread,
+  /// unless constructed with kReusePortPerLoop.
   /// Must be called before @c start
   /// @param numThreads
   /// - 0 means all I/O in loop's thread, no thread will created.
@@ -95,6 +102,10 @@ class TcpServer : boost::noncopyable
  private:
   /// Not thread safe, but in loop
   void newConnection(int sockfd, const InetAddress& peerAddr);
+  /// Not thread safe, but in ioLoop
+  void newConnectionInLoop(EventLoop* ioLoop, int sockfd, const InetAddress& peerAddr);
+  /// Not thread safe, but in loop
+  void createConnection(EventLoop* ioLoop, int sockfd, const InetAddress& peerAddr);
   /// Thread safe.
   void removeConnection(const TcpConnectionPtr& conn);
   /// Not thread safe, but in loop
@@ -103,17 +114,22 @@ class TcpServer : boost::noncopyable
   typedef std::map<string, TcpConnectionPtr> ConnectionMap;
 
   EventLoop* loop_;  // the acceptor loop
+  const InetAddress listenAddr_;
   const string ipPort_;
   const string name_;
+  const bool acceptPerLoop_;
   boost::scoped_ptr<Acceptor> acceptor_; // avoid revealing Acceptor
+  // kReusePortPerLoop only, one for each I/O loop other than loop_
+  std::vector<Acceptor*> loopAcceptors_;
   boost::shared_ptr<EventLoopThreadPool> threadPool_;
   ConnectionCallback connectionCallback_;
   MessageCallback messageCallback_;
   WriteCompleteCallback writeCompleteCallback_;
   ThreadInitCallback threadInitCallback_;
   AtomicInt32 started_;
-  // always in loop thread
-  int nextConnId_;
+  AtomicInt32 nextConnId_;
+  // accessed by every accepting loop with kReusePortPerLoop
+  MutexLock mutex_;
   ConnectionMap connections_;
 };
 
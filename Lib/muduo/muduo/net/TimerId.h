@@ -19,6 +19,7 @@ namespace net
 {
 
 class Timer;
+class WheelTimer;
 
 ///
 /// An opaque identifier, for canceling Timer.
@@ -28,22 +29,34 @@ class TimerId : public muduo::copyable
  public:
   TimerId()
     : timer_(NULL),
+      wheelTimer_(NULL),
       sequence_(0)
   {
   }
 
   TimerId(Timer* timer, int64_t seq)
     : timer_(timer),
+      wheelTimer_(NULL),
+      sequence_(seq)
+  {
+  }
+
+  TimerId(WheelTimer* timer, int64_t seq)
+    : timer_(NULL),
+      wheelTimer_(timer),
       sequence_(seq)
   {
   }
 
   // default copy-ctor, dtor and assignment are okay
 
+  friend class EventLoop;
   friend class TimerQueue;
+  friend class TimingWheel;
 
  private:
   Timer* timer_;
+  WheelTimer* wheelTimer_;
   int64_t sequence_;
 };
 
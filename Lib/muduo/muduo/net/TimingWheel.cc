@@ -0,0 +1,315 @@
+// Use of this source code is governed by a BSD-style license
+// that can be found in the License file.
+
+#include <muduo/net/TimingWheel.h>
+
+#include <muduo/base/Logging.h>
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/TimerId.h>
+
+#include <boost/bind.hpp>
+
+#include <algorithm>
+
+#include <assert.h>
+#include <math.h>
+#include <strings.h>  // bzero
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace muduo
+{
+namespace net
+{
+namespace detail
+{
+// defined in TimerQueue.cc
+int createTimerfd();
+}
+}
+}
+
+using namespace muduo;
+using namespace muduo::net;
+
+AtomicInt64 TimingWheel::s_numCreated_;
+
+const int TimingWheel::kTickMs;
+
+TimingWheel::TimingWheel(EventLoop* loop)
+  : loop_(loop),
+    timerfd_(detail::createTimerfd()),
+    timerfdChannel_(loop, timerfd_),
+    base_(nowTick()),
+    count_(0),
+    ticking_(false),
+    running_(NULL),
+    runningCanceled_(false)
+{
+  timerfdChannel_.setReadCallback(
+      boost::bind(&TimingWheel::handleRead, this));
+  timerfdChannel_.enableReading();
+}
+
+TimingWheel::~TimingWheel()
+{
+  timerfdChannel_.disableAll();
+  timerfdChannel_.remove();
+  ::close(timerfd_);
+  // also those still in the wheel, and those whose adoption never ran
+  for (size_t i = 0; i < allTimers_.size(); ++i)
+  {
+    delete allTimers_[i];
+  }
+}
+
+TimerId TimingWheel::addTimer(const TimerCallback& cb, double delay, double interval)
+{
+  WheelTimer* timer = loop_->isInLoopThread() ? allocTimer() : newTimer();
+  timer->callback_ = cb;
+  timer->interval_ = interval > 0.0 ? std::max(toTicks(interval), static_cast<int64_t>(1)) : 0;
+  timer->sequence_ = s_numCreated_.incrementAndGet();
+  TimerId id(timer, timer->sequence_);
+  if (loop_->isInLoopThread())
+  {
+    addTimerInLoop(timer, toTicks(delay));
+  }
+  else
+  {
+    loop_->queueInLoop(
+        boost::bind(&TimingWheel::adoptTimerInLoop, this, timer, toTicks(delay)));
+  }
+  return id;
+}
+
+void TimingWheel::cancel(TimerId timerId)
+{
+  loop_->runInLoop(
+      boost::bind(&TimingWheel::cancelInLoop, this, timerId.wheelTimer_, timerId.sequence_));
+}
+
+void TimingWheel::addTimerInLoop(WheelTimer* timer, int64_t delayTicks)
+{
+  loop_->assertInLoopThread();
+  startTicking();
+  // the current tick has partly passed, count from the next one
+  timer->expires_ = nowTick() + 1 + delayTicks;
+  insert(timer);
+  ++count_;
+}
+
+void TimingWheel::adoptTimerInLoop(WheelTimer* timer, int64_t delayTicks)
+{
+  addTimerInLoop(timer, delayTicks);
+}
+
+void TimingWheel::cancelInLoop(WheelTimer* timer, int64_t sequence)
+{
+  loop_->assertInLoopThread();
+  if (timer == NULL || timer->sequence_ != sequence)
+  {
+    return;
+  }
+  if (timer->linked())
+  {
+    timer->unlink();
+    --count_;
+    freeTimer(timer);
+  }
+  else if (timer == running_)
+  {
+    runningCanceled_ = true;
+  }
+}
+
+void TimingWheel::handleRead()
+{
+  loop_->assertInLoopThread();
+  uint64_t howmany;
+  ssize_t n = ::read(timerfd_, &howmany, sizeof howmany);
+  if (n != sizeof howmany)
+  {
+    LOG_ERROR << "TimingWheel::handleRead() reads " << n << " bytes instead of 8";
+  }
+  runExpired(nowTick());
+  if (count_ == 0)
+  {
+    stopTicking();
+  }
+}
+
+void TimingWheel::insert(WheelTimer* timer)
+{
+  int64_t expires = timer->expires_;
+  int64_t idx = expires - base_;
+  WheelTimer* head;
+  if (idx < 0)
+  {
+    // already due, run on the next tick
+    head = &root_[base_ & (kRootSize - 1)];
+  }
+  else if (idx < kRootSize)
+  {
+    head = &root_[expires & (kRootSize - 1)];
+  }
+  else
+  {
+    int level = 0;
+    int shift = kRootBits;
+    while (level < kLevels - 1 && idx >= (static_cast<int64_t>(1) << (shift + kLevelBits)))
+    {
+      ++level;
+      shift += kLevelBits;
+    }
+    if (idx >= (static_cast<int64_t>(1) << (shift + kLevelBits)))
+    {
+      // beyond the last level, park it as far out as it goes
+      expires = base_ + (static_cast<int64_t>(1) << (shift + kLevelBits)) - 1;
+    }
+    head = &levels_[level][(expires >> shift) & (kLevelSize - 1)];
+  }
+  append(head, timer);
+}
+
+// move every timer of one slot down to the level it belongs to now
+void TimingWheel::cascade(int level, int index)
+{
+  WheelTimer* head = &levels_[level][index];
+  while (head->linked())
+  {
+    WheelTimer* timer = head->next_;
+    timer->unlink();
+    insert(timer);
+  }
+}
+
+void TimingWheel::runExpired(int64_t now)
+{
+  WheelTimer expired;
+  while (base_ <= now)
+  {
+    int index = static_cast<int>(base_ & (kRootSize - 1));
+    if (index == 0)
+    {
+      int shift = kRootBits;
+      for (int level = 0; level < kLevels; ++level, shift += kLevelBits)
+      {
+        int slot = static_cast<int>((base_ >> shift) & (kLevelSize - 1));
+        cascade(level, slot);
+        if (slot != 0)
+        {
+          break;
+        }
+      }
+    }
+
+    // detach the slot first, callbacks may add or cancel timers
+    WheelTimer* head = &root_[index];
+    while (head->linked())
+    {
+      WheelTimer* timer = head->next_;
+      timer->unlink();
+      append(&expired, timer);
+    }
+    ++base_;
+
+    while (expired.linked())
+    {
+      WheelTimer* timer = expired.next_;
+      timer->unlink();
+      running_ = timer;
+      runningCanceled_ = false;
+      timer->callback_();
+      running_ = NULL;
+      if (timer->interval_ > 0 && !runningCanceled_)
+      {
+        timer->expires_ = base_ - 1 + timer->interval_;
+        insert(timer);
+      }
+      else
+      {
+        --count_;
+        freeTimer(timer);
+      }
+    }
+  }
+}
+
+void TimingWheel::startTicking()
+{
+  if (ticking_)
+  {
+    return;
+  }
+  // nothing was due while idle, skip the ticks we slept through
+  base_ = std::max(base_, nowTick() + 1);
+  struct itimerspec newValue;
+  bzero(&newValue, sizeof newValue);
+  newValue.it_value.tv_nsec = kTickMs * 1000 * 1000;
+  newValue.it_interval.tv_nsec = kTickMs * 1000 * 1000;
+  if (::timerfd_settime(timerfd_, 0, &newValue, NULL))
+  {
+    LOG_SYSERR << "timerfd_settime()";
+  }
+  ticking_ = true;
+}
+
+void TimingWheel::stopTicking()
+{
+  struct itimerspec newValue;
+  bzero(&newValue, sizeof newValue);
+  if (::timerfd_settime(timerfd_, 0, &newValue, NULL))
+  {
+    LOG_SYSERR << "timerfd_settime()";
+  }
+  ticking_ = false;
+}
+
+WheelTimer* TimingWheel::allocTimer()
+{
+  if (freeList_.empty())
+  {
+    return newTimer();
+  }
+  WheelTimer* timer = freeList_.back();
+  freeList_.pop_back();
+  return timer;
+}
+
+WheelTimer* TimingWheel::newTimer()
+{
+  WheelTimer* timer = new WheelTimer;
+  MutexLockGuard lock(mutex_);
+  allTimers_.push_back(timer);
+  return timer;
+}
+
+void TimingWheel::freeTimer(WheelTimer* timer)
+{
+  timer->callback_ = TimerCallback();
+  freeList_.push_back(timer);
+}
+
+void TimingWheel::append(WheelTimer* head, WheelTimer* timer)
+{
+  assert(!timer->linked());
+  timer->prev_ = head->prev_;
+  timer->next_ = head;
+  head->prev_->next_ = timer;
+  head->prev_ = timer;
+}
+
+int64_t TimingWheel::nowTick()
+{
+  struct timespec ts;
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / (1000 * 1000)) / kTickMs;
+}
+
+int64_t TimingWheel::toTicks(double seconds)
+{
+  // round up, timers never fire early
+  double ticks = ::ceil(seconds * 1000 / kTickMs);
+  return ticks > 0 ? static_cast<int64_t>(ticks) : 0;
+}
@@ -0,0 +1,154 @@
+// Use of this source code is governed by a BSD-style license
+// that can be found in the License file.
+//
+// This is an internal header file, you should not include this.
+
+#ifndef MUDUO_NET_TIMINGWHEEL_H
+#define MUDUO_NET_TIMINGWHEEL_H
+
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <muduo/base/Atomic.h>
+#include <muduo/base/Mutex.h>
+#include <muduo/net/Callbacks.h>
+#include <muduo/net/Channel.h>
+
+namespace muduo
+{
+namespace net
+{
+
+class EventLoop;
+class TimerId;
+
+///
+/// Internal class for timers on a TimingWheel.
+/// An intrusive list node, so linking and unlinking never allocate.
+///
+class WheelTimer : boost::noncopyable
+{
+ public:
+  WheelTimer()
+    : prev_(this),
+      next_(this),
+      expires_(0),
+      interval_(0),
+      sequence_(0)
+  { }
+
+ private:
+  friend class TimingWheel;
+
+  bool linked() const { return next_ != this; }
+
+  void unlink()
+  {
+    prev_->next_ = next_;
+    next_->prev_ = prev_;
+    prev_ = next_ = this;
+  }
+
+  WheelTimer* prev_;
+  WheelTimer* next_;
+  TimerCallback callback_;
+  int64_t expires_;   // in ticks
+  int64_t interval_;  // in ticks, 0 for one-shot
+  int64_t sequence_;
+};
+
+///
+/// Hierarchical timing wheel, after the classic Linux kernel timer wheel.
+///
+/// Time advances in ticks of kTickMs.  A timer lands in one of four levels
+/// depending on how far away it is, 256 slots for the first level and 64
+/// for the others, so timers up to about 77 days out are held exactly.
+/// Every 256 ticks one slot of the next level is cascaded down.
+/// Adding and cancelling are O(1) and allocation free once warmed up.
+/// Timers never fire early, and at most about two ticks late.
+///
+/// One periodic timerfd drives the wheel, armed only while it holds timers.
+/// Meant for the many coarse timeouts of a server, keepalive, login
+/// deadlines, which rarely fire and are mostly cancelled.
+///
+class TimingWheel : boost::noncopyable
+{
+ public:
+  static const int kTickMs = 100;
+
+  explicit TimingWheel(EventLoop* loop);
+  ~TimingWheel();
+
+  ///
+  /// Schedules the callback to be run after @c delay seconds,
+  /// repeats every @c interval seconds if @c interval > 0.0.
+  ///
+  /// Safe to call from other threads.
+  TimerId addTimer(const TimerCallback& cb, double delay, double interval);
+
+  /// Safe to call from other threads.
+  void cancel(TimerId timerId);
+
+  size_t size() const { return count_; }
+
+ private:
+  enum
+  {
+    kRootBits = 8,
+    kLevelBits = 6,
+    kRootSize = 1 << kRootBits,
+    kLevelSize = 1 << kLevelBits,
+    kLevels = 3,  // besides the root
+  };
+
+  void addTimerInLoop(WheelTimer* timer, int64_t delayTicks);
+  // for timers allocated by other threads
+  void adoptTimerInLoop(WheelTimer* timer, int64_t delayTicks);
+  void cancelInLoop(WheelTimer* timer, int64_t sequence);
+  // called when timerfd alarms
+  void handleRead();
+
+  void insert(WheelTimer* timer);
+  void cascade(int level, int index);
+  void runExpired(int64_t now);
+  void startTicking();
+  void stopTicking();
+
+  WheelTimer* allocTimer();
+  // safe to call from other threads
+  WheelTimer* newTimer();
+  void freeTimer(WheelTimer* timer);
+
+  static void append(WheelTimer* head, WheelTimer* timer);
+  static int64_t nowTick();
+  static int64_t toTicks(double seconds);
+
+  EventLoop* loop_;
+  const int timerfd_;
+  Channel timerfdChannel_;
+  int64_t base_;  // next tick to run
+  size_t count_;
+  bool ticking_;
+
+  WheelTimer root_[kRootSize];
+  WheelTimer levels_[kLevels][kLevelSize];
+
+  // timer being run, cancel() from its own callback stops it repeating
+  WheelTimer* running_;
+  bool runningCanceled_;
+
+  // nodes are recycled, never freed while the wheel lives,
+  // so a stale TimerId is detected by its sequence
+  std::vector<WheelTimer*> freeList_;
+  // every node ever created, including those from other threads
+  // not adopted yet, the destructor frees them all
+  MutexLock mutex_;
+  std::vector<WheelTimer*> allTimers_; // @GuardedBy mutex_
+
+  static AtomicInt64 s_numCreated_;
+};
+
+}
+}
+#endif  // MUDUO_NET_TIMINGWHEEL_H
@@ -152,6 +152,36 @@ BOOST_AUTO_TEST_CASE(testBufferFindEOL)
   BOOST_CHECK_EQUAL(buf.findEOL(buf.peek()+90000), null);
 }
 
+BOOST_AUTO_TEST_CASE(testBufferRetrieveAsChunk)
+{
+  Buffer buf;
+  buf.append(string(100, 's'));
+  buf.append(string(2000, 'l'));
+  buf.append(string(30, 't'));
+
+  // small slice is copied, buffer keeps its storage
+  const char* inner = buf.peek();
+  muduo::net::BufferChunk small = buf.retrieveAsChunk(100);
+  BOOST_CHECK_EQUAL(small.toString(), string(100, 's'));
+  BOOST_CHECK(small.data() != inner);
+  BOOST_CHECK_EQUAL(buf.peek(), inner + 100);
+
+  // large slice takes over the storage, the tail moves to fresh storage
+  const char* large = buf.peek();
+  muduo::net::BufferChunk chunk = buf.retrieveAsChunk(2000);
+  BOOST_CHECK_EQUAL(chunk.data(), large);
+  BOOST_CHECK_EQUAL(chunk.size(), 2000);
+  BOOST_CHECK_EQUAL(buf.readableBytes(), 30);
+  BOOST_CHECK_EQUAL(buf.prependableBytes(), Buffer::kCheapPrepend);
+  BOOST_CHECK_EQUAL(buf.writableBytes(), Buffer::kInitialSize - 30);
+
+  // writing to the buffer leaves the chunk intact
+  buf.append(string(5000, 'w'));
+  BOOST_CHECK_EQUAL(chunk.toString(), string(2000, 'l'));
+  BOOST_CHECK_EQUAL(buf.retrieveAsString(30), string(30, 't'));
+  BOOST_CHECK_EQUAL(buf.retrieveAllAsString(), string(5000, 'w'));
+}
+
 #ifdef __GXX_EXPERIMENTAL_CXX0X__
 void output(Buffer&& buf, const void* inner)
 {
@@ -0,0 +1,97 @@
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/TimingWheel.h>
+#include <muduo/base/Timestamp.h>
+
+#include <boost/bind.hpp>
+
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace muduo;
+using namespace muduo::net;
+
+// Adds and cancels N timers on the TimerQueue and on the TimingWheel,
+// the way idle connections arm and disarm their timeouts, then lets N
+// wheel timers fire and checks that none is early.
+
+EventLoop* g_loop;
+int g_fired = 0;
+int g_total = 0;
+int g_early = 0;
+double g_maxLate = 0.0;
+
+void onTimer(Timestamp due)
+{
+  double late = timeDifference(Timestamp::now(), due);
+  if (late < 0)
+  {
+    ++g_early;
+  }
+  else if (late > g_maxLate)
+  {
+    g_maxLate = late;
+  }
+  if (++g_fired == g_total)
+  {
+    g_loop->quit();
+  }
+}
+
+void noop()
+{
+}
+
+void addAndCancel(int n, bool wheel)
+{
+  std::vector<TimerId> ids;
+  ids.reserve(n);
+  Timestamp start(Timestamp::now());
+  for (int i = 0; i < n; ++i)
+  {
+    double delay = 30 + i % 600;
+    ids.push_back(wheel ? g_loop->runAfterCoarse(delay, noop)
+                        : g_loop->runAfter(delay, noop));
+  }
+  double added = timeDifference(Timestamp::now(), start);
+
+  start = Timestamp::now();
+  for (int i = 0; i < n; ++i)
+  {
+    g_loop->cancel(ids[i]);
+  }
+  double cancelled = timeDifference(Timestamp::now(), start);
+  printf("%-11s %d timers: add %.3f s (%.0f ns each), cancel %.3f s (%.0f ns each)\n",
+         wheel ? "TimingWheel" : "TimerQueue", n,
+         added, added * 1e9 / n, cancelled, cancelled * 1e9 / n);
+}
+
+void fireAll(int n)
+{
+  g_total = n;
+  Timestamp now(Timestamp::now());
+  for (int i = 0; i < n; ++i)
+  {
+    double delay = 0.05 + (i % 30) * 0.1;
+    g_loop->runAfterCoarse(delay, boost::bind(onTimer, addTime(now, delay)));
+  }
+  Timestamp start(Timestamp::now());
+  g_loop->loop();
+  printf("%d wheel timers fired in %.3f s, %d early, at most %.0f ms late (tick %d ms)\n",
+         g_fired, timeDifference(Timestamp::now(), start), g_early,
+         g_maxLate * 1000, TimingWheel::kTickMs);
+}
+
+int main(int argc, char* argv[])
+{
+  int n = argc > 1 ? atoi(argv[1]) : 1000 * 1000;
+  EventLoop loop;
+  g_loop = &loop;
+
+  addAndCancel(n, false);
+  addAndCancel(n, true);
+  // again, now the wheel recycles its nodes
+  addAndCancel(n, true);
+  fireAll(n);
+  return g_early == 0 ? 0 : 1;
+}
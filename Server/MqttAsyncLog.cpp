@@ -0,0 +1,207 @@
+#include "MqttAsyncLog.h"
+
+#include <assert.h>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <boost/bind.hpp>
+#include <muduo/base/LogFile.h>
+#include <muduo/base/Timestamp.h>
+
+using namespace muduo;
+
+MqttAsyncLog* MqttAsyncLog::instance_ = NULL;
+__thread MqttAsyncLog::Ring* MqttAsyncLog::t_ring_ = NULL;
+
+const size_t MqttAsyncLog::kRingSize;
+
+MqttAsyncLog::Ring::Ring()
+  :tail_(0),
+   dropped_(0),
+   head_(0),
+   reportedDropped_(0)
+{
+}
+
+MqttAsyncLog::MqttAsyncLog(const string& basename, off_t rollSize, int flushInterval)
+  :basename_(basename),
+   rollSize_(rollSize),
+   flushInterval_(flushInterval),
+   running_(false),
+   thread_(boost::bind(&MqttAsyncLog::threadFunc, this), "Logging"),
+   cond_(mutex_)
+{
+}
+
+MqttAsyncLog::~MqttAsyncLog()
+{
+  if(running_)
+    stop();
+  //线程退出前可能还在写日志，环不释放
+}
+
+void MqttAsyncLog::start()
+{
+  assert(instance_ == NULL);
+  running_ = true;
+  thread_.start();
+  __atomic_store_n(&instance_, this, __ATOMIC_RELEASE);
+}
+
+void MqttAsyncLog::stop()
+{
+  __atomic_store_n(&instance_, static_cast<MqttAsyncLog*>(NULL), __ATOMIC_RELEASE);
+  {
+    MutexLockGuard lock(mutex_);
+    running_ = false;
+    cond_.notify();
+  }
+  thread_.join();
+}
+
+void MqttAsyncLog::output(const char* logline, int len)
+{
+  MqttAsyncLog* log = __atomic_load_n(&instance_, __ATOMIC_ACQUIRE);
+  if(log)
+    log->append(logline, len);
+  else
+    fwrite(logline, 1, static_cast<size_t>(len), stdout);
+}
+
+void MqttAsyncLog::flush()
+{
+  MqttAsyncLog* log = __atomic_load_n(&instance_, __ATOMIC_ACQUIRE);
+  if(log && t_ring_)
+    log->waitEmpty(t_ring_);
+  else
+    fflush(stdout);
+}
+
+void MqttAsyncLog::append(const char* logline, int len)
+{
+  Ring* ring = t_ring_;
+  if(__builtin_expect(ring == NULL, 0))
+    ring = t_ring_ = registerRing();
+
+  size_t n = static_cast<size_t>(len);
+  uint64_t tail = ring->tail_;
+  uint64_t head = __atomic_load_n(&ring->head_, __ATOMIC_ACQUIRE);
+  if(kRingSize - (tail - head) < n)
+  {
+    __atomic_store_n(&ring->dropped_, ring->dropped_ + 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  size_t pos = static_cast<size_t>(tail % kRingSize);
+  size_t first = n < kRingSize - pos ? n : kRingSize - pos;
+  memcpy(ring->data_ + pos, logline, first);
+  memcpy(ring->data_, logline + first, n - first);
+  __atomic_store_n(&ring->tail_, tail + n, __ATOMIC_RELEASE);
+
+  //过半才唤醒后台线程，平时由它定时来取
+  if(tail + n - head > kRingSize / 2)
+    cond_.notify();
+}
+
+//最多等一秒，后台线程卡住时也要让 abort 继续
+void MqttAsyncLog::waitEmpty(const Ring* ring)
+{
+  cond_.notify();
+  struct timespec delay = { 0, 1000 * 1000 };
+  for(int i = 0; i < 1000; ++i)
+  {
+    if(__atomic_load_n(&ring->head_, __ATOMIC_ACQUIRE) == ring->tail_)
+      return;
+    ::nanosleep(&delay, NULL);
+  }
+}
+
+MqttAsyncLog::Ring* MqttAsyncLog::registerRing()
+{
+  //new 不保证按缓存行对齐
+  void* p = NULL;
+  if(::posix_memalign(&p, 64, sizeof(Ring)) != 0)
+    abort();
+  Ring* ring = new(p) Ring;
+  MutexLockGuard lock(mutex_);
+  rings_.push_back(ring);
+  return ring;
+}
+
+void MqttAsyncLog::threadFunc()
+{
+  LogFile output(basename_, rollSize_, false, flushInterval_);
+  std::vector<Ring*> rings;
+  std::vector<uint64_t> tails;
+  bool running = true;
+  while(running)
+  {
+    {
+      MutexLockGuard lock(mutex_);
+      if(running_)
+        cond_.waitForSeconds(0.05);
+      running = running_;
+      rings = rings_;
+    }
+
+    //先写入并刷新，再推进 head_，flush() 看到环空时内容已交给内核
+    tails.resize(rings.size());
+    bool written = false;
+    for(size_t i = 0; i < rings.size(); ++i)
+    {
+      Ring* ring = rings[i];
+      uint64_t head = ring->head_;
+      uint64_t tail = __atomic_load_n(&ring->tail_, __ATOMIC_ACQUIRE);
+      tails[i] = tail;
+
+      int64_t dropped = __atomic_load_n(&ring->dropped_, __ATOMIC_RELAXED);
+      if(dropped != ring->reportedDropped_)
+      {
+        char buf[128];
+        int len = snprintf(buf, sizeof buf, "%s dropped %lld log lines, log buffer full\n",
+                           Timestamp::now().toFormattedString().c_str(),
+                           static_cast<long long>(dropped - ring->reportedDropped_));
+        output.append(buf, len);
+        ring->reportedDropped_ = dropped;
+        written = true;
+      }
+
+      if(head == tail)
+        continue;
+      size_t pos = static_cast<size_t>(head % kRingSize);
+      size_t n = static_cast<size_t>(tail - head);
+      size_t first = n < kRingSize - pos ? n : kRingSize - pos;
+      output.append(ring->data_ + pos, static_cast<int>(first));
+      if(n > first)
+        output.append(ring->data_, static_cast<int>(n - first));
+      written = true;
+    }
+    if(!written)
+      continue;
+
+    output.flush();
+    for(size_t i = 0; i < rings.size(); ++i)
+      __atomic_store_n(&rings[i]->head_, tails[i], __ATOMIC_RELEASE);
+  }
+}
+
+bool MqttLogRateLimit::allow(int perSecond, int* suppressed)
+{
+  int64_t second = Timestamp::now().microSecondsSinceEpoch() / Timestamp::kMicroSecondsPerSecond;
+  if(second != second_)
+  {
+    second_ = second;
+    count_ = 0;
+  }
+  if(count_ >= perSecond)
+  {
+    ++suppressed_;
+    return false;
+  }
+  ++count_;
+  *suppressed = suppressed_;
+  suppressed_ = 0;
+  return true;
+}
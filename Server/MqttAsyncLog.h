@@ -0,0 +1,75 @@
+#ifndef MQTTASYNCLOG_H
+#define MQTTASYNCLOG_H
+
+#include <stdint.h>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <muduo/base/Condition.h>
+#include <muduo/base/Mutex.h>
+#include <muduo/base/Thread.h>
+#include <muduo/base/Types.h>
+
+//异步日志，用 Logger::setOutput(MqttAsyncLog::output) 安装。
+//每个线程首次写日志时分配一个单生产者单消费者的环形缓冲区，之后写日志只复制到本线程的环里，
+//不加锁也不分配内存；后台线程轮流取出各环的内容写入 LogFile。
+//环满时丢弃该行并计数，由后台线程在日志中注明，调用方不会被阻塞。
+//进程内只能有一个实例。
+class MqttAsyncLog : boost::noncopyable
+{
+public:
+  MqttAsyncLog(const muduo::string& basename, off_t rollSize, int flushInterval = 3);
+  ~MqttAsyncLog();
+
+  void start();
+  void stop();
+
+  //Logger 的输出函数，没有已启动的实例时写到标准输出
+  static void output(const char* logline, int len);
+  //Logger 的刷新函数，LOG_FATAL 退出前等本线程的日志写到文件
+  static void flush();
+
+private:
+  static const size_t kRingSize = 1024 * 1024;
+
+  struct Ring
+  {
+    Ring();
+
+    //生产者写 tail_，消费者写 head_，分开放在两个缓存行上
+    uint64_t tail_ __attribute__ ((aligned (64)));
+    int64_t dropped_;
+    uint64_t head_ __attribute__ ((aligned (64)));
+    int64_t reportedDropped_;
+    char data_[kRingSize];
+  };
+
+  void append(const char* logline, int len);
+  void waitEmpty(const Ring* ring);
+  Ring* registerRing();
+  void threadFunc();
+
+  const muduo::string basename_;
+  const off_t rollSize_;
+  const int flushInterval_;
+  bool running_;
+  muduo::Thread thread_;
+  muduo::MutexLock mutex_;
+  muduo::Condition cond_;
+  std::vector<Ring*> rings_;
+
+  static MqttAsyncLog* instance_;
+  static __thread Ring* t_ring_;
+};
+
+//按调用点限制每秒的日志行数，用作 static __thread 变量，只在本线程访问
+struct MqttLogRateLimit
+{
+  int64_t second_;
+  int count_;
+  int suppressed_;
+
+  //本秒已输出 perSecond 行时返回 false；返回 true 时 *suppressed 为上次输出后跳过的行数
+  bool allow(int perSecond, int* suppressed);
+};
+
+#endif // MQTTASYNCLOG_H
@@ -4,234 +4,413 @@
 #include <muduo/base/Logging.h>
 #include <muduo/net/Endian.h>
 #include <muduo/base/Singleton.h>
-#include <muduo/base/Atomic.h>
 
 #include "MqttTopicTree.h"
 #include "MqttProtocol.h"
-
-namespace
-{
-  AtomicUint32 mid;
-
-  uint16_t NewMid()
-  {
-    return static_cast<uint16_t>(mid.addAndGet(1) % 0xff);
-  }
-}
+#include "MqttPublishFrame.h"
+#include "MqttMessagePool.h"
+#include "MqttFrameDecoder.h"
+#include "MqttSessionStore.h"
+#include "MqttSpillQueue.h"
+#include "MqttMetrics.h"
+#include "MqttLatency.h"
+#include "MqttAsyncLog.h"
+
+//每个 IO 线程每秒最多记录的 PUBLISH 日志行数，以及记录的负载字节数
+const int kPublishLogsPerSecond = 20;
+const int kLoggedPayloadBytes = 64;
 
 #define MSB(A) static_cast<uint8_t>((A & 0xFF00) >> 8)
 #define LSB(A) static_cast<uint8_t>(A & 0x00FF)
 
-MqttClientSession::MqttClientSession(EventLoop* loop,uint16_t keepalive)
+MqttClientSession::MqttClientSession(EventLoop* loop,const MqttSessionConfig* config)
   : loop_(loop),
-    lastInTime_(0),
+    config_(config),
+    store_(config->store),
     will_(false),
     clean_session_(false),
-    keepalive_(keepalive)
+    sendUnconfdMsgs_(config->inflightWindow),
+    congested_(false),
+    drainStart_(0),
+    backlog_(-1)
 {
-  if(keepalive_ > 0)
-    timerId_ = loop_->runEvery(keepalive/2,boost::bind(&MqttClientSession::checkAlive,this));
 }
 
 MqttClientSession::~MqttClientSession()
 {
-  if(keepalive_ > 0)
-    loop_->cancel(timerId_);
+  //断开时已从 keepalive 链表摘下
+  assert(!keepAliveNode_.linked());
+  MqttMetrics::add(MqttMetrics::kQueuedMessages, -static_cast<int64_t>(pendingMsgs_.size()));
 }
 
-void MqttClientSession::publishOfflineMsg()
+void MqttClientSession::startKeepAlive(const TcpConnectionPtr& conn, uint16_t keepalive)
+{
+  conn->getLoop()->assertInLoopThread();
+  MqttKeepAlive* keepAlive = MqttKeepAlive::of(conn->getLoop());
+  if(keepalive > 0 && keepAlive)
+    keepAlive->add(&keepAliveNode_,get_pointer(conn),keepalive,Timestamp::now());
+}
+
+void MqttClientSession::stopKeepAlive(const TcpConnectionPtr& conn)
+{
+  MqttKeepAlive* keepAlive = MqttKeepAlive::of(conn->getLoop());
+  if(keepAlive)
+    keepAlive->remove(&keepAliveNode_);
+}
+
+void MqttClientSession::setTcpConnection(const TcpConnectionPtr& conn)
+{
+  conn->getLoop()->assertInLoopThread();
+  TcpConWeakPtr_ = conn;
+  congested_ = false;
+  drainStart_ = 0;
+  conn->setHighWaterMarkCallback(
+        boost::bind(&MqttClientSession::onHighWaterMark, this, _1, _2), config_->maxOutboundBytes);
+  storeBacklog(conn);
+}
+
+//回调在连接所属线程，会话已交给别的连接时不处理
+bool MqttClientSession::attached(const TcpConnectionPtr& conn) const
 {
-  if(sendUnconfdMsgs_.size() > 0)
+  return ownerLoop() == conn->getLoop() && TcpConWeakPtr_.lock() == conn;
+}
+
+void MqttClientSession::onHighWaterMark(const TcpConnectionPtr& conn, size_t bytes)
+{
+  if(!attached(conn))
+    return;
+  //回调是排队执行的，期间可能已经写空
+  if(conn->outputBytes() < config_->maxOutboundBytes)
   {
-    TcpConnectionPtr ptr = TcpConWeakPtr_.lock();
-    if(ptr)
-    {
-      MqttMsgList::type_msgs msgs = sendUnconfdMsgs_.copy();
-      for(MqttMsgList::Iterator it=msgs.begin(); it!=msgs.end(); ++it)
-      {
-        boost::shared_ptr<MqttMessage>& msg = it->second;
-        if(msg->qos == 2 && msg->state == MqttMessage::ms_wait_for_pubcomp)
-        {
-          sendPubRel(ptr,msg->mid);
-          continue;
-        }
-
-        if(msg->qos == 0)
-          sendUnconfdMsgs_.deleteMsg(msg->mid);
-
-        std::vector<uint8_t> sendbuf = packageMsg(msg,msg->remainglen);
-        ptr->send(sendbuf.data(),static_cast<int>(sendbuf.size()));
-      }
-    }
+    sendPending(conn);
+    return;
+  }
+
+  Singleton<MqttOutboundStats>::instance().highWaterMarks.increment();
+  LOG_DEBUG << clientID_ << " output buffer " << bytes << " bytes, pausing delivery";
+  congested_ = true;
+  conn->setWriteCompleteCallback(
+        boost::bind(&MqttClientSession::onWriteComplete, this, _1));
+}
+
+void MqttClientSession::onWriteComplete(const TcpConnectionPtr& conn)
+{
+  //只在拥塞或统计写空耗时期间安装，平时每次写完不必排队回调
+  conn->setWriteCompleteCallback(WriteCompleteCallback());
+  if(drainStart_ != 0)
+  {
+    MqttLatency::record(MqttLatency::kOutputDrain, drainStart_);
+    drainStart_ = 0;
   }
+  if(!attached(conn))
+    return;
+  congested_ = false;
+  sendPending(conn);
+}
+
+bool MqttClientSession::writable(const TcpConnectionPtr& conn) const
+{
+  return !congested_ && conn->outputBytes() < config_->maxOutboundBytes;
 }
 
-void MqttClientSession::publish(const boost::shared_ptr<MqttMessage>& msg)
+void MqttClientSession::setOwnerLoop(EventLoop* loop)
 {
-  if(msg->qos == 0)
-    msg->state = MqttMessage::ms_publish;
-  else if(msg->qos == 1)
-    msg->state = MqttMessage::ms_wait_for_puback;
-  else // msg->qos == 2
-    msg->state = MqttMessage::ms_wait_for_pubrec;
+  loop_->assertInLoopThread();
+  __atomic_store_n(&loop_, loop, __ATOMIC_RELEASE);
+}
 
+void MqttClientSession::publishOfflineMsg()
+{
+  loop_->assertInLoopThread();
   TcpConnectionPtr ptr = TcpConWeakPtr_.lock();
-  if(ptr)
+  if(!ptr)
+    return;
+
+  //先按原顺序重发上次未确认的，再发离线期间积压的
+  std::vector<MqttInflightWindow::Slot*> slots;
+  sendUnconfdMsgs_.inflight(&slots);
+  for(size_t i=0; i<slots.size(); ++i)
   {
-    if(msg->qos > 0)
-      sendUnconfdMsgs_.push(msg);
+    MqttInflightWindow::Slot* slot = slots[i];
+    if(slot->msg->qos == 2 && slot->state == MqttMessage::ms_wait_for_pubcomp)
+      sendPubRel(ptr,slot->mid);
+    else
+      sendPublish(ptr,slot->msg,slot->mid,1);
+  }
+
+  sendPending(ptr);
+}
 
-    std::vector<uint8_t> sendbuf = packageMsg(msg,msg->remainglen);
-    ptr->send(sendbuf.data(),static_cast<int>(sendbuf.size()));
+void MqttClientSession::publish(const boost::shared_ptr<const MqttMessage>& msg)
+{
+  EventLoop* loop = ownerLoop();
+  if(!loop->isInLoopThread())
+  {
+    //会话不属于当前线程（例如刚迁到别的线程），转交给所属线程
+    loop->runInLoop(boost::bind(&MqttClientSession::publish, shared_from_this(), msg));
+    return;
+  }
+
+  TcpConnectionPtr ptr = TcpConWeakPtr_.lock();
+  //断开后连接对象可能还未销毁，按离线处理
+  if(ptr && !ptr->connected())
+    ptr.reset();
+  //离线、拥塞、窗口已满或已有排队的消息时排在队尾，保持顺序
+  if(ptr && pendingMsgs_.empty() && (!spill_ || spill_->empty()) && writable(ptr) &&
+     (msg->qos == 0 || !sendUnconfdMsgs_.full()))
+  {
+    deliver(ptr,msg);
   }
   else
   {
-    LOG_INFO  << "offline msg store ";
-    if(msg->qos > 0)
-      msg->mid = NewMid();
-    sendUnconfdMsgs_.push(msg);
+    enqueue(ptr,msg);
   }
+  storeBacklog(ptr);
 }
 
-void MqttClientSession::onMessage(const TcpConnectionPtr& conn, Buffer* buffer, Timestamp time)
+void MqttClientSession::storeBacklog(const TcpConnectionPtr& conn)
 {
-  conn->getLoop()->assertInLoopThread();
-  //固定报头（报文类型byte 1 + 剩余长度（最大为4个字节，最小1个字节），
-  //后面可变报头必然超过3个字节，所以此处判断 < 5 不会错过正确mqtt消息
-  //ping 消息 仅仅两个字节
-  if(buffer->readableBytes() < 2)
-    return;
-
-  uint8_t msgType = buffer->peekInt8();
+  int64_t backlog = -1;
+  if(conn && conn->connected())
+    backlog = static_cast<int64_t>(sendUnconfdMsgs_.size() + pendingMsgs_.size());
+  __atomic_store_n(&backlog_, backlog, __ATOMIC_RELAXED);
+}
 
-  const char* byte = buffer->peek();
-  uint32_t remaining_length = 0;
-  uint32_t remaining_mult = 1;
+//不能立即发出的消息排队，内存队列满时按慢消费者策略处理
+void MqttClientSession::enqueue(const TcpConnectionPtr& conn, const boost::shared_ptr<const MqttMessage>& msg)
+{
+  MqttOutboundStats& stats = Singleton<MqttOutboundStats>::instance();
+  MqttSessionConfig::SlowConsumerPolicy policy = config_->policy;
+  if(policy == MqttSessionConfig::kDropPolicy && conn && msg->qos == 0 && !writable(conn))
+  {
+    stats.droppedQos0.increment();
+    return;
+  }
 
-  char i=0;
-  do
+  bool spilling = spill_ && !spill_->empty();
+  if(!spilling && pendingMsgs_.size() >= config_->maxQueuedMessages)
   {
-    byte++;
-    ++i;
+    if(policy == MqttSessionConfig::kSpillPolicy)
+    {
+      if(!spill_)
+        spill_.reset(new MqttSpillQueue(config_->spillDir, config_->maxSpillBytes));
+      spilling = true;
+    }
+    else
+    {
+      if(policy == MqttSessionConfig::kDisconnectPolicy && conn)
+      {
+        LOG_WARN << clientID_ << " is too slow, " << pendingMsgs_.size()
+                 << " messages queued, disconnecting";
+        stats.disconnects.increment();
+        conn->forceClose();
+      }
+      else
+      {
+        stats.droppedOverflow.increment();
+      }
+      return;
+    }
+  }
 
-    if(i > 4) //不符合mqtt协议
+  if(spilling)
+  {
+    if(!spill_->push(*msg))
     {
-      conn->forceClose();
+      stats.droppedSpillFull.increment();
       return;
     }
-    remaining_length  += (*byte & 127) * remaining_mult;
-    remaining_mult *= 128;
-  }while((*byte & 128) != 0);
+    stats.spilled.increment();
+  }
+  else
+  {
+    pendingMsgs_.push_back(msg);
+    MqttMetrics::add(MqttMetrics::kQueuedMessages, 1);
+  }
 
-  assert(buffer->readableBytes() >= remaining_length + i + 1);
+  if(!conn && store_ && !clean_session_)
+    store_->enqueue(clientID_,*msg);
+}
 
-  if(buffer->readableBytes() < remaining_length + i + 1)
+void MqttClientSession::persist()
+{
+  loop_->assertInLoopThread();
+  if(!store_)
     return;
-  else
+
+  std::list<MqttTopic> topics;
+  for(std::list<MqttSubscription>::iterator it=topics_.begin(); it!=topics_.end(); ++it)
+    topics.push_back(it->topic);
+  store_->saveSession(clientID_,topics);
+  std::vector<MqttInflightWindow::Slot*> slots;
+  sendUnconfdMsgs_.inflight(&slots);
+  for(size_t i=0; i<slots.size(); ++i)
   {
-    lastInTime_ = time;
+    //已收到 PUBREC 的 QoS 2 消息客户端已经持有，只差 PUBREL，不再保存
+    if(slots[i]->state != MqttMessage::ms_wait_for_pubcomp)
+      store_->enqueue(clientID_,*slots[i]->msg);
+  }
+  for(size_t i=0; i<pendingMsgs_.size(); ++i)
+    store_->enqueue(clientID_,*pendingMsgs_[i]);
+  //溢出的消息也要保存，按批读出，不整个读进内存
+  if(spill_ && !spill_->empty())
+    spill_->forEach(boost::bind(&MqttSessionStore::enqueue, store_, boost::cref(clientID_), _1));
+}
 
-    buffer->retrieve(i+1);
-    uint8_t cmd = msgType & 0xF0;
+void MqttClientSession::deliver(const TcpConnectionPtr& conn, const boost::shared_ptr<const MqttMessage>& msg)
+{
+  uint16_t mid = 0;
+  if(msg->qos > 0)
+  {
+    mid = sendUnconfdMsgs_.add(msg, msg->qos == 1 ? MqttMessage::ms_wait_for_puback
+                                                  : MqttMessage::ms_wait_for_pubrec);
+    assert(mid != 0);
+  }
+  sendPublish(conn,msg,mid,0);
+}
 
-    switch (cmd)
+//窗口有空位且连接不拥塞时依次发出排队的消息
+void MqttClientSession::sendPending(const TcpConnectionPtr& conn)
+{
+  while(writable(conn))
+  {
+    if(pendingMsgs_.empty() && spill_ && !spill_->empty())
     {
-      case PINGREQ:
-        mqttHandlePingReq(conn);
-        break;
-      case PINGRESP:
-        break;
-      case PUBACK:
-        mqttHandlePublishAck(conn, *buffer,remaining_length);
-        break;
-      case PUBCOMP:
-        mqttHandlePublishComp(conn, *buffer,remaining_length);
-        break;
-      case PUBLISH:
-        mqttHadnlePublish(conn,*buffer,msgType,remaining_length);
-        break;
-      case PUBREC:
-        mqttHandlePublishRec(conn, *buffer, remaining_length);
-        break;
-      case PUBREL:
-        mqttHandlePublishRel(conn,*buffer,remaining_length);
-        break;
-      case DISCONNECT:
-        if(!mqttHandleDisconnect(conn,remaining_length))
-        {
-          conn->forceClose();
-        }
-        break;
-      case SUBSCRIBE:
-        if(!mqttHandleSubcribe(conn,*buffer,remaining_length))
-        {
-          LOG_ERROR << "SUBSCRIBE ERR";
-          conn->forceClose();
-        }
-        break;
-      case UNSUBSCRIBE:
-        if(!mqttHandleUnsubcribe(conn,*buffer,remaining_length))
-        {
-          LOG_ERROR << "UNSUBSCRIBE ERR";
-          conn->forceClose();
-        }
-        break;
-      default:
-        conn->forceClose();
-        assert(!"no this msg type");
-        break;
-
+      spill_->pop(std::max(config_->maxQueuedMessages / 2, static_cast<size_t>(1)), &pendingMsgs_);
+      MqttMetrics::add(MqttMetrics::kQueuedMessages, static_cast<int64_t>(pendingMsgs_.size()));
     }
+    if(pendingMsgs_.empty() ||
+       (pendingMsgs_.front()->qos > 0 && sendUnconfdMsgs_.full()))
+      break;
+    deliver(conn,pendingMsgs_.front());
+    pendingMsgs_.pop_front();
+    MqttMetrics::add(MqttMetrics::kQueuedMessages, -1);
+  }
+  storeBacklog(conn);
+}
+
+void MqttClientSession::onMessage(const TcpConnectionPtr& conn, Buffer* buffer, Timestamp time)
+{
+  conn->getLoop()->assertInLoopThread();
+  //只由所属线程处理，attachSession 接上连接之前报文留在缓冲区
+  if(!attached(conn))
+    return;
+  //一次读取可能包含多个报文，逐个处理所有完整报文，不完整的留待下次
+  keepAliveNode_.touch(time);
+
+  if(MqttFrameDecoder::drain(buffer, boost::bind(&MqttClientSession::onFrame, this, boost::cref(conn), _1, _2))
+     == MqttFrameDecoder::kMalformed)
+    conn->forceClose();
+}
+
+//连接已关闭（如处理了 DISCONNECT）后，同一次读到的其余报文不再处理
+bool MqttClientSession::onFrame(const TcpConnectionPtr& conn, const MqttFixedHeader& header, Buffer* buffer)
+{
+  if(!conn->connected())
+    return true;
+  MqttMetrics::packetIn(header.type, header.headerLength + header.remainingLength);
+  MqttLatencyTimer timer(MqttLatency::kDispatch + (header.type >> 4));
+  return handlePacket(conn,buffer,header);
+}
+
+bool MqttClientSession::handlePacket(const TcpConnectionPtr& conn, Buffer* buffer, const MqttFixedHeader& header)
+{
+  const uint32_t len = header.remainingLength;
+  switch (header.type & 0xF0)
+  {
+    case PINGREQ:
+      mqttHandlePingReq(conn);
+      return true;
+    case PINGRESP:
+      return true;
+    case PUBACK:
+      if(len != 2) return false;
+      mqttHandlePublishAck(conn, *buffer,len);
+      return true;
+    case PUBCOMP:
+      if(len != 2) return false;
+      mqttHandlePublishComp(conn, *buffer,len);
+      return true;
+    case PUBLISH:
+      return mqttHadnlePublish(conn,*buffer,header.type,len);
+    case PUBREC:
+      if(len != 2) return false;
+      mqttHandlePublishRec(conn, *buffer, len);
+      return true;
+    case PUBREL:
+      if(len != 2) return false;
+      mqttHandlePublishRel(conn,*buffer,len);
+      return true;
+    case DISCONNECT:
+      return mqttHandleDisconnect(conn,len);
+    case SUBSCRIBE:
+      if(!mqttHandleSubcribe(conn,*buffer,len))
+      {
+        LOG_ERROR << "SUBSCRIBE ERR";
+        return false;
+      }
+      return true;
+    case UNSUBSCRIBE:
+      if(!mqttHandleUnsubcribe(conn,*buffer,len))
+      {
+        LOG_ERROR << "UNSUBSCRIBE ERR";
+        return false;
+      }
+      return true;
+    default:
+      LOG_ERROR << "unknown msg type " << static_cast<int>(header.type);
+      return false;
   }
 }
 
 
 bool MqttClientSession::mqttHandleSubcribe(const TcpConnectionPtr& conn, Buffer& buffer,const size_t len)
 {
+  if(len < 2) return false;
   uint16_t mid = buffer.readInt16();
 
-
-  std::vector<uint8_t> qosVector;
-  size_t readedNum = 0;
-  readedNum += sizeof(mid);
-  while(readedNum < len)
+  //先读完整个载荷再改订阅，报文有错时不会留下一半的订阅
+  std::vector<std::pair<MqttTopic,uint8_t> > filters;
+  size_t left = len - sizeof(mid);
+  while(left > 0)
   {
-    //暂存缓冲区中可读数据
-    size_t num = buffer.readableBytes();
-
-    string topic;
-    readMqttString(topic, buffer);
+    MqttTopic topic;
+    if(readMqttTopic(topic, buffer, &left) <= 0 || left < 1) return false;
     //    if(!subTopicCheck(topic.c_str())) return false;
 
     uint8_t qos = buffer.readInt8();
+    --left;
     if(qos > 2) return false;
+    filters.push_back(std::make_pair(topic, qos));
+  }
 
-    qosVector.push_back(qos);
-
-    MqttTopicTree& topicTree = Singleton<MqttTopicTree>::instance();
-    //将客户端加入订阅链表
-    if(cleanSession())
-    {
-      topicTree.addSubscriber(topic,
-                              boost::any_cast<boost::shared_ptr<MqttClientSession> >(conn->getContext()));
-      topics_.push_back(topic);
-    }
-    else
+  MqttTopicTree& topicTree = Singleton<MqttTopicTree>::instance();
+  std::vector<uint8_t> qosVector;
+  for(size_t i = 0; i < filters.size(); ++i)
+  {
+    const MqttTopic& topic = filters[i].first;
+    uint8_t qos = filters[i].second;
+    //将客户端加入订阅链表，重复订阅同一主题只保留一份
+    std::list<MqttSubscription>::iterator it = findSubscription(topic);
+    if(it == topics_.end())
     {
-      std::list<string>::iterator it = std::find(topics_.begin(),topics_.end(),topic);
-      if(it == topics_.end())
+      MqttSubscription subscription(topic);
+      //格式不对的共享订阅回 0x80，不当作普通过滤器
+      if(MqttSubscription::isShareFilter(topic) && !subscription.shared())
       {
-
-        topicTree.addSubscriber(topic,
+        LOG_WARN << clientID_ << " malformed shared subscription " << topic.str();
+        qos = 0x80;
+      }
+      else
+      {
+        topics_.push_back(subscription);
+        topicTree.addSubscriber(topics_.back(),
                                 boost::any_cast<boost::shared_ptr<MqttClientSession> >(conn->getContext()));
-
-        topics_.push_back(topic);
       }
     }
+    qosVector.push_back(qos);
 
-    LOG_INFO <<"subTopic "<< topic << ",qos  " << static_cast<int>(qos);
-    num -= buffer.readableBytes();
-    readedNum += num;
+    LOG_INFO <<"subTopic "<< topic.str() << ",qos  " << static_cast<int>(qos);
   }
 
   sendSuback(conn,mid,qosVector);
@@ -240,26 +419,29 @@ bool MqttClientSession::mqttHandleSubcribe(const TcpConnectionPtr& conn, Buffer&
 
 bool MqttClientSession::mqttHandleUnsubcribe(const TcpConnectionPtr& conn, Buffer& buffer,const size_t len)
 {
+  if(len < 2) return false;
   uint16_t mid = buffer.readInt16();
 
-  MqttTopicTree& topicTree = Singleton<MqttTopicTree>::instance();
-  size_t readedNum = 0;
-  readedNum += sizeof(mid);
-  while (readedNum < len)
+  //同 SUBSCRIBE，先读完整个载荷再退订
+  std::vector<MqttTopic> filters;
+  size_t left = len - sizeof(mid);
+  while (left > 0)
   {
-    //暂存缓冲区中可读数据
-    size_t num = buffer.readableBytes();
-
-    string topic;
-    readMqttString(topic, buffer);
-
-    topicTree.unSubscriber(topic,boost::shared_ptr<MqttClientSession>(shared_from_this()));
-    LOG_INFO << "Unsubcribe " << topic;
-
-    topics_.remove(topic);
+    MqttTopic topic;
+    if(readMqttTopic(topic, buffer, &left) <= 0) return false;
+    filters.push_back(topic);
+  }
 
-    num -= buffer.readableBytes();
-    readedNum += num;
+  MqttTopicTree& topicTree = Singleton<MqttTopicTree>::instance();
+  for(size_t i = 0; i < filters.size(); ++i)
+  {
+    LOG_INFO << "Unsubcribe " << filters[i].str();
+    std::list<MqttSubscription>::iterator it = findSubscription(filters[i]);
+    if(it != topics_.end())
+    {
+      topicTree.unSubscriber(*it);
+      topics_.erase(it);
+    }
   }
 
   sendUnsuback(conn,mid);
@@ -282,6 +464,7 @@ void MqttClientSession::mqttHandlePingReq(const TcpConnectionPtr& conn)
 {
   uint8_t message[2] = {PINGRESP,0};
   conn->send(message,sizeof(message));
+  MqttMetrics::packetOut(message[0], sizeof(message));
 }
 
 bool MqttClientSession::mqttHadnlePublish(const TcpConnectionPtr& conn, Buffer& buffer, uint8_t header, const size_t len)
@@ -289,37 +472,42 @@ bool MqttClientSession::mqttHadnlePublish(const TcpConnectionPtr& conn, Buffer&
   uint8_t dup = static_cast<uint8_t>((header & 0x08)>>3);
   uint8_t qos = static_cast<uint8_t>((header & 0x06)>>1);
   bool retain = (header & 0x01);
-  assert(qos != 3);
   if(qos == 3) return false;
 
-  string topic;
-  readMqttString(topic,buffer);
-  assert(topic.size() > 0);
+  MqttTopic topic;
+  size_t left = len;
+  if(readMqttTopic(topic,buffer,&left) <= 0) return false;
+  //发布的主题不能含通配符，否则是协议错误，断开连接
+  if(topic.hasWildcards()) return false;
 
   uint16_t mid = 0;
-  uint32_t payloadLen = static_cast<uint32_t>(len - (topic.size() + 2));
   if(qos > 0)
   {
-    payloadLen -= 2;
+    if(left < 2) return false;
     mid = buffer.readInt16();
+    left -= 2;
   }
+  uint32_t payloadLen = static_cast<uint32_t>(left);
 
-  boost::shared_ptr<MqttMessage> msgPtr(new MqttMessage());
-  msgPtr->dup = dup;
-  msgPtr->mid = mid;
+  boost::shared_ptr<MqttMessage> msgPtr = newMqttMessage();
   msgPtr->qos = qos;
-  msgPtr->state = MqttMessage::ms_publish;
   msgPtr->retain = retain;
   msgPtr->topic = topic;
-  msgPtr->remainglen = len;
   msgPtr->timestamp = Timestamp::now();
 
   MqttTopicTree& topicTree = Singleton<MqttTopicTree>::instance();
   if(payloadLen > 0)
   {
-    msgPtr->payload.reserve(payloadLen);
-    msgPtr->payload.assign(buffer.peek(),payloadLen);
-    buffer.retrieve(payloadLen);
+    //小负载复制到池块，大负载直接接管读缓冲
+    if(payloadLen <= kMaxInlinePayload)
+    {
+      msgPtr->payload = newMqttPayload(buffer.peek(), payloadLen);
+      buffer.retrieve(payloadLen);
+    }
+    else
+    {
+      msgPtr->payload = buffer.retrieveAsChunk(payloadLen);
+    }
   }
   else //payloadLen == 0
   {
@@ -329,26 +517,31 @@ bool MqttClientSession::mqttHadnlePublish(const TcpConnectionPtr& conn, Buffer&
   if(qos != 2)
   {
     if(qos == 1)
-    {
-      msgPtr->mid = NewMid();
       sendPublishAck(conn,mid);
-    }
 
     topicTree.Publish(topic,msgPtr);
   }
   else //qos == 2
   {
-    msgPtr->state = MqttMessage::ms_wait_for_pubrel;
-    recvUnconfdMsgs_.push(msgPtr);
+    recvUnconfdMsgs_.push(mid,msgPtr,MqttMessage::ms_wait_for_pubrel);
     sendPubRec(conn,mid);
   }
 
-  LOG_DEBUG << "topic: " << topic
-            << " qos: " << static_cast<int>(qos)
-            << " dup: " << static_cast<int>(dup)
-            << " mid: " << static_cast<int>(mid)
-            << " retain: " << static_cast<int>(retain)
-            << " payload: " << msgPtr->payload ;
+  //每条消息一行，限速并截断负载，否则调试级别下日志本身就成了瓶颈
+  static __thread MqttLogRateLimit publishLogLimit;
+  int suppressed = 0;
+  if(Logger::logLevel() <= Logger::DEBUG && publishLogLimit.allow(kPublishLogsPerSecond, &suppressed))
+  {
+    StringPiece payload = msgPtr->payload.toStringPiece();
+    LOG_DEBUG << "topic: " << topic.str()
+              << " qos: " << static_cast<int>(qos)
+              << " dup: " << static_cast<int>(dup)
+              << " mid: " << static_cast<int>(mid)
+              << " retain: " << static_cast<int>(retain)
+              << " payload: " << StringPiece(payload.data(), payload.size() < kLoggedPayloadBytes ?
+                                                             payload.size() : kLoggedPayloadBytes)
+              << " (" << payload.size() << " bytes, " << suppressed << " publishes not logged)";
+  }
 
   return true;
 }
@@ -357,31 +550,31 @@ void MqttClientSession::mqttHandlePublishAck(const TcpConnectionPtr& conn, Buffe
 {
   uint16_t mid = buffer.readInt16();
 
-  //  delSendUnconfMsg(mid);
-  sendUnconfdMsgs_.deleteMsg(mid);
+  if(sendUnconfdMsgs_.remove(mid))
+    sendPending(conn);
 }
 
 void MqttClientSession::mqttHandlePublishRel(const TcpConnectionPtr& conn, Buffer& buffer, const size_t len)
 {
   uint16_t mid = buffer.readInt16();
 
+  //重连后客户端可能重发 PUBREL，已转发过的只回 PUBCOMP
   boost::shared_ptr<MqttMessage> msg = recvUnconfdMsgs_.getandDelMsg(mid);
-  assert(msg);
   if(msg)
   {
     MqttTopicTree& topicTree = Singleton<MqttTopicTree>::instance();
-
-    msg->mid = NewMid();
     topicTree.Publish(msg->topic,msg);
-
-    sendPubComp(conn,mid);
   }
 
+  sendPubComp(conn,mid);
 }
 
 void MqttClientSession::mqttHandlePublishRec(const TcpConnectionPtr& conn, Buffer& buffer, const size_t len)
 {
   uint16_t mid = buffer.readInt16();
+  MqttInflightWindow::Slot* slot = sendUnconfdMsgs_.find(mid);
+  if(slot)
+    slot->state = MqttMessage::ms_wait_for_pubcomp;
   sendPubRel(conn,mid);
 }
 
@@ -389,52 +582,38 @@ void MqttClientSession::mqttHandlePublishComp(const TcpConnectionPtr& conn, Buff
 {
   uint16_t mid = buffer.readInt16();
 
-  sendUnconfdMsgs_.deleteMsg(mid);
+  if(sendUnconfdMsgs_.remove(mid))
+    sendPending(conn);
 }
 
-void MqttClientSession::checkAlive()
+void MqttClientSession::sendPublish(const TcpConnectionPtr& conn, const boost::shared_ptr<const MqttMessage>& msg,
+                                    uint16_t mid, uint8_t dup)
 {
-  Timestamp now(Timestamp::now());
-  double freeTime = timeDifference(now,lastInTime_);
-  if(freeTime > (1.5 * keepalive_))
+  assert(msg->frame);
+  const MqttPublishFrame& frame = *msg->frame;
+
+  //报头通常很短，放在栈上；只有超长主题才用堆
+  char stackBuf[256];
+  string heapBuf;
+  char* header = stackBuf;
+  if(frame.headerSize() > sizeof stackBuf)
   {
-    TcpConnectionPtr conn = TcpConWeakPtr_.lock();
-    if(conn)
-    {
-      conn->forceClose();
-    }
+    heapBuf.resize(frame.headerSize());
+    header = &*heapBuf.begin();
   }
-}
-
-std::vector<uint8_t> MqttClientSession::packageMsg(const boost::shared_ptr<MqttMessage>& msg, const size_t& remainglen)
-{
-  std::vector<uint8_t> remaingBytes = encodeRemainingLenth(static_cast<uint32_t>(remainglen));
-  assert(remaingBytes.size() != 0);
-
-  size_t size = remaingBytes.size() + remainglen + 1;
-
-  std::vector<uint8_t> sendBuf(size);
 
-  std::vector<uint8_t>::iterator it = sendBuf.begin();
-  *it = static_cast<uint8_t>(PUBLISH | ((msg->dup&0x1)<<3) | (msg->qos<<1) | msg->retain);
-  ++it;
+  frame.encodeHeader(mid,dup,header);
+  conn->send(StringPiece(header,static_cast<int>(frame.headerSize())),frame.payload());
+  MqttMetrics::packetOut(PUBLISH, frame.headerSize() + frame.payload().size());
 
-  std::copy(remaingBytes.begin(),remaingBytes.end(),it);
-  it += remaingBytes.size();
-
-  *it = MSB(msg->topic.size());  ++it;
-  *it = LSB(msg->topic.size());  ++it;
-  std::copy(msg->topic.begin(),msg->topic.end(),it); it += msg->topic.size();
-
-  if(msg->qos > 0)
+  //没能一次写完，记下从此刻到 handleWrite 写空输出缓冲区的时间
+  if(drainStart_ == 0 && MqttLatency::enabled() && conn->outputBytes() > 0)
   {
-    *it = MSB(msg->mid);  ++it;
-    *it = LSB(msg->mid);  ++it;
+    drainStart_ = MqttLatency::now();
+    if(!congested_)
+      conn->setWriteCompleteCallback(
+            boost::bind(&MqttClientSession::onWriteComplete, this, _1));
   }
-
-  std::copy(msg->payload.begin(), msg->payload.end(), it);
-
-  return sendBuf;
 }
 
 void MqttClientSession::sendSuback(const TcpConnectionPtr& conn, uint16_t mid,const std::vector<uint8_t>& payload)
@@ -453,18 +632,21 @@ void MqttClientSession::sendSuback(const TcpConnectionPtr& conn, uint16_t mid,co
   sendbuf.insert(sendbuf.end(),payload.begin(),payload.end());
 
   conn->send(sendbuf.data(),static_cast<int>(sendbuf.size()));
+  MqttMetrics::packetOut(SUBACK, sendbuf.size());
 }
 
 void MqttClientSession::sendUnsuback(const TcpConnectionPtr& conn, uint16_t mid)
 {
   uint8_t message[4] = {UNSUBACK,2,MSB(mid),LSB(mid)};
   conn->send(message,sizeof(message));
+  MqttMetrics::packetOut(message[0], sizeof(message));
 }
 
 void MqttClientSession::sendPublishAck(const TcpConnectionPtr& conn, uint16_t mid)
 {
   uint8_t message[4] = {PUBACK,2,MSB(mid),LSB(mid)};
   conn->send(message,sizeof(message));
+  MqttMetrics::packetOut(message[0], sizeof(message));
 
 }
 
@@ -472,30 +654,39 @@ void MqttClientSession::sendPubRec(const TcpConnectionPtr& conn, uint16_t mid)
 {
   uint8_t message[4] = {PUBREC,2,MSB(mid),LSB(mid)};
   conn->send(message,sizeof(message));
+  MqttMetrics::packetOut(message[0], sizeof(message));
 }
 
 void MqttClientSession::sendPubRel(const TcpConnectionPtr& conn, uint16_t mid)
 {
   uint8_t message[4] = {PUBREL|0x02,2,MSB(mid),LSB(mid)};
   conn->send(message,sizeof(message));
+  MqttMetrics::packetOut(message[0], sizeof(message));
 }
 
 void MqttClientSession::sendPubComp(const TcpConnectionPtr& conn, uint16_t mid)
 {
   uint8_t message[4] = {PUBCOMP,2,MSB(mid),LSB(mid)};
   conn->send(message,sizeof(message));
+  MqttMetrics::packetOut(message[0], sizeof(message));
 }
 
 void MqttClientSession::sendPingResp(const TcpConnectionPtr& conn)
 {
   uint8_t message[2] = {PINGRESP,0};
   conn->send(message,sizeof(message));
+  MqttMetrics::packetOut(message[0], sizeof(message));
 }
 
 
-int MqttClientSession::readMqttString(string& buf, Buffer& buffer)
+int MqttClientSession::readMqttString(string& buf, Buffer& buffer, size_t* left)
 {
+  if(*left < 2 || buffer.readableBytes() < 2 ||
+     *left < 2 + static_cast<size_t>(static_cast<uint16_t>(buffer.peekInt16())))
+    return -1;
+
   uint16_t len = buffer.readInt16();
+  *left -= 2 + len;
   if(len > 0)
   {
     buf.reserve(len);
@@ -505,6 +696,27 @@ int MqttClientSession::readMqttString(string& buf, Buffer& buffer)
   return len;
 }
 
+std::list<MqttSubscription>::iterator MqttClientSession::findSubscription(const MqttTopic& topic)
+{
+  std::list<MqttSubscription>::iterator it = topics_.begin();
+  while(it != topics_.end() && it->topic != topic)
+    ++it;
+  return it;
+}
+
+int MqttClientSession::readMqttTopic(MqttTopic& topic, Buffer& buffer, size_t* left)
+{
+  if(*left < 2 || buffer.readableBytes() < 2 ||
+     *left < 2 + static_cast<size_t>(static_cast<uint16_t>(buffer.peekInt16())))
+    return -1;
+
+  uint16_t len = buffer.readInt16();
+  *left -= 2 + len;
+  topic = MqttTopic::intern(StringPiece(buffer.peek(), len));
+  buffer.retrieve(len);
+  return len;
+}
+
 std::vector<uint8_t> MqttClientSession::encodeRemainingLenth(uint32_t remainingLength)
 {
   uint8_t remaining_bytes[4] = {0};
@@ -528,41 +740,25 @@ std::vector<uint8_t> MqttClientSession::encodeRemainingLenth(uint32_t remainingL
   return std::vector<uint8_t>(remaining_bytes,remaining_bytes + i);
 }
 
-void MqttMsgList::push(MqttMsgList::type_mid mid, const boost::shared_ptr<MqttMessage>& msg)
-{
-  MutexLockGuard lock(mutex_);
-  msgs_[mid] = msg;
-}
-
-void MqttMsgList::push(const boost::shared_ptr<MqttMessage>& msg)
+void MqttMsgList::push(MqttMsgList::type_mid mid, const boost::shared_ptr<MqttMessage>& msg, MqttMessage::msgState state)
 {
-  MutexLockGuard lock(mutex_);
-  type_mid mid = msg->mid;
-  msgs_[mid] = msg;
-}
-
-void MqttMsgList::insert(MqttMsgList::Iterator first, MqttMsgList::Iterator last)
-{
-  MutexLockGuard lock(mutex_);
-  msgs_.insert(first,last);
+  size_t size = msgs_.size();
+  Entry& entry = msgs_[mid];
+  if(msgs_.size() != size)
+    MqttMetrics::add(MqttMetrics::kAwaitingRelease, 1);
+  entry.msg = msg;
+  entry.state = state;
 }
 
 boost::shared_ptr<MqttMessage> MqttMsgList::getandDelMsg(MqttMsgList::type_mid mid)
 {
-  MutexLockGuard lock(mutex_);
-  boost::shared_ptr<MqttMessage> ret = msgs_.find(mid)->second;
-  msgs_.erase(mid);
+  boost::shared_ptr<MqttMessage> ret;
+  Iterator it = msgs_.find(mid);
+  if(it != msgs_.end())
+  {
+    ret = it->second.msg;
+    msgs_.erase(it);
+    MqttMetrics::add(MqttMetrics::kAwaitingRelease, -1);
+  }
   return ret;
 }
-
-void MqttMsgList::deleteMsg(MqttMsgList::type_mid mid)
-{
-  MutexLockGuard lock(mutex_);
-  msgs_.erase(mid);
-}
-
-MqttMsgList::type_msgs MqttMsgList::copy()
-{
-  MutexLockGuard lock(mutex_);
-  return msgs_;
-}
@@ -3,55 +3,132 @@
 
 #include <map>
 #include <list>
+#include <deque>
 #include <boost/weak_ptr.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <muduo/net/TcpConnection.h>
 #include <muduo/net/EventLoop.h>
+#include <muduo/base/Atomic.h>
 #include <muduo/base/Mutex.h>
 #include <muduo/base/Timestamp.h>
 #include <muduo/base/Types.h>
 
 #include "MqttMessage.h"
+#include "MqttKeepAlive.h"
+#include "MqttInflightWindow.h"
+#include "MqttSubscriberSet.h"
+#include "MqttMetrics.h"
+
+struct MqttFixedHeader;
+class MqttSessionStore;
+class MqttSpillQueue;
 
 using namespace net;
 
+//会话的可配置参数，由 MqttServer 持有，生命期长于所有会话
+struct MqttSessionConfig
+{
+  //待发队列满时的处理方式
+  enum SlowConsumerPolicy
+  {
+    kDropPolicy,        // 拥塞时丢弃新的 QoS 0 消息，队列满时丢弃新消息
+    kDisconnectPolicy,  // 队列满时断开连接，持久会话保留
+    kSpillPolicy,       // 队列满时写入磁盘，队列空出后读回
+  };
+
+  MqttSessionConfig()
+    : inflightWindow(20),
+      maxOutboundBytes(4*1024*1024),
+      maxQueuedMessages(10000),
+      policy(kDropPolicy),
+      spillDir("/tmp"),
+      maxSpillBytes(256*1024*1024),
+      store(NULL)
+  { }
+
+  uint16_t inflightWindow;    // 同时等待确认的 QoS>0 消息上限
+  size_t maxOutboundBytes;    // 连接输出缓冲区的高水位，超过后不再写入新消息
+  size_t maxQueuedMessages;   // 每个会话在内存中排队的消息上限
+  SlowConsumerPolicy policy;
+  string spillDir;
+  size_t maxSpillBytes;       // 每个会话溢出文件中未读回的字节上限，超过后丢弃新消息
+  MqttSessionStore* store;    // 非空时持久会话下线后的离线消息写入 store
+};
+
+//慢消费者处理的累计次数，所有 IO 线程共用一份
+struct MqttOutboundStats : boost::noncopyable
+{
+  AtomicInt64 highWaterMarks;   // 输出缓冲区越过高水位
+  AtomicInt64 droppedQos0;      // 拥塞时丢弃的 QoS 0 消息
+  AtomicInt64 droppedOverflow;  // 队列满时丢弃的消息
+  AtomicInt64 disconnects;      // 队列满时断开的连接
+  AtomicInt64 spilled;          // 写入磁盘的消息
+  AtomicInt64 droppedSpillFull; // 溢出文件达到上限后丢弃的消息
+};
+
+//接收方向 QoS 2 等待 PUBREL 的消息，报文标识符由客户端决定。
+//只在会话所属的 EventLoop 线程访问，不加锁。
 class MqttMsgList
 {
 public:
   typedef uint16_t type_mid;
-  typedef std::map<type_mid,boost::shared_ptr<MqttMessage> > type_msgs;
+  struct Entry
+  {
+    boost::shared_ptr<MqttMessage> msg;
+    MqttMessage::msgState state;
+  };
+  typedef std::map<type_mid,Entry> type_msgs;
   typedef type_msgs::iterator Iterator;
 
-  void push(type_mid mid,const boost::shared_ptr<MqttMessage>& msg);
+  ~MqttMsgList()
+  { MqttMetrics::add(MqttMetrics::kAwaitingRelease, -static_cast<int64_t>(msgs_.size())); }
 
-  void push(const boost::shared_ptr<MqttMessage>& msg);
-
-  void insert(Iterator first,Iterator last);
+  void push(type_mid mid,const boost::shared_ptr<MqttMessage>& msg,MqttMessage::msgState state);
 
   boost::shared_ptr<MqttMessage> getandDelMsg(type_mid mid);
 
-  void deleteMsg(type_mid mid);
-
-  type_msgs copy();
-
   size_t size() const
   { return msgs_.size(); }
 
 private:
   type_msgs msgs_;
-  MutexLock mutex_;
 };
 
 
 class MqttClientSession : public boost::enable_shared_from_this<MqttClientSession>
 {
 public:
-  MqttClientSession(EventLoop* loop,uint16_t keepalive);
+  MqttClientSession(EventLoop* loop,const MqttSessionConfig* config);
   ~MqttClientSession();
 
+  //会话的所有状态只在所属线程上修改：上线时是连接所属的 EventLoop，
+  //下线后仍是最后一次连接的 EventLoop。其他线程的投递都转交过去。
+  EventLoop* ownerLoop() const
+  { return __atomic_load_n(&loop_, __ATOMIC_ACQUIRE); }
+
+  //在原所属线程调用，此后发来的投递都转交到新线程
+  void setOwnerLoop(EventLoop* loop);
+
   void publishOfflineMsg();
-  void publish(const boost::shared_ptr<MqttMessage>& msg);
+  //可在任意线程调用
+  void publish(const boost::shared_ptr<const MqttMessage>& msg);
+  //重启恢复时放回存储里的离线消息，不再写回存储
+  void restoreOfflineMsg(const boost::shared_ptr<const MqttMessage>& msg)
+  {
+    pendingMsgs_.push_back(msg);
+    MqttMetrics::add(MqttMetrics::kQueuedMessages, 1);
+  }
+  //持久会话下线时在所属线程调用，把订阅和未送达的消息写入存储
+  void persist();
+
+  //已发出未确认与排队待发的消息数，离线时为 -1。可在任意线程调用，共享订阅据此挑选成员
+  int64_t backlog() const
+  { return __atomic_load_n(&backlog_, __ATOMIC_RELAXED); }
+  //连接断开后在所属线程调用
+  void updateBacklog()
+  { storeBacklog(TcpConWeakPtr_.lock()); }
 
   void setWill(bool will)
   { will_ = will; }
@@ -68,7 +145,7 @@ public:
   void setCleanSession(bool cleanSession)
   { clean_session_ = cleanSession; }
 
-  void ResetWillMsg(boost::shared_ptr<MqttMessage>& willmsgPtr)
+  void ResetWillMsg(const boost::shared_ptr<MqttMessage>& willmsgPtr)
   { willMsgPtr_ = willmsgPtr; }
 
   boost::shared_ptr<MqttMessage> willMsg() const
@@ -83,14 +160,23 @@ public:
   void setPassWord(const string& passWord)
   { password_ = passWord; }
 
-  void setTcpConnection(const TcpConnectionPtr& conn)
-  { TcpConWeakPtr_ = conn; }
+  //在连接所属线程调用，并安装输出缓冲区的高水位回调
+  void setTcpConnection(const TcpConnectionPtr& conn);
+
+  //在连接所属线程调用，keepalive 为 0 时不检查
+  void startKeepAlive(const TcpConnectionPtr& conn, uint16_t keepalive);
+  void stopKeepAlive(const TcpConnectionPtr& conn);
+
+  //会话归 conn 所属线程且已接上 conn。可在 conn 所属线程调用
+  bool attached(const TcpConnectionPtr& conn) const;
 
   void onMessage(const TcpConnectionPtr& conn, Buffer* buffer, Timestamp time);
 
-  std::list<string>& subTopics()
+  std::list<MqttSubscription>& subTopics()
   { return topics_; }
 private:
+  bool onFrame(const TcpConnectionPtr& conn, const MqttFixedHeader& header, Buffer* buffer);
+  bool handlePacket(const TcpConnectionPtr& conn, Buffer* buffer, const MqttFixedHeader& header);
   void mqttHandlePublishAck(const TcpConnectionPtr& conn, Buffer& buffer,const size_t len);
   void mqttHandlePublishRel(const TcpConnectionPtr& conn, Buffer& buffer,const size_t len);
   void mqttHandlePublishRec(const TcpConnectionPtr& conn, Buffer& buffer,const size_t len);
@@ -109,29 +195,49 @@ private:
   void sendPubComp(const TcpConnectionPtr& conn, uint16_t mid);
   void sendSuback(const TcpConnectionPtr& conn, uint16_t mid, const std::vector<uint8_t>& payload);
 
-  void checkAlive();
-  int readMqttString(string& buf,Buffer& buffer);
+  //left 为本报文剩余的字节数，字符串越过报文末尾时失败，成功时扣去读掉的字节
+  int readMqttString(string& buf,Buffer& buffer,size_t* left);
+  //读出一个主题并驻留，不经过临时字符串；left 同 readMqttString
+  int readMqttTopic(MqttTopic& topic,Buffer& buffer,size_t* left);
+  std::list<MqttSubscription>::iterator findSubscription(const MqttTopic& topic);
   std::vector<uint8_t> encodeRemainingLenth(uint32_t remainingLength);
-  std::vector<uint8_t> packageMsg(const boost::shared_ptr<MqttMessage>& msg,const size_t& remainglen);
+  void sendPublish(const TcpConnectionPtr& conn, const boost::shared_ptr<const MqttMessage>& msg,
+                   uint16_t mid, uint8_t dup);
+  void deliver(const TcpConnectionPtr& conn, const boost::shared_ptr<const MqttMessage>& msg);
+  void enqueue(const TcpConnectionPtr& conn, const boost::shared_ptr<const MqttMessage>& msg);
+  void sendPending(const TcpConnectionPtr& conn);
+  bool writable(const TcpConnectionPtr& conn) const;
+  void onHighWaterMark(const TcpConnectionPtr& conn, size_t bytes);
+  void onWriteComplete(const TcpConnectionPtr& conn);
+  void storeBacklog(const TcpConnectionPtr& conn);
 
 
   EventLoop* loop_;
-  Timestamp lastInTime_;
+  const MqttSessionConfig* config_;
+  MqttSessionStore* store_;
+  MqttKeepAliveNode keepAliveNode_;
 
   bool will_;
   bool clean_session_;
-  std::list<string> topics_;
+  std::list<MqttSubscription> topics_;
   string clientID_;
   string username_;
   string password_;
   boost::weak_ptr<TcpConnection> TcpConWeakPtr_;
 
-  TimerId timerId_;
   boost::shared_ptr<MqttMessage> willMsgPtr_;
 
-  MqttMsgList sendUnconfdMsgs_;
+  MqttInflightWindow sendUnconfdMsgs_;
+  //离线期间以及窗口已满、连接拥塞时待发的消息，按到达顺序
+  std::deque<boost::shared_ptr<const MqttMessage> > pendingMsgs_;
+  //pendingMsgs_ 放不下的消息，排在 pendingMsgs_ 之后
+  boost::scoped_ptr<MqttSpillQueue> spill_;
+  //输出缓冲区越过高水位，等它写空后再继续发送
+  bool congested_;
+  //输出缓冲区开始积压的时刻，0 表示没有在统计
+  uint64_t drainStart_;
+  int64_t backlog_;
   MqttMsgList recvUnconfdMsgs_;
-  const uint16_t keepalive_;
 };
 
 #endif // MQTTCLIENT_H
@@ -0,0 +1,26 @@
+#include "MqttFrameDecoder.h"
+
+MqttFrameDecoder::Result MqttFrameDecoder::peekFrame(const char* data, size_t len, MqttFixedHeader* header)
+{
+  uint32_t remainingLength = 0;
+  uint32_t multiplier = 1;
+  size_t pos = 1;
+  for(;;)
+  {
+    if(pos > 4) //剩余长度最多4个字节，不符合mqtt协议
+      return kMalformed;
+    if(pos >= len)
+      return kIncomplete;
+
+    uint8_t byte = static_cast<uint8_t>(data[pos++]);
+    remainingLength += (byte & 127) * multiplier;
+    multiplier *= 128;
+    if((byte & 128) == 0)
+      break;
+  }
+
+  header->type = static_cast<uint8_t>(data[0]);
+  header->remainingLength = remainingLength;
+  header->headerLength = pos;
+  return len - pos >= remainingLength ? kComplete : kIncomplete;
+}
@@ -0,0 +1,55 @@
+#ifndef MQTTFRAMEDECODER_H
+#define MQTTFRAMEDECODER_H
+
+#include <stdint.h>
+#include <muduo/net/Buffer.h>
+
+using namespace muduo;
+
+//控制报文的固定报头
+struct MqttFixedHeader
+{
+  uint8_t type;              //首字节：报文类型与标志位
+  uint32_t remainingLength;  //剩余长度
+  size_t headerLength;       //固定报头自身长度，2 到 5 字节
+};
+
+//流式解析固定报头。peekFrame 只读取缓冲区，不消费数据：
+//返回 kComplete 时整个报文（固定报头 + 剩余长度）都已在缓冲区中。
+//drain 据此循环取出一次读到的所有完整报文，不完整的报文留待下次读取。
+class MqttFrameDecoder
+{
+public:
+  enum Result
+  {
+    kIncomplete,
+    kComplete,
+    kMalformed,
+  };
+
+  static Result peekFrame(const char* data, size_t len, MqttFixedHeader* header);
+
+  static Result peekFrame(const net::Buffer& buffer, MqttFixedHeader* header)
+  { return peekFrame(buffer.peek(), buffer.readableBytes(), header); }
+
+  //依次把 buffer 中每个完整报文交给 handler(header, buffer)，调用时缓冲区正好从报文的可变报头开始。
+  //handler 少读了则跳过余下字节，保持与报文边界同步；多读了或返回 false 视为报文格式错误。
+  //返回 kIncomplete 表示剩下的不足一个报文（可能为空）；返回 kMalformed 时缓冲区已不可用，应断开连接
+  template<typename Handler>
+  static Result drain(net::Buffer* buffer, Handler handler)
+  {
+    MqttFixedHeader header;
+    Result result;
+    while((result = peekFrame(*buffer, &header)) == kComplete)
+    {
+      buffer->retrieve(header.headerLength);
+      size_t rest = buffer->readableBytes() - header.remainingLength;
+      if(!handler(header, buffer) || buffer->readableBytes() < rest)
+        return kMalformed;
+      buffer->retrieve(buffer->readableBytes() - rest);
+    }
+    return result;
+  }
+};
+
+#endif // MQTTFRAMEDECODER_H
@@ -0,0 +1,112 @@
+#ifndef MQTTHISTOGRAM_H
+#define MQTTHISTOGRAM_H
+
+#include <stdint.h>
+#include <string.h>
+
+//对数-线性分桶的直方图，记录非负整数（如微秒）。
+//小于 64 的值各占一个桶，之后每翻一倍分 32 个桶，相对误差不超过 1/32。
+//本身不加锁，各线程分别记录后再合并。只由一个线程记录时，别的线程可以随时 merge 读取，
+//各项用 relaxed 原子读写，读到的不是同一时刻的值。
+class MqttHistogram
+{
+public:
+  MqttHistogram()
+  { reset(); }
+
+  void record(uint64_t value)
+  {
+    increase(&counts_[indexOf(value)], 1);
+    increase(&count_, 1);
+    increase(&sum_, value);
+    if(value > load(&max_))
+      __atomic_store_n(&max_, value, __ATOMIC_RELAXED);
+  }
+
+  void merge(const MqttHistogram& other)
+  {
+    for(int i = 0; i < kBuckets; ++i)
+      counts_[i] += load(&other.counts_[i]);
+    count_ += load(&other.count_);
+    sum_ += load(&other.sum_);
+    uint64_t max = load(&other.max_);
+    if(max > max_)
+      max_ = max;
+  }
+
+  void reset()
+  {
+    memset(counts_, 0, sizeof counts_);
+    count_ = 0;
+    sum_ = 0;
+    max_ = 0;
+  }
+
+  uint64_t count() const
+  { return count_; }
+
+  uint64_t max() const
+  { return max_; }
+
+  double mean() const
+  { return count_ == 0 ? 0 : static_cast<double>(sum_) / static_cast<double>(count_); }
+
+  //不小于 p% 记录值的桶上界，p 取 0 到 100
+  uint64_t percentile(double p) const
+  {
+    if(count_ == 0)
+      return 0;
+    uint64_t rank = static_cast<uint64_t>(p / 100 * static_cast<double>(count_) + 0.5);
+    if(rank == 0)
+      rank = 1;
+    uint64_t seen = 0;
+    for(int i = 0; i < kBuckets; ++i)
+    {
+      seen += counts_[i];
+      if(seen >= rank)
+      {
+        uint64_t upper = upperBound(i);
+        return upper < max_ ? upper : max_;
+      }
+    }
+    return max_;
+  }
+
+private:
+  static const int kSubBucketBits = 6;
+  static const int kSubBuckets = 1 << kSubBucketBits;
+  static const int kHalf = kSubBuckets / 2;
+  static const int kBuckets = (64 - kSubBucketBits + 2) * kHalf;
+
+  static uint64_t load(const uint64_t* p)
+  { return __atomic_load_n(p, __ATOMIC_RELAXED); }
+
+  //只有一个写者，不需要带锁前缀的加法
+  static void increase(uint64_t* p, uint64_t n)
+  { __atomic_store_n(p, load(p) + n, __ATOMIC_RELAXED); }
+
+  //最高位为 msb 的值落在第 msb-5 组，组内按右移后的 32..63 线性分桶
+  static int indexOf(uint64_t value)
+  {
+    if(value < static_cast<uint64_t>(kSubBuckets))
+      return static_cast<int>(value);
+    int shift = 63 - __builtin_clzll(value) - (kSubBucketBits - 1);
+    return shift * kHalf + static_cast<int>(value >> shift);
+  }
+
+  static uint64_t upperBound(int index)
+  {
+    if(index < kSubBuckets)
+      return static_cast<uint64_t>(index);
+    int shift = index / kHalf - 1;
+    uint64_t sub = static_cast<uint64_t>(index - shift * kHalf);
+    return ((sub + 1) << shift) - 1;
+  }
+
+  uint64_t counts_[kBuckets];
+  uint64_t count_;
+  uint64_t sum_;
+  uint64_t max_;
+};
+
+#endif // MQTTHISTOGRAM_H
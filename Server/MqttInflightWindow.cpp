@@ -0,0 +1,93 @@
+#include "MqttInflightWindow.h"
+#include "MqttMetrics.h"
+
+#include <algorithm>
+#include <assert.h>
+
+namespace
+{
+  //不小于 n 的 2 的幂，n 不超过 65535
+  size_t roundUpPowerOfTwo(size_t n)
+  {
+    size_t size = 1;
+    while(size < n)
+      size <<= 1;
+    return size;
+  }
+
+  bool earlier(const MqttInflightWindow::Slot* lhs, const MqttInflightWindow::Slot* rhs)
+  {
+    //序号会回绕，按差值比较
+    return static_cast<int32_t>(lhs->seq - rhs->seq) < 0;
+  }
+}
+
+MqttInflightWindow::MqttInflightWindow(uint16_t window)
+  : window_(std::max(window, static_cast<uint16_t>(1))),
+    mask_(roundUpPowerOfTwo(window_) - 1),
+    count_(0),
+    nextMid_(0),
+    nextSeq_(0)
+{
+}
+
+MqttInflightWindow::~MqttInflightWindow()
+{
+  MqttMetrics::add(MqttMetrics::kInflightMessages, -static_cast<int64_t>(count_));
+}
+
+MqttInflightWindow::type_mid MqttInflightWindow::add(const boost::shared_ptr<const MqttMessage>& msg,
+                                                     MqttMessage::msgState state)
+{
+  if(full())
+    return 0;
+
+  if(!slots_)
+    slots_.reset(new Slot[mask_ + 1]);
+
+  //槽位数不小于窗口，未满时最多找一圈必有空位
+  Slot* slot = NULL;
+  do
+  {
+    ++nextMid_;
+    if(nextMid_ == 0)
+      ++nextMid_;
+    slot = &slots_[nextMid_ & mask_];
+  } while(slot->mid != 0);
+
+  slot->msg = msg;
+  slot->state = state;
+  slot->mid = nextMid_;
+  slot->seq = nextSeq_++;
+  ++count_;
+  MqttMetrics::add(MqttMetrics::kInflightMessages, 1);
+  return nextMid_;
+}
+
+bool MqttInflightWindow::remove(type_mid mid)
+{
+  Slot* slot = find(mid);
+  if(!slot)
+    return false;
+
+  slot->msg.reset();
+  slot->state = MqttMessage::ms_invalid;
+  slot->mid = 0;
+  --count_;
+  MqttMetrics::add(MqttMetrics::kInflightMessages, -1);
+  return true;
+}
+
+void MqttInflightWindow::inflight(std::vector<Slot*>* slots)
+{
+  slots->clear();
+  if(!slots_ || count_ == 0)
+    return;
+
+  for(size_t i = 0; i <= mask_; ++i)
+  {
+    if(slots_[i].mid != 0)
+      slots->push_back(&slots_[i]);
+  }
+  std::sort(slots->begin(), slots->end(), earlier);
+}
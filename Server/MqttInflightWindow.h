@@ -0,0 +1,68 @@
+#ifndef MQTTINFLIGHTWINDOW_H
+#define MQTTINFLIGHTWINDOW_H
+
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "MqttMessage.h"
+
+//发送方向的未确认消息窗口，只在会话所属线程访问。
+//槽位数组按报文标识符直接定位（mid & mask），最多 window 条在途；
+//标识符按会话顺序分配并跳过仍占用的槽位。
+//数组在首次 QoS>0 投递时分配一次，之后的投递与确认都不再分配内存。
+class MqttInflightWindow : boost::noncopyable
+{
+public:
+  typedef uint16_t type_mid;
+
+  struct Slot
+  {
+    Slot() : state(MqttMessage::ms_invalid), mid(0), seq(0) { }
+
+    boost::shared_ptr<const MqttMessage> msg;
+    MqttMessage::msgState state;
+    type_mid mid;   // 0 表示空闲
+    uint32_t seq;   // 分配顺序，重发时按它排序
+  };
+
+  //window 为 0 时按 1 处理
+  explicit MqttInflightWindow(uint16_t window);
+  ~MqttInflightWindow();
+
+  //占用一个槽位并返回新分配的报文标识符，窗口已满返回 0
+  type_mid add(const boost::shared_ptr<const MqttMessage>& msg, MqttMessage::msgState state);
+
+  Slot* find(type_mid mid)
+  {
+    if(!slots_)
+      return NULL;
+    Slot& slot = slots_[mid & mask_];
+    return (mid != 0 && slot.mid == mid) ? &slot : NULL;
+  }
+
+  bool remove(type_mid mid);
+
+  //按发送顺序取出所有在途消息，用于重连后重发
+  void inflight(std::vector<Slot*>* slots);
+
+  bool full() const
+  { return count_ >= window_; }
+
+  size_t size() const
+  { return count_; }
+
+  size_t window() const
+  { return window_; }
+
+private:
+  const size_t window_;
+  const size_t mask_;
+  boost::scoped_array<Slot> slots_;
+  size_t count_;
+  type_mid nextMid_;
+  uint32_t nextSeq_;
+};
+
+#endif // MQTTINFLIGHTWINDOW_H
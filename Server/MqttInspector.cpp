@@ -0,0 +1,241 @@
+#include "MqttInspector.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <boost/bind.hpp>
+#include <muduo/base/Singleton.h>
+#include <muduo/net/EventLoop.h>
+
+#include "MqttClient.h"
+#include "MqttLatency.h"
+#include "MqttMessagePool.h"
+#include "MqttServer.h"
+#include "MqttTopic.h"
+#include "MqttTopicTree.h"
+
+using namespace muduo;
+using namespace muduo::net;
+
+namespace
+{
+
+void appendf(string* out, const char* fmt, ...) __attribute__ ((format (printf, 2, 3)));
+
+void appendf(string* out, const char* fmt, ...)
+{
+  char buf[256];
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(buf, sizeof buf, fmt, args);
+  va_end(args);
+  if(n > 0)
+    out->append(buf, static_cast<size_t>(n) < sizeof buf ? static_cast<size_t>(n) : sizeof buf - 1);
+}
+
+MqttMetrics::Snapshot total(const std::vector<MqttMetrics::Snapshot>& threads)
+{
+  MqttMetrics::Snapshot sum;
+  for(size_t i = 0; i < threads.size(); ++i)
+    sum.add(threads[i]);
+  return sum;
+}
+
+}
+
+MqttInspector::MqttInspector(MqttServer* server)
+  :server_(server),
+   lastTime_(Timestamp::now())
+{
+}
+
+void MqttInspector::registerCommands(Inspector* inspector)
+{
+  inspector->add("mqtt", "overview", boost::bind(&MqttInspector::overview, this, _1, _2),
+                 "connections, message rates, queues and memory pools");
+  inspector->add("mqtt", "loops", boost::bind(&MqttInspector::loops, this, _1, _2),
+                 "connections, pending functors and packets per IO loop");
+  inspector->add("mqtt", "packets", boost::bind(&MqttInspector::packets, this, _1, _2),
+                 "packets received and sent by type");
+  inspector->add("mqtt", "fanout", boost::bind(&MqttInspector::fanout, this, _1, _2),
+                 "histogram of subscribers matched per publish");
+  inspector->add("mqtt", "latency", boost::bind(&MqttInspector::latency, this, _1, _2),
+                 "hot path latency per stage, /on /off /reset");
+}
+
+string MqttInspector::overview(HttpRequest::Method, const ArgList&)
+{
+  std::vector<MqttMetrics::Snapshot> threads;
+  MqttMetrics::collect(&threads);
+  MqttMetrics::Snapshot now = total(threads);
+  Timestamp nowTime(Timestamp::now());
+  double seconds = timeDifference(nowTime, lastTime_);
+  if(seconds <= 0)
+    seconds = 1;
+
+  string out;
+  appendf(&out, "connections        %lld\n", static_cast<long long>(now.counters[MqttMetrics::kConnections]));
+  appendf(&out, "publishes          %lld (%.1f/s)\n", static_cast<long long>(now.counters[MqttMetrics::kPublishes]),
+          static_cast<double>(now.counters[MqttMetrics::kPublishes] - last_.counters[MqttMetrics::kPublishes]) / seconds);
+  appendf(&out, "deliveries         %lld (%.1f/s)\n", static_cast<long long>(now.counters[MqttMetrics::kDeliveries]),
+          static_cast<double>(now.counters[MqttMetrics::kDeliveries] - last_.counters[MqttMetrics::kDeliveries]) / seconds);
+  appendf(&out, "bytes in           %lld (%.1f/s)\n", static_cast<long long>(now.counters[MqttMetrics::kBytesIn]),
+          static_cast<double>(now.counters[MqttMetrics::kBytesIn] - last_.counters[MqttMetrics::kBytesIn]) / seconds);
+  appendf(&out, "bytes out          %lld (%.1f/s)\n", static_cast<long long>(now.counters[MqttMetrics::kBytesOut]),
+          static_cast<double>(now.counters[MqttMetrics::kBytesOut] - last_.counters[MqttMetrics::kBytesOut]) / seconds);
+  appendf(&out, "queued messages    %lld\n", static_cast<long long>(now.counters[MqttMetrics::kQueuedMessages]));
+  appendf(&out, "inflight messages  %lld\n", static_cast<long long>(now.counters[MqttMetrics::kInflightMessages]));
+  appendf(&out, "awaiting PUBREL    %lld\n", static_cast<long long>(now.counters[MqttMetrics::kAwaitingRelease]));
+  last_ = now;
+  lastTime_ = nowTime;
+
+  size_t retained = 0;
+  size_t snapshotRetained = 0;
+  Singleton<MqttTopicTree>::instance().retainedCount(&retained, &snapshotRetained);
+  appendf(&out, "retained           %zu in memory, %zu in snapshot\n", retained, snapshotRetained);
+  appendf(&out, "interned topics    %zu\n", MqttTopic::internedCount());
+
+  MqttOutboundStats& outbound = Singleton<MqttOutboundStats>::instance();
+  appendf(&out, "slow consumers     high water mark %lld, dropped qos0 %lld, dropped on overflow %lld, "
+          "disconnected %lld, spilled %lld, dropped with spill file full %lld\n",
+          static_cast<long long>(outbound.highWaterMarks.get()), static_cast<long long>(outbound.droppedQos0.get()),
+          static_cast<long long>(outbound.droppedOverflow.get()), static_cast<long long>(outbound.disconnects.get()),
+          static_cast<long long>(outbound.spilled.get()), static_cast<long long>(outbound.droppedSpillFull.get()));
+
+  MqttMessagePool::Stats pool = MqttMessagePool::stats();
+  appendf(&out, "message pool       allocations %lld, fallbacks %lld, remote frees %lld, outstanding %lld, slabs %lld\n",
+          static_cast<long long>(pool.allocations), static_cast<long long>(pool.fallbacks),
+          static_cast<long long>(pool.remoteFrees), static_cast<long long>(pool.outstanding),
+          static_cast<long long>(pool.slabs));
+  return out;
+}
+
+//IO 线程的计数按所在 EventLoop 归并，其余线程（主线程接受连接、遗嘱等）合为 other
+string MqttInspector::loops(HttpRequest::Method, const ArgList&)
+{
+  std::vector<MqttMetrics::Snapshot> threads;
+  MqttMetrics::collect(&threads);
+  std::vector<EventLoop*> ioLoops = server_->ioLoops();
+
+  string out;
+  appendf(&out, "%-16s %12s %8s %14s %14s\n", "loop", "connections", "queue", "packets in", "packets out");
+  std::vector<bool> matched(threads.size(), false);
+  for(size_t i = 0; i < ioLoops.size(); ++i)
+  {
+    MqttMetrics::Snapshot sum;
+    string name;
+    for(size_t k = 0; k < threads.size(); ++k)
+    {
+      if(threads[k].loop != ioLoops[i])
+        continue;
+      sum.add(threads[k]);
+      name = threads[k].thread;
+      matched[k] = true;
+    }
+    int64_t in = 0;
+    int64_t sent = 0;
+    for(int type = 0; type < MqttMetrics::kPacketTypes; ++type)
+    {
+      in += sum.packetsIn[type];
+      sent += sum.packetsOut[type];
+    }
+    if(name.empty())
+      appendf(&out, "#%-15zu", i);
+    else
+      appendf(&out, "%-16s", name.c_str());
+    appendf(&out, " %12lld %8zu %14lld %14lld\n", static_cast<long long>(sum.counters[MqttMetrics::kConnections]),
+            ioLoops[i]->queueSize(), static_cast<long long>(in), static_cast<long long>(sent));
+  }
+
+  MqttMetrics::Snapshot other;
+  for(size_t k = 0; k < threads.size(); ++k)
+    if(!matched[k])
+      other.add(threads[k]);
+  int64_t in = 0;
+  int64_t sent = 0;
+  for(int type = 0; type < MqttMetrics::kPacketTypes; ++type)
+  {
+    in += other.packetsIn[type];
+    sent += other.packetsOut[type];
+  }
+  appendf(&out, "%-16s %12lld %8s %14lld %14lld\n", "other",
+          static_cast<long long>(other.counters[MqttMetrics::kConnections]), "-",
+          static_cast<long long>(in), static_cast<long long>(sent));
+  return out;
+}
+
+string MqttInspector::packets(HttpRequest::Method, const ArgList&)
+{
+  std::vector<MqttMetrics::Snapshot> threads;
+  MqttMetrics::collect(&threads);
+  MqttMetrics::Snapshot sum = total(threads);
+
+  string out;
+  appendf(&out, "%-12s %14s %14s\n", "type", "in", "out");
+  for(int type = 1; type < MqttMetrics::kPacketTypes - 1; ++type)
+    appendf(&out, "%-12s %14lld %14lld\n", MqttMetrics::packetName(type),
+            static_cast<long long>(sum.packetsIn[type]), static_cast<long long>(sum.packetsOut[type]));
+  appendf(&out, "%-12s %14lld %14lld\n", "bytes",
+          static_cast<long long>(sum.counters[MqttMetrics::kBytesIn]),
+          static_cast<long long>(sum.counters[MqttMetrics::kBytesOut]));
+  return out;
+}
+
+string MqttInspector::fanout(HttpRequest::Method, const ArgList&)
+{
+  std::vector<MqttMetrics::Snapshot> threads;
+  MqttMetrics::collect(&threads);
+  MqttMetrics::Snapshot sum = total(threads);
+
+  string out;
+  appendf(&out, "%-16s %14s\n", "subscribers", "publishes");
+  appendf(&out, "%-16s %14lld\n", "0", static_cast<long long>(sum.fanout[0]));
+  for(int bucket = 1; bucket < MqttMetrics::kFanoutBuckets; ++bucket)
+  {
+    unsigned long long low = 1ULL << (bucket - 1);
+    char range[32];
+    if(bucket == MqttMetrics::kFanoutBuckets - 1)
+      snprintf(range, sizeof range, "%llu+", low);
+    else if(bucket == 1)
+      snprintf(range, sizeof range, "1");
+    else
+      snprintf(range, sizeof range, "%llu-%llu", low, (low << 1) - 1);
+    appendf(&out, "%-16s %14lld\n", range, static_cast<long long>(sum.fanout[bucket]));
+  }
+  return out;
+}
+
+//参数 on、off、reset 切换或清空后再输出当前的统计
+string MqttInspector::latency(HttpRequest::Method, const ArgList& args)
+{
+  string out;
+  if(!args.empty())
+  {
+    if(args[0] == "on")
+      MqttLatency::setEnabled(true);
+    else if(args[0] == "off")
+      MqttLatency::setEnabled(false);
+    else if(args[0] == "reset")
+      MqttLatency::reset();
+    else
+      return "usage: /mqtt/latency[/on|/off|/reset]\n";
+  }
+  appendf(&out, "latency recording %s, microseconds\n", MqttLatency::enabled() ? "on" : "off");
+
+  std::vector<MqttHistogram> histograms(MqttLatency::kNumStages);
+  MqttLatency::collect(&histograms[0]);
+  double scale = 1 / MqttLatency::ticksPerMicrosecond();
+  appendf(&out, "%-16s %12s %10s %10s %10s %10s %10s\n", "stage", "count", "mean", "p50", "p99", "p99.9", "max");
+  for(int stage = 0; stage < MqttLatency::kNumStages; ++stage)
+  {
+    const MqttHistogram& histogram = histograms[static_cast<size_t>(stage)];
+    if(histogram.count() == 0)
+      continue;
+    appendf(&out, "%-16s %12llu %10.2f %10.2f %10.2f %10.2f %10.2f\n", MqttLatency::stageName(stage),
+            static_cast<unsigned long long>(histogram.count()), histogram.mean() * scale,
+            static_cast<double>(histogram.percentile(50)) * scale,
+            static_cast<double>(histogram.percentile(99)) * scale,
+            static_cast<double>(histogram.percentile(99.9)) * scale,
+            static_cast<double>(histogram.max()) * scale);
+  }
+  return out;
+}
@@ -0,0 +1,37 @@
+#ifndef MQTTINSPECTOR_H
+#define MQTTINSPECTOR_H
+
+#include <muduo/base/Timestamp.h>
+#include <muduo/net/inspect/Inspector.h>
+#include <boost/noncopyable.hpp>
+
+#include "MqttMetrics.h"
+
+class MqttServer;
+
+//在 muduo Inspector 上注册 /mqtt/ 下的运行指标页面：
+//overview、loops、packets、fanout、latency，均为纯文本。
+//回调在 Inspector 的 EventLoop 线程中执行，不在 IO 线程中。
+class MqttInspector : boost::noncopyable
+{
+public:
+  explicit MqttInspector(MqttServer* server);
+
+  void registerCommands(muduo::net::Inspector* inspector);
+
+private:
+  typedef muduo::net::Inspector::ArgList ArgList;
+
+  muduo::string overview(muduo::net::HttpRequest::Method, const ArgList&);
+  muduo::string loops(muduo::net::HttpRequest::Method, const ArgList&);
+  muduo::string packets(muduo::net::HttpRequest::Method, const ArgList&);
+  muduo::string fanout(muduo::net::HttpRequest::Method, const ArgList&);
+  muduo::string latency(muduo::net::HttpRequest::Method, const ArgList& args);
+
+  MqttServer* server_;
+  //上次请求 overview 时的合计，用于计算速率；只在 Inspector 线程访问
+  MqttMetrics::Snapshot last_;
+  muduo::Timestamp lastTime_;
+};
+
+#endif // MQTTINSPECTOR_H
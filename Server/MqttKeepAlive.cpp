@@ -0,0 +1,126 @@
+#include "MqttKeepAlive.h"
+
+#include <boost/bind.hpp>
+#include <boost/any.hpp>
+#include <boost/shared_ptr.hpp>
+#include <muduo/base/Logging.h>
+
+void MqttKeepAliveNode::touch(Timestamp now)
+{
+  if(owner_)
+    owner_->touch(this,now);
+}
+
+MqttKeepAlive::MqttKeepAlive(EventLoop* loop)
+  : loop_(loop),
+    count_(0),
+    sweeping_(false)
+{
+}
+
+MqttKeepAlive::~MqttKeepAlive()
+{
+  if(sweeping_)
+    loop_->cancel(sweepTimer_);
+
+  for(std::map<uint16_t,MqttKeepAliveNode*>::iterator it=buckets_.begin(); it!=buckets_.end(); ++it)
+  {
+    MqttKeepAliveNode* head = it->second;
+    while(head->linked())
+    {
+      MqttKeepAliveNode* node = head->next_;
+      node->unlink();
+      node->owner_ = NULL;
+    }
+    delete head;
+  }
+}
+
+MqttKeepAlive* MqttKeepAlive::of(EventLoop* loop)
+{
+  const boost::shared_ptr<MqttKeepAlive>* keepAlive =
+      boost::any_cast<boost::shared_ptr<MqttKeepAlive> >(&loop->getContext());
+  return keepAlive ? keepAlive->get() : NULL;
+}
+
+void MqttKeepAlive::add(MqttKeepAliveNode* node, TcpConnection* conn, uint16_t keepalive, Timestamp now)
+{
+  loop_->assertInLoopThread();
+  assert(!node->linked() && keepalive > 0);
+
+  MqttKeepAliveNode*& head = buckets_[keepalive];
+  if(head == NULL)
+    head = new MqttKeepAliveNode;
+
+  node->owner_ = this;
+  node->bucket_ = head;
+  node->conn_ = conn;
+  node->lastActive_ = now;
+  append(head,node);
+  ++count_;
+
+  //没有连接时不扫描，空闲的线程不必每秒醒来
+  if(!sweeping_)
+  {
+    sweepTimer_ = loop_->runEveryCoarse(1.0,boost::bind(&MqttKeepAlive::sweep,this));
+    sweeping_ = true;
+  }
+}
+
+void MqttKeepAlive::touch(MqttKeepAliveNode* node, Timestamp now)
+{
+  assert(node->owner_ == this);
+  node->lastActive_ = now;
+  //同一链表的 keepalive 相同，移到表尾后表头仍是最久没有报文的
+  if(node->next_ != node->bucket_)
+  {
+    node->unlink();
+    append(node->bucket_,node);
+  }
+}
+
+void MqttKeepAlive::remove(MqttKeepAliveNode* node)
+{
+  loop_->assertInLoopThread();
+  if(node->owner_ != this)
+    return;
+
+  node->unlink();
+  node->owner_ = NULL;
+  node->bucket_ = NULL;
+  node->conn_ = NULL;
+  --count_;
+}
+
+void MqttKeepAlive::sweep()
+{
+  Timestamp now(Timestamp::now());
+  for(std::map<uint16_t,MqttKeepAliveNode*>::iterator it=buckets_.begin(); it!=buckets_.end(); ++it)
+  {
+    const double timeout = 1.5 * it->first;
+    MqttKeepAliveNode* head = it->second;
+    while(head->linked() && timeDifference(now,head->next_->lastActive_) > timeout)
+    {
+      MqttKeepAliveNode* node = head->next_;
+      LOG_DEBUG << "keepalive timeout " << node->conn_->name();
+      //断开回调里还会 remove，这里先摘下，不会重复处理
+      TcpConnection* conn = node->conn_;
+      remove(node);
+      conn->forceClose();
+    }
+  }
+
+  if(count_ == 0)
+  {
+    loop_->cancel(sweepTimer_);
+    sweeping_ = false;
+  }
+}
+
+void MqttKeepAlive::append(MqttKeepAliveNode* head, MqttKeepAliveNode* node)
+{
+  node->prev_ = head->prev_;
+  node->next_ = head;
+  head->prev_->next_ = node;
+  head->prev_ = node;
+}
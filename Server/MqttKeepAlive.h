@@ -0,0 +1,84 @@
+#ifndef MQTTKEEPALIVE_H
+#define MQTTKEEPALIVE_H
+
+#include <map>
+#include <boost/noncopyable.hpp>
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/TcpConnection.h>
+#include <muduo/base/Timestamp.h>
+
+using namespace muduo;
+using namespace muduo::net;
+
+class MqttKeepAlive;
+
+//挂在 MqttKeepAlive 链表上的节点，嵌在会话里，入链出链都不分配内存
+class MqttKeepAliveNode : boost::noncopyable
+{
+public:
+  MqttKeepAliveNode()
+    : prev_(this),
+      next_(this),
+      owner_(NULL),
+      bucket_(NULL),
+      conn_(NULL)
+  { }
+
+  bool linked() const
+  { return next_ != this; }
+
+  //收到报文时调用，只更新时间并移到表尾
+  void touch(Timestamp now);
+
+private:
+  friend class MqttKeepAlive;
+
+  void unlink()
+  {
+    prev_->next_ = next_;
+    next_->prev_ = prev_;
+    prev_ = next_ = this;
+  }
+
+  MqttKeepAliveNode* prev_;
+  MqttKeepAliveNode* next_;
+  MqttKeepAlive* owner_;
+  MqttKeepAliveNode* bucket_;
+  TcpConnection* conn_;
+  Timestamp lastActive_;
+};
+
+//每个 EventLoop 一个，保存本线程上开启了 keepalive 的连接。
+//相同 keepalive 的连接放在同一条链表里，按最后活动时间排序，
+//每秒扫描一次各链表表头，超过 1.5 倍 keepalive 没有报文的断开。
+//活跃的连接不需要定时器，空闲的也只在扫描时看一眼表头。
+class MqttKeepAlive : boost::noncopyable
+{
+public:
+  explicit MqttKeepAlive(EventLoop* loop);
+  ~MqttKeepAlive();
+
+  //当前线程的 MqttKeepAlive，由 MqttServer 在线程启动时放进 EventLoop 的 context
+  static MqttKeepAlive* of(EventLoop* loop);
+
+  void add(MqttKeepAliveNode* node, TcpConnection* conn, uint16_t keepalive, Timestamp now);
+  void touch(MqttKeepAliveNode* node, Timestamp now);
+  void remove(MqttKeepAliveNode* node);
+
+  size_t size() const
+  { return count_; }
+
+private:
+  void sweep();
+
+  static void append(MqttKeepAliveNode* head, MqttKeepAliveNode* node);
+
+  EventLoop* loop_;
+  //keepalive -> 链表头
+  std::map<uint16_t,MqttKeepAliveNode*> buckets_;
+  size_t count_;
+  bool sweeping_;
+  TimerId sweepTimer_;
+};
+
+#endif // MQTTKEEPALIVE_H
@@ -0,0 +1,131 @@
+#include "MqttLatency.h"
+
+#include <vector>
+#include <muduo/base/Mutex.h>
+#include <muduo/base/Singleton.h>
+
+using namespace muduo;
+
+int MqttLatency::enabled_ = 0;
+int MqttLatency::generation_ = 0;
+__thread MqttLatency::Block* MqttLatency::t_block_ = NULL;
+
+//所有记录过的线程的直方图，线程退出后保留
+struct MqttLatency::Registry
+{
+  Registry()
+    :ticksPerMicrosecond_(0)
+  { }
+
+  MutexLock mutex_;
+  std::vector<Block*> blocks_;
+  double ticksPerMicrosecond_;
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+namespace
+{
+
+uint64_t monotonicNanoseconds()
+{
+  struct timespec ts;
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+//对照 CLOCK_MONOTONIC 测 10ms，rdtsc 的频率与核心当前频率无关
+double calibrate()
+{
+  uint64_t startNs = monotonicNanoseconds();
+  uint64_t startTicks = MqttLatency::now();
+  struct timespec delay = { 0, 10 * 1000 * 1000 };
+  ::nanosleep(&delay, NULL);
+  uint64_t ns = monotonicNanoseconds() - startNs;
+  uint64_t ticks = MqttLatency::now() - startTicks;
+  return ns == 0 ? 1000 : static_cast<double>(ticks) * 1000 / static_cast<double>(ns);
+}
+
+}
+#endif
+
+void MqttLatency::setEnabled(bool on)
+{
+  if(on)
+  {
+    ticksPerMicrosecond();
+    reset();
+  }
+  __atomic_store_n(&enabled_, on ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+void MqttLatency::reset()
+{
+  __atomic_add_fetch(&generation_, 1, __ATOMIC_RELAXED);
+}
+
+MqttLatency::Block* MqttLatency::newBlock()
+{
+  Block* block = new Block;
+  block->generation = __atomic_load_n(&generation_, __ATOMIC_RELAXED);
+  Registry& registry = Singleton<Registry>::instance();
+  MutexLockGuard lock(registry.mutex_);
+  registry.blocks_.push_back(block);
+  return block;
+}
+
+void MqttLatency::clear(Block* block, int generation)
+{
+  for(int i = 0; i < kNumStages; ++i)
+    block->histograms[i].reset();
+  __atomic_store_n(&block->generation, generation, __ATOMIC_RELAXED);
+}
+
+//还没按新一代清空的线程不计入
+void MqttLatency::collect(MqttHistogram* histograms)
+{
+  int generation = __atomic_load_n(&generation_, __ATOMIC_RELAXED);
+  Registry& registry = Singleton<Registry>::instance();
+  MutexLockGuard lock(registry.mutex_);
+  for(size_t i = 0; i < registry.blocks_.size(); ++i)
+  {
+    const Block& block = *registry.blocks_[i];
+    if(__atomic_load_n(&block.generation, __ATOMIC_RELAXED) != generation)
+      continue;
+    for(int k = 0; k < kNumStages; ++k)
+      histograms[k].merge(block.histograms[k]);
+  }
+}
+
+double MqttLatency::ticksPerMicrosecond()
+{
+  Registry& registry = Singleton<Registry>::instance();
+  MutexLockGuard lock(registry.mutex_);
+  if(registry.ticksPerMicrosecond_ == 0)
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    registry.ticksPerMicrosecond_ = calibrate();
+#else
+    registry.ticksPerMicrosecond_ = 1000;
+#endif
+  }
+  return registry.ticksPerMicrosecond_;
+}
+
+const char* MqttLatency::stageName(int stage)
+{
+  if(stage >= kDispatch && stage < kQuery)
+    return MqttMetrics::packetName(stage - kDispatch);
+  switch(stage)
+  {
+    case kQuery:
+      return "query";
+    case kFanout:
+      return "fanout";
+    case kDeliver:
+      return "deliver";
+    case kOutputDrain:
+      return "output drain";
+    default:
+      return "unknown";
+  }
+}
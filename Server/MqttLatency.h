@@ -0,0 +1,106 @@
+#ifndef MQTTLATENCY_H
+#define MQTTLATENCY_H
+
+#include <stdint.h>
+#include <time.h>
+#include <boost/noncopyable.hpp>
+
+#include "MqttHistogram.h"
+#include "MqttMetrics.h"
+
+//热路径各阶段的耗时直方图，默认关闭，由 Inspector 的 /mqtt/latency/on 打开。
+//关闭时每处只多一次读全局标志；打开后按线程记录时钟周期，读取时合并并换算为微秒。
+//起止都在同一线程，x86-64 上用 rdtsc，其他平台用 CLOCK_MONOTONIC。
+class MqttLatency
+{
+public:
+  enum Stage
+  {
+    kDispatch,                                        // 处理一个入站报文，按报文类型分项
+    kQuery = kDispatch + MqttMetrics::kPacketTypes,   // 匹配订阅者并去重
+    kFanout,                                          // Publish 按 loop 分组投递
+    kDeliver,                                         // 订阅者线程处理一批投递
+    kOutputDrain,                                     // 输出缓冲区由非空到 handleWrite 写空
+    kNumStages
+  };
+
+  static bool enabled()
+  { return __builtin_expect(__atomic_load_n(&enabled_, __ATOMIC_RELAXED) != 0, 0); }
+
+  //打开时清空之前的记录
+  static void setEnabled(bool on);
+  //各线程在下次记录时清空自己的直方图
+  static void reset();
+
+  static uint64_t now()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + static_cast<uint64_t>(ts.tv_nsec);
+#endif
+  }
+
+  static void record(int stage, uint64_t start)
+  {
+    uint64_t end = now();
+    local().histograms[stage].record(end > start ? end - start : 0);
+  }
+
+  //合并所有线程的直方图，histograms 须有 kNumStages 项，单位为 now() 的计数
+  static void collect(MqttHistogram* histograms);
+  //now() 每微秒的计数
+  static double ticksPerMicrosecond();
+  static const char* stageName(int stage);
+
+private:
+  struct Block
+  {
+    MqttHistogram histograms[kNumStages];
+    int generation;
+  };
+
+  struct Registry;
+
+  static Block& local()
+  {
+    Block* block = t_block_;
+    if(__builtin_expect(block == NULL, 0))
+      block = t_block_ = newBlock();
+    int generation = __atomic_load_n(&generation_, __ATOMIC_RELAXED);
+    if(__builtin_expect(block->generation != generation, 0))
+      clear(block, generation);
+    return *block;
+  }
+
+  static Block* newBlock();
+  static void clear(Block* block, int generation);
+
+  static int enabled_;
+  static int generation_;
+  static __thread Block* t_block_;
+};
+
+//作用域内的耗时记入 stage，构造时未打开则什么也不做
+class MqttLatencyTimer : boost::noncopyable
+{
+public:
+  explicit MqttLatencyTimer(int stage)
+    :stage_(stage),
+     start_(MqttLatency::enabled() ? MqttLatency::now() : 0)
+  { }
+
+  ~MqttLatencyTimer()
+  {
+    if(start_ != 0)
+      MqttLatency::record(stage_, start_);
+  }
+
+private:
+  const int stage_;
+  const uint64_t start_;
+};
+
+#endif // MQTTLATENCY_H
@@ -0,0 +1,656 @@
+#include "MqttLogSessionStore.h"
+
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <algorithm>
+#include <muduo/base/Logging.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+  //记录格式：[u32 body 长度][u32 校验和][body]，body 首字节为记录类型
+  const size_t kHeaderSize = 8;
+  //缓冲区超过这个大小就不等 flushInterval，立即写出
+  const size_t kBatchBytes = 4*1024*1024;
+  //缓冲区超过这个大小时追加方等写线程写出，磁盘跟不上时不无限占用内存
+  const size_t kMaxBufferBytes = 4*kBatchBytes;
+
+  uint32_t checksum(const char* data, size_t len)
+  {
+    //FNV-1a 的变体，每次处理 8 字节，只用来发现写了一半的记录；恢复时要扫过整个日志
+    uint64_t hash = 14695981039346656037ull;
+    size_t i = 0;
+    for(; i+8<=len; i+=8)
+    {
+      uint64_t word;
+      memcpy(&word, data + i, sizeof word);
+      hash = (hash ^ word) * 1099511628211ull;
+    }
+    for(; i<len; ++i)
+      hash = (hash ^ static_cast<uint8_t>(data[i])) * 1099511628211ull;
+    return static_cast<uint32_t>(hash ^ (hash >> 32));
+  }
+
+  template<typename T>
+  void put(string* out, T value)
+  {
+    out->append(reinterpret_cast<const char*>(&value), sizeof value);
+  }
+
+  void putString(string* out, const char* data, size_t len)
+  {
+    put(out, static_cast<uint32_t>(len));
+    out->append(data, len);
+  }
+
+  void putString(string* out, const string& s)
+  {
+    putString(out, s.data(), s.size());
+  }
+
+  //body 写好后补上记录头
+  void beginRecord(string* out, uint8_t type)
+  {
+    out->assign(kHeaderSize, '\0');
+    put(out, type);
+  }
+
+  void endRecord(string* out)
+  {
+    uint32_t len = static_cast<uint32_t>(out->size() - kHeaderSize);
+    uint32_t sum = checksum(out->data() + kHeaderSize, len);
+    memcpy(&(*out)[0], &len, sizeof len);
+    memcpy(&(*out)[4], &sum, sizeof sum);
+  }
+
+  //在映射内存上按顺序读字段，越界后 ok() 为 false
+  class Reader
+  {
+  public:
+    Reader(const char* data, size_t len)
+      : data_(data), end_(data + len), ok_(true)
+    { }
+
+    template<typename T>
+    T get()
+    {
+      T value = T();
+      if(!check(sizeof value))
+        return value;
+      memcpy(&value, data_, sizeof value);
+      data_ += sizeof value;
+      return value;
+    }
+
+    StringPiece getString()
+    {
+      uint32_t len = get<uint32_t>();
+      if(!check(len))
+        return StringPiece();
+      StringPiece s(data_, static_cast<int>(len));
+      data_ += len;
+      return s;
+    }
+
+    bool ok() const
+    { return ok_; }
+
+  private:
+    bool check(size_t len)
+    {
+      if(ok_ && static_cast<size_t>(end_ - data_) >= len)
+        return true;
+      ok_ = false;
+      return false;
+    }
+
+    const char* data_;
+    const char* end_;
+    bool ok_;
+  };
+
+  //从 data 开始取一条完整且校验通过的记录，失败返回 false
+  bool nextRecord(const char* data, size_t len, StringPiece* record)
+  {
+    if(len < kHeaderSize + 1)
+      return false;
+    uint32_t bodyLen, sum;
+    memcpy(&bodyLen, data, sizeof bodyLen);
+    memcpy(&sum, data + 4, sizeof sum);
+    if(bodyLen == 0 || bodyLen > len - kHeaderSize ||
+       checksum(data + kHeaderSize, bodyLen) != sum)
+      return false;
+    record->set(data, static_cast<int>(kHeaderSize + bodyLen));
+    return true;
+  }
+
+  Reader body(const StringPiece& record)
+  {
+    return Reader(record.data() + kHeaderSize, record.size() - kHeaderSize);
+  }
+
+  bool writeAll(int fd, const char* data, size_t len)
+  {
+    while(len > 0)
+    {
+      ssize_t n = ::write(fd, data, len);
+      if(n < 0)
+      {
+        if(errno == EINTR)
+          continue;
+        return false;
+      }
+      data += n;
+      len -= static_cast<size_t>(n);
+    }
+    return true;
+  }
+
+  void syncDir(const string& dir)
+  {
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd >= 0)
+    {
+      ::fsync(fd);
+      ::close(fd);
+    }
+  }
+}
+
+//只读映射一个段文件
+class MqttLogSessionStore::MappedSegment : boost::noncopyable
+{
+public:
+  MappedSegment(const string& path, uint64_t seq)
+    : seq_(seq), data_(NULL), size_(0)
+  {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if(fd >= 0 && ::fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+      void* addr = ::mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+      if(addr != MAP_FAILED)
+      {
+        data_ = static_cast<const char*>(addr);
+        size_ = static_cast<size_t>(st.st_size);
+        ::madvise(addr, size_, MADV_SEQUENTIAL);
+      }
+    }
+    if(fd >= 0)
+      ::close(fd);
+  }
+
+  ~MappedSegment()
+  {
+    if(data_)
+      ::munmap(const_cast<char*>(data_), size_);
+  }
+
+  //依次调用 f(record)，遇到不完整的记录停止
+  template<typename F>
+  void forEach(F f) const
+  {
+    size_t offset = 0;
+    StringPiece record;
+    while(nextRecord(data_ + offset, size_ - offset, &record))
+    {
+      f(record);
+      offset += record.size();
+    }
+    if(offset < size_)
+      LOG_WARN << "session store: segment " << seq_ << " truncated at " << offset;
+  }
+
+  //压缩段返回 true 并给出它覆盖的段序号范围
+  bool compactedRange(uint64_t* first, uint64_t* last) const
+  {
+    StringPiece record;
+    if(!data_ || !nextRecord(data_, size_, &record))
+      return false;
+    Reader reader = body(record);
+    if(reader.get<uint8_t>() != kCompacted)
+      return false;
+    *first = reader.get<uint64_t>();
+    *last = reader.get<uint64_t>();
+    return reader.ok();
+  }
+
+  uint64_t seq() const
+  { return seq_; }
+
+  bool contains(const char* p) const
+  { return p >= data_ && p < data_ + size_; }
+
+private:
+  const uint64_t seq_;
+  const char* data_;
+  size_t size_;
+};
+
+MqttLogSessionStore::MqttLogSessionStore(const string& dir, size_t segmentSize, double flushInterval)
+  : dir_(dir),
+    segmentSize_(segmentSize),
+    flushInterval_(flushInterval),
+    fd_(-1),
+    segmentBytes_(0),
+    compactThread_("SessionCompact"),
+    running_(false),
+    thread_(boost::bind(&MqttLogSessionStore::threadFunc, this), "SessionStore"),
+    latch_(1),
+    mutex_(),
+    cond_(mutex_),
+    flushed_(mutex_),
+    appended_(0),
+    written_(0),
+    flushTarget_(0)
+{
+  if(::mkdir(dir_.c_str(), 0755) != 0 && errno != EEXIST)
+    LOG_SYSFATAL << "session store: mkdir " << dir_;
+}
+
+MqttLogSessionStore::~MqttLogSessionStore()
+{
+  if(running_)
+  {
+    {
+      MutexLockGuard lock(mutex_);
+      running_ = false;
+      cond_.notify();
+    }
+    thread_.join();
+  }
+  //等正在进行的压缩结束
+  compactThread_.stop();
+  if(fd_ >= 0)
+    ::close(fd_);
+}
+
+string MqttLogSessionStore::segmentPath(uint64_t seq) const
+{
+  char name[32];
+  snprintf(name, sizeof name, "/%016llu.seg", static_cast<unsigned long long>(seq));
+  return dir_ + name;
+}
+
+std::vector<uint64_t> MqttLogSessionStore::listSegments() const
+{
+  std::vector<uint64_t> seqs;
+  DIR* dir = ::opendir(dir_.c_str());
+  if(!dir)
+    return seqs;
+  struct dirent* entry;
+  while((entry = ::readdir(dir)) != NULL)
+  {
+    unsigned long long seq;
+    char suffix[8];
+    if(sscanf(entry->d_name, "%16llu.%4s", &seq, suffix) == 2 && strcmp(suffix, "seg") == 0)
+      seqs.push_back(seq);
+  }
+  ::closedir(dir);
+  std::sort(seqs.begin(), seqs.end());
+  return seqs;
+}
+
+void MqttLogSessionStore::apply(LiveSessions* live, const StringPiece& record)
+{
+  Reader reader = body(record);
+  uint8_t type = reader.get<uint8_t>();
+  if(type == kCompacted)
+    return;
+  StringPiece clientID = reader.getString();
+  if(!reader.ok())
+    return;
+
+  if(type == kSession)
+  {
+    LiveSession& session = (*live)[clientID];
+    session.session = record;
+    session.msgs.clear();
+  }
+  else if(type == kRemove)
+  {
+    live->erase(clientID);
+  }
+  else if(type == kEnqueue)
+  {
+    //会话已重新上线或被删除后才到达的离线消息直接丢弃
+    LiveSessions::iterator it = live->find(clientID);
+    if(it != live->end())
+      it->second.msgs.push_back(record);
+  }
+}
+
+void MqttLogSessionStore::replay(const std::vector<MappedSegment*>& segments, LiveSessions* live)
+{
+  for(size_t i=0; i<segments.size(); ++i)
+    segments[i]->forEach(boost::bind(&MqttLogSessionStore::apply, live, _1));
+}
+
+void MqttLogSessionStore::recover(std::vector<StoredSession>* sessions)
+{
+  assert(!running_);
+  std::vector<uint64_t> seqs = listSegments();
+  //恢复出的消息负载直接指向映射内存，每条消息持有所在段的引用，段在消息全部投递后才解除映射
+  std::vector<boost::shared_ptr<MappedSegment> > mapped;
+  for(size_t i=0; i<seqs.size(); ++i)
+    mapped.push_back(boost::make_shared<MappedSegment>(segmentPath(seqs[i]), seqs[i]));
+
+  //压缩时在删除旧段之前崩溃，旧段已被压缩段包含
+  std::vector<MappedSegment*> live;
+  for(size_t i=0; i<mapped.size(); ++i)
+  {
+    uint64_t first, last;
+    if(mapped[i]->compactedRange(&first, &last))
+    {
+      while(!live.empty() && live.back()->seq() >= first)
+      {
+        ::unlink(segmentPath(live.back()->seq()).c_str());
+        live.pop_back();
+      }
+    }
+    live.push_back(mapped[i].get());
+  }
+
+  LiveSessions liveSessions;
+  replay(live, &liveSessions);
+
+  int64_t msgs = 0;
+  size_t owner = 0;
+  sessions->reserve(sessions->size() + liveSessions.size());
+  for(LiveSessions::iterator it=liveSessions.begin(); it!=liveSessions.end(); ++it)
+  {
+    sessions->push_back(StoredSession());
+    StoredSession& session = sessions->back();
+    session.clientID = it->first.as_string();
+
+    Reader reader = body(it->second.session);
+    reader.get<uint8_t>();
+    reader.getString();
+    uint32_t topics = reader.get<uint32_t>();
+    for(uint32_t i=0; i<topics && reader.ok(); ++i)
+      session.topics.push_back(reader.getString().as_string());
+
+    //同一会话的离线消息多数来自同一主题，主题名不变时不再查 intern 表
+    StringPiece lastTopic;
+    MqttTopic topic;
+    //一个会话的消息放在同一块内存里，共用一个引用计数，全部投递完后一起释放。
+    //不放进消息池：池的 slab 只增不还，恢复时的峰值会一直占着
+    boost::shared_ptr<std::vector<MqttMessage> > block =
+      boost::make_shared<std::vector<MqttMessage> >(it->second.msgs.size());
+    session.msgs.reserve(it->second.msgs.size());
+    for(size_t i=0; i<it->second.msgs.size(); ++i)
+    {
+      const StringPiece& record = it->second.msgs[i];
+      Reader msgReader = body(record);
+      msgReader.get<uint8_t>();
+      msgReader.getString();
+      uint8_t qos = msgReader.get<uint8_t>();
+      bool retain = msgReader.get<uint8_t>() != 0;
+      StringPiece topicName = msgReader.getString();
+      StringPiece payload = msgReader.getString();
+      if(!msgReader.ok())
+        continue;
+      if(topicName != lastTopic || topic.empty())
+      {
+        topic = MqttTopic::intern(topicName);
+        lastTopic = topicName;
+      }
+      while(!mapped[owner]->contains(record.data()))
+        owner = (owner + 1) % mapped.size();
+
+      boost::shared_ptr<MqttMessage> msg(block, &(*block)[session.msgs.size()]);
+      msg->qos = qos;
+      msg->retain = retain;
+      msg->topic = topic;
+      msg->payload = net::BufferChunk(mapped[owner], payload.data(), static_cast<size_t>(payload.size()));
+      session.msgs.push_back(msg);
+    }
+    msgs += static_cast<int64_t>(session.msgs.size());
+  }
+
+  segments_.clear();
+  for(size_t i=0; i<live.size(); ++i)
+    segments_.push_back(live[i]->seq());
+
+  LOG_INFO << "session store: recovered " << sessions->size() << " sessions, "
+           << msgs << " queued messages from " << segments_.size() << " segments";
+}
+
+void MqttLogSessionStore::start()
+{
+  assert(!running_);
+  //上次的段不再追加，从新段开始写
+  openSegment(segments_.empty() ? 1 : segments_.back() + 1);
+  compactThread_.start(1);
+  running_ = true;
+  thread_.start();
+  latch_.wait();
+}
+
+void MqttLogSessionStore::saveSession(const string& clientID, const std::list<MqttTopic>& topics)
+{
+  string record;
+  beginRecord(&record, kSession);
+  putString(&record, clientID);
+  put(&record, static_cast<uint32_t>(topics.size()));
+  for(std::list<MqttTopic>::const_iterator it=topics.begin(); it!=topics.end(); ++it)
+    putString(&record, it->str());
+  endRecord(&record);
+  append(record);
+}
+
+void MqttLogSessionStore::removeSession(const string& clientID)
+{
+  string record;
+  beginRecord(&record, kRemove);
+  putString(&record, clientID);
+  endRecord(&record);
+  append(record);
+}
+
+void MqttLogSessionStore::enqueue(const string& clientID, const MqttMessage& msg)
+{
+  string record;
+  record.reserve(kHeaderSize + 16 + clientID.size() + msg.topic.size() + msg.payload.size());
+  beginRecord(&record, kEnqueue);
+  putString(&record, clientID);
+  put(&record, msg.qos);
+  put(&record, static_cast<uint8_t>(msg.retain ? 1 : 0));
+  putString(&record, msg.topic.str());
+  putString(&record, msg.payload.data(), msg.payload.size());
+  endRecord(&record);
+  append(record);
+}
+
+void MqttLogSessionStore::append(const string& record)
+{
+  MutexLockGuard lock(mutex_);
+  while(running_ && buffer_.size() >= kMaxBufferBytes)
+  {
+    cond_.notify();
+    flushed_.wait();
+  }
+  buffer_.append(record);
+  ++appended_;
+  if(buffer_.size() >= kBatchBytes)
+    cond_.notify();
+}
+
+void MqttLogSessionStore::flush()
+{
+  MutexLockGuard lock(mutex_);
+  int64_t target = appended_;
+  flushTarget_ = std::max(flushTarget_, target);
+  cond_.notify();
+  while(running_ && written_ < target)
+    flushed_.wait();
+}
+
+void MqttLogSessionStore::threadFunc()
+{
+  latch_.countDown();
+  string batch;
+  bool running = true;
+  while(running)
+  {
+    int64_t upto = 0;
+    int64_t records = 0;
+    {
+      MutexLockGuard lock(mutex_);
+      if(running_ && buffer_.size() < kBatchBytes && flushTarget_ <= written_)
+        cond_.waitForSeconds(flushInterval_);
+      batch.swap(buffer_);
+      upto = appended_;
+      records = upto - written_;
+      running = running_;
+    }
+
+    //一批记录一次 write 一次 fdatasync
+    if(!batch.empty())
+    {
+      writeBatch(batch, records);
+      batch.clear();
+    }
+
+    {
+      MutexLockGuard lock(mutex_);
+      written_ = upto;
+      flushed_.notifyAll();
+    }
+
+    if(running)
+      compact();
+  }
+}
+
+void MqttLogSessionStore::writeBatch(const string& batch, int64_t records)
+{
+  if(!writeAll(fd_, batch.data(), batch.size()))
+    LOG_SYSERR << "session store: write";
+  if(::fdatasync(fd_) != 0)
+    LOG_SYSERR << "session store: fdatasync";
+  syncs_.increment();
+  records_.add(records);
+
+  segmentBytes_ += batch.size();
+  if(segmentBytes_ >= segmentSize_)
+  {
+    uint64_t next;
+    {
+      MutexLockGuard lock(segmentsMutex_);
+      next = segments_.back() + 1;
+    }
+    openSegment(next);
+  }
+}
+
+void MqttLogSessionStore::openSegment(uint64_t seq)
+{
+  if(fd_ >= 0)
+    ::close(fd_);
+  string path = segmentPath(seq);
+  fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if(fd_ < 0)
+    LOG_SYSFATAL << "session store: open " << path;
+  syncDir(dir_);
+  MutexLockGuard lock(segmentsMutex_);
+  segments_.push_back(seq);
+  segmentBytes_ = 0;
+}
+
+//在写线程调用：封存的段够多且没有压缩在进行时，交给压缩线程
+void MqttLogSessionStore::compact()
+{
+  std::vector<uint64_t> sealed;
+  {
+    MutexLockGuard lock(segmentsMutex_);
+    if(segments_.size() <= static_cast<size_t>(kCompactSegments))
+      return;
+    sealed.assign(segments_.begin(), segments_.end() - 1);
+  }
+  if(compacting_.getAndSet(1) == 0)
+    compactThread_.run(boost::bind(&MqttLogSessionStore::compactSegments, this, sealed));
+}
+
+//在压缩线程运行：把 sealed 中仍有效的记录重写进一个段，替换其中最后一个。
+//写线程只会在它们之后追加新段，不会动这些段
+void MqttLogSessionStore::compactSegments(const std::vector<uint64_t>& sealed)
+{
+  boost::ptr_vector<MappedSegment> mapped;
+  std::vector<MappedSegment*> inputs;
+  for(size_t i=0; i<sealed.size(); ++i)
+  {
+    mapped.push_back(new MappedSegment(segmentPath(sealed[i]), sealed[i]));
+    inputs.push_back(&mapped.back());
+  }
+
+  LiveSessions live;
+  replay(inputs, &live);
+
+  string tmpPath = dir_ + "/compact.tmp";
+  int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if(fd < 0)
+  {
+    LOG_SYSERR << "session store: open " << tmpPath;
+    compacting_.getAndSet(0);
+    return;
+  }
+
+  string out;
+  beginRecord(&out, kCompacted);
+  put(&out, sealed.front());
+  put(&out, sealed.back());
+  endRecord(&out);
+  size_t msgs = 0;
+  bool ok = true;
+  for(LiveSessions::iterator it=live.begin(); it!=live.end() && ok; ++it)
+  {
+    out.append(it->second.session.data(), it->second.session.size());
+    for(size_t i=0; i<it->second.msgs.size(); ++i)
+      out.append(it->second.msgs[i].data(), it->second.msgs[i].size());
+    msgs += it->second.msgs.size();
+    if(out.size() >= kBatchBytes)
+    {
+      ok = writeAll(fd, out.data(), out.size());
+      out.clear();
+    }
+  }
+  ok = ok && writeAll(fd, out.data(), out.size()) && ::fdatasync(fd) == 0;
+  ::close(fd);
+  if(!ok)
+  {
+    LOG_SYSERR << "session store: write " << tmpPath;
+    ::unlink(tmpPath.c_str());
+    compacting_.getAndSet(0);
+    return;
+  }
+
+  //先原子地替换最后一个封存段，再删除其余的；中途崩溃时恢复会按覆盖范围跳过旧段
+  if(::rename(tmpPath.c_str(), segmentPath(sealed.back()).c_str()) != 0)
+  {
+    LOG_SYSERR << "session store: rename " << tmpPath;
+    compacting_.getAndSet(0);
+    return;
+  }
+  syncDir(dir_);
+  for(size_t i=0; i+1<sealed.size(); ++i)
+    ::unlink(segmentPath(sealed[i]).c_str());
+
+  {
+    MutexLockGuard lock(segmentsMutex_);
+    assert(segments_.front() == sealed.front());
+    segments_.erase(segments_.begin(), segments_.begin() + static_cast<ptrdiff_t>(sealed.size() - 1));
+  }
+  compacting_.getAndSet(0);
+  LOG_INFO << "session store: compacted " << sealed.size() << " segments into "
+           << live.size() << " sessions, " << msgs << " queued messages";
+}
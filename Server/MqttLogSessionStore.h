@@ -0,0 +1,114 @@
+#ifndef MQTTLOGSESSIONSTORE_H
+#define MQTTLOGSESSIONSTORE_H
+
+#include <map>
+#include <vector>
+#include <muduo/base/Atomic.h>
+#include <muduo/base/Condition.h>
+#include <muduo/base/CountDownLatch.h>
+#include <muduo/base/Mutex.h>
+#include <muduo/base/StringPiece.h>
+#include <muduo/base/Thread.h>
+#include <muduo/base/ThreadPool.h>
+
+#include "MqttSessionStore.h"
+
+//默认的会话存储：只追加的日志。
+//
+//记录追加到内存缓冲区即返回，后台线程按批写入当前段文件并 fdatasync 一次（组提交），
+//崩溃最多丢失最近 flushInterval 内的记录。缓冲区积压超过 kMaxBufferBytes 时追加方等待写出。
+//段文件超过 segmentSize 后换新段；已封存的段超过 kCompactSegments 个时，由单独的压缩线程
+//把其中仍有效的会话与消息重写成一个段，删除旧段，压缩期间组提交照常进行。
+//
+//恢复时逐个 mmap 段文件顺序扫描，记录直接在映射内存中解析，不经过 read 拷贝；
+//恢复出的离线消息负载也指向映射内存，段在这些消息投递完之前保持映射。
+//段尾不完整或校验失败的记录视为崩溃时未写完，丢弃该段其后内容。
+class MqttLogSessionStore : public MqttSessionStore
+{
+public:
+  MqttLogSessionStore(const string& dir,
+                      size_t segmentSize = 64*1024*1024,
+                      double flushInterval = 0.1);
+  ~MqttLogSessionStore();
+
+  virtual void recover(std::vector<StoredSession>* sessions);
+  virtual void start();
+
+  virtual void saveSession(const string& clientID, const std::list<MqttTopic>& topics);
+  virtual void removeSession(const string& clientID);
+  virtual void enqueue(const string& clientID, const MqttMessage& msg);
+
+  //等待已追加的记录全部落盘
+  void flush();
+
+  int64_t records()
+  { return records_.get(); }
+
+  int64_t syncs()
+  { return syncs_.get(); }
+
+private:
+  enum RecordType
+  {
+    kSession = 1,
+    kRemove = 2,
+    kEnqueue = 3,
+    kCompacted = 4,  // 压缩段的第一条记录：覆盖的段序号范围
+  };
+
+  static const int kCompactSegments = 4;
+
+  //一个会话仍有效的记录，指向映射内存
+  struct LiveSession
+  {
+    StringPiece session;
+    std::vector<StringPiece> msgs;
+  };
+  //键同样指向映射内存，回放时不为每条记录构造 clientID
+  typedef std::map<StringPiece,LiveSession> LiveSessions;
+
+  class MappedSegment;
+
+  void append(const string& record);
+  void threadFunc();
+  void writeBatch(const string& batch, int64_t records);
+  void openSegment(uint64_t seq);
+  void compact();
+  void compactSegments(const std::vector<uint64_t>& sealed);
+
+  string segmentPath(uint64_t seq) const;
+  std::vector<uint64_t> listSegments() const;
+  //按顺序回放一组已映射的段，得到仍有效的记录
+  static void apply(LiveSessions* live, const StringPiece& record);
+  static void replay(const std::vector<MappedSegment*>& segments, LiveSessions* live);
+
+  const string dir_;
+  const size_t segmentSize_;
+  const double flushInterval_;
+
+  //以下由写线程使用
+  int fd_;
+  size_t segmentBytes_;
+
+  //写线程换段时追加，压缩线程完成后删去被合并的段
+  muduo::MutexLock segmentsMutex_;
+  std::vector<uint64_t> segments_;  // 升序，最后一个是当前段
+  muduo::ThreadPool compactThread_;
+  AtomicInt32 compacting_;
+
+  bool running_;
+  muduo::Thread thread_;
+  muduo::CountDownLatch latch_;
+  muduo::MutexLock mutex_;
+  muduo::Condition cond_;
+  muduo::Condition flushed_;
+  string buffer_;
+  int64_t appended_;  // 已追加的记录数
+  int64_t written_;   // 已落盘的记录数
+  int64_t flushTarget_;  // flush() 等待的记录数，未达到前后台线程不等 flushInterval
+
+  AtomicInt64 records_;
+  AtomicInt64 syncs_;
+};
+
+#endif // MQTTLOGSESSIONSTORE_H
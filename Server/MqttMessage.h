@@ -2,8 +2,18 @@
 #define MQTTMESSAGE_H
 
 #include <stdint.h>
+#include <boost/shared_ptr.hpp>
 #include <muduo/base/Timestamp.h>
+#include <muduo/net/BufferChunk.h>
+
+#include "MqttTopic.h"
+
 using namespace muduo;
+
+class MqttPublishFrame;
+
+//发布后在订阅者间共享，投递路径上只拿到 const 指针。
+//报文标识符、DUP 与投递状态随每次投递变化，保存在会话的 MqttInflightWindow::Slot 与 MqttMsgList::Entry 中
 class MqttMessage
 {
 public:
@@ -18,15 +28,13 @@ public:
     ms_wait_for_pubcomp,
   };
 
-  size_t remainglen;
-  uint16_t mid;
   uint8_t qos;
-  uint8_t dup;
   bool retain;
-  msgState state;
-  string topic;
-  string payload;
+  MqttTopic topic;
+  net::BufferChunk payload;
   Timestamp timestamp;
+  //发布前由 MqttTopicTree::Publish 编码一次，所有订阅者共享
+  boost::shared_ptr<const MqttPublishFrame> frame;
 };
 
 #endif // MQTTMESSAGE_H
@@ -0,0 +1,221 @@
+#include "MqttMessagePool.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <boost/make_shared.hpp>
+#include <boost/static_assert.hpp>
+#include <muduo/base/Atomic.h>
+#include <muduo/base/Mutex.h>
+
+#include "MqttMessage.h"
+#include "MqttPublishFrame.h"
+
+namespace
+{
+  //各档位可用字节数：32、64、128、256、512
+  const int kClasses = 5;
+  const size_t kMinBlockSize = 32;
+  const size_t kSlabSize = 64 * 1024;
+
+  struct Arena;
+
+  //每块前 16 字节记录所属 arena 与档位，释放时据此归还，owner 为空表示来自 malloc
+  struct BlockHeader
+  {
+    Arena* owner;
+    size_t sizeClass;
+  };
+  BOOST_STATIC_ASSERT(sizeof(BlockHeader) == 16);
+
+  struct FreeBlock
+  {
+    FreeBlock* next;
+  };
+
+  //计数只由所属线程写，其他线程统计时按 relaxed 读取
+  struct Arena
+  {
+    FreeBlock* free[kClasses];
+    FreeBlock* remote[kClasses];  // 其他线程释放的块，CAS 压栈，所属线程整条取走
+    int64_t allocations;
+    int64_t localFrees;
+    int64_t slabs;
+    Arena* next;
+  };
+
+  __thread Arena* t_arena = NULL;
+
+  MutexLock g_arenasMutex;
+  Arena* g_arenas = NULL;
+  AtomicInt64 g_fallbacks;
+  AtomicInt64 g_remoteFrees;
+
+  inline void bump(int64_t* counter)
+  {
+    __atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
+  }
+
+  inline size_t blockSize(int sizeClass)
+  {
+    return kMinBlockSize << sizeClass;
+  }
+
+  inline int classOf(size_t size)
+  {
+    int sizeClass = 0;
+    while(blockSize(sizeClass) < size)
+      ++sizeClass;
+    return sizeClass;
+  }
+
+  Arena* threadArena()
+  {
+    if(!t_arena)
+    {
+      //线程退出后 arena 不回收：IO 线程与进程同寿，其他线程可能仍持有它分出的块
+      Arena* arena = static_cast<Arena*>(::calloc(1, sizeof(Arena)));
+      MutexLockGuard lock(g_arenasMutex);
+      arena->next = g_arenas;
+      g_arenas = arena;
+      t_arena = arena;
+    }
+    return t_arena;
+  }
+
+  void refill(Arena* arena, int sizeClass)
+  {
+    //先收回其他线程还回来的块
+    if(__atomic_load_n(&arena->remote[sizeClass], __ATOMIC_RELAXED))
+    {
+      arena->free[sizeClass] = __sync_lock_test_and_set(&arena->remote[sizeClass], static_cast<FreeBlock*>(NULL));
+      return;
+    }
+
+    size_t stride = sizeof(BlockHeader) + blockSize(sizeClass);
+    char* slab = static_cast<char*>(::malloc(kSlabSize));
+    if(!slab)
+      throw std::bad_alloc();
+    bump(&arena->slabs);
+
+    FreeBlock* head = NULL;
+    for(size_t offset = 0; offset + stride <= kSlabSize; offset += stride)
+    {
+      BlockHeader* header = reinterpret_cast<BlockHeader*>(slab + offset);
+      header->owner = arena;
+      header->sizeClass = static_cast<size_t>(sizeClass);
+      FreeBlock* block = reinterpret_cast<FreeBlock*>(header + 1);
+      block->next = head;
+      head = block;
+    }
+    arena->free[sizeClass] = head;
+  }
+}
+
+void* MqttMessagePool::allocate(size_t size)
+{
+  if(size > kMaxBlockSize)
+  {
+    g_fallbacks.increment();
+    BlockHeader* header = static_cast<BlockHeader*>(::malloc(sizeof(BlockHeader) + size));
+    if(!header)
+      throw std::bad_alloc();
+    header->owner = NULL;
+    header->sizeClass = 0;
+    return header + 1;
+  }
+
+  Arena* arena = threadArena();
+  int sizeClass = classOf(size);
+  if(!arena->free[sizeClass])
+    refill(arena, sizeClass);
+
+  FreeBlock* block = arena->free[sizeClass];
+  arena->free[sizeClass] = block->next;
+  bump(&arena->allocations);
+  return block;
+}
+
+void MqttMessagePool::deallocate(void* p)
+{
+  if(!p)
+    return;
+
+  BlockHeader* header = static_cast<BlockHeader*>(p) - 1;
+  Arena* owner = header->owner;
+  if(!owner)
+  {
+    ::free(header);
+    return;
+  }
+
+  FreeBlock* block = static_cast<FreeBlock*>(p);
+  int sizeClass = static_cast<int>(header->sizeClass);
+  if(owner == t_arena)
+  {
+    block->next = owner->free[sizeClass];
+    owner->free[sizeClass] = block;
+    bump(&owner->localFrees);
+  }
+  else
+  {
+    //只有所属线程会一次取走整条链，压栈一侧不存在 ABA
+    FreeBlock* head;
+    do
+    {
+      head = __atomic_load_n(&owner->remote[sizeClass], __ATOMIC_RELAXED);
+      block->next = head;
+    } while(!__sync_bool_compare_and_swap(&owner->remote[sizeClass], head, block));
+    g_remoteFrees.increment();
+  }
+}
+
+MqttMessagePool::Stats MqttMessagePool::stats()
+{
+  Stats stats;
+  stats.allocations = 0;
+  stats.slabs = 0;
+  int64_t localFrees = 0;
+  {
+    MutexLockGuard lock(g_arenasMutex);
+    for(Arena* arena = g_arenas; arena; arena = arena->next)
+    {
+      stats.allocations += __atomic_load_n(&arena->allocations, __ATOMIC_RELAXED);
+      localFrees += __atomic_load_n(&arena->localFrees, __ATOMIC_RELAXED);
+      stats.slabs += __atomic_load_n(&arena->slabs, __ATOMIC_RELAXED);
+    }
+  }
+  stats.fallbacks = g_fallbacks.get();
+  stats.remoteFrees = g_remoteFrees.get();
+  stats.outstanding = stats.allocations - localFrees - stats.remoteFrees;
+  return stats;
+}
+
+namespace
+{
+  struct PoolDeleter
+  {
+    void operator()(char* p) const
+    { MqttMessagePool::deallocate(p); }
+  };
+}
+
+boost::shared_ptr<MqttMessage> newMqttMessage()
+{
+  return boost::allocate_shared<MqttMessage>(MqttPoolAllocator<MqttMessage>());
+}
+
+boost::shared_ptr<const MqttPublishFrame> newMqttPublishFrame(const MqttMessage& msg)
+{
+  return boost::allocate_shared<MqttPublishFrame>(MqttPoolAllocator<MqttPublishFrame>(), msg);
+}
+
+net::BufferChunk newMqttPayload(const char* data, size_t len)
+{
+  if(len > kMaxInlinePayload)
+    return net::BufferChunk(StringPiece(data, static_cast<int>(len)));
+
+  char* block = static_cast<char*>(MqttMessagePool::allocate(len));
+  ::memcpy(block, data, len);
+  boost::shared_ptr<char> owner(block, PoolDeleter(), MqttPoolAllocator<char>());
+  return net::BufferChunk(owner, block, len);
+}
@@ -0,0 +1,104 @@
+#ifndef MQTTMESSAGEPOOL_H
+#define MQTTMESSAGEPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <new>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <muduo/net/BufferChunk.h>
+
+using namespace muduo;
+
+class MqttMessage;
+class MqttPublishFrame;
+
+//发布路径上小对象的定长块分配器：MqttMessage、MqttPublishFrame、投递批次及小负载。
+//每个线程一个 arena，按 32~512 字节分为几档，分配和本线程释放都不加锁；
+//其他线程释放的块挂到所属 arena 的无锁链表上，所属线程空闲块用完时整条收回。
+//超过 kMaxBlockSize 的请求直接走 malloc。slab 只增不还，按峰值占用。
+class MqttMessagePool : boost::noncopyable
+{
+public:
+  static const size_t kMaxBlockSize = 512;
+
+  struct Stats
+  {
+    int64_t allocations;  // 池内分配
+    int64_t fallbacks;    // 超出最大档位走 malloc
+    int64_t remoteFrees;  // 由其他线程释放
+    int64_t outstanding;  // 尚未释放的池内块
+    int64_t slabs;
+  };
+
+  static void* allocate(size_t size);
+  static void deallocate(void* p);
+
+  //所有线程的计数之和，各项分别读取，不是同一时刻的精确快照
+  static Stats stats();
+};
+
+//供 boost::allocate_shared 及容器使用，对象与引用计数落在同一个池块中
+template<typename T>
+class MqttPoolAllocator
+{
+public:
+  typedef T value_type;
+  typedef T* pointer;
+  typedef const T* const_pointer;
+  typedef T& reference;
+  typedef const T& const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  template<typename U>
+  struct rebind
+  { typedef MqttPoolAllocator<U> other; };
+
+  MqttPoolAllocator()
+  { }
+
+  template<typename U>
+  MqttPoolAllocator(const MqttPoolAllocator<U>&)
+  { }
+
+  pointer address(reference x) const
+  { return &x; }
+
+  const_pointer address(const_reference x) const
+  { return &x; }
+
+  pointer allocate(size_type n, const void* = 0)
+  { return static_cast<pointer>(MqttMessagePool::allocate(n * sizeof(T))); }
+
+  void deallocate(pointer p, size_type)
+  { MqttMessagePool::deallocate(p); }
+
+  size_type max_size() const
+  { return static_cast<size_type>(-1) / sizeof(T); }
+
+  void construct(pointer p, const T& value)
+  { new (p) T(value); }
+
+  void destroy(pointer p)
+  { p->~T(); }
+};
+
+template<typename T, typename U>
+bool operator==(const MqttPoolAllocator<T>&, const MqttPoolAllocator<U>&)
+{ return true; }
+
+template<typename T, typename U>
+bool operator!=(const MqttPoolAllocator<T>&, const MqttPoolAllocator<U>&)
+{ return false; }
+
+const size_t kMaxInlinePayload = 256;
+
+//从池中分配的空消息，字段由调用者填写
+boost::shared_ptr<MqttMessage> newMqttMessage();
+//为 msg 编码发布帧，帧对象同样来自池
+boost::shared_ptr<const MqttPublishFrame> newMqttPublishFrame(const MqttMessage& msg);
+//复制一段负载；不超过 kMaxInlinePayload 时数据和引用计数都放在池块中
+net::BufferChunk newMqttPayload(const char* data, size_t len);
+
+#endif // MQTTMESSAGEPOOL_H
@@ -0,0 +1,98 @@
+#include "MqttMetrics.h"
+
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <muduo/base/CurrentThread.h>
+#include <muduo/base/Mutex.h>
+#include <muduo/base/Singleton.h>
+#include <muduo/net/EventLoop.h>
+
+using namespace muduo;
+
+__thread MqttMetrics::Block* MqttMetrics::t_block_ = NULL;
+
+//所有线程的计数块，只增不减
+struct MqttMetrics::Registry
+{
+  MutexLock mutex_;
+  std::vector<Block*> blocks_;
+};
+
+const int MqttMetrics::kFanoutBuckets;
+const int MqttMetrics::kPacketTypes;
+
+MqttMetrics::Block* MqttMetrics::newBlock()
+{
+  //new 不保证按缓存行对齐
+  void* p = NULL;
+  if(::posix_memalign(&p, 64, sizeof(Block)) != 0)
+    abort();
+  Block* block = new(p) Block;
+  memset(block->counters, 0, sizeof block->counters);
+  memset(block->packetsIn, 0, sizeof block->packetsIn);
+  memset(block->packetsOut, 0, sizeof block->packetsOut);
+  memset(block->fanout, 0, sizeof block->fanout);
+  block->thread = CurrentThread::name();
+  block->loop = net::EventLoop::getEventLoopOfCurrentThread();
+
+  Registry& registry = Singleton<Registry>::instance();
+  MutexLockGuard lock(registry.mutex_);
+  registry.blocks_.push_back(block);
+  return block;
+}
+
+void MqttMetrics::collect(std::vector<Snapshot>* threads)
+{
+  Registry& registry = Singleton<Registry>::instance();
+  MutexLockGuard lock(registry.mutex_);
+  for(size_t i = 0; i < registry.blocks_.size(); ++i)
+  {
+    const Block& block = *registry.blocks_[i];
+    Snapshot snapshot;
+    snapshot.thread = block.thread;
+    snapshot.loop = block.loop;
+    for(int k = 0; k < kNumCounters; ++k)
+      snapshot.counters[k] = __atomic_load_n(&block.counters[k], __ATOMIC_RELAXED);
+    for(int k = 0; k < kPacketTypes; ++k)
+    {
+      snapshot.packetsIn[k] = __atomic_load_n(&block.packetsIn[k], __ATOMIC_RELAXED);
+      snapshot.packetsOut[k] = __atomic_load_n(&block.packetsOut[k], __ATOMIC_RELAXED);
+    }
+    for(int k = 0; k < kFanoutBuckets; ++k)
+      snapshot.fanout[k] = __atomic_load_n(&block.fanout[k], __ATOMIC_RELAXED);
+    threads->push_back(snapshot);
+  }
+}
+
+MqttMetrics::Snapshot::Snapshot()
+  : loop(NULL)
+{
+  memset(counters, 0, sizeof counters);
+  memset(packetsIn, 0, sizeof packetsIn);
+  memset(packetsOut, 0, sizeof packetsOut);
+  memset(fanout, 0, sizeof fanout);
+}
+
+void MqttMetrics::Snapshot::add(const Snapshot& other)
+{
+  for(int k = 0; k < kNumCounters; ++k)
+    counters[k] += other.counters[k];
+  for(int k = 0; k < kPacketTypes; ++k)
+  {
+    packetsIn[k] += other.packetsIn[k];
+    packetsOut[k] += other.packetsOut[k];
+  }
+  for(int k = 0; k < kFanoutBuckets; ++k)
+    fanout[k] += other.fanout[k];
+}
+
+const char* MqttMetrics::packetName(int type)
+{
+  static const char* const names[kPacketTypes] =
+  {
+    "RESERVED", "CONNECT", "CONNACK", "PUBLISH", "PUBACK", "PUBREC", "PUBREL", "PUBCOMP",
+    "SUBSCRIBE", "SUBACK", "UNSUBSCRIBE", "UNSUBACK", "PINGREQ", "PINGRESP", "DISCONNECT", "RESERVED",
+  };
+  return type >= 0 && type < kPacketTypes ? names[type] : "UNKNOWN";
+}
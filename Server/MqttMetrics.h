@@ -0,0 +1,116 @@
+#ifndef MQTTMETRICS_H
+#define MQTTMETRICS_H
+
+#include <stdint.h>
+#include <utility>
+#include <vector>
+#include <muduo/base/Types.h>
+
+namespace muduo
+{
+namespace net
+{
+class EventLoop;
+}
+}
+
+//运行指标。每个线程一块按缓存行对齐的计数，只由本线程写入：
+//写入是普通的读-加-写，不用带锁前缀的原子指令，也不与别的线程争同一缓存行；
+//读取时汇总所有线程的计数，各项之间不保证是同一时刻的值。
+//连接数、排队消息数等量按增减记在当时所在的线程上，单个线程可能为负，合计才有意义。
+class MqttMetrics
+{
+public:
+  enum Counter
+  {
+    kBytesIn,
+    kBytesOut,
+    kConnections,       // 当前的连接
+    kPublishes,         // 分发的 PUBLISH，包括遗嘱
+    kDeliveries,        // 分发给订阅者的次数
+    kQueuedMessages,    // 会话待发队列中的消息，不含写入磁盘的
+    kInflightMessages,  // 已发出、等待 PUBACK/PUBCOMP 的消息
+    kAwaitingRelease,   // 已收到、等待 PUBREL 的 QoS 2 消息
+    kNumCounters
+  };
+
+  //一次发布的订阅者数按 0、1、2-3、4-7…… 分桶，最后一桶不设上限
+  static const int kFanoutBuckets = 18;
+  static const int kPacketTypes = 16;
+
+  static void add(Counter counter, int64_t n)
+  { increase(&local().counters[counter], n); }
+
+  //type 为固定报头首字节，bytes 为整个报文的长度
+  static void packetIn(uint8_t type, size_t bytes)
+  {
+    Block& block = local();
+    increase(&block.packetsIn[type >> 4], 1);
+    increase(&block.counters[kBytesIn], static_cast<int64_t>(bytes));
+  }
+
+  static void packetOut(uint8_t type, size_t bytes)
+  {
+    Block& block = local();
+    increase(&block.packetsOut[type >> 4], 1);
+    increase(&block.counters[kBytesOut], static_cast<int64_t>(bytes));
+  }
+
+  static void fanout(size_t subscribers)
+  {
+    Block& block = local();
+    int bucket = subscribers == 0 ? 0 : 64 - __builtin_clzll(subscribers);
+    increase(&block.fanout[bucket < kFanoutBuckets ? bucket : kFanoutBuckets - 1], 1);
+    increase(&block.counters[kPublishes], 1);
+    increase(&block.counters[kDeliveries], static_cast<int64_t>(subscribers));
+  }
+
+  struct Snapshot
+  {
+    Snapshot();
+    void add(const Snapshot& other);
+
+    muduo::string thread;
+    muduo::net::EventLoop* loop;  // 首次计数时线程上的 EventLoop，没有为 NULL
+    int64_t counters[kNumCounters];
+    int64_t packetsIn[kPacketTypes];
+    int64_t packetsOut[kPacketTypes];
+    int64_t fanout[kFanoutBuckets];
+  };
+
+  //每个计过数的线程一项，可在任意线程调用
+  static void collect(std::vector<Snapshot>* threads);
+
+  //报文类型的名称，如 "PUBLISH"
+  static const char* packetName(int type);
+
+private:
+  struct Block
+  {
+    int64_t counters[kNumCounters];
+    int64_t packetsIn[kPacketTypes];
+    int64_t packetsOut[kPacketTypes];
+    int64_t fanout[kFanoutBuckets];
+    muduo::string thread;
+    muduo::net::EventLoop* loop;
+  } __attribute__ ((aligned (64)));
+
+  struct Registry;
+
+  static void increase(int64_t* counter, int64_t n)
+  { __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED); }
+
+  static Block& local()
+  {
+    if(__builtin_expect(t_block_ == NULL, 0))
+      t_block_ = newBlock();
+    return *t_block_;
+  }
+
+  //线程退出后计数块保留，累计值不丢
+  static Block* newBlock();
+
+  static __thread Block* t_block_;
+};
+
+#endif // MQTTMETRICS_H
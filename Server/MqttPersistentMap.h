@@ -0,0 +1,301 @@
+#ifndef MQTTPERSISTENTMAP_H
+#define MQTTPERSISTENTMAP_H
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <muduo/base/StringPiece.h>
+#include <muduo/base/Types.h>
+
+using namespace muduo;
+
+//以字符串为键的持久化哈希映射（HAMT，每层 32 路）。
+//节点一经发布便不再修改：set/erase 只复制从根到目标的路径，
+//其余子树与旧版本共享。拷贝本对象为 O(1)，得到的副本即一致快照，
+//读者拿到快照后无需加锁。
+//set 会复制值本身：值应是指针或小对象。会增长的容器（如订阅者列表）放在这里时
+//每次修改都整份复制，同一个键被反复修改就是平方级，MqttTopicTree 因此只存 MqttSubscriberSet 的指针。
+template<typename V>
+class MqttPersistentMap
+{
+public:
+  MqttPersistentMap()
+    : size_(0)
+  { }
+
+  const V* find(const StringPiece& key) const
+  { return find(key, hashKey(key)); }
+
+  //hash 须等于 hashKey(key)，调用者已算好时免去重算（如 MqttTopic::hash）
+  const V* find(const StringPiece& key, uint64_t hash) const
+  {
+    const Node* node = root_.get();
+    int shift = 0;
+    while(node)
+    {
+      if(shift >= kHashBits)
+        return findCollision(*node, key);
+
+      uint32_t bit = 1u << ((hash >> shift) & kMask);
+      if(!(node->bitmap_ & bit))
+        return NULL;
+      const Slot& slot = node->slots_[slotIndex(node->bitmap_, bit)];
+      if(slot.entry_)
+      {
+        const Entry& e = *slot.entry_;
+        return (e.hash_ == hash && key == StringPiece(e.key_)) ? &e.value_ : NULL;
+      }
+      node = slot.node_.get();
+      shift += kBitsPerLevel;
+    }
+    return NULL;
+  }
+
+  //插入或替换 key 对应的值
+  void set(const StringPiece& key, const V& value)
+  { set(key, hashKey(key), value); }
+
+  void set(const StringPiece& key, uint64_t hash, const V& value)
+  {
+    EntryPtr entry(new Entry(key, hash, value));
+    bool added = false;
+    root_ = insert(root_, entry, 0, &added);
+    if(added)
+      ++size_;
+  }
+
+  bool erase(const StringPiece& key)
+  { return erase(key, hashKey(key)); }
+
+  bool erase(const StringPiece& key, uint64_t hash)
+  {
+    bool removed = false;
+    root_ = remove(root_, key, hash, 0, &removed);
+    if(removed)
+      --size_;
+    return removed;
+  }
+
+  size_t size() const
+  { return size_; }
+
+  bool empty() const
+  { return size_ == 0; }
+
+  //按任意顺序对每个元素调用 f(key, value)
+  template<typename F>
+  void forEach(F& f) const
+  {
+    if(root_)
+      visit(*root_, f);
+  }
+
+  static uint64_t hashKey(const StringPiece& key)
+  {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for(int i = 0; i < key.size(); ++i)
+    {
+      hash ^= static_cast<uint8_t>(key[i]);
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+private:
+  static const int kBitsPerLevel = 5;
+  static const int kHashBits = 64;
+  static const uint64_t kMask = 31;
+
+  struct Entry
+  {
+    Entry(const StringPiece& key, uint64_t hash, const V& value)
+      : key_(key.data(), key.size()), hash_(hash), value_(value)
+    { }
+
+    string key_;
+    uint64_t hash_;
+    V value_;
+  };
+
+  struct Node;
+  typedef boost::shared_ptr<const Entry> EntryPtr;
+  typedef boost::shared_ptr<const Node> NodePtr;
+
+  //子节点与元素二者有且只有一个
+  struct Slot
+  {
+    NodePtr node_;
+    EntryPtr entry_;
+  };
+
+  //哈希位用尽后退化为冲突节点，元素线性存放在 collisions_
+  struct Node
+  {
+    Node()
+      : bitmap_(0)
+    { }
+
+    uint32_t bitmap_;
+    std::vector<Slot> slots_;
+    std::vector<EntryPtr> collisions_;
+  };
+
+  static size_t slotIndex(uint32_t bitmap, uint32_t bit)
+  { return static_cast<size_t>(__builtin_popcount(bitmap & (bit - 1))); }
+
+  static const V* findCollision(const Node& node, const StringPiece& key)
+  {
+    for(size_t i = 0; i < node.collisions_.size(); ++i)
+    {
+      if(key == StringPiece(node.collisions_[i]->key_))
+        return &node.collisions_[i]->value_;
+    }
+    return NULL;
+  }
+
+  //只含一个元素的节点可以被父节点直接内联
+  static EntryPtr singleEntry(const Node& node)
+  {
+    if(node.slots_.size() == 1 && node.slots_[0].entry_)
+      return node.slots_[0].entry_;
+    if(node.collisions_.size() == 1)
+      return node.collisions_[0];
+    return EntryPtr();
+  }
+
+  static NodePtr insert(const NodePtr& node, const EntryPtr& entry, int shift, bool* added)
+  {
+    boost::shared_ptr<Node> copy(node ? new Node(*node) : new Node());
+
+    if(shift >= kHashBits)
+    {
+      for(size_t i = 0; i < copy->collisions_.size(); ++i)
+      {
+        if(copy->collisions_[i]->key_ == entry->key_)
+        {
+          copy->collisions_[i] = entry;
+          return copy;
+        }
+      }
+      copy->collisions_.push_back(entry);
+      *added = true;
+      return copy;
+    }
+
+    uint32_t bit = 1u << ((entry->hash_ >> shift) & kMask);
+    size_t index = slotIndex(copy->bitmap_, bit);
+    if(!(copy->bitmap_ & bit))
+    {
+      Slot slot;
+      slot.entry_ = entry;
+      copy->slots_.insert(copy->slots_.begin() + index, slot);
+      copy->bitmap_ |= bit;
+      *added = true;
+      return copy;
+    }
+
+    Slot& slot = copy->slots_[index];
+    if(slot.entry_)
+    {
+      if(slot.entry_->hash_ == entry->hash_ && slot.entry_->key_ == entry->key_)
+      {
+        slot.entry_ = entry;
+        return copy;
+      }
+      bool dummy = false;
+      NodePtr child = insert(NodePtr(), slot.entry_, shift + kBitsPerLevel, &dummy);
+      slot.node_ = insert(child, entry, shift + kBitsPerLevel, added);
+      slot.entry_.reset();
+    }
+    else
+    {
+      slot.node_ = insert(slot.node_, entry, shift + kBitsPerLevel, added);
+    }
+    return copy;
+  }
+
+  //返回删除后的节点；节点变空时返回空指针，未找到时原样返回
+  static NodePtr remove(const NodePtr& node, const StringPiece& key, uint64_t hash,
+                        int shift, bool* removed)
+  {
+    if(!node)
+      return node;
+
+    if(shift >= kHashBits)
+    {
+      for(size_t i = 0; i < node->collisions_.size(); ++i)
+      {
+        if(key == StringPiece(node->collisions_[i]->key_))
+        {
+          *removed = true;
+          if(node->collisions_.size() == 1)
+            return NodePtr();
+          boost::shared_ptr<Node> copy(new Node(*node));
+          copy->collisions_.erase(copy->collisions_.begin() + i);
+          return copy;
+        }
+      }
+      return node;
+    }
+
+    uint32_t bit = 1u << ((hash >> shift) & kMask);
+    if(!(node->bitmap_ & bit))
+      return node;
+
+    size_t index = slotIndex(node->bitmap_, bit);
+    const Slot& slot = node->slots_[index];
+    Slot replacement;
+    if(slot.entry_)
+    {
+      if(slot.entry_->hash_ != hash || key != StringPiece(slot.entry_->key_))
+        return node;
+      *removed = true;
+    }
+    else
+    {
+      NodePtr child = remove(slot.node_, key, hash, shift + kBitsPerLevel, removed);
+      if(child == slot.node_)
+        return node;
+      if(child)
+      {
+        replacement.entry_ = singleEntry(*child);
+        if(!replacement.entry_)
+          replacement.node_ = child;
+      }
+    }
+
+    boost::shared_ptr<Node> copy(new Node(*node));
+    if(replacement.node_ || replacement.entry_)
+    {
+      copy->slots_[index] = replacement;
+    }
+    else
+    {
+      copy->slots_.erase(copy->slots_.begin() + index);
+      copy->bitmap_ &= ~bit;
+      if(copy->slots_.empty())
+        return NodePtr();
+    }
+    return copy;
+  }
+
+  template<typename F>
+  static void visit(const Node& node, F& f)
+  {
+    for(size_t i = 0; i < node.slots_.size(); ++i)
+    {
+      const Slot& slot = node.slots_[i];
+      if(slot.entry_)
+        f(slot.entry_->key_, slot.entry_->value_);
+      else
+        visit(*slot.node_, f);
+    }
+    for(size_t i = 0; i < node.collisions_.size(); ++i)
+      f(node.collisions_[i]->key_, node.collisions_[i]->value_);
+  }
+
+  NodePtr root_;
+  size_t size_;
+};
+
+#endif // MQTTPERSISTENTMAP_H
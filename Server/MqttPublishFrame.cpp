@@ -0,0 +1,63 @@
+#include "MqttPublishFrame.h"
+
+#include <string.h>
+
+#include "MqttMessage.h"
+#include "MqttProtocol.h"
+
+MqttPublishFrame::MqttPublishFrame(const MqttMessage& msg)
+  : headerSize_(0),
+    midOffset_(0),
+    payload_(msg.payload)
+{
+  size_t remainingLength = 2 + msg.topic.size() + (msg.qos > 0 ? 2 : 0) + msg.payload.size();
+  assert(remainingLength <= MQTT_MAX_PAYLOAD);
+
+  size_t maxSize = 1 + 4 + 2 + msg.topic.size() + 2;
+  char* header = inlineHeader_;
+  if(maxSize > kInlineHeader)
+  {
+    longHeader_.resize(maxSize);
+    header = &longHeader_[0];
+  }
+
+  header[headerSize_++] = static_cast<char>(PUBLISH | (msg.qos<<1) | msg.retain);
+  do
+  {
+    uint8_t byte = static_cast<uint8_t>(remainingLength % 128);
+    remainingLength /= 128;
+    if(remainingLength > 0)
+      byte = byte | 0x80;
+    header[headerSize_++] = static_cast<char>(byte);
+  }while(remainingLength > 0);
+
+  header[headerSize_++] = static_cast<char>((msg.topic.size() & 0xFF00) >> 8);
+  header[headerSize_++] = static_cast<char>(msg.topic.size() & 0x00FF);
+  ::memcpy(header + headerSize_, msg.topic.data(), msg.topic.size());
+  headerSize_ += msg.topic.size();
+
+  if(msg.qos > 0)
+  {
+    midOffset_ = headerSize_;
+    header[headerSize_++] = '\0';
+    header[headerSize_++] = '\0';
+  }
+
+  //按最长预留，实际更短时报头可能落回对象内
+  if(header != inlineHeader_ && headerSize_ <= kInlineHeader)
+  {
+    ::memcpy(inlineHeader_, header, headerSize_);
+    longHeader_.clear();
+  }
+}
+
+void MqttPublishFrame::encodeHeader(uint16_t mid, uint8_t dup, char* buf) const
+{
+  ::memcpy(buf, header(), headerSize_);
+  buf[0] = static_cast<char>(buf[0] | ((dup&0x1)<<3));
+  if(midOffset_ > 0)
+  {
+    buf[midOffset_] = static_cast<char>((mid & 0xFF00) >> 8);
+    buf[midOffset_+1] = static_cast<char>(mid & 0x00FF);
+  }
+}
@@ -0,0 +1,43 @@
+#ifndef MQTTPUBLISHFRAME_H
+#define MQTTPUBLISHFRAME_H
+
+#include <boost/noncopyable.hpp>
+#include <muduo/base/Types.h>
+#include <muduo/net/BufferChunk.h>
+
+using namespace muduo;
+
+class MqttMessage;
+
+//一条 PUBLISH 报文只编码一次：固定报头、主题与报文标识符占位写入报头，
+//负载以引用计数的 BufferChunk 共享。每次投递只复制并修补很短的报头
+//（DUP 位与报文标识符），负载经 writev 发送，不会为每个订阅者复制。
+class MqttPublishFrame : boost::noncopyable
+{
+public:
+  explicit MqttPublishFrame(const MqttMessage& msg);
+
+  size_t headerSize() const
+  { return headerSize_; }
+
+  //将一次投递的报头写入 buf，buf 至少 headerSize() 字节
+  void encodeHeader(uint16_t mid, uint8_t dup, char* buf) const;
+
+  const muduo::net::BufferChunk& payload() const
+  { return payload_; }
+
+private:
+  //主题不长时报头直接放在对象内，帧只占一次分配
+  static const size_t kInlineHeader = 64;
+
+  const char* header() const
+  { return headerSize_ <= kInlineHeader ? inlineHeader_ : longHeader_.data(); }
+
+  char inlineHeader_[kInlineHeader];
+  string longHeader_;
+  size_t headerSize_;
+  size_t midOffset_;  // 0 表示 QoS 0，无报文标识符
+  muduo::net::BufferChunk payload_;
+};
+
+#endif // MQTTPUBLISHFRAME_H
@@ -0,0 +1,295 @@
+#include "MqttRetainSnapshot.h"
+
+#include <boost/static_assert.hpp>
+#include <muduo/base/Logging.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+  const char kMagic[8] = {'X','M','Q','R','E','T','1','\0'};
+
+  struct Header
+  {
+    char magic[8];
+    uint64_t count;
+  };
+
+  struct IndexEntry
+  {
+    uint64_t offset;       // 主题在文件中的偏移，负载紧随其后
+    uint32_t topicLen;
+    uint32_t payloadLen;
+    uint8_t qos;
+    uint8_t reserved[7];
+  };
+  BOOST_STATIC_ASSERT(sizeof(IndexEntry) == 24);
+
+  const IndexEntry& indexAt(const char* data, size_t i)
+  {
+    return reinterpret_cast<const IndexEntry*>(data + sizeof(Header))[i];
+  }
+
+  struct Unmap
+  {
+    explicit Unmap(size_t length)
+      : length_(length)
+    { }
+    void operator()(const void* addr) const
+    { ::munmap(const_cast<void*>(addr), length_); }
+    size_t length_;
+  };
+}
+
+MqttRetainSnapshot::MqttRetainSnapshot()
+  : data_(NULL),
+    length_(0),
+    count_(0)
+{
+}
+
+bool MqttRetainSnapshot::open(const string& path)
+{
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if(fd < 0)
+  {
+    if(errno != ENOENT)
+      LOG_SYSERR << "retain snapshot: open " << path;
+    return false;
+  }
+
+  struct stat st;
+  void* addr = MAP_FAILED;
+  if(::fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(Header))
+    addr = ::mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if(addr == MAP_FAILED)
+  {
+    LOG_ERROR << "retain snapshot: cannot map " << path;
+    return false;
+  }
+
+  size_t length = static_cast<size_t>(st.st_size);
+  boost::shared_ptr<const void> mapping(addr, Unmap(length));
+  const Header* header = static_cast<const Header*>(addr);
+  if(memcmp(header->magic, kMagic, sizeof kMagic) != 0 ||
+     header->count > (length - sizeof(Header)) / sizeof(IndexEntry))
+  {
+    LOG_ERROR << "retain snapshot: bad header in " << path;
+    return false;
+  }
+  //索引按查找顺序随机访问
+  ::madvise(addr, sizeof(Header) + header->count * sizeof(IndexEntry), MADV_RANDOM);
+
+  mapping_ = mapping;
+  data_ = static_cast<const char*>(addr);
+  length_ = length;
+  count_ = static_cast<size_t>(header->count);
+  return true;
+}
+
+//索引项越界时按空主题、空负载处理
+StringPiece MqttRetainSnapshot::topic(size_t i) const
+{
+  assert(i < count_);
+  const IndexEntry& e = indexAt(data_, i);
+  if(e.offset > length_ || e.topicLen > length_ - e.offset)
+    return StringPiece();
+  return StringPiece(data_ + e.offset, static_cast<int>(e.topicLen));
+}
+
+StringPiece MqttRetainSnapshot::payload(size_t i) const
+{
+  assert(i < count_);
+  const IndexEntry& e = indexAt(data_, i);
+  if(e.offset > length_ || static_cast<uint64_t>(e.topicLen) + e.payloadLen > length_ - e.offset)
+    return StringPiece();
+  return StringPiece(data_ + e.offset + e.topicLen, static_cast<int>(e.payloadLen));
+}
+
+uint8_t MqttRetainSnapshot::qos(size_t i) const
+{
+  assert(i < count_);
+  return indexAt(data_, i).qos;
+}
+
+size_t MqttRetainSnapshot::lowerBound(const StringPiece& topic) const
+{
+  size_t first = 0, count = count_;
+  while(count > 0)
+  {
+    size_t step = count / 2;
+    if(this->topic(first + step) < topic)
+    {
+      first += step + 1;
+      count -= step + 1;
+    }
+    else
+    {
+      count = step;
+    }
+  }
+  return first;
+}
+
+size_t MqttRetainSnapshot::find(const StringPiece& topic) const
+{
+  size_t i = lowerBound(topic);
+  return (i < count_ && this->topic(i) == topic) ? i : count_;
+}
+
+boost::shared_ptr<MqttMessage> MqttRetainSnapshot::message(size_t i) const
+{
+  StringPiece payload = this->payload(i);
+  boost::shared_ptr<MqttMessage> msg;
+  if(payload.empty())
+    return msg;
+
+  msg.reset(new MqttMessage);
+  msg->qos = qos(i);
+  msg->retain = true;
+  msg->topic = MqttTopic::intern(topic(i));
+  msg->payload = net::BufferChunk(mapping_, payload.data(), payload.size());
+  return msg;
+}
+
+namespace
+{
+  typedef MqttRetainSnapshot::Entry Entry;
+
+  //合并 base 与 changes，按主题顺序对每条保留的消息调用 f
+  template<typename F>
+  void merge(const MqttRetainSnapshot* base, const std::vector<Entry>& changes, F& f)
+  {
+    size_t i = 0, j = 0;
+    size_t n = base ? base->size() : 0;
+    while(i < n || j < changes.size())
+    {
+      int r = 0;
+      if(i == n)
+        r = 1;
+      else if(j == changes.size())
+        r = -1;
+      else
+        r = base->topic(i).compare(changes[j].topic);
+
+      if(r < 0)
+      {
+        Entry e = { base->topic(i), base->qos(i), base->payload(i), false };
+        if(!e.payload.empty())
+          f(e);
+        ++i;
+      }
+      else
+      {
+        if(!changes[j].deleted)
+          f(changes[j]);
+        if(r == 0)
+          ++i;
+        ++j;
+      }
+    }
+  }
+
+  struct Counter
+  {
+    Counter() : count(0) { }
+    void operator()(const Entry&)
+    { ++count; }
+    uint64_t count;
+  };
+
+  //第一遍写索引，第二遍写数据区
+  class Writer
+  {
+  public:
+    Writer(FILE* fp, uint64_t offset)
+      : fp_(fp), offset_(offset), writeIndex_(true), ok_(true)
+    { }
+
+    void operator()(const Entry& e)
+    {
+      if(writeIndex_)
+      {
+        IndexEntry index;
+        memset(&index, 0, sizeof index);
+        index.offset = offset_;
+        index.topicLen = static_cast<uint32_t>(e.topic.size());
+        index.payloadLen = static_cast<uint32_t>(e.payload.size());
+        index.qos = e.qos;
+        write(&index, sizeof index);
+        offset_ += index.topicLen + index.payloadLen;
+      }
+      else
+      {
+        write(e.topic.data(), e.topic.size());
+        write(e.payload.data(), e.payload.size());
+      }
+    }
+
+    void startData()
+    { writeIndex_ = false; }
+
+    bool ok() const
+    { return ok_; }
+
+  private:
+    void write(const void* data, size_t len)
+    {
+      if(ok_ && len > 0 && ::fwrite_unlocked(data, 1, len, fp_) != len)
+        ok_ = false;
+    }
+
+    FILE* fp_;
+    uint64_t offset_;
+    bool writeIndex_;
+    bool ok_;
+  };
+}
+
+bool MqttRetainSnapshot::write(const string& path, const MqttRetainSnapshot* base,
+                               const std::vector<Entry>& changes, size_t* written)
+{
+  Counter counter;
+  merge(base, changes, counter);
+
+  string tmpPath = path + ".tmp";
+  FILE* fp = ::fopen(tmpPath.c_str(), "we");
+  if(!fp)
+  {
+    LOG_SYSERR << "retain snapshot: open " << tmpPath;
+    return false;
+  }
+  std::vector<char> buffer(1024*1024);
+  ::setvbuf(fp, &buffer[0], _IOFBF, buffer.size());
+
+  Header header;
+  memcpy(header.magic, kMagic, sizeof kMagic);
+  header.count = counter.count;
+  bool ok = ::fwrite_unlocked(&header, 1, sizeof header, fp) == sizeof header;
+
+  Writer writer(fp, sizeof(Header) + counter.count * sizeof(IndexEntry));
+  merge(base, changes, writer);
+  writer.startData();
+  merge(base, changes, writer);
+
+  ok = ok && writer.ok() && ::fflush(fp) == 0 && ::fdatasync(::fileno(fp)) == 0;
+  ::fclose(fp);
+  if(!ok || ::rename(tmpPath.c_str(), path.c_str()) != 0)
+  {
+    LOG_SYSERR << "retain snapshot: write " << path;
+    ::unlink(tmpPath.c_str());
+    return false;
+  }
+
+  if(written)
+    *written = static_cast<size_t>(counter.count);
+  return true;
+}
@@ -0,0 +1,60 @@
+#ifndef MQTTRETAINSNAPSHOT_H
+#define MQTTRETAINSNAPSHOT_H
+
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <muduo/base/StringPiece.h>
+#include <muduo/base/Types.h>
+
+#include "MqttMessage.h"
+
+//保留消息的磁盘快照，启动时只读映射，按需取出，不必把几百万条保留消息重新读进内存。
+//
+//文件格式：[文件头][按主题排序的定长索引][主题与负载数据区]。
+//索引项记录主题与负载在文件中的位置，查找为二分，通配符按过滤器的字面前缀缩小范围。
+//取出的消息负载直接引用映射内存，映射在最后一个引用释放后才解除。
+class MqttRetainSnapshot : boost::noncopyable
+{
+public:
+  //写快照的一条输入，deleted 为 true 表示删除基准快照中的同名主题
+  struct Entry
+  {
+    StringPiece topic;
+    uint8_t qos;
+    StringPiece payload;
+    bool deleted;
+  };
+
+  MqttRetainSnapshot();
+
+  //映射快照文件，文件不存在或格式不对时返回 false，此时快照为空
+  bool open(const string& path);
+
+  size_t size() const
+  { return count_; }
+
+  //第一个主题不小于 topic 的位置
+  size_t lowerBound(const StringPiece& topic) const;
+  //主题恰为 topic 的位置，没有时返回 size()
+  size_t find(const StringPiece& topic) const;
+
+  StringPiece topic(size_t i) const;
+  StringPiece payload(size_t i) const;
+  uint8_t qos(size_t i) const;
+  //每次调用都新建消息对象，负载与映射共享
+  boost::shared_ptr<MqttMessage> message(size_t i) const;
+
+  //把 base（可为 NULL）与 changes 合并写成新快照：changes 中的主题覆盖 base，
+  //changes 须已按主题排序且无重复。先写临时文件再改名，写失败时保留旧文件。
+  static bool write(const string& path, const MqttRetainSnapshot* base,
+                    const std::vector<Entry>& changes, size_t* written);
+
+private:
+  boost::shared_ptr<const void> mapping_;
+  const char* data_;
+  size_t length_;
+  size_t count_;
+};
+
+#endif // MQTTRETAINSNAPSHOT_H
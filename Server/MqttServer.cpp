@@ -9,107 +9,298 @@
 
 #include "MqttProtocol.h"
 #include "MqttTopicTree.h"
-
-MqttServer::MqttServer(EventLoop* loop,const InetAddress& addr,const int numThreads)
-  :tcpServer_(loop,addr,"mqtt server"),
+#include "MqttFrameDecoder.h"
+#include "MqttKeepAlive.h"
+#include "MqttPublishFrame.h"
+#include "MqttMessagePool.h"
+#include "MqttMetrics.h"
+#include "MqttLatency.h"
+
+MqttServer::MqttServer(EventLoop* loop,const InetAddress& addr,const int numThreads,bool reusePort)
+  :tcpServer_(loop,addr,"mqtt server",
+              reusePort ? TcpServer::kReusePortPerLoop : TcpServer::kNoReusePort),
     protocolNameV311_(PROTOCOL_NAME_v311),
-    waitConnectTime_(10)
+    waitConnectTime_(10),
+    loggedOutboundEvents_(0),
+    loggedPoolAllocations_(0),
+    purgedTopics_(0),
+    retainSnapshotInterval_(0),
+    retainSnapshotThread_("RetainSnapshot")
 {
   tcpServer_.setConnectionCallback(
         boost::bind(&MqttServer::onConnection, this, _1));
   tcpServer_.setMessageCallback(
         boost::bind(&MqttServer::onMessage, this, _1, _2, _3));
+  tcpServer_.setThreadInitCallback(
+        boost::bind(&MqttServer::onThreadInit, this, _1));
   tcpServer_.setThreadNum(numThreads);
 }
 
+void MqttServer::start()
+{
+  if(!retainSnapshotPath_.empty())
+  {
+    Singleton<MqttTopicTree>::instance().loadRetainSnapshot(retainSnapshotPath_);
+    retainSnapshotThread_.start(1);
+    tcpServer_.getLoop()->runEvery(retainSnapshotInterval_,
+                                   boost::bind(&MqttServer::saveRetainSnapshot, this));
+  }
+  if(store_)
+  {
+    std::vector<MqttSessionStore::StoredSession> sessions;
+    store_->recover(&sessions);
+    for(size_t i=0; i<sessions.size(); ++i)
+      restoreSession(sessions[i]);
+    store_->start();
+  }
+  tcpServer_.getLoop()->runEvery(60, boost::bind(&MqttServer::logOutboundStats, this));
+  tcpServer_.getLoop()->runEvery(60, boost::bind(&MqttServer::logMessagePoolStats, this));
+  tcpServer_.getLoop()->runEvery(1, boost::bind(&MqttServer::purgeTopics, this));
+  tcpServer_.start();
+}
+
+void MqttServer::setShareStrategy(MqttShareStrategy strategy)
+{
+  Singleton<MqttTopicTree>::instance().setShareStrategy(strategy);
+}
+
+//慢消费者策略触发过才输出
+void MqttServer::logOutboundStats()
+{
+  MqttOutboundStats& stats = Singleton<MqttOutboundStats>::instance();
+  int64_t events = stats.highWaterMarks.get() + stats.droppedQos0.get() + stats.droppedOverflow.get() +
+                   stats.disconnects.get() + stats.spilled.get() + stats.droppedSpillFull.get();
+  if(events == loggedOutboundEvents_)
+    return;
+  loggedOutboundEvents_ = events;
+  LOG_INFO << "slow consumers: high water mark " << stats.highWaterMarks.get()
+           << ", dropped qos0 " << stats.droppedQos0.get()
+           << ", dropped on overflow " << stats.droppedOverflow.get()
+           << ", disconnected " << stats.disconnects.get()
+           << ", spilled " << stats.spilled.get()
+           << ", dropped with spill file full " << stats.droppedSpillFull.get();
+}
+
+//有新的发布才输出
+void MqttServer::logMessagePoolStats()
+{
+  MqttMessagePool::Stats stats = MqttMessagePool::stats();
+  if(stats.allocations == loggedPoolAllocations_)
+    return;
+  loggedPoolAllocations_ = stats.allocations;
+  LOG_INFO << "message pool: allocations " << stats.allocations
+           << ", outstanding " << stats.outstanding
+           << ", freed by other threads " << stats.remoteFrees
+           << ", malloc fallbacks " << stats.fallbacks
+           << ", slabs " << stats.slabs;
+}
+
+//清除已无消息或订阅引用的驻留主题。在 base loop 上每秒只查一批，
+//几百万个主题时也不会长时间占住 accept 与定时器；一轮扫完后汇总输出
+void MqttServer::purgeTopics()
+{
+  bool sweepDone = false;
+  purgedTopics_ += MqttTopic::purge(kPurgeBatch, &sweepDone);
+  if(sweepDone)
+  {
+    if(purgedTopics_ > 0)
+      LOG_INFO << "topic table: purged " << purgedTopics_ << ", " << MqttTopic::internedCount() << " interned";
+    purgedTopics_ = 0;
+  }
+}
+
+//上一次还没写完时跳过这一次
+void MqttServer::saveRetainSnapshot()
+{
+  if(savingRetainSnapshot_.getAndSet(1) == 0)
+    retainSnapshotThread_.run(boost::bind(&MqttServer::saveRetainSnapshotInThread, this));
+}
+
+void MqttServer::saveRetainSnapshotInThread()
+{
+  Singleton<MqttTopicTree>::instance().saveRetainSnapshot(retainSnapshotPath_);
+  savingRetainSnapshot_.getAndSet(0);
+}
+
+//恢复的会话先归主线程，客户端重新连接时再交给连接所属线程
+void MqttServer::restoreSession(const MqttSessionStore::StoredSession& stored)
+{
+  boost::shared_ptr<MqttClientSession> client(
+        new MqttClientSession(tcpServer_.getLoop(),&sessionConfig_));
+  client->setClientID(stored.clientID);
+  client->setCleanSession(false);
+
+  for(size_t i=0; i<stored.msgs.size(); ++i)
+  {
+    const boost::shared_ptr<MqttMessage>& msg = stored.msgs[i];
+    msg->frame = newMqttPublishFrame(*msg);
+    client->restoreOfflineMsg(msg);
+  }
+
+  MqttTopicTree& topicTree = Singleton<MqttTopicTree>::instance();
+  for(size_t i=0; i<stored.topics.size(); ++i)
+  {
+    MqttTopic topic = MqttTopic::intern(stored.topics[i]);
+    client->subTopics().push_back(MqttSubscription(topic));
+    topicTree.addSubscriber(client->subTopics().back(),client,false);
+  }
+  offlineClients_.pushClient(stored.clientID,client);
+}
+
+void MqttServer::onThreadInit(EventLoop* loop)
+{
+  loop->setContext(boost::shared_ptr<MqttKeepAlive>(new MqttKeepAlive(loop)));
+  MutexLockGuard lock(ioLoopsMutex_);
+  ioLoops_.push_back(loop);
+}
+
 void MqttServer::onConnection(const TcpConnectionPtr& conn)
 {
   conn->getLoop()->assertInLoopThread();
   if(conn->connected())
   {
         conn->enableCloseAfter(waitConnectTime_);
+        MqttMetrics::add(MqttMetrics::kConnections, 1);
   }
   else
   {
+    MqttMetrics::add(MqttMetrics::kConnections, -1);
     if(!conn->getContext().empty())
     {
-      MqttTopicTree& topicTree = Singleton<MqttTopicTree>::instance();
       boost::shared_ptr<MqttClientSession> ptr =
           boost::any_cast<boost::shared_ptr<MqttClientSession> >(conn->getContext());
+      //会话还没交接过来或还没接上这个连接，由 attachSession 处理
+      if(ptr->attached(conn))
+        sessionClosed(conn,ptr);
+    }
+  }
+}
 
-      if(ptr->will())
-      {
-        boost::shared_ptr<MqttMessage> msg = ptr->willMsg();
-        if(msg)
-        {
-          msg->remainglen = 2 + msg->topic.length() + 2 + msg->payload.length();
-
-          topicTree.Publish(msg->topic,msg);
+void MqttServer::sessionClosed(const TcpConnectionPtr& conn, const boost::shared_ptr<MqttClientSession>& ptr)
+{
+  conn->getLoop()->assertInLoopThread();
+  MqttTopicTree& topicTree = Singleton<MqttTopicTree>::instance();
+  ptr->stopKeepAlive(conn);
+  //共享订阅不再选中下线的持久会话
+  ptr->updateBacklog();
 
-          if(msg->retain)
-            topicTree.addRetainMsg(msg);
-        }
-      }
+  if(ptr->will())
+  {
+    boost::shared_ptr<MqttMessage> msg = ptr->willMsg();
+    if(msg)
+    {
+      topicTree.Publish(msg->topic,msg);
 
-      if(!ptr->cleanSession())
-      {
-        offlineClients_.pushClient(ptr->clientID(),ptr);
-      }
-      else
-      {
-        std::list<string>& topics = ptr->subTopics();
-        for(std::list<string>::iterator it=topics.begin(); it!=topics.end(); ++it)
-          topicTree.unSubscriber(*it, ptr);
-      }
+      if(msg->retain)
+        topicTree.addRetainMsg(msg);
     }
   }
+
+  if(!ptr->cleanSession())
+  {
+    ptr->persist();
+    offlineClients_.pushClient(ptr->clientID(),ptr);
+  }
+  else
+  {
+    std::list<MqttSubscription>& topics = ptr->subTopics();
+    for(std::list<MqttSubscription>::iterator it=topics.begin(); it!=topics.end(); ++it)
+      topicTree.unSubscriber(*it);
+  }
 }
 
-void MqttServer::onMessage(const TcpConnectionPtr& conn, Buffer* buffer, Timestamp time)
+//在会话原所属线程运行，交出所有权后由连接所属线程继续
+void MqttServer::handOverSession(const boost::shared_ptr<MqttClientSession>& client,
+                                 const TcpConnectionPtr& conn, const ConnectFields& fields)
+{
+  client->setOwnerLoop(conn->getLoop());
+  conn->getLoop()->queueInLoop(
+        boost::bind(&MqttServer::attachSession, this, client, conn, fields, true));
+}
+
+//在会话新的所属线程运行，此后才写入 CONNECT 的字段、处理连接上的报文
+void MqttServer::attachSession(const boost::shared_ptr<MqttClientSession>& client,
+                               const TcpConnectionPtr& conn, const ConnectFields& fields, bool handedOver)
 {
   conn->getLoop()->assertInLoopThread();
-  //连接消息固定报头（报文类型byte 1 + 剩余长度（最大为4个字节，最小1个字节），
-  //后面可变报头必然超过3个字节，所以此处判断 < 5 不会错过正确mqtt消息
-  if(buffer->readableBytes() < 5)
+  assert(client->ownerLoop() == conn->getLoop());
+  if(fields.resumed && store_)
+    store_->removeSession(fields.clientID);
+
+  client->setWill(fields.will);
+  client->setClientID(fields.clientID);
+  client->setCleanSession(fields.cleanSession);
+  if(fields.willMsg)
+    client->ResetWillMsg(fields.willMsg);
+  if(fields.hasUserName)
+    client->setUserName(fields.userName);
+  if(fields.hasPassWord)
+    client->setPassWord(fields.passWord);
+
+  if(!conn->connected())
+  {
+    //交接期间连接已断开，断开回调跳过了它
+    sessionClosed(conn,client);
     return;
+  }
 
-  uint8_t msgType = buffer->peekInt8();
+  client->setTcpConnection(conn);
+  conn->setMessageCallback(
+        boost::bind(&MqttClientSession::onMessage, client.get(), _1, _2, _3));
+  client->startKeepAlive(conn,fields.keepalive);
+  client->publishOfflineMsg();
 
-  const char* byte = buffer->peek();
-  uint32_t remaining_length = 0;
-  uint32_t remaining_mult = 1;
+  //交接期间到达的报文由 MqttServer::onMessage 留在了输入缓冲区里
+  if(handedOver && conn->inputBuffer()->readableBytes() > 0)
+    client->onMessage(conn,conn->inputBuffer(),Timestamp::now());
+}
 
-  char i=0;
-  do
-  {
-    byte++;
-    ++i;
+void MqttServer::onMessage(const TcpConnectionPtr& conn, Buffer* buffer, Timestamp time)
+{
+  conn->getLoop()->assertInLoopThread();
+  //CONNECT 已接受，会话交接完成前的报文留在输入缓冲区，由 attachSession 处理
+  if(!conn->getContext().empty())
+    return;
+
+  MqttFixedHeader header;
+  MqttFrameDecoder::Result result = MqttFrameDecoder::peekFrame(*buffer,&header);
+  if(result == MqttFrameDecoder::kIncomplete)
+    return;
 
-    if(i > 4) //不符合mqtt协议
+  //CONNECT 的可变报头固定为10个字节
+  if(result == MqttFrameDecoder::kComplete && (header.type & 0xF0) == CONNECT &&
+     header.remainingLength >= 10)
+  {
+    MqttMetrics::packetIn(header.type, header.headerLength + header.remainingLength);
+    buffer->retrieve(header.headerLength);
+    size_t rest = buffer->readableBytes() - header.remainingLength;
+    bool accepted;
+    {
+      MqttLatencyTimer timer(MqttLatency::kDispatch + (CONNECT >> 4));
+      accepted = mqttHandleConnect(conn,*buffer,header.remainingLength);
+    }
+    if(accepted && buffer->readableBytes() >= rest)
     {
-      conn->forceClose();
+      buffer->retrieve(buffer->readableBytes() - rest);
+      conn->cancelCloseAfter();
+      //与 CONNECT 一同到达的报文交给会话处理，不必等下一次读事件；
+      //会话还在交接时留给 attachSession
+      if(buffer->readableBytes() > 0)
+      {
+        boost::shared_ptr<MqttClientSession> client =
+            boost::any_cast<boost::shared_ptr<MqttClientSession> >(conn->getContext());
+        if(client->attached(conn))
+          client->onMessage(conn,buffer,time);
+      }
       return;
     }
-    remaining_length  += (*byte & 127) * remaining_mult;
-    remaining_mult *= 128;
-  }while((*byte & 128) != 0);
-
-  if(buffer->readableBytes() < remaining_length + i + 1)
-    return;
-  else
-  {
-    buffer->retrieve(i+1);
-
-    uint8_t cmd = msgType & 0xF0;
-    if(cmd == CONNECT && mqttHandleConnect(conn,*buffer))
-            conn->cancelCloseAfter();
-    else
-      conn->forceClose();
   }
+
+  conn->forceClose();
 }
 
 
-bool MqttServer::mqttHandleConnect(const TcpConnectionPtr& conn, Buffer& buffer)
+bool MqttServer::mqttHandleConnect(const TcpConnectionPtr& conn, Buffer& buffer, size_t remainingLength)
 {
   conn->getLoop()->assertInLoopThread();
   uint16_t len = buffer.readInt16();
@@ -154,74 +345,98 @@ bool MqttServer::mqttHandleConnect(const TcpConnectionPtr& conn, Buffer& buffer)
 
   uint16_t keepalive = buffer.readInt16();
 
+  //此后的字段都是带长度的字符串，不能读出 CONNECT 之外
+  size_t left = remainingLength - 10;
   string clientID;
-  if(readMqttString(clientID,buffer) <= 0)
+  if(readMqttString(clientID,buffer,&left) <= 0)
   {
     sendConnack(conn,0,CONNACK_REFUSED_IDENTIFIER_REJECTED);
     return false;
   }
 
-  boost::shared_ptr<MqttClientSession> client;
-  if(!clean_session)
-  {
-    LOG_DEBUG << "clean_session mqtt client";
-    client = offlineClients_.popClient(clientID);
-    if(!client)
-      client.reset(new MqttClientSession(conn->getLoop(),keepalive));
-  }
-  else
-  {
-    LOG_DEBUG << "new mqtt client";
-    client.reset(new MqttClientSession(conn->getLoop(),keepalive));
-  }
-
-  client->setWill(will);
-  client->setTcpConnection(conn);
-  client->setClientID(clientID);
-  client->setCleanSession(clean_session);
-  conn->setContext(client);
-  conn->setMessageCallback(
-        boost::bind(&MqttClientSession::onMessage, client.get(), _1, _2, _3));
-
+  //先读完整个 CONNECT，出错时不会取走离线会话
+  boost::shared_ptr<MqttMessage> willMsgPtr;
   if(will)
   {
-    boost::shared_ptr<MqttMessage> willMsgPtr(new MqttMessage);
+    willMsgPtr.reset(new MqttMessage);
     willMsgPtr->qos = will_qos;
     willMsgPtr->retain = will_retain;
-    willMsgPtr->mid = 0;
 
-    if((readMqttString(willMsgPtr->topic,buffer) <= 0) ||
-       (readMqttString(willMsgPtr->payload,buffer) <= 0) )
+    string topic;
+    string payload;
+    if((readMqttString(topic,buffer,&left) <= 0) ||
+       (readMqttString(payload,buffer,&left) <= 0) )
       return false;
-
-    client->ResetWillMsg(willMsgPtr);
+    willMsgPtr->topic = MqttTopic::intern(topic);
+    //遗嘱会被发布，主题同样不能含通配符
+    if(willMsgPtr->topic.hasWildcards())
+      return false;
+    willMsgPtr->payload = BufferChunk(payload);
   }
 
+  string userName;
+  string passWord;
   if(username_flag)
   {
-    string userName;
-    if(readMqttString(userName, buffer) <= 0)
+    if(readMqttString(userName, buffer, &left) <= 0)
       return false;
-    else
-      client->setUserName(userName);
 
     if(password_flag)
     {
       //TODO  验证用户密码
-      string passWord;
-      if(readMqttString(passWord, buffer) <= 0)
+      if(readMqttString(passWord, buffer, &left) <= 0)
         return false;
-      else
-        client->setPassWord(passWord);
     }
   }
+  //标志位之外多出的字段也是协议错误
+  if(left != 0)
+    return false;
+
+  ConnectFields fields;
+  fields.clientID = clientID;
+  fields.will = (will != 0);
+  fields.cleanSession = (clean_session != 0);
+  fields.willMsg = willMsgPtr;
+  fields.hasUserName = (username_flag != 0);
+  fields.hasPassWord = (password_flag != 0);
+  fields.userName = userName;
+  fields.passWord = passWord;
+  fields.keepalive = keepalive;
+
+  boost::shared_ptr<MqttClientSession> client;
+  if(!clean_session)
+  {
+    LOG_DEBUG << "clean_session mqtt client";
+    client = offlineClients_.popClient(clientID);
+    fields.resumed = static_cast<bool>(client);
+    if(!client)
+      client.reset(new MqttClientSession(conn->getLoop(),&sessionConfig_));
+  }
+  else
+  {
+    LOG_DEBUG << "new mqtt client";
+    client.reset(new MqttClientSession(conn->getLoop(),&sessionConfig_));
+  }
+
+  //会话的字段和消息回调都等它归这个线程后再设置，此前的报文由 MqttServer::onMessage 留在缓冲区
+  conn->setContext(client);
 
   sendConnack(conn,connectAck,CONNACK_ACCEPTED);
 
   LOG_DEBUG << " clientID: " << clientID
             << ", keepalive: " << keepalive;
 
-  client->publishOfflineMsg();
+  EventLoop* owner = client->ownerLoop();
+  if(owner == conn->getLoop())
+  {
+    attachSession(client,conn,fields,false);
+  }
+  else
+  {
+    //离线会话上次连在别的线程，先由那个线程交出所有权
+    owner->runInLoop(
+          boost::bind(&MqttServer::handOverSession, this, client, conn, fields));
+  }
 
   return true;
 }
@@ -230,11 +445,17 @@ void MqttServer::sendConnack(const TcpConnectionPtr& conn, uint8_t ack, uint8_t
 {
   uint8_t message[4] = {CONNACK,2,ack,result};
   conn->send(message,sizeof(message));
+  MqttMetrics::packetOut(CONNACK, sizeof(message));
 }
 
-int MqttServer::readMqttString(string& buf, Buffer& buffer)
+int MqttServer::readMqttString(string& buf, Buffer& buffer, size_t* left)
 {
+  if(*left < 2 || buffer.readableBytes() < 2 ||
+     *left < 2 + static_cast<size_t>(static_cast<uint16_t>(buffer.peekInt16())))
+    return -1;
+
   uint16_t len = buffer.readInt16();
+  *left -= 2 + len;
   if(len > 0)
   {
     buf.reserve(len);
@@ -4,34 +4,127 @@
 #include <list>
 #include <vector>
 #include <map>
+#include <boost/scoped_ptr.hpp>
+#include <muduo/base/Atomic.h>
+#include <muduo/base/Mutex.h>
+#include <muduo/base/ThreadPool.h>
 #include <muduo/net/TcpServer.h>
 #include <muduo/net/TcpConnection.h>
 
 #include "MqttClient.h"
 #include "MqttofflineClientList.h"
+#include "MqttSessionStore.h"
 
 using namespace net;
 
 class MqttServer
 {
 public:
-  MqttServer(EventLoop* loop, const InetAddress& addr,const int numThreads);
+  MqttServer(EventLoop* loop, const InetAddress& addr,const int numThreads,bool reusePort = false);
 
-  void start()
-  { tcpServer_.start(); }
+  //有会话存储时先恢复上次保存的持久会话，再开始监听
+  void start();
+
+  //每个会话同时等待确认的 QoS 1/2 消息数，start 之前设置
+  void setInflightWindow(uint16_t window)
+  { sessionConfig_.inflightWindow = window; }
+
+  //慢消费者的限制：输出缓冲区超过 maxBytes 后暂停投递，排队消息超过 maxQueued 时按 policy 处理，
+  //spillDir 为 kSpillPolicy 写溢出文件的目录，每个会话的溢出文件最多积压 maxSpillBytes。start 之前设置
+  void setOutboundLimits(size_t maxBytes, size_t maxQueued,
+                         MqttSessionConfig::SlowConsumerPolicy policy, const string& spillDir,
+                         size_t maxSpillBytes)
+  {
+    sessionConfig_.maxOutboundBytes = maxBytes;
+    sessionConfig_.maxQueuedMessages = maxQueued;
+    sessionConfig_.policy = policy;
+    sessionConfig_.spillDir = spillDir;
+    sessionConfig_.maxSpillBytes = maxSpillBytes;
+  }
+
+  //持久会话的存储，由 MqttServer 持有，start 之前设置；不设置时只保存在内存里
+  void setSessionStore(MqttSessionStore* store)
+  {
+    store_.reset(store);
+    sessionConfig_.store = store;
+  }
+
+  //启动时从 path 加载保留消息快照，之后每 interval 秒在后台线程保存一次，start 之前设置
+  void setRetainSnapshot(const string& path, double interval)
+  {
+    retainSnapshotPath_ = path;
+    retainSnapshotInterval_ = interval;
+  }
+
+  //共享订阅在组内选成员的方式，start 之前设置
+  void setShareStrategy(MqttShareStrategy strategy);
+
+  //所有 IO 线程的 EventLoop，可在任意线程调用
+  std::vector<EventLoop*> ioLoops() const
+  {
+    MutexLockGuard lock(ioLoopsMutex_);
+    return ioLoops_;
+  }
 
 private:
+  //CONNECT 里要写入会话的字段，交接完成后在新的所属线程写入
+  struct ConnectFields
+  {
+    ConnectFields()
+      : will(false), cleanSession(false), resumed(false),
+        hasUserName(false), hasPassWord(false), keepalive(0)
+    { }
+
+    string clientID;
+    string userName;
+    string passWord;
+    boost::shared_ptr<MqttMessage> willMsg;
+    bool will;
+    bool cleanSession;
+    bool resumed;       // 取自离线会话，存储里的旧记录要删掉
+    bool hasUserName;
+    bool hasPassWord;
+    uint16_t keepalive;
+  };
+
+  //purgeTopics 每秒检查的驻留主题数，一百万个主题约一分钟扫完一轮
+  static const size_t kPurgeBatch = 16384;
+
+  void onThreadInit(EventLoop* loop);
+  void restoreSession(const MqttSessionStore::StoredSession& stored);
+  void logOutboundStats();
+  void logMessagePoolStats();
+  void purgeTopics();
+  void saveRetainSnapshot();
+  void saveRetainSnapshotInThread();
   void onConnection(const TcpConnectionPtr& conn);
+  void sessionClosed(const TcpConnectionPtr& conn, const boost::shared_ptr<MqttClientSession>& ptr);
+  void handOverSession(const boost::shared_ptr<MqttClientSession>& client,
+                       const TcpConnectionPtr& conn, const ConnectFields& fields);
+  void attachSession(const boost::shared_ptr<MqttClientSession>& client,
+                     const TcpConnectionPtr& conn, const ConnectFields& fields, bool handedOver);
   void onMessage(const TcpConnectionPtr& conn, Buffer* buffer, Timestamp time);
   void sendConnack(const TcpConnectionPtr& conn, uint8_t ack, uint8_t result);
-  bool mqttHandleConnect(const TcpConnectionPtr& conn, Buffer& buffer);
-  int readMqttString(string& buf, Buffer& buffer);
+  bool mqttHandleConnect(const TcpConnectionPtr& conn, Buffer& buffer, size_t remainingLength);
+  //left 为本报文剩余的字节数，字符串越过报文末尾时失败，成功时扣去读掉的字节
+  int readMqttString(string& buf, Buffer& buffer, size_t* left);
 
   net::TcpServer tcpServer_;
   //已下线的保留客户端
   MqttofflineClientList offlineClients_;
   const string protocolNameV311_;
   const int waitConnectTime_;
+  MqttSessionConfig sessionConfig_;
+  int64_t loggedOutboundEvents_;
+  int64_t loggedPoolAllocations_;
+  size_t purgedTopics_;  // 本轮扫描已清除的驻留主题
+  boost::scoped_ptr<MqttSessionStore> store_;
+  string retainSnapshotPath_;
+  double retainSnapshotInterval_;
+  ThreadPool retainSnapshotThread_;
+  AtomicInt32 savingRetainSnapshot_;
+  mutable MutexLock ioLoopsMutex_;
+  std::vector<EventLoop*> ioLoops_;
 };
 
 #endif // MQTTSERVER_H
@@ -0,0 +1,43 @@
+#ifndef MQTTSESSIONSTORE_H
+#define MQTTSESSIONSTORE_H
+
+#include <list>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <muduo/base/Types.h>
+
+#include "MqttMessage.h"
+
+//持久会话（clean_session=0）的存储接口，重启后恢复下线会话的订阅与离线消息。
+//在线会话只在内存里，下线时整体写入，重新上线时删除。
+//所有方法线程安全，可由各 IO 线程直接调用。
+class MqttSessionStore : boost::noncopyable
+{
+public:
+  struct StoredSession
+  {
+    string clientID;
+    std::vector<string> topics;
+    std::vector<boost::shared_ptr<MqttMessage> > msgs;
+  };
+
+  virtual ~MqttSessionStore()
+  { }
+
+  //启动时调用一次，在 start 之前，取回上次保存的所有会话
+  virtual void recover(std::vector<StoredSession>* sessions) = 0;
+
+  virtual void start() = 0;
+
+  //会话下线：保存订阅，并丢弃之前为它保存的离线消息
+  virtual void saveSession(const string& clientID, const std::list<MqttTopic>& topics) = 0;
+
+  //会话重新上线，或不再需要保存
+  virtual void removeSession(const string& clientID) = 0;
+
+  //为下线会话追加一条离线消息
+  virtual void enqueue(const string& clientID, const MqttMessage& msg) = 0;
+};
+
+#endif // MQTTSESSIONSTORE_H
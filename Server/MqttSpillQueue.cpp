@@ -0,0 +1,231 @@
+#include "MqttSpillQueue.h"
+
+#include <muduo/base/Logging.h>
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "MqttPublishFrame.h"
+#include "MqttMessagePool.h"
+
+namespace
+{
+  //记录：[u32 主题长度][u32 负载长度][u8 qos][主题][负载]
+  struct RecordHeader
+  {
+    uint32_t topicLen;
+    uint32_t payloadLen;
+    uint8_t qos;
+  } __attribute__ ((packed));
+
+  //写缓冲攒到这么多才写一次文件，读回时每次读这么多
+  const size_t kWriteBatch = 64*1024;
+  const size_t kReadBatch = 256*1024;
+}
+
+MqttSpillQueue::MqttSpillQueue(const string& dir, size_t maxBytes)
+  : dir_(dir),
+    maxBytes_(maxBytes),
+    fd_(-1),
+    writeFailed_(false),
+    readOffset_(0),
+    writeOffset_(0),
+    readPos_(0),
+    count_(0),
+    bytes_(0)
+{
+}
+
+MqttSpillQueue::~MqttSpillQueue()
+{
+  if(fd_ >= 0)
+    ::close(fd_);
+}
+
+bool MqttSpillQueue::open()
+{
+  string path = dir_ + "/spill-XXXXXX";
+  fd_ = ::mkostemp(&path[0], O_CLOEXEC);
+  if(fd_ < 0)
+  {
+    LOG_SYSERR << "spill queue: mkstemp " << path;
+    return false;
+  }
+  ::unlink(path.c_str());
+  return true;
+}
+
+bool MqttSpillQueue::push(const MqttMessage& msg)
+{
+  RecordHeader header;
+  header.topicLen = static_cast<uint32_t>(msg.topic.size());
+  header.payloadLen = static_cast<uint32_t>(msg.payload.size());
+  header.qos = msg.qos;
+  size_t len = sizeof header + msg.topic.size() + msg.payload.size();
+  if(bytes_ + len > maxBytes_)
+    return false;
+
+  writeBuf_.append(reinterpret_cast<const char*>(&header), sizeof header);
+  writeBuf_.append(msg.topic.data(), msg.topic.size());
+  writeBuf_.append(msg.payload.data(), msg.payload.size());
+  ++count_;
+  bytes_ += len;
+
+  if(writeBuf_.size() >= kWriteBatch)
+    flushWrites();
+  return true;
+}
+
+//写不进文件时记录留在内存里，下次再试；总量仍受 maxBytes_ 限制
+void MqttSpillQueue::flushWrites()
+{
+  if(fd_ < 0 && !open())
+    return;
+
+  size_t written = 0;
+  while(written < writeBuf_.size())
+  {
+    ssize_t n = ::pwrite(fd_, writeBuf_.data() + written, writeBuf_.size() - written, writeOffset_);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+    {
+      if(!writeFailed_)
+        LOG_SYSERR << "spill queue: write, keeping " << writeBuf_.size() - written << " bytes in memory";
+      writeFailed_ = true;
+      break;
+    }
+    written += static_cast<size_t>(n);
+    writeOffset_ += n;
+  }
+  if(written == writeBuf_.size())
+    writeFailed_ = false;
+  writeBuf_.erase(0, written);
+}
+
+bool MqttSpillQueue::fill(string* buf, off_t* offset)
+{
+  if(*offset >= writeOffset_)
+    return false;
+
+  size_t len = static_cast<size_t>(std::min(static_cast<off_t>(kReadBatch), writeOffset_ - *offset));
+  size_t old = buf->size();
+  buf->resize(old + len);
+  size_t done = 0;
+  while(done < len)
+  {
+    ssize_t n = ::pread(fd_, &(*buf)[old + done], len - done, *offset + static_cast<off_t>(done));
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+    {
+      //读不出的记录无法恢复，连同缓冲里读了一半的记录一起丢弃，跳过文件余下的内容
+      LOG_SYSERR << "spill queue: read";
+      buf->clear();
+      *offset = writeOffset_;
+      return false;
+    }
+    done += static_cast<size_t>(n);
+  }
+  *offset += static_cast<off_t>(len);
+  return true;
+}
+
+boost::shared_ptr<MqttMessage> MqttSpillQueue::decode(const string& buf, size_t* pos)
+{
+  boost::shared_ptr<MqttMessage> msg;
+  RecordHeader header;
+  if(buf.size() - *pos < sizeof header)
+    return msg;
+  memcpy(&header, buf.data() + *pos, sizeof header);
+  size_t len = sizeof header + header.topicLen + header.payloadLen;
+  if(buf.size() - *pos < len)
+    return msg;
+
+  const char* data = buf.data() + *pos + sizeof header;
+  msg = newMqttMessage();
+  msg->qos = header.qos;
+  msg->retain = false;
+  msg->topic = MqttTopic::intern(StringPiece(data, static_cast<int>(header.topicLen)));
+  msg->payload = newMqttPayload(data + header.topicLen, header.payloadLen);
+  *pos += len;
+  return msg;
+}
+
+void MqttSpillQueue::pop(size_t max, std::deque<boost::shared_ptr<const MqttMessage> >* out)
+{
+  size_t popped = 0;
+  while(popped < max && count_ > 0)
+  {
+    size_t pos = readPos_;
+    boost::shared_ptr<MqttMessage> msg = decode(readBuf_, &readPos_);
+    if(msg)
+    {
+      msg->frame = newMqttPublishFrame(*msg);
+      out->push_back(msg);
+      bytes_ -= readPos_ - pos;
+      --count_;
+      ++popped;
+      continue;
+    }
+
+    //读缓冲里不够一条完整记录：先读文件，文件读完再接上还没写出的部分
+    readBuf_.erase(0, readPos_);
+    readPos_ = 0;
+    if(fill(&readBuf_, &readOffset_))
+      continue;
+    if(!writeBuf_.empty())
+    {
+      readBuf_.append(writeBuf_);
+      writeBuf_.clear();
+      continue;
+    }
+    LOG_ERROR << "spill queue: " << count_ << " messages lost";
+    count_ = 0;
+  }
+
+  //读空后从头复用文件
+  if(count_ == 0)
+  {
+    if(fd_ >= 0 && writeOffset_ > 0 && ::ftruncate(fd_, 0) != 0)
+      LOG_SYSERR << "spill queue: ftruncate";
+    readOffset_ = 0;
+    writeOffset_ = 0;
+    readBuf_.clear();
+    readPos_ = 0;
+    writeBuf_.clear();
+    bytes_ = 0;
+  }
+}
+
+void MqttSpillQueue::forEach(const MessageCallback& f)
+{
+  string buf(readBuf_, readPos_);
+  size_t pos = 0;
+  off_t offset = readOffset_;
+  bool tookWrites = false;
+  size_t seen = 0;
+  while(seen < count_)
+  {
+    boost::shared_ptr<MqttMessage> msg = decode(buf, &pos);
+    if(msg)
+    {
+      f(*msg);
+      ++seen;
+      continue;
+    }
+
+    buf.erase(0, pos);
+    pos = 0;
+    if(fill(&buf, &offset))
+      continue;
+    if(tookWrites)
+      break;
+    buf.append(writeBuf_);
+    tookWrites = true;
+  }
+}
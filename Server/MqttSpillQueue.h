@@ -0,0 +1,63 @@
+#ifndef MQTTSPILLQUEUE_H
+#define MQTTSPILLQUEUE_H
+
+#include <deque>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <muduo/base/Types.h>
+
+#include "MqttMessage.h"
+
+//慢消费者内存队列放不下的消息按顺序追加到磁盘文件，队列空出后再读回。
+//文件创建后立即 unlink，进程退出或对象析构时自动回收。只在会话所属线程使用。
+//
+//读写都在 IO 线程上，因此按批进行：写入先攒在内存里，满 kWriteBatch 才写一次文件；
+//读回时每次读 kReadBatch 字节再逐条解析。未取出的记录超过 maxBytes 后不再接收。
+class MqttSpillQueue : boost::noncopyable
+{
+public:
+  typedef boost::function<void (const MqttMessage&)> MessageCallback;
+
+  MqttSpillQueue(const string& dir, size_t maxBytes);
+  ~MqttSpillQueue();
+
+  //超过字节上限时返回 false，消息未保存
+  bool push(const MqttMessage& msg);
+  //按写入顺序取出最多 max 条追加到 out
+  void pop(size_t max, std::deque<boost::shared_ptr<const MqttMessage> >* out);
+  //按写入顺序把每条消息交给 f，不取出；读文件时同样按批，内存占用与队列长度无关
+  void forEach(const MessageCallback& f);
+
+  size_t size() const
+  { return count_; }
+
+  bool empty() const
+  { return count_ == 0; }
+
+  //未取出的记录占用的字节数
+  size_t bytes() const
+  { return bytes_; }
+
+private:
+  bool open();
+  void flushWrites();
+  //从文件的 offset 处读一批追加到 buf，文件已读完时返回 false
+  bool fill(string* buf, off_t* offset);
+  //从 buf 的 pos 处解析一条完整记录，不完整时返回空
+  static boost::shared_ptr<MqttMessage> decode(const string& buf, size_t* pos);
+
+  const string dir_;
+  const size_t maxBytes_;
+  int fd_;
+  bool writeFailed_;
+  off_t readOffset_;   // 文件中下一次读取的位置
+  off_t writeOffset_;  // 文件已写到的位置
+  string readBuf_;     // 从文件读出尚未取出的数据，readPos_ 之前的已取出
+  size_t readPos_;
+  string writeBuf_;    // 尚未写入文件的记录，排在文件内容之后
+  size_t count_;
+  size_t bytes_;
+};
+
+#endif // MQTTSPILLQUEUE_H
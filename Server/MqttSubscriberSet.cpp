@@ -0,0 +1,166 @@
+#include "MqttSubscriberSet.h"
+
+#include <limits>
+#include <string.h>
+
+#include "MqttClient.h"
+
+const size_t MqttSubscription::kNoSlot;
+
+namespace
+{
+
+const char kSharePrefix[] = "$share/";
+const size_t kSharePrefixLength = sizeof kSharePrefix - 1;
+//轮询或哈希选中离线成员时最多再往后看几个，保持 O(1)
+const size_t kShareProbes = 4;
+
+typedef boost::shared_ptr<MqttClientSession> SessionPtr;
+
+//离线的排在最后
+uint64_t loadOf(const SessionPtr& session)
+{
+  int64_t backlog = session->backlog();
+  return backlog < 0 ? std::numeric_limits<uint64_t>::max() : static_cast<uint64_t>(backlog);
+}
+
+}
+
+MqttSubscription::MqttSubscription(const MqttTopic& subscribed)
+  : topic(subscribed),
+    filter(subscribed),
+    slot(kNoSlot)
+{
+  if(!isShareFilter(subscribed))
+    return;
+
+  //组名非空且不含通配符，其后的过滤器非空
+  const string& name = subscribed.str();
+  size_t end = name.find('/', kSharePrefixLength);
+  if(end == string::npos || end == kSharePrefixLength || end + 1 == name.size() ||
+     name.find_first_of("+#", kSharePrefixLength) < end)
+    return;
+
+  group = MqttTopic::intern(StringPiece(name.data() + kSharePrefixLength,
+                                        static_cast<int>(end - kSharePrefixLength)));
+  filter = MqttTopic::intern(StringPiece(name.data() + end + 1, static_cast<int>(name.size() - end - 1)));
+}
+
+bool MqttSubscription::isShareFilter(const MqttTopic& topic)
+{
+  return topic.size() > kSharePrefixLength && memcmp(topic.data(), kSharePrefix, kSharePrefixLength) == 0;
+}
+
+bool MqttSubscriberSet::add(const SessionPtr& session, MqttSubscription* subscription)
+{
+  MutexLockGuard lock(mutex_);
+  if(subscription->slot != MqttSubscription::kNoSlot)
+    return false;
+
+  Entry e;
+  e.session_ = session;
+  e.subscription_ = subscription;
+  if(!subscription->shared())
+  {
+    subscription->slot = entries_.size();
+    entries_.push_back(e);
+    return true;
+  }
+
+  //一个过滤器上的组通常只有几个
+  size_t i = 0;
+  while(i < groups_.size() && groups_[i].name_ != subscription->group)
+    ++i;
+  if(i == groups_.size())
+  {
+    groups_.push_back(Group());
+    groups_.back().name_ = subscription->group;
+    groups_.back().next_ = 0;
+  }
+  subscription->slot = groups_[i].members_.size();
+  groups_[i].members_.push_back(e);
+  ++members_;
+  return true;
+}
+
+bool MqttSubscriberSet::remove(MqttSubscription* subscription)
+{
+  MutexLockGuard lock(mutex_);
+  if(!subscription->shared())
+    return removeEntry(&entries_, subscription);
+
+  size_t i = 0;
+  while(i < groups_.size() && groups_[i].name_ != subscription->group)
+    ++i;
+  if(i == groups_.size() || !removeEntry(&groups_[i].members_, subscription))
+    return false;
+  --members_;
+
+  if(groups_[i].members_.empty())
+  {
+    if(i != groups_.size() - 1)
+      std::swap(groups_[i], groups_.back());
+    groups_.pop_back();
+  }
+  return true;
+}
+
+bool MqttSubscriberSet::removeEntry(std::vector<Entry>* entries, MqttSubscription* subscription)
+{
+  size_t slot = subscription->slot;
+  if(slot >= entries->size() || (*entries)[slot].subscription_ != subscription)
+    return false;
+
+  Entry& last = entries->back();
+  if(slot != entries->size() - 1)
+  {
+    last.subscription_->slot = slot;
+    (*entries)[slot].session_.swap(last.session_);
+    (*entries)[slot].subscription_ = last.subscription_;
+  }
+  entries->pop_back();
+  subscription->slot = MqttSubscription::kNoSlot;
+
+  //大集合缩到四分之一以下时归还内存
+  if(entries->capacity() > 64 && entries->size() < entries->capacity() / 4)
+    std::vector<Entry>(*entries).swap(*entries);
+  return true;
+}
+
+const SessionPtr& MqttSubscriberSet::pick(Group* group, MqttShareStrategy strategy, uint64_t hash)
+{
+  const std::vector<Entry>& members = group->members_;
+  const size_t n = members.size();
+  size_t start = 0;
+  if(strategy == kShareLeastInflight)
+  {
+    //两个候选中取负载低的，不必知道全组的负载
+    size_t a = static_cast<size_t>(group->next_++ % n);
+    uint64_t x = group->next_ * 0x9E3779B97F4A7C15ULL;
+    size_t b = static_cast<size_t>((x ^ (x >> 31)) % n);
+    if(b == a)
+      b = (a + 1) % n;
+    return loadOf(members[b].session_) < loadOf(members[a].session_) ? members[b].session_ : members[a].session_;
+  }
+  else if(strategy == kShareStickyHash)
+  {
+    start = static_cast<size_t>(hash % n);
+  }
+  else
+  {
+    start = static_cast<size_t>(group->next_++ % n);
+  }
+
+  for(size_t k = 0; k < kShareProbes && k < n; ++k)
+  {
+    const SessionPtr& session = members[(start + k) % n].session_;
+    if(session->backlog() >= 0)
+    {
+      //轮询跳过离线成员后从选中者的下一个继续，否则它后面的成员会多分到一份
+      if(strategy == kShareRoundRobin)
+        group->next_ += k;
+      return session;
+    }
+  }
+  return members[start].session_;
+}
@@ -0,0 +1,104 @@
+#ifndef MQTTSUBSCRIBERSET_H
+#define MQTTSUBSCRIBERSET_H
+
+#include <stdint.h>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <muduo/base/Mutex.h>
+
+#include "MqttTopic.h"
+
+class MqttClientSession;
+
+//共享订阅每条消息从组内选一个成员投递的方式
+enum MqttShareStrategy
+{
+  kShareRoundRobin,
+  kShareLeastInflight,  // 轮到的与随机的一个中取未确认、排队消息少的，离线的不选
+  kShareStickyHash      // 同一主题总是给同一个成员，成员变化时重新分配
+};
+
+//会话对一个主题过滤器的订阅，保存在会话的订阅表中（地址须稳定）。
+//slot 是它在该过滤器订阅者集合（或共享组）中的下标，作为集合的侵入式句柄，只在集合的锁内读写。
+//共享订阅 "$share/<group>/<filter>" 拆成 group 与 filter，普通订阅的 group 为空、filter 即 topic
+struct MqttSubscription
+{
+  static const size_t kNoSlot = static_cast<size_t>(-1);
+
+  explicit MqttSubscription(const MqttTopic& subscribed);
+
+  bool shared() const
+  { return !group.empty(); }
+
+  //以 "$share/" 开头；格式不对的不是共享订阅，也不应当作普通过滤器订阅
+  static bool isShareFilter(const MqttTopic& topic);
+
+  MqttTopic topic;   // 客户端订阅时的原样
+  MqttTopic filter;  // 用来匹配主题的过滤器
+  MqttTopic group;
+  size_t slot;
+};
+
+//一个主题过滤器的订阅者，按下标连续存放。
+//删除时把最后一个移到空出的位置并改写它的句柄，增删都是 O(1)；
+//句柄同时保证同一订阅只出现一次。集合持有会话，会话须退订后才会释放。
+//同一过滤器的共享订阅按组名分组，组内成员同样按下标存放，每次发布每组只选出一个。
+//自带锁，外层的主题表只负责找到集合，遍历大集合时不占住整个分片。
+class MqttSubscriberSet : boost::noncopyable
+{
+public:
+  MqttSubscriberSet()
+    :members_(0)
+  { }
+
+  //订阅已在某个集合中时返回 false
+  bool add(const boost::shared_ptr<MqttClientSession>& session, MqttSubscription* subscription);
+  //订阅不在本集合中时返回 false
+  bool remove(MqttSubscription* subscription);
+
+  //普通订阅者与各共享组成员的总数
+  size_t size() const
+  {
+    MutexLockGuard lock(mutex_);
+    return entries_.size() + members_;
+  }
+
+  //持锁按下标顺序对每个普通订阅者调用 f(session)，再对每个共享组按 strategy 选出的一个成员调用 f，
+  //hash 为发布主题的哈希，供 kShareStickyHash 使用。f 不能再访问本集合
+  template<typename F>
+  void forEach(F& f, MqttShareStrategy strategy = kShareRoundRobin, uint64_t hash = 0) const
+  {
+    MutexLockGuard lock(mutex_);
+    for(size_t i = 0; i < entries_.size(); ++i)
+      f(entries_[i].session_);
+    for(size_t i = 0; i < groups_.size(); ++i)
+      f(pick(&groups_[i], strategy, hash));
+  }
+
+private:
+  struct Entry
+  {
+    boost::shared_ptr<MqttClientSession> session_;
+    MqttSubscription* subscription_;
+  };
+
+  struct Group
+  {
+    MqttTopic name_;
+    std::vector<Entry> members_;
+    uint64_t next_;  // 轮询位置，也作随机数种子
+  };
+
+  static bool removeEntry(std::vector<Entry>* entries, MqttSubscription* subscription);
+  //O(1)，不遍历组内成员
+  static const boost::shared_ptr<MqttClientSession>& pick(Group* group, MqttShareStrategy strategy, uint64_t hash);
+
+  mutable MutexLock mutex_;
+  std::vector<Entry> entries_;
+  //轮询位置在发布时推进
+  mutable std::vector<Group> groups_;
+  size_t members_;
+};
+
+#endif // MQTTSUBSCRIBERSET_H
@@ -0,0 +1,157 @@
+#include "MqttTopic.h"
+
+#include <boost/noncopyable.hpp>
+#include <boost/unordered_map.hpp>
+#include <muduo/base/Mutex.h>
+#include <muduo/base/Singleton.h>
+
+#include "MqttPersistentMap.h"
+
+MqttTopic::Rep::Rep(const StringPiece& name)
+  : name_(name.data(), name.size()),
+    hash_(MqttPersistentMap<bool>::hashKey(name)),
+    wildcards_(false)
+{
+  for(int i = 0; i < name.size(); ++i)
+  {
+    if(name[i] == '/')
+      levelEnds_.push_back(static_cast<uint16_t>(i));
+    else if(name[i] == '+' || name[i] == '#')
+      wildcards_ = true;
+  }
+  levelEnds_.push_back(static_cast<uint16_t>(name.size()));
+}
+
+//按哈希高位分片，每片一把锁；表中的引用计数为 1 说明已没有其他持有者
+class MqttTopicTable : boost::noncopyable
+{
+public:
+  MqttTopic intern(const StringPiece& name)
+  {
+    uint64_t hash = MqttPersistentMap<bool>::hashKey(name);
+    Shard& shard = shards_[hash >> (64 - kShardBits)];
+    MutexLockGuard lock(shard.mutex_);
+    std::pair<Map::iterator, Map::iterator> range = shard.map_.equal_range(hash);
+    for(Map::iterator it = range.first; it != range.second; ++it)
+    {
+      if(StringPiece(it->second->name_) == name)
+        return MqttTopic(it->second);
+    }
+    MqttTopic::RepPtr rep(new MqttTopic::Rep(name));
+    shard.map_.insert(std::make_pair(hash, rep));
+    return MqttTopic(rep);
+  }
+
+  size_t size()
+  {
+    size_t n = 0;
+    for(int i = 0; i < kShards; ++i)
+    {
+      MutexLockGuard lock(shards_[i].mutex_);
+      n += shards_[i].map_.size();
+    }
+    return n;
+  }
+
+  MqttTopicTable()
+    : purgeShard_(0),
+      purgeBucket_(0)
+  { }
+
+  //从上次停下的桶继续，按桶检查，至少 maxScanned 个表项后停下，一次只持一个分片的锁。
+  //两次调用之间表扩容时桶号会错位，漏掉的主题留到下一轮
+  size_t purge(size_t maxScanned, bool* sweepDone)
+  {
+    size_t removed = 0;
+    size_t scanned = 0;
+    *sweepDone = false;
+    std::vector<uint64_t> hashes;
+    for(int visited = 0; visited < kShards && scanned < maxScanned; ++visited)
+    {
+      Shard& shard = shards_[purgeShard_];
+      {
+        MutexLockGuard lock(shard.mutex_);
+        size_t buckets = shard.map_.bucket_count();
+        while(purgeBucket_ < buckets && scanned < maxScanned)
+        {
+          size_t bucket = purgeBucket_++;
+          hashes.clear();
+          for(Map::local_iterator it = shard.map_.begin(bucket); it != shard.map_.end(bucket); ++it)
+          {
+            ++scanned;
+            //持锁时别处无法从表中取得新引用，计数不会从 1 再增加
+            if(it->second.unique())
+              hashes.push_back(it->first);
+          }
+          for(size_t i = 0; i < hashes.size(); ++i)
+          {
+            std::pair<Map::iterator, Map::iterator> range = shard.map_.equal_range(hashes[i]);
+            for(Map::iterator it = range.first; it != range.second; )
+            {
+              if(it->second.unique())
+              {
+                it = shard.map_.erase(it);
+                ++removed;
+              }
+              else
+              {
+                ++it;
+              }
+            }
+          }
+        }
+        if(purgeBucket_ < buckets)
+          break;
+      }
+      purgeBucket_ = 0;
+      purgeShard_ = (purgeShard_ + 1) % kShards;
+      if(purgeShard_ == 0)
+        *sweepDone = true;
+    }
+    return removed;
+  }
+
+private:
+  static const int kShardBits = 4;
+  static const int kShards = 1 << kShardBits;
+
+  typedef boost::unordered_multimap<uint64_t, MqttTopic::RepPtr> Map;
+
+  struct Shard
+  {
+    MutexLock mutex_;
+    Map map_;
+  };
+
+  Shard shards_[kShards];
+  //purge 的游标，只由调用 purge 的线程访问
+  int purgeShard_;
+  size_t purgeBucket_;
+};
+
+const MqttTopic::Rep& MqttTopic::emptyRep()
+{
+  static const Rep empty((StringPiece()));
+  return empty;
+}
+
+MqttTopic::MqttTopic()
+{
+}
+
+MqttTopic MqttTopic::intern(const StringPiece& name)
+{
+  if(name.empty())
+    return MqttTopic();
+  return Singleton<MqttTopicTable>::instance().intern(name);
+}
+
+size_t MqttTopic::internedCount()
+{
+  return Singleton<MqttTopicTable>::instance().size();
+}
+
+size_t MqttTopic::purge(size_t maxScanned, bool* sweepDone)
+{
+  return Singleton<MqttTopicTable>::instance().purge(maxScanned, sweepDone);
+}
@@ -0,0 +1,100 @@
+#ifndef MQTTTOPIC_H
+#define MQTTTOPIC_H
+
+#include <stdint.h>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <muduo/base/StringPiece.h>
+#include <muduo/base/Types.h>
+
+using namespace muduo;
+
+//驻留的主题名或订阅过滤器。相同的字符串全局只保存一份，消息、会话订阅表与索引
+//都只持有指向它的引用；哈希、各层级边界、是否含通配符在驻留时算好，之后不再扫描字符串。
+//两个 MqttTopic 相等当且仅当指向同一份，比较只需比指针。
+//
+//驻留表按哈希分片加锁，不再被引用的主题由 purge() 分批定期清除。
+class MqttTopic
+{
+public:
+  //空主题
+  MqttTopic();
+
+  static MqttTopic intern(const StringPiece& name);
+
+  const string& str() const
+  { return rep().name_; }
+
+  const char* data() const
+  { return rep().name_.data(); }
+
+  size_t size() const
+  { return rep().name_.size(); }
+
+  bool empty() const
+  { return rep().name_.empty(); }
+
+  //与 MqttPersistentMap::hashKey 相同
+  uint64_t hash() const
+  { return rep().hash_; }
+
+  bool hasWildcards() const
+  { return rep().wildcards_; }
+
+  //以 '$' 开头的系统主题不被首层通配符匹配
+  bool isSystem() const
+  { return !empty() && data()[0] == '$'; }
+
+  //"a/b/" 有三层，最后一层为空；空主题算一层
+  size_t levelCount() const
+  { return rep().levelEnds_.size(); }
+
+  StringPiece level(size_t i) const
+  {
+    size_t begin = i == 0 ? 0 : rep().levelEnds_[i-1] + 1u;
+    return StringPiece(data() + begin, static_cast<int>(rep().levelEnds_[i] - begin));
+  }
+
+  void swap(MqttTopic& rhs)
+  { rep_.swap(rhs.rep_); }
+
+  bool operator==(const MqttTopic& rhs) const
+  { return rep_ == rhs.rep_; }
+
+  bool operator!=(const MqttTopic& rhs) const
+  { return rep_ != rhs.rep_; }
+
+  //驻留表中的主题数
+  static size_t internedCount();
+  //从上次停下的位置继续清除只剩驻留表引用的主题，检查约 maxScanned 个后停下，返回清除的个数。
+  //扫完整张表时 *sweepDone 为 true。只能在一个线程调用
+  static size_t purge(size_t maxScanned, bool* sweepDone);
+
+private:
+  struct Rep
+  {
+    explicit Rep(const StringPiece& name);
+
+    string name_;
+    uint64_t hash_;
+    bool wildcards_;
+    std::vector<uint16_t> levelEnds_;  // 每层结束处的偏移
+  };
+  typedef boost::shared_ptr<const Rep> RepPtr;
+
+  explicit MqttTopic(const RepPtr& ptr)
+    : rep_(ptr)
+  { }
+
+  //空主题不进驻留表，rep_ 为空
+  const Rep& rep() const
+  { return rep_ ? *rep_ : emptyRep(); }
+
+  static const Rep& emptyRep();
+
+  friend class MqttTopicTable;
+
+  RepPtr rep_;
+};
+
+#endif // MQTTTOPIC_H
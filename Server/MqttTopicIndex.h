@@ -0,0 +1,241 @@
+#ifndef MQTTTOPICINDEX_H
+#define MQTTTOPICINDEX_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "MqttTopic.h"
+
+//以驻留主题为键的开放寻址哈希表（Swiss table 式）。
+//槽位按 16 个一组，每组另有 16 字节控制字：空、已删除，或哈希的高 7 位。
+//查找时一条 SSE2 比较筛出组内候选，键只比较驻留指针，
+//通常一次控制字读取加一次槽位读取即可命中，不必像树那样逐层跳转。
+//
+//本身不加锁，也不能 O(1) 拷贝；并发访问由调用者分片加锁。
+//值宜为 shared_ptr，读者在锁内拷出后即可放开分片锁。MqttTopicTree 里的值是
+//可变的 MqttSubscriberSet，增删订阅者由集合自己的锁保护，表只在集合新建或移除时改动。
+template<typename V>
+class MqttTopicIndex
+{
+public:
+  MqttTopicIndex()
+    : groups_(0),
+      size_(0),
+      growthLeft_(0)
+  { }
+
+  const V* find(const MqttTopic& key) const
+  {
+    size_t index = findIndex(key, mix(key.hash()));
+    return index == kNotFound ? NULL : &slots_[index].value_;
+  }
+
+  //插入或替换 key 对应的值
+  void set(const MqttTopic& key, const V& value)
+  {
+    uint64_t hash = mix(key.hash());
+    size_t index = findIndex(key, hash);
+    if(index != kNotFound)
+    {
+      slots_[index].value_ = value;
+      return;
+    }
+
+    index = findInsertSlot(hash);
+    //没有空余且要占用的是空槽时先扩容（删除标记多时原大小重建即可）
+    if(growthLeft_ == 0 && ctrl_[index] == kEmpty)
+    {
+      rehash(size_ * 2 >= maxLoad(groups_) ? (groups_ == 0 ? 1 : groups_ * 2) : groups_);
+      index = findInsertSlot(hash);
+    }
+    if(ctrl_[index] == kEmpty)
+      --growthLeft_;
+    ctrl_[index] = h2(hash);
+    slots_[index].key_ = key;
+    slots_[index].value_ = value;
+    ++size_;
+  }
+
+  bool erase(const MqttTopic& key)
+  {
+    size_t index = findIndex(key, mix(key.hash()));
+    if(index == kNotFound)
+      return false;
+
+    //按组探测：组内还有空槽说明没有探测序列越过本组，可直接置空，否则留删除标记
+    const int8_t* group = &ctrl_[index / kGroupSize * kGroupSize];
+    if(matchEmpty(group))
+    {
+      ctrl_[index] = kEmpty;
+      ++growthLeft_;
+    }
+    else
+    {
+      ctrl_[index] = kDeleted;
+    }
+    slots_[index] = Slot();
+    --size_;
+    return true;
+  }
+
+  size_t size() const
+  { return size_; }
+
+  bool empty() const
+  { return size_ == 0; }
+
+  size_t capacity() const
+  { return groups_ * kGroupSize; }
+
+  //按任意顺序对每个元素调用 f(key, value)
+  template<typename F>
+  void forEach(F& f) const
+  {
+    for(size_t i = 0; i < ctrl_.size(); ++i)
+    {
+      if(ctrl_[i] >= 0)
+        f(slots_[i].key_, slots_[i].value_);
+    }
+  }
+
+private:
+  static const size_t kGroupSize = 16;
+  static const size_t kNotFound = static_cast<size_t>(-1);
+  static const int8_t kEmpty = -128;
+  static const int8_t kDeleted = -2;
+
+  struct Slot
+  {
+    MqttTopic key_;
+    V value_;
+  };
+
+  //驻留主题的哈希直接取自字符串，乘一次让高位也充分混合；
+  //最高 7 位存入控制字，组号取其下的位
+  static uint64_t mix(uint64_t hash)
+  { return hash * 0x9E3779B97F4A7C15ULL; }
+
+  static int8_t h2(uint64_t hash)
+  { return static_cast<int8_t>(hash >> 57); }
+
+  static size_t h1(uint64_t hash)
+  { return static_cast<size_t>(hash >> 7); }
+
+  static size_t maxLoad(size_t groups)
+  { return groups * kGroupSize * 7 / 8; }
+
+#ifdef __SSE2__
+  static uint32_t match(const int8_t* group, int8_t value)
+  {
+    __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(value), ctrl)));
+  }
+
+  //空与删除标记的最高位为 1
+  static uint32_t matchEmptyOrDeleted(const int8_t* group)
+  {
+    __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    return static_cast<uint32_t>(_mm_movemask_epi8(ctrl));
+  }
+#else
+  static uint32_t match(const int8_t* group, int8_t value)
+  {
+    uint32_t mask = 0;
+    for(size_t i = 0; i < kGroupSize; ++i)
+    {
+      if(group[i] == value)
+        mask |= 1u << i;
+    }
+    return mask;
+  }
+
+  static uint32_t matchEmptyOrDeleted(const int8_t* group)
+  {
+    uint32_t mask = 0;
+    for(size_t i = 0; i < kGroupSize; ++i)
+    {
+      if(group[i] < 0)
+        mask |= 1u << i;
+    }
+    return mask;
+  }
+#endif
+
+  static uint32_t matchEmpty(const int8_t* group)
+  { return match(group, kEmpty); }
+
+  //组号取哈希去掉 h2 后的部分，之后按三角数跳组，组数为 2 的幂时能走遍所有组
+  size_t findIndex(const MqttTopic& key, uint64_t hash) const
+  {
+    if(groups_ == 0)
+      return kNotFound;
+    size_t mask = groups_ - 1;
+    size_t group = h1(hash) & mask;
+    int8_t tag = h2(hash);
+    for(size_t step = 1; step <= groups_; ++step)
+    {
+      const int8_t* ctrl = &ctrl_[group * kGroupSize];
+      uint32_t candidates = match(ctrl, tag);
+      while(candidates)
+      {
+        size_t index = group * kGroupSize + static_cast<size_t>(__builtin_ctz(candidates));
+        if(slots_[index].key_ == key)
+          return index;
+        candidates &= candidates - 1;
+      }
+      if(matchEmpty(ctrl))
+        return kNotFound;
+      group = (group + step) & mask;
+    }
+    return kNotFound;
+  }
+
+  //调用前须确认 key 不在表中；表为空时先分配
+  size_t findInsertSlot(uint64_t hash)
+  {
+    if(groups_ == 0)
+      rehash(1);
+    size_t mask = groups_ - 1;
+    size_t group = h1(hash) & mask;
+    for(size_t step = 1; ; ++step)
+    {
+      uint32_t available = matchEmptyOrDeleted(&ctrl_[group * kGroupSize]);
+      if(available)
+        return group * kGroupSize + static_cast<size_t>(__builtin_ctz(available));
+      group = (group + step) & mask;
+    }
+  }
+
+  void rehash(size_t groups)
+  {
+    std::vector<int8_t> ctrl(groups * kGroupSize, static_cast<int8_t>(kEmpty));
+    std::vector<Slot> slots(groups * kGroupSize);
+    ctrl_.swap(ctrl);
+    slots_.swap(slots);
+    groups_ = groups;
+    growthLeft_ = maxLoad(groups) - size_;
+
+    for(size_t i = 0; i < ctrl.size(); ++i)
+    {
+      if(ctrl[i] < 0)
+        continue;
+      uint64_t hash = mix(slots[i].key_.hash());
+      size_t index = findInsertSlot(hash);
+      ctrl_[index] = h2(hash);
+      slots_[index].key_.swap(slots[i].key_);
+      std::swap(slots_[index].value_, slots[i].value_);
+    }
+  }
+
+  std::vector<int8_t> ctrl_;
+  std::vector<Slot> slots_;
+  size_t groups_;
+  size_t size_;
+  size_t growthLeft_;  // 还可占用的空槽数，保持负载不超过 7/8
+};
+
+#endif // MQTTTOPICINDEX_H
@@ -1,239 +1,511 @@
 #include "MqttTopicTree.h"
 #include <boost/bind.hpp>
-#include <boost/algorithm/string/split.hpp>
-
-#include <boost/algorithm/string/classification.hpp>
+#include <boost/make_shared.hpp>
 #include <vector>
 #include <muduo/base/Logging.h>
 
+#include "MqttPublishFrame.h"
+#include "MqttMessagePool.h"
+#include "MqttMetrics.h"
+#include "MqttLatency.h"
+
 
 MqttTopicTree::MqttTopicTree()
-  : topicMapPtr_(new type_topicMap()),
-    wildcardTopicMapPtr_(new type_wildcardsTopicMap())
+  : retainSaving_(false),
+    retainVersion_(0),
+    savedRetainVersion_(0),
+    shareStrategy_(kShareRoundRobin)
 {
-  assert(topicMapPtr_);
 }
 
 
-void MqttTopicTree::addSubscriber(const string& topic, const boost::shared_ptr<MqttClientSession>& subscriber)
+void MqttTopicTree::addSubscriber(MqttSubscription& subscription, const boost::shared_ptr<MqttClientSession>& subscriber,
+                                  bool sendRetained)
 {
-  if( !haveWildcards(topic))
+  const MqttTopic& topic = subscription.filter;
+  if(subscription.shared())
+    sendRetained = false;
+  if(!topic.hasWildcards())
   {
-    MutexLockGuard lock(mutexTopicMap_);
-    if(!topicMapPtr_.unique())
     {
-      type_topicMapPtr newTopicMapPtr(new type_topicMap(*topicMapPtr_));
-      topicMapPtr_.swap(newTopicMapPtr);
+      TopicShard& shard = topicShard(topic);
+      MutexLockGuard lock(shard.mutex_);
+      const type_subscribersPtr* subscribers = shard.index_.find(topic);
+      if(subscribers)
+      {
+        (*subscribers)->add(subscriber, &subscription);
+      }
+      else
+      {
+        type_subscribersPtr created(new MqttSubscriberSet);
+        created->add(subscriber, &subscription);
+        shard.index_.set(topic, created);
+      }
     }
-    content& v = (*topicMapPtr_)[topic];
-    v.subscribers_.push_back(subscriber);
-    if(v.retainMsg_)
+    boost::shared_ptr<MqttMessage> retainMsg;
+    if(sendRetained)
+      retainMsg = getRetainMsg(topic);
+    if(retainMsg)
     {
-      subscriber->publish(v.retainMsg_);
+      subscriber->publish(retainMsg);
     }
   }
   else // have wildcards
   {
     {
-      MutexLockGuard lock(mutexWildcardTopicMap_);
-      if(!wildcardTopicMapPtr_.unique())
+      //集合为各快照共享，只有新建时才修改前缀树
+      MutexLockGuard lock(mutexWildcardTopicTrie_);
+      const type_subscribersPtr* subscribers = wildcardTopicTrie_.find(topic.str());
+      if(subscribers)
+      {
+        (*subscribers)->add(subscriber, &subscription);
+      }
+      else
       {
-        type_wildcardsTopicMapPtr newwildcardsTopicMapPtr(new type_wildcardsTopicMap(*wildcardTopicMapPtr_));
-        wildcardTopicMapPtr_.swap(newwildcardsTopicMapPtr);
+        type_subscribersPtr created(new MqttSubscriberSet);
+        created->add(subscriber, &subscription);
+        wildcardTopicTrie_.set(topic.str(), created);
       }
-      type_subscribersList& subscribers = (*wildcardTopicMapPtr_)[topic];
-      subscribers.push_back(subscriber);
     }
-    std::vector<boost::shared_ptr<MqttMessage> > retainMsgs = getRetainMsg(topic);
-    for(std::vector<boost::shared_ptr<MqttMessage> >::iterator it=retainMsgs.begin();
-        it!=retainMsgs.end(); ++it)
+    if(!sendRetained)
+      return;
+
+    type_retainTrie retained;
+    boost::shared_ptr<const MqttRetainSnapshot> snapshot;
     {
-      subscriber->publish(*it);
+      MutexLockGuard lock(mutexRetainTrie_);
+      retained = retainTrie_;
+      snapshot = retainSnapshot_;
     }
-
+    //在所属线程分页投递，第一页也在 SUBACK 之后
+    RetainScanPtr scan(new RetainScan(retained, snapshot, topic.str(), subscriber));
+    subscriber->ownerLoop()->queueInLoop(
+          boost::bind(&MqttTopicTree::sendRetainPage, this, scan));
   }
 }
 
-void MqttTopicTree::unSubscriber(const string& topic, const boost::shared_ptr<MqttClientSession>& subscriber)
+//集合清空后从表中移除，仍持有旧快照的读者看到的是空集合
+void MqttTopicTree::unSubscriber(MqttSubscription& subscription)
 {
-  if( !haveWildcards(topic))
+  const MqttTopic& topic = subscription.filter;
+  if(!topic.hasWildcards())
   {
-    LOG_DEBUG << "unsub " << topic;
-    MutexLockGuard lock(mutexTopicMap_);
-    if(!topicMapPtr_.unique())
-    {
-      type_topicMapPtr newTopicMapPtr(new type_topicMap(*topicMapPtr_));
-      topicMapPtr_.swap(newTopicMapPtr);
-    }
-    content& v = (*topicMapPtr_)[topic];
-    type_subscribersList::iterator it = std::find_if( v.subscribers_.begin(),
-                                                      v.subscribers_.end(),
-                                                      findSubscriber(subscriber));
-    if(it != v.subscribers_.end())
-      v.subscribers_.erase(it);
-
-    if(v.subscribers_.size() == 0 && !v.retainMsg_)
-      topicMapPtr_->erase(topic);
+    LOG_DEBUG << "unsub " << topic.str();
+    TopicShard& shard = topicShard(topic);
+    MutexLockGuard lock(shard.mutex_);
+    const type_subscribersPtr* subscribers = shard.index_.find(topic);
+    if(!subscribers || !(*subscribers)->remove(&subscription))
+      return;
+
+    if((*subscribers)->size() == 0)
+      shard.index_.erase(topic);
   }
   else
   {
-    LOG_DEBUG << "unsub # " << topic;
-    MutexLockGuard lock(mutexWildcardTopicMap_);
-    if(!wildcardTopicMapPtr_.unique())
-    {
-      type_wildcardsTopicMapPtr newwildcardsTopicMapPtr(new type_wildcardsTopicMap(*wildcardTopicMapPtr_));
-      wildcardTopicMapPtr_.swap(newwildcardsTopicMapPtr);
-    }
-    type_subscribersList& subscribers = (*wildcardTopicMapPtr_)[topic];
-    type_subscribersList::iterator it = std::find_if( subscribers.begin(),
-                                                      subscribers.end(),
-                                                      findSubscriber(subscriber));
-    if(it != subscribers.end())
-      subscribers.erase(it);
-
-    if(subscribers.size() == 0)
-      wildcardTopicMapPtr_->erase(topic);
+    LOG_DEBUG << "unsub # " << topic.str();
+    MutexLockGuard lock(mutexWildcardTopicTrie_);
+    const type_subscribersPtr* subscribers = wildcardTopicTrie_.find(topic.str());
+    if(!subscribers || !(*subscribers)->remove(&subscription))
+      return;
+
+    if((*subscribers)->size() == 0)
+      wildcardTopicTrie_.erase(topic.str());
   }
 }
 
-MqttTopicTree::type_subscribersList MqttTopicTree::querySubscribers(const string& topic)
+size_t MqttTopicTree::querySubscribers(const MqttTopic& topic, LoopBatches* batches)
 {
-  assert(!haveWildcards(topic));
-  type_subscribersList ret;
+  assert(!topic.hasWildcards());
+  size_t matched = 0;
 
+  //只在分片锁内取出集合，遍历时只持有集合自己的锁
+  type_subscribersPtr subscribers;
   {
-    type_topicMapPtr ptr;
-    {
-      MutexLockGuard lock(mutexTopicMap_);
-      ptr = topicMapPtr_;
-    }
-
-    type_topicMap::iterator it = ptr->find(topic);
-    if(it != ptr->end())
-    {
-      type_subscribersList tmp = it->second.subscribers_;
-      ret.merge(tmp);
-    }
+    TopicShard& shard = topicShard(topic);
+    MutexLockGuard lock(shard.mutex_);
+    const type_subscribersPtr* v = shard.index_.find(topic);
+    if(v)
+      subscribers = *v;
+  }
+  if(subscribers)
+  {
+    subscribers->forEach(*batches, shareStrategy_, topic.hash());
+    ++matched;
   }
 
   //通配符订阅者
+  type_wildcardsTopicTrie snapshot;
   {
-    type_wildcardsTopicMapPtr ptr;
-    {
-      MutexLockGuard lock(mutexWildcardTopicMap_);
-      ptr = wildcardTopicMapPtr_;
-    }
-    for(type_wildcardsTopicMap::iterator it=ptr->begin(); it!=ptr->end(); ++it)
-    {
-      if(matchingWildcard(it->first, topic))
-      {
-        type_subscribersList tmp = it->second;
-        ret.merge(tmp);
-      }
-    }
+    MutexLockGuard lock(mutexWildcardTopicTrie_);
+    snapshot = wildcardTopicTrie_;
   }
+  std::vector<const type_subscribersPtr*> wildcards;
+  snapshot.match(topic, &wildcards);
+  for(size_t i=0; i<wildcards.size(); ++i)
+  {
+    (*wildcards[i])->forEach(*batches, shareStrategy_, topic.hash());
+    ++matched;
+  }
+
+  return matched;
+}
+
+void MqttTopicTree::LoopBatches::operator ()(const boost::shared_ptr<MqttClientSession>& subscriber)
+{
+  //离线会话也交给所属线程存储，会话状态只由一个线程修改
+  EventLoop* loop = subscriber->ownerLoop();
+
+  std::vector<std::pair<EventLoop*, SessionBatchPtr> >::iterator batch = batches_.begin();
+  while(batch != batches_.end() && batch->first != loop)
+    ++batch;
+  if(batch == batches_.end())
+  {
+    batches_.push_back(std::make_pair(loop, boost::allocate_shared<SessionBatch>(MqttPoolAllocator<SessionBatch>())));
+    batch = batches_.end() - 1;
+  }
+  batch->second->push_back(subscriber);
+}
 
-  return ret;
+void MqttTopicTree::LoopBatches::unique()
+{
+  for(size_t i=0; i<batches_.size(); ++i)
+  {
+    SessionBatch& batch = *batches_[i].second;
+    std::sort(batch.begin(), batch.end());
+    batch.erase(std::unique(batch.begin(), batch.end()), batch.end());
+  }
 }
 
-std::vector<boost::shared_ptr<MqttMessage> > MqttTopicTree::getRetainMsg(const string& topic)
+boost::shared_ptr<MqttMessage> MqttTopicTree::getRetainMsg(const MqttTopic& topic)
 {
-  type_topicMapPtr ptr;
+  type_retainTrie retained;
+  boost::shared_ptr<const MqttRetainSnapshot> snapshot;
   {
-    MutexLockGuard lock(mutexTopicMap_);
-    ptr = topicMapPtr_;
+    MutexLockGuard lock(mutexRetainTrie_);
+    retained = retainTrie_;
+    snapshot = retainSnapshot_;
   }
 
-  std::vector<boost::shared_ptr<MqttMessage> > ret;
-  for(type_topicMap::iterator it=topicMapPtr_->begin(); it!=topicMapPtr_->end(); ++it)
+  //内存中有（包括删除标记）时以内存为准
+  const boost::shared_ptr<MqttMessage>* msg = retained.find(topic.str());
+  if(msg)
+    return (*msg)->payload.empty() ? boost::shared_ptr<MqttMessage>() : *msg;
+
+  if(snapshot)
   {
-    string itTopic = it->first;
-    if(matchingWildcard(topic,itTopic) && it->second.retainMsg_)
-      ret.push_back(it->second.retainMsg_);
+    size_t i = snapshot->find(topic.str());
+    if(i != snapshot->size())
+      return snapshotRetainMsg(*snapshot, i);
   }
+  return boost::shared_ptr<MqttMessage>();
+}
 
-  return ret;
+MqttTopicTree::RetainScan::RetainScan(const type_retainTrie& retained,
+                                      const boost::shared_ptr<const MqttRetainSnapshot>& snapshot,
+                                      const string& filter,
+                                      const boost::shared_ptr<MqttClientSession>& subscriber)
+  : retained_(retained),
+    snapshot_(snapshot),
+    cursor_(retained, filter),
+    retainedDone_(false),
+    filter_(filter),
+    prefix_(filter, 0, std::min(filter.find_first_of("+#"), filter.size())),
+    snapshotPos_(0),
+    subscriber_(subscriber)
+{
 }
 
+void MqttTopicTree::sendRetainPage(const RetainScanPtr& scan)
+{
+  boost::shared_ptr<MqttClientSession> subscriber = scan->subscriber_.lock();
+  if(!subscriber)
+    return;
+
+  std::vector<boost::shared_ptr<MqttMessage> > msgs;
+  bool more = nextRetainPage(get_pointer(scan), &msgs);
+  for(size_t i=0; i<msgs.size(); ++i)
+    subscriber->publish(msgs[i]);
+
+  if(more)
+    subscriber->ownerLoop()->queueInLoop(
+          boost::bind(&MqttTopicTree::sendRetainPage, this, scan));
+}
 
-bool MqttTopicTree::haveWildcards(const string& topic) const
+//取下一页匹配的保留消息，返回是否还有
+bool MqttTopicTree::nextRetainPage(RetainScan* scan, std::vector<boost::shared_ptr<MqttMessage> >* msgs)
 {
-  string::size_type pos1 = topic.find_first_of('#');
-  string::size_type pos2 = topic.find_last_of('+');
+  if(!scan->retainedDone_)
+  {
+    std::vector<boost::shared_ptr<MqttMessage> > retained;
+    scan->retainedDone_ = !scan->cursor_.next(kRetainPageSize, &retained);
+    for(size_t i=0; i<retained.size(); ++i)
+    {
+      if(!retained[i]->payload.empty())
+        msgs->push_back(retained[i]);
+    }
+    if(scan->snapshot_ && scan->retainedDone_)
+      scan->snapshotPos_ = scan->snapshot_->lowerBound(scan->prefix_);
+    return !scan->retainedDone_ || (scan->snapshot_ && scan->snapshotPos_ < scan->snapshot_->size());
+  }
+
+  if(!scan->snapshot_)
+    return false;
 
-  return (pos1 != string::npos || pos2 != string::npos);
+  //快照按主题排序，只扫描与过滤器字面前缀相同的一段；每页扫描的条数也有上限
+  const MqttRetainSnapshot& snapshot = *scan->snapshot_;
+  size_t scanned = 0;
+  while(scan->snapshotPos_ < snapshot.size() &&
+        msgs->size() < kRetainPageSize && scanned < kRetainPageSize * 16)
+  {
+    size_t i = scan->snapshotPos_++;
+    ++scanned;
+    StringPiece topic = snapshot.topic(i);
+    if(!topic.starts_with(scan->prefix_))
+    {
+      scan->snapshotPos_ = snapshot.size();
+      break;
+    }
+    string retainTopic = topic.as_string();
+    if(!matchingWildcard(scan->filter_, retainTopic) || scan->retained_.find(retainTopic))
+      continue;
+    boost::shared_ptr<MqttMessage> msg = snapshotRetainMsg(snapshot, i);
+    if(msg)
+      msgs->push_back(msg);
+  }
+  return scan->snapshotPos_ < snapshot.size();
+}
+
+boost::shared_ptr<MqttMessage> MqttTopicTree::snapshotRetainMsg(const MqttRetainSnapshot& snapshot, size_t i)
+{
+  boost::shared_ptr<MqttMessage> msg = snapshot.message(i);
+  if(msg)
+    msg->frame = newMqttPublishFrame(*msg);
+  return msg;
 }
 
 
+//与 MqttTopicTrie::match 语义一致：'#' 可匹配零层，首层通配符不匹配 '$' 主题
 bool MqttTopicTree::matchingWildcard(const string& wildcardTopic, const string& topic) const
 {
-  std::vector<string> vWildcardTopic;
-  boost::split(vWildcardTopic, wildcardTopic, boost::is_any_of( "/" ));
-  std::vector<string> vTopic;
-  boost::split(vTopic, topic, boost::is_any_of( "/" ));
+  if(!topic.empty() && topic[0] == '$' &&
+     !wildcardTopic.empty() && (wildcardTopic[0] == '+' || wildcardTopic[0] == '#'))
+    return false;
 
-  typedef std::vector<string>::iterator Viterator;
-  for(Viterator Wit=vWildcardTopic.begin(),it=vTopic.begin();
-      Wit!=vWildcardTopic.end() && it!=vTopic.end();
-      ++Wit, ++it)
+  size_t wpos = 0, pos = 0;
+  while(wpos <= wildcardTopic.size())
   {
-    if(*Wit == *it || *Wit == "+")
-      continue;
-    else if(*Wit == "#")
+    size_t wend = wildcardTopic.find('/', wpos);
+    if(wend == string::npos)
+      wend = wildcardTopic.size();
+    size_t wlen = wend - wpos;
+
+    if(wlen == 1 && wildcardTopic[wpos] == '#')
       return true;
-    else
+    if(pos > topic.size())
       return false;
+
+    size_t end = topic.find('/', pos);
+    if(end == string::npos)
+      end = topic.size();
+    size_t len = end - pos;
+
+    if(!(wlen == 1 && wildcardTopic[wpos] == '+') &&
+       (wlen != len || wildcardTopic.compare(wpos, wlen, topic, pos, len) != 0))
+      return false;
+
+    wpos = wend + 1;
+    pos = end + 1;
   }
 
-  if(vWildcardTopic.size() == vTopic.size())  //数量相等，for循环全部匹配成功
-    return true;
-  else
-    return false;
+  //过滤器各层全部匹配，主题也须恰好用尽
+  return pos > topic.size();
 }
 
-void MqttTopicTree::Publish(const string& topic, const boost::shared_ptr<MqttMessage>& msg)
+void MqttTopicTree::Publish(const MqttTopic& topic, const boost::shared_ptr<MqttMessage>& msg)
 {
+  //报文只编码一次，所有订阅者共享同一帧
+  if(!msg->frame)
+    msg->frame = newMqttPublishFrame(*msg);
+  //此后只读，各线程的订阅者拿到的都是同一个对象
+  boost::shared_ptr<const MqttMessage> shared(msg);
+
   if(msg->retain && msg->payload.size() > 0)
     addRetainMsg(msg);
 
-  MqttTopicTree::type_subscribersList list = querySubscribers(topic);
-  for(Iterator it=list.begin(); it!=list.end(); ++it)
+  //按订阅者所属 EventLoop 分组，每个 loop 只投递一次任务，
+  //跨线程交接次数由 O(订阅者) 降为 O(loop)
+  LoopBatches batches;
   {
-    boost::shared_ptr<MqttClientSession> ptr = it->lock();
-    if(ptr)
-      ptr->publish(msg);
+    MqttLatencyTimer timer(MqttLatency::kQuery);
+    if(querySubscribers(topic, &batches) > 1)
+      batches.unique();
+  }
+
+  size_t subscribers = 0;
+  for(size_t i=0; i<batches.batches_.size(); ++i)
+    subscribers += batches.batches_[i].second->size();
+  MqttMetrics::fanout(subscribers);
+
+  MqttLatencyTimer timer(MqttLatency::kFanout);
+  for(size_t i=0; i<batches.batches_.size(); ++i)
+  {
+    batches.batches_[i].first->runInLoop(
+          boost::bind(&MqttTopicTree::publishBatch, shared, batches.batches_[i].second));
+  }
+}
+
+void MqttTopicTree::publishBatch(const boost::shared_ptr<const MqttMessage>& msg, const SessionBatchPtr& batch)
+{
+  MqttLatencyTimer timer(MqttLatency::kDeliver);
+  for(SessionBatch::iterator it=batch->begin(); it!=batch->end(); ++it)
+  {
+    (*it)->publish(msg);
   }
 }
 
 void MqttTopicTree::addRetainMsg(const boost::shared_ptr<MqttMessage>& msg)
 {
-  MutexLockGuard lock(mutexTopicMap_);
-  if(!topicMapPtr_.unique())
+  assert(!msg->topic.empty());
+  //含通配符的 PUBLISH 和遗嘱主题在读报文时已被拒绝
+  assert(!msg->topic.hasWildcards());
+  MutexLockGuard lock(mutexRetainTrie_);
+  retainTrie_.set(msg->topic.str(), msg);
+  ++retainVersion_;
+}
+
+void MqttTopicTree::delRetainMsg(const MqttTopic& topic)
+{
+  assert(!topic.hasWildcards());
+  boost::shared_ptr<MqttMessage> tombstone(new MqttMessage);
+  tombstone->qos = 0;
+  tombstone->retain = true;
+  tombstone->topic = topic;
+
+  //快照里有的主题要留下删除标记；正在保存时新快照可能包含它，也留下
+  MutexLockGuard lock(mutexRetainTrie_);
+  if(retainSaving_ ||
+     (retainSnapshot_ && retainSnapshot_->find(topic.str()) != retainSnapshot_->size()))
+    retainTrie_.set(topic.str(), tombstone);
+  else if(retainTrie_.find(topic.str()))
+    retainTrie_.erase(topic.str());
+  else
+    return;
+  ++retainVersion_;
+}
+
+void MqttTopicTree::retainedCount(size_t* inMemory, size_t* inSnapshot)
+{
+  MutexLockGuard lock(mutexRetainTrie_);
+  *inMemory = retainTrie_.size();
+  *inSnapshot = retainSnapshot_ ? retainSnapshot_->size() : 0;
+}
+
+bool MqttTopicTree::loadRetainSnapshot(const string& path)
+{
+  boost::shared_ptr<MqttRetainSnapshot> snapshot(new MqttRetainSnapshot);
+  if(!snapshot->open(path))
+    return false;
+  LOG_INFO << "retain snapshot: " << snapshot->size() << " retained messages in " << path;
+  MutexLockGuard lock(mutexRetainTrie_);
+  retainSnapshot_ = snapshot;
+  return true;
+}
+
+namespace
+{
+  struct collectRetainMsg
   {
-    type_topicMapPtr newTopicMapPtr(new type_topicMap(*topicMapPtr_));
-    topicMapPtr_.swap(newTopicMapPtr);
+    explicit collectRetainMsg(std::vector<boost::shared_ptr<MqttMessage> >* msgs)
+      :msgs_(msgs)
+    { }
+    void operator ()(const boost::shared_ptr<MqttMessage>& msg)
+    { msgs_->push_back(msg); }
+  private:
+    std::vector<boost::shared_ptr<MqttMessage> >* msgs_;
+  };
+
+  bool topicLess(const boost::shared_ptr<MqttMessage>& lhs, const boost::shared_ptr<MqttMessage>& rhs)
+  {
+    return StringPiece(lhs->topic.str()) < StringPiece(rhs->topic.str());
   }
-  assert(msg->topic.length() != 0);
-  content& v = (*topicMapPtr_)[msg->topic];
-  v.retainMsg_ = msg;
+
+  //写完后每次持锁清理这么多条，不长时间挡住发布
+  const size_t kRetainTrimBatch = 1024;
 }
 
-void MqttTopicTree::delRetainMsg(const string& topic)
+bool MqttTopicTree::saveRetainSnapshot(const string& path)
 {
-  MutexLockGuard lock(mutexTopicMap_);
-  if(!topicMapPtr_.unique())
+  type_retainTrie retained;
+  boost::shared_ptr<const MqttRetainSnapshot> base;
+  int64_t version = 0;
   {
-    type_topicMapPtr newTopicMapPtr(new type_topicMap(*topicMapPtr_));
-    topicMapPtr_.swap(newTopicMapPtr);
+    MutexLockGuard lock(mutexRetainTrie_);
+    if(retainVersion_ == savedRetainVersion_)
+      return true;
+    retained = retainTrie_;
+    base = retainSnapshot_;
+    version = retainVersion_;
+    retainSaving_ = true;
   }
 
-  type_topicMap::iterator it = topicMapPtr_->find(topic);
-  if(it != topicMapPtr_->end())
+  //快照副本持有所有消息，变化项里的主题与负载在写完之前一直有效
+  std::vector<boost::shared_ptr<MqttMessage> > msgs;
+  msgs.reserve(retained.size());
+  collectRetainMsg collector(&msgs);
+  retained.forEach(collector);
+  std::sort(msgs.begin(), msgs.end(), topicLess);
+
+  std::vector<MqttRetainSnapshot::Entry> changes(msgs.size());
+  for(size_t i=0; i<msgs.size(); ++i)
   {
-    content& v = it->second;
-    v.retainMsg_.reset();
+    MqttRetainSnapshot::Entry& e = changes[i];
+    e.topic = msgs[i]->topic.str();
+    e.qos = msgs[i]->qos;
+    e.payload = msgs[i]->payload.toStringPiece();
+    e.deleted = msgs[i]->payload.empty();
   }
-}
 
+  Timestamp start(Timestamp::now());
+  size_t written = 0;
+  boost::shared_ptr<MqttRetainSnapshot> saved;
+  if(MqttRetainSnapshot::write(path, get_pointer(base), changes, &written))
+  {
+    saved.reset(new MqttRetainSnapshot);
+    if(!saved->open(path))
+    {
+      LOG_ERROR << "retain snapshot: cannot map " << path << " after saving";
+      saved.reset();
+    }
+  }
 
+  //换上新快照；映射失败时仍用旧快照，内存中的保留消息一条不删，结果不变
+  {
+    MutexLockGuard lock(mutexRetainTrie_);
+    retainSaving_ = false;
+    if(saved)
+      retainSnapshot_ = saved;
+  }
+  if(!saved)
+    return false;
+  savedRetainVersion_ = version;
 
+  //已写进新快照、之后又没有变过的保留消息从内存中删去，由快照按需提供。
+  //变过的是不同的消息对象，比较指针即可
+  size_t trimmed = 0;
+  for(size_t i=0; i<msgs.size(); i+=kRetainTrimBatch)
+  {
+    MutexLockGuard lock(mutexRetainTrie_);
+    for(size_t j=i; j<std::min(i+kRetainTrimBatch, msgs.size()); ++j)
+    {
+      const boost::shared_ptr<MqttMessage>* live = retainTrie_.find(msgs[j]->topic.str());
+      if(live && *live == msgs[j])
+      {
+        retainTrie_.erase(msgs[j]->topic.str());
+        ++trimmed;
+      }
+    }
+  }
+  LOG_INFO << "retain snapshot: saved " << written << " retained messages in "
+           << timeDifference(Timestamp::now(), start) << " s, " << trimmed << " dropped from memory";
+  return true;
+}
@@ -1,8 +1,6 @@
 #ifndef MQTTTOPICTREE_H
 #define MQTTTOPICTREE_H
 
-#include <list>
-#include <map>
 #include <algorithm>
 #include <boost/weak_ptr.hpp>
 #include <boost/shared_ptr.hpp>
@@ -11,65 +9,130 @@
 #include <muduo/base/Types.h>
 
 #include "MqttMessage.h"
+#include "MqttMessagePool.h"
 #include "MqttClient.h"
+#include "MqttPersistentMap.h"
+#include "MqttTopicTrie.h"
+#include "MqttTopicIndex.h"
+#include "MqttSubscriberSet.h"
+#include "MqttRetainSnapshot.h"
 
 
+//精确主题按驻留主题分片放在哈希表中，通配符订阅保存在持久化结构中：
+//读者在锁内以 O(1) 拷贝得到快照后无锁读取，写者只复制被修改的路径。
+//两者的值都是各自加锁的订阅者集合，表里只记录集合，增删订阅者不必复制已有的订阅者。
+//共享订阅按去掉 "$share/<group>/" 后的过滤器放进同一个集合，每次发布每组只投递给一个成员。
 class MqttTopicTree : boost::noncopyable
 {
-  struct content;
 public:
-  typedef std::list<boost::weak_ptr<MqttClientSession> > type_subscribersList;
-  typedef std::map<string,content> type_topicMap;
-  typedef std::map<string,type_subscribersList> type_wildcardsTopicMap;
-  typedef boost::shared_ptr<type_topicMap> type_topicMapPtr;
-  typedef boost::shared_ptr<type_wildcardsTopicMap> type_wildcardsTopicMapPtr;
-  typedef type_subscribersList::iterator Iterator;
+  typedef boost::shared_ptr<MqttSubscriberSet> type_subscribersPtr;
+  typedef MqttTopicIndex<type_subscribersPtr> type_topicIndex;
+  typedef MqttTopicTrie<type_subscribersPtr> type_wildcardsTopicTrie;
+  //保留消息按主题层级索引；负载为空的消息是删除标记，表示快照里的同名主题已被清除
+  typedef MqttTopicTrie<boost::shared_ptr<MqttMessage> > type_retainTrie;
 
 
   MqttTopicTree();
 
-  void addSubscriber(const string& topic,const boost::shared_ptr<MqttClientSession>& subscriber);
+  //subscription 属于 subscriber 的订阅表，退订之前地址不能变。
+  //sendRetained 为 false 时不投递已有的保留消息，用于恢复会话原有的订阅；共享订阅不投递保留消息
+  void addSubscriber(MqttSubscription& subscription,const boost::shared_ptr<MqttClientSession>& subscriber,
+                     bool sendRetained = true);
 
-  void unSubscriber(const string& topic,const boost::shared_ptr<MqttClientSession>& subscriber);
+  void unSubscriber(MqttSubscription& subscription);
 
-  void Publish(const string& topic, const boost::shared_ptr<MqttMessage>& msg);
+  void Publish(const MqttTopic& topic, const boost::shared_ptr<MqttMessage>& msg);
+
+  //启动前设置，默认轮询
+  void setShareStrategy(MqttShareStrategy strategy)
+  { shareStrategy_ = strategy; }
 
   void addRetainMsg(const boost::shared_ptr<MqttMessage>& msg);
-  void delRetainMsg(const string& topic);
+  void delRetainMsg(const MqttTopic& topic);
+
+  //通配符订阅的保留消息每次最多投递这么多条，其余在之后的循环中继续，不长时间占住 IO 线程
+  static const size_t kRetainPageSize = 256;
+
+  //启动时映射上次保存的保留消息快照，之后按需从快照取出。在 start 之前调用
+  bool loadRetainSnapshot(const string& path);
+  //把当前全部保留消息写成新快照，自上次保存以来没有变化时不写。写完后映射新快照，
+  //其中没有再变过的保留消息从内存中删去。一次只能有一个线程调用，不会阻塞发布与订阅
+  bool saveRetainSnapshot(const string& path);
+  //内存中的保留消息数（含删除标记）与快照里的条数
+  void retainedCount(size_t* inMemory, size_t* inSnapshot);
 
 private:
-  bool haveWildcards(const string& topic) const;
-  bool matchingWildcard(const string& wildcardTopic, const string& topic) const;
-  type_subscribersList  querySubscribers(const string& topic);
-  std::vector<boost::shared_ptr<MqttMessage> > getRetainMsg(const string& topic);
+  typedef std::vector<boost::shared_ptr<MqttClientSession>,
+                      MqttPoolAllocator<boost::shared_ptr<MqttClientSession> > > SessionBatch;
+  typedef boost::shared_ptr<SessionBatch> SessionBatchPtr;
 
+  static void publishBatch(const boost::shared_ptr<const MqttMessage>& msg, const SessionBatchPtr& batch);
 
+  //按订阅者所属 EventLoop 分组，每个 loop 只投递一次任务
+  struct LoopBatches
+  {
+    void operator ()(const boost::shared_ptr<MqttClientSession>& subscriber);
+    //会话同时匹配多个过滤器时只保留一份
+    void unique();
+
+    std::vector<std::pair<EventLoop*, SessionBatchPtr> > batches_;
+  };
 
-  struct findSubscriber
+  //一次通配符订阅的保留消息查询，先取内存中的，再取快照里的
+  struct RetainScan
   {
-    findSubscriber(const boost::shared_ptr<MqttClientSession>& subscriber)
-      :subscriber_(subscriber)
-    { }
-    bool operator ()( type_subscribersList::value_type& subscriber)
-    {
-      boost::shared_ptr<MqttClientSession> ptr = subscriber.lock();
-      return ptr == subscriber_;
-    }
-  private:
-    const boost::shared_ptr<MqttClientSession>& subscriber_;
+    RetainScan(const type_retainTrie& retained,
+               const boost::shared_ptr<const MqttRetainSnapshot>& snapshot,
+               const string& filter,
+               const boost::shared_ptr<MqttClientSession>& subscriber);
+
+    type_retainTrie retained_;  // 开始时的快照，用来判断快照里的主题是否已被覆盖
+    boost::shared_ptr<const MqttRetainSnapshot> snapshot_;  // 与 retained_ 同时取得
+    type_retainTrie::Cursor cursor_;
+    bool retainedDone_;
+    string filter_;
+    string prefix_;             // 过滤器中第一个通配符之前的部分
+    size_t snapshotPos_;
+    boost::weak_ptr<MqttClientSession> subscriber_;
   };
+  typedef boost::shared_ptr<RetainScan> RetainScanPtr;
 
-  struct content
+  bool matchingWildcard(const string& wildcardTopic, const string& topic) const;
+  //把匹配 topic 的订阅者加入 batches，返回匹配的过滤器个数
+  size_t querySubscribers(const MqttTopic& topic, LoopBatches* batches);
+  boost::shared_ptr<MqttMessage> getRetainMsg(const MqttTopic& topic);
+  void sendRetainPage(const RetainScanPtr& scan);
+  bool nextRetainPage(RetainScan* scan, std::vector<boost::shared_ptr<MqttMessage> >* msgs);
+  static boost::shared_ptr<MqttMessage> snapshotRetainMsg(const MqttRetainSnapshot& snapshot, size_t i);
+
+
+
+  //精确主题按哈希高位分片，发布时各线程查不同主题基本不争同一把锁
+  static const int kTopicShardBits = 6;
+  struct TopicShard
   {
-    type_subscribersList subscribers_;
-    boost::shared_ptr<MqttMessage> retainMsg_;
+    type_topicIndex index_;
+    MutexLock mutex_;
   };
 
-  type_topicMapPtr topicMapPtr_;
-  MutexLock mutexTopicMap_;
+  TopicShard& topicShard(const MqttTopic& topic)
+  { return topicShards_[topic.hash() >> (64 - kTopicShardBits)]; }
+
+  TopicShard topicShards_[1 << kTopicShardBits];
+
+  type_wildcardsTopicTrie wildcardTopicTrie_;
+  MutexLock mutexWildcardTopicTrie_;
+
+  type_retainTrie retainTrie_;
+  MutexLock mutexRetainTrie_;
 
-  type_wildcardsTopicMapPtr  wildcardTopicMapPtr_;
-  MutexLock mutexWildcardTopicMap_;
+  //以下受 mutexRetainTrie_ 保护。快照本身只读，保存新快照后整个替换，
+  //与 retainTrie_ 一起取得才是一致的保留消息集合
+  boost::shared_ptr<const MqttRetainSnapshot> retainSnapshot_;
+  bool retainSaving_;           // 正在写新快照，删除保留消息时一律留下删除标记
+  int64_t retainVersion_;       // 保留消息每次变化加一
+  int64_t savedRetainVersion_;  // 只由保存快照的线程访问
+  MqttShareStrategy shareStrategy_;
 };
 
 #endif // MQTTTOPICTREE_H
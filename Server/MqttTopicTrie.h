@@ -0,0 +1,341 @@
+#ifndef MQTTTOPICTRIE_H
+#define MQTTTOPICTRIE_H
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <muduo/base/StringPiece.h>
+#include <muduo/base/Types.h>
+
+#include "MqttPersistentMap.h"
+#include "MqttTopic.h"
+
+using namespace muduo;
+
+//按层级索引的订阅过滤器树。
+//每个节点除普通层级子节点外，另有 '+' 和 '#' 两个专用槽位，
+//匹配一个主题只需沿可能匹配的分支下行，代价与主题层数相关，与订阅数量无关。
+//
+//节点不可变：set/erase 按路径复制（子节点表为 MqttPersistentMap），
+//拷贝本对象为 O(1)，副本即快照，可在不持锁的情况下匹配。
+template<typename T>
+class MqttTopicTrie
+{
+public:
+  MqttTopicTrie()
+    : size_(0)
+  { }
+
+  const T* find(const string& filter) const
+  {
+    const Node* node = root_.get();
+    size_t pos = 0;
+    while(pos <= filter.size() && node)
+    {
+      StringPiece level = nextLevel(filter, &pos);
+      node = getChild(*node, level).get();
+    }
+    return (node && node->hasValue_) ? &node->value_ : NULL;
+  }
+
+  //设置 filter 对应的值，不存在则创建路径
+  void set(const string& filter, const T& value)
+  {
+    bool added = false;
+    root_ = setNode(root_, filter, 0, value, &added);
+    if(added)
+      ++size_;
+  }
+
+  //删除 filter 对应的值，并剪除因此变空的分支
+  void erase(const string& filter)
+  {
+    bool removed = false;
+    root_ = eraseNode(root_, filter, 0, &removed);
+    if(removed)
+      --size_;
+  }
+
+  //将所有与 topic 匹配的过滤器的值追加到 out，按驻留时记下的层级边界下行
+  void match(const MqttTopic& topic, std::vector<const T*>* out) const
+  {
+    if(!root_)
+      return;
+    //以 '$' 开头的主题不被首层通配符匹配
+    matchNode(*root_, topic, 0, !topic.isSystem(), out);
+  }
+
+  size_t size() const
+  { return size_; }
+
+  bool empty() const
+  { return size_ == 0; }
+
+  //对每个值调用 f(value)，顺序不定
+  template<typename F>
+  void forEach(F& f) const
+  {
+    if(root_)
+      visit(*root_, f);
+  }
+
+private:
+  struct Node;
+  typedef boost::shared_ptr<const Node> NodePtr;
+  typedef MqttPersistentMap<NodePtr> Children;
+
+public:
+  //反向查询：树中存的是具体主题，按订阅过滤器取出所有匹配主题的值。
+  //只沿过滤器可能匹配的分支下行，'+' 展开一层、'#' 展开整棵子树。
+  //游标持有创建时的快照，可分多次取完，期间的修改不影响它。
+  class Cursor
+  {
+  public:
+    Cursor(const MqttTopicTrie& trie, const string& filter)
+      : filter_(filter)
+    {
+      if(trie.root_)
+        stack_.push_back(Item(trie.root_, 0, false, true));
+    }
+
+    //最多取 limit 个值追加到 out，返回是否还有未取的
+    bool next(size_t limit, std::vector<T>* out)
+    {
+      size_t count = 0;
+      while(!stack_.empty() && count < limit)
+      {
+        Item item = stack_.back();
+        stack_.pop_back();
+        const Node& node = *item.node_;
+
+        if(item.subtree_ || item.pos_ > filter_.size())
+        {
+          if(node.hasValue_)
+          {
+            out->push_back(node.value_);
+            ++count;
+          }
+          if(item.subtree_)
+            pushChildren(node, 0, true, false);
+          continue;
+        }
+
+        size_t pos = item.pos_;
+        StringPiece level = nextLevel(filter_, &pos);
+        if(isHash(level))
+        {
+          // "a/#" 也匹配 "a"
+          if(node.hasValue_)
+          {
+            out->push_back(node.value_);
+            ++count;
+          }
+          pushChildren(node, pos, true, item.root_);
+        }
+        else if(isPlus(level))
+        {
+          pushChildren(node, pos, false, item.root_);
+        }
+        else
+        {
+          const NodePtr* child = node.children_.find(level);
+          if(child)
+            stack_.push_back(Item(*child, pos, false, false));
+        }
+      }
+      return !stack_.empty();
+    }
+
+  private:
+    struct Item
+    {
+      Item(const NodePtr& node, size_t pos, bool subtree, bool root)
+        : node_(node), pos_(pos), subtree_(subtree), root_(root)
+      { }
+      NodePtr node_;
+      size_t pos_;
+      bool subtree_;  // 已匹配到 '#'，整棵子树都算
+      bool root_;
+    };
+
+    struct Pusher
+    {
+      Pusher(std::vector<Item>* stack, size_t pos, bool subtree, bool skipSystem)
+        : stack_(stack), pos_(pos), subtree_(subtree), skipSystem_(skipSystem)
+      { }
+      void operator()(const string& level, const NodePtr& child)
+      {
+        //以 '$' 开头的主题不被首层通配符匹配
+        if(skipSystem_ && !level.empty() && level[0] == '$')
+          return;
+        stack_->push_back(Item(child, pos_, subtree_, false));
+      }
+      std::vector<Item>* stack_;
+      size_t pos_;
+      bool subtree_;
+      bool skipSystem_;
+    };
+
+    void pushChildren(const Node& node, size_t pos, bool subtree, bool skipSystem)
+    {
+      Pusher pusher(&stack_, pos, subtree, skipSystem);
+      node.children_.forEach(pusher);
+    }
+
+    string filter_;
+    std::vector<Item> stack_;
+  };
+
+private:
+
+  struct Node
+  {
+    Node()
+      : hasValue_(false), value_()
+    { }
+
+    bool empty() const
+    { return !hasValue_ && children_.empty() && !plus_ && !hash_; }
+
+    bool hasValue_;
+    T value_;
+    Children children_;
+    NodePtr plus_;
+    NodePtr hash_;
+  };
+
+  //取 pos 处的一个层级，并将 pos 移至下一层级起点；
+  //最后一层之后 pos 为 str.size()+1
+  static StringPiece nextLevel(const string& str, size_t* pos)
+  {
+    size_t begin = *pos;
+    size_t end = str.find('/', begin);
+    if(end == string::npos)
+      end = str.size();
+    *pos = end + 1;
+    return StringPiece(str.data() + begin, static_cast<int>(end - begin));
+  }
+
+  static bool isPlus(const StringPiece& level)
+  { return level.size() == 1 && level[0] == '+'; }
+
+  static bool isHash(const StringPiece& level)
+  { return level.size() == 1 && level[0] == '#'; }
+
+  static NodePtr getChild(const Node& node, const StringPiece& level)
+  {
+    if(isPlus(level))
+      return node.plus_;
+    if(isHash(level))
+      return node.hash_;
+    const NodePtr* child = node.children_.find(level);
+    return child ? *child : NodePtr();
+  }
+
+  static void setChild(Node* node, const StringPiece& level, const NodePtr& child)
+  {
+    if(isPlus(level))
+      node->plus_ = child;
+    else if(isHash(level))
+      node->hash_ = child;
+    else if(child)
+      node->children_.set(level, child);
+    else
+      node->children_.erase(level);
+  }
+
+  static NodePtr setNode(const NodePtr& node, const string& filter, size_t pos,
+                         const T& value, bool* added)
+  {
+    boost::shared_ptr<Node> copy(node ? new Node(*node) : new Node());
+    if(pos > filter.size())
+    {
+      *added = !copy->hasValue_;
+      copy->hasValue_ = true;
+      copy->value_ = value;
+      return copy;
+    }
+
+    StringPiece level = nextLevel(filter, &pos);
+    setChild(copy.get(), level, setNode(getChild(*copy, level), filter, pos, value, added));
+    return copy;
+  }
+
+  //返回删除后的节点；节点变空时返回空指针，未找到时原样返回
+  static NodePtr eraseNode(const NodePtr& node, const string& filter, size_t pos, bool* removed)
+  {
+    if(!node)
+      return node;
+
+    boost::shared_ptr<Node> copy;
+    if(pos > filter.size())
+    {
+      if(!node->hasValue_)
+        return node;
+      *removed = true;
+      copy.reset(new Node(*node));
+      copy->hasValue_ = false;
+      copy->value_ = T();
+    }
+    else
+    {
+      StringPiece level = nextLevel(filter, &pos);
+      NodePtr child = getChild(*node, level);
+      NodePtr newChild = eraseNode(child, filter, pos, removed);
+      if(newChild == child)
+        return node;
+      copy.reset(new Node(*node));
+      setChild(copy.get(), level, newChild);
+    }
+    return copy->empty() ? NodePtr() : copy;
+  }
+
+  static void matchNode(const Node& node, const MqttTopic& topic, size_t level,
+                        bool wildcards, std::vector<const T*>* out)
+  {
+    // '#' 匹配余下任意层级，包括零层（"a/#" 匹配 "a"）
+    if(wildcards && node.hash_ && node.hash_->hasValue_)
+      out->push_back(&node.hash_->value_);
+
+    if(level == topic.levelCount())
+    {
+      if(node.hasValue_)
+        out->push_back(&node.value_);
+      return;
+    }
+
+    const NodePtr* child = node.children_.find(topic.level(level));
+    if(child)
+      matchNode(**child, topic, level + 1, true, out);
+    if(wildcards && node.plus_)
+      matchNode(*node.plus_, topic, level + 1, true, out);
+  }
+
+  template<typename F>
+  static void visit(const Node& node, F& f)
+  {
+    if(node.hasValue_)
+      f(node.value_);
+    if(node.plus_)
+      visit(*node.plus_, f);
+    if(node.hash_)
+      visit(*node.hash_, f);
+    Visitor<F> visitor(f);
+    node.children_.forEach(visitor);
+  }
+
+  template<typename F>
+  struct Visitor
+  {
+    explicit Visitor(F& f)
+      : f_(f)
+    { }
+    void operator()(const string&, const NodePtr& child)
+    { visit(*child, f_); }
+    F& f_;
+  };
+
+  NodePtr root_;
+  size_t size_;
+};
+
+#endif // MQTTTOPICTRIE_H
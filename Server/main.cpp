@@ -1,13 +1,18 @@
 #include <muduo/net/EventLoop.h>
+#include <muduo/net/EventLoopThread.h>
+#include <muduo/net/inspect/Inspector.h>
 #include <muduo/base/Logging.h>
-#include <muduo/base/AsyncLogging.h>
 #include <muduo/base/Singleton.h>
 #include <muduo/base/Types.h>
 #include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <cmdline.h>
 
+#include "MqttAsyncLog.h"
+#include "MqttInspector.h"
 #include "MqttServer.h"
 #include "MqttTopicTree.h"
+#include "MqttLogSessionStore.h"
 
 using namespace muduo;
 off_t kRollSize = 500*1000*1000;
@@ -17,6 +22,17 @@ struct Options
   std::string ip;
   uint16_t port;
   int threads;
+  bool reusePort;
+  uint16_t inflight;
+  std::string storeDir;
+  double snapshotInterval;
+  int maxOutbound;
+  int maxQueued;
+  std::string slowPolicy;
+  int maxSpillMB;
+  uint16_t inspectPort;
+  Logger::LogLevel logLevel;
+  MqttShareStrategy shareStrategy;
 };
 
 void parseCommandLine(int argc, char* argv[], Options* options)
@@ -25,29 +41,103 @@ void parseCommandLine(int argc, char* argv[], Options* options)
   par.add<std::string>("ip", 'i', "mqtt server IP address ", false, "127.0.0.1");
   par.add<uint16_t>("port", 'p', "mqtt server listen port ", false, 1883);
   par.add<int>("threads",'n',"Number of worker threads ",false,3);
+  par.add("reuseport",'r',"Each worker thread accepts on its own SO_REUSEPORT socket ");
+  par.add<uint16_t>("inflight",'w',"Max unacknowledged QoS 1/2 messages per client ",false,20,
+                    cmdline::range<uint16_t>(1,65535));
+  par.add<std::string>("store-dir",'d',"Directory of the persistent session log and retained message snapshot, both are kept in memory only if not set ",false,"");
+  par.add<double>("snapshot-interval",'s',"Seconds between retained message snapshots ",false,60);
+  par.add<int>("max-outbound",'o',"Bytes buffered for a subscriber before delivery to it pauses ",false,4*1024*1024,
+               cmdline::range<int>(1,1024*1024*1024));
+  par.add<int>("max-queued",'q',"Messages queued for a subscriber before the slow consumer policy applies ",false,10000,
+               cmdline::range<int>(1,100000000));
+  par.add<std::string>("slow-policy",'P',"What to do when a subscriber queue is full ",false,"drop",
+                       cmdline::oneof<std::string>("drop","disconnect","spill"));
+  par.add<int>("max-spill",'m',"Megabytes a subscriber may have spilled to disk before new messages to it are dropped ",false,256,
+               cmdline::range<int>(1,1024*1024));
+  par.add<std::string>("log-level",'l',"Minimum level written to the log ",false,"info",
+                       cmdline::oneof<std::string>("trace","debug","info","warn","error"));
+  par.add<std::string>("share-strategy",'g',"How a shared subscription ($share/<group>/<filter>) picks the member for each message ",
+                       false,"round_robin",cmdline::oneof<std::string>("round_robin","least_inflight","sticky"));
+  par.add<uint16_t>("inspect-port",'I',"HTTP port of the muduo inspector serving /mqtt/ metrics, 0 to disable ",false,0);
 
   par.parse_check(argc, argv);
 
   options->ip = par.get<std::string>("ip");
   options->port = par.get<uint16_t>("port");
   options->threads = par.get<int>("threads");
+  options->reusePort = par.exist("reuseport");
+  options->inflight = par.get<uint16_t>("inflight");
+  options->storeDir = par.get<std::string>("store-dir");
+  options->snapshotInterval = par.get<double>("snapshot-interval");
+  options->maxOutbound = par.get<int>("max-outbound");
+  options->maxQueued = par.get<int>("max-queued");
+  options->slowPolicy = par.get<std::string>("slow-policy");
+  options->maxSpillMB = par.get<int>("max-spill");
+  options->inspectPort = par.get<uint16_t>("inspect-port");
+  const std::string strategy = par.get<std::string>("share-strategy");
+  if(strategy == "least_inflight")
+    options->shareStrategy = kShareLeastInflight;
+  else if(strategy == "sticky")
+    options->shareStrategy = kShareStickyHash;
+  else
+    options->shareStrategy = kShareRoundRobin;
+  const std::string level = par.get<std::string>("log-level");
+  if(level == "trace")
+    options->logLevel = Logger::TRACE;
+  else if(level == "debug")
+    options->logLevel = Logger::DEBUG;
+  else if(level == "info")
+    options->logLevel = Logger::INFO;
+  else if(level == "warn")
+    options->logLevel = Logger::WARN;
+  else
+    options->logLevel = Logger::ERROR;
 
   LOG_INFO << "listen in "<<options->ip<<":"<<options->port << " , "
-           << options->threads << " worker threads.";
+           << options->threads << " worker threads"
+           << (options->reusePort ? ", accepting in each thread." : ".");
 }
 
 int main(int argc, char* argv[])
 {
-  Logger::setLogLevel(Logger::DEBUG);
   string logfilename( ::basename(argv[0]));
-  AsyncLogging log(logfilename, kRollSize);
+  MqttAsyncLog log(logfilename, kRollSize);
   log.start();
+  Logger::setOutput(MqttAsyncLog::output);
+  Logger::setFlush(MqttAsyncLog::flush);
 
   EventLoop loop;
   Options opt;
   parseCommandLine(argc,argv,&opt);
+  Logger::setLogLevel(opt.logLevel);
   InetAddress listenAddr(opt.ip,opt.port);
-  MqttServer server(&loop, listenAddr, opt.threads);
+  MqttServer server(&loop, listenAddr, opt.threads, opt.reusePort);
+  server.setInflightWindow(opt.inflight);
+  server.setShareStrategy(opt.shareStrategy);
+  MqttSessionConfig::SlowConsumerPolicy policy = MqttSessionConfig::kDropPolicy;
+  if(opt.slowPolicy == "disconnect")
+    policy = MqttSessionConfig::kDisconnectPolicy;
+  else if(opt.slowPolicy == "spill")
+    policy = MqttSessionConfig::kSpillPolicy;
+  server.setOutboundLimits(static_cast<size_t>(opt.maxOutbound), static_cast<size_t>(opt.maxQueued), policy,
+                           opt.storeDir.empty() ? "/tmp" : opt.storeDir.c_str(),
+                           static_cast<size_t>(opt.maxSpillMB)*1024*1024);
+  if(!opt.storeDir.empty())
+  {
+    server.setSessionStore(new MqttLogSessionStore(opt.storeDir.c_str()));
+    server.setRetainSnapshot((opt.storeDir + "/retained.snap").c_str(), opt.snapshotInterval);
+  }
+
+  //Inspector 跑在单独的线程里，查询不占用接受连接的主循环
+  boost::scoped_ptr<EventLoopThread> inspectThread;
+  boost::scoped_ptr<Inspector> inspector;
+  MqttInspector mqttInspector(&server);
+  if(opt.inspectPort != 0)
+  {
+    inspectThread.reset(new EventLoopThread);
+    inspector.reset(new Inspector(inspectThread->startLoop(), InetAddress(opt.ip, opt.inspectPort), "mqtt-server"));
+    mqttInspector.registerCommands(inspector.get());
+  }
 
   server.start();
   loop.loop();
@@ -0,0 +1,696 @@
+#include <muduo/base/Atomic.h>
+#include <muduo/base/CountDownLatch.h>
+#include <muduo/base/Logging.h>
+#include <muduo/base/Mutex.h>
+#include <muduo/base/Timestamp.h>
+#include <muduo/net/Endian.h>
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/EventLoopThreadPool.h>
+#include <muduo/net/InetAddress.h>
+#include <muduo/net/TcpClient.h>
+
+#include <boost/bind.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <algorithm>
+#include <cmdline.h>
+#include <limits>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "MqttFrameDecoder.h"
+#include "MqttHistogram.h"
+#include "MqttProtocol.h"
+#include "MqttTestClient.h"
+
+using namespace muduo;
+using namespace muduo::net;
+
+//对本机 broker 施加负载：若干发布者轮流发往 bench/<k>，订阅者按比例用 bench/+ 或某个 bench/<k> 订阅。
+//负载前 8 字节是发布时刻（微秒），订阅者收到时据此统计发布到投递的时延，两端须在同一台机器上。
+//预热结束后开始计数，只统计发布时刻落在计量区间内的消息，结束后再等一会让在途消息到齐。
+//-G 让订阅者加入共享订阅组，-c 模拟每条消息的处理耗时，对比不同订阅者数时每个订阅者的吞吐。
+//用法：mqtt-bench -p 1883 -P 4 -S 64 -q 1 -t 16 -s 64 -W 25 -d 10
+//      mqtt-bench -p 1883 -P 2 -S 4 -n 4 -G workers -c 50 -r 20000
+namespace
+{
+
+struct Options
+{
+  std::string ip;
+  uint16_t port;
+  int threads;
+  int publishers;
+  int subscribers;
+  int qos;
+  int topics;
+  int payload;
+  int wildcardPercent;
+  std::string share;
+  int work;
+  int rate;
+  int inflight;
+  double warmup;
+  double duration;
+  double drain;
+};
+
+void parseCommandLine(int argc, char* argv[], Options* options)
+{
+  cmdline::parser par;
+  par.add<std::string>("ip", 'i', "mqtt server IP address ", false, "127.0.0.1");
+  par.add<uint16_t>("port", 'p', "mqtt server port ", false, 1883);
+  par.add<int>("threads", 'n', "Number of client IO threads ", false, 2, cmdline::range<int>(1, 256));
+  par.add<int>("publishers", 'P', "Number of publishing connections ", false, 4, cmdline::range<int>(1, 100000));
+  par.add<int>("subscribers", 'S', "Number of subscribing connections ", false, 16, cmdline::range<int>(0, 1000000));
+  par.add<int>("qos", 'q', "QoS of publishes and subscriptions ", false, 0, cmdline::range<int>(0, 2));
+  par.add<int>("topics", 't', "Number of topics publishers rotate over (fan-out) ", false, 1, cmdline::range<int>(1, 1000000));
+  par.add<int>("payload", 's', "Payload size in bytes, at least 8 ", false, 64, cmdline::range<int>(8, 256 * 1024 * 1024));
+  par.add<int>("wildcard", 'W', "Percent of subscribers that subscribe to bench/+ instead of one topic ", false, 0,
+               cmdline::range<int>(0, 100));
+  par.add<std::string>("share", 'G', "Subscribers join the shared subscription group $share/<name>/<filter> ", false, "");
+  par.add<int>("work", 'c', "Microseconds a subscriber blocks per message, modelling a consumer waiting on I/O ", false, 0,
+               cmdline::range<int>(0, 1000000));
+  par.add<int>("rate", 'r', "Messages per second per publisher, 0 publishes as fast as the window allows ", false, 0,
+               cmdline::range<int>(0, 100000000));
+  par.add<int>("inflight", 'w', "Unacknowledged QoS 1/2 messages per publisher when not rate limited ", false, 16,
+               cmdline::range<int>(1, 65535));
+  par.add<double>("warmup", 'u', "Seconds before measuring ", false, 2);
+  par.add<double>("duration", 'd', "Seconds of measurement ", false, 10);
+  par.add<double>("drain", 'D', "Seconds to wait for in-flight messages after measurement ", false, 2);
+  par.parse_check(argc, argv);
+
+  options->ip = par.get<std::string>("ip");
+  options->port = par.get<uint16_t>("port");
+  options->threads = par.get<int>("threads");
+  options->publishers = par.get<int>("publishers");
+  options->subscribers = par.get<int>("subscribers");
+  options->qos = par.get<int>("qos");
+  options->topics = par.get<int>("topics");
+  options->payload = par.get<int>("payload");
+  options->wildcardPercent = par.get<int>("wildcard");
+  options->share = par.get<std::string>("share");
+  options->work = par.get<int>("work");
+  options->rate = par.get<int>("rate");
+  options->inflight = par.get<int>("inflight");
+  options->warmup = par.get<double>("warmup");
+  options->duration = par.get<double>("duration");
+  options->drain = par.get<double>("drain");
+}
+
+const int64_t kNever = std::numeric_limits<int64_t>::max();
+
+uint16_t readUint16(const char* p)
+{
+  uint16_t be16 = 0;
+  memcpy(&be16, p, sizeof be16);
+  return sockets::networkToHost16(be16);
+}
+
+class MqttBench;
+
+//一个发布者或订阅者连接，所有状态只在所属 loop 中访问
+class BenchClient : boost::noncopyable
+{
+public:
+  BenchClient(EventLoop* loop, const InetAddress& serverAddr, const string& clientId,
+              MqttBench* owner, int publisher, const string& filter);
+
+  void start()
+  { client_.connect(); }
+  void stop()
+  { client_.disconnect(); }
+
+  void startPublishing();
+  void stopPublishing();
+  //只记录计量区间内发布的消息，结束后在所属线程合并
+  const MqttHistogram& latency() const
+  { return latency_; }
+  int64_t measuredDelivered() const
+  { return measuredDelivered_; }
+
+  EventLoop* getLoop() const
+  { return client_.getLoop(); }
+
+private:
+  void onConnection(const TcpConnectionPtr& conn);
+  void onMessage(const TcpConnectionPtr& conn, Buffer* buffer, Timestamp time);
+  void onWriteComplete(const TcpConnectionPtr& conn);
+  void handlePacket(const TcpConnectionPtr& conn, uint8_t type, const char* body, size_t len);
+  void handlePublish(const TcpConnectionPtr& conn, uint8_t type, const char* body, size_t len);
+  void sendAck(const TcpConnectionPtr& conn, uint8_t type, uint16_t mid);
+  void publish(const TcpConnectionPtr& conn);
+  void publishAllowed(const TcpConnectionPtr& conn);
+  void onTick();
+
+  TcpClient client_;
+  MqttBench* owner_;
+  const int publisher_;  // 发布者编号，订阅者为 -1
+  const string filter_;
+  const string clientId_;
+
+  bool publishing_;
+  TimerId ticker_;
+  Timestamp lastTick_;
+  double credit_;        // 限速时累计可发送的条数
+  int inflight_;
+  uint16_t nextMid_;
+  int64_t next_;         // 下一条发往的主题序号
+  MqttHistogram latency_;
+  int64_t measuredDelivered_;
+};
+
+class MqttBench : boost::noncopyable
+{
+public:
+  MqttBench(EventLoop* loop, const Options& options);
+
+  void start();
+
+  const Options& options() const
+  { return options_; }
+  int64_t fanout(int topic) const
+  { return fanout_[static_cast<size_t>(topic)]; }
+
+  //计量区间，微秒
+  bool measuring(int64_t sentAt) const
+  { return sentAt >= __atomic_load_n(&measureStart_, __ATOMIC_RELAXED) &&
+           sentAt < __atomic_load_n(&measureEnd_, __ATOMIC_RELAXED); }
+
+  //在客户端所属线程调用
+  void clientReady();
+  void clientClosed(const string& clientId);
+  void published(int topic, int64_t sentAt);
+  void delivered(int64_t sentAt);
+  void acked()
+  { acked_.increment(); }
+
+private:
+  void allReady();
+  void checkConnected();
+  void beginMeasure();
+  void endMeasure();
+  void report();
+  void progress();
+  void stop();
+  void waitForLoops();
+  void quit();
+
+  EventLoop* loop_;
+  Options options_;
+  EventLoopThreadPool threadPool_;
+  boost::ptr_vector<BenchClient> clients_;
+  std::vector<int64_t> fanout_;  // 每个主题的订阅者数
+
+  AtomicInt32 ready_;
+  AtomicInt32 closed_;
+  int64_t measureStart_;  // 主线程写，各 loop 读
+  int64_t measureEnd_;
+  //全程计数，用于每秒进度
+  AtomicInt64 sent_;
+  AtomicInt64 received_;
+  AtomicInt64 acked_;
+  //计量区间内发布的消息
+  AtomicInt64 measuredSent_;
+  AtomicInt64 expected_;
+  AtomicInt64 measuredDelivered_;
+  int64_t lastSent_;
+  int64_t lastReceived_;
+  Timestamp started_;
+  TimerId progress_;
+  bool finished_;
+};
+
+BenchClient::BenchClient(EventLoop* loop, const InetAddress& serverAddr, const string& clientId,
+                         MqttBench* owner, int publisher, const string& filter)
+  : client_(loop, serverAddr, clientId),
+    owner_(owner),
+    publisher_(publisher),
+    filter_(filter),
+    clientId_(clientId),
+    publishing_(false),
+    credit_(0),
+    inflight_(0),
+    nextMid_(0),
+    next_(publisher),
+    measuredDelivered_(0)
+{
+  client_.setConnectionCallback(boost::bind(&BenchClient::onConnection, this, _1));
+  client_.setMessageCallback(boost::bind(&BenchClient::onMessage, this, _1, _2, _3));
+  client_.setWriteCompleteCallback(boost::bind(&BenchClient::onWriteComplete, this, _1));
+}
+
+void BenchClient::onConnection(const TcpConnectionPtr& conn)
+{
+  if(!conn->connected())
+  {
+    publishing_ = false;
+    owner_->clientClosed(clientId_);
+    return;
+  }
+
+  conn->setTcpNoDelay(true);
+  //clean session，keepalive 为 0
+  std::string packet;
+  MqttTestClient::appendConnect(&packet, clientId_.c_str(), true, 0);
+  conn->send(packet.data(), static_cast<int>(packet.size()));
+}
+
+void BenchClient::onMessage(const TcpConnectionPtr& conn, Buffer* buffer, Timestamp)
+{
+  MqttFixedHeader header;
+  MqttFrameDecoder::Result result;
+  while((result = MqttFrameDecoder::peekFrame(*buffer, &header)) == MqttFrameDecoder::kComplete)
+  {
+    handlePacket(conn, header.type, buffer->peek() + header.headerLength, header.remainingLength);
+    buffer->retrieve(header.headerLength + header.remainingLength);
+  }
+  if(result == MqttFrameDecoder::kMalformed)
+  {
+    LOG_ERROR << clientId_ << " malformed packet";
+    conn->shutdown();
+  }
+}
+
+void BenchClient::handlePacket(const TcpConnectionPtr& conn, uint8_t type, const char* body, size_t len)
+{
+  switch(type & 0xF0)
+  {
+    case CONNACK:
+      if(len < 2 || body[1] != CONNACK_ACCEPTED)
+      {
+        LOG_ERROR << clientId_ << " CONNECT refused";
+        conn->shutdown();
+      }
+      else if(publisher_ >= 0)
+      {
+        owner_->clientReady();
+      }
+      else
+      {
+        std::string packet;
+        MqttTestClient::appendSubscribe(&packet, 1, filter_.c_str(), static_cast<uint8_t>(owner_->options().qos));
+        conn->send(packet.data(), static_cast<int>(packet.size()));
+      }
+      break;
+    case SUBACK:
+      owner_->clientReady();
+      break;
+    case PUBLISH:
+      handlePublish(conn, type, body, len);
+      break;
+    case PUBREL:
+      if(len >= 2)
+        sendAck(conn, PUBCOMP, readUint16(body));
+      break;
+    case PUBREC:
+      if(len >= 2)
+        sendAck(conn, PUBREL | 0x02, readUint16(body));
+      break;
+    case PUBACK:
+    case PUBCOMP:
+      --inflight_;
+      owner_->acked();
+      if(publishing_ && owner_->options().rate == 0)
+        publishAllowed(conn);
+      break;
+    default:
+      break;
+  }
+}
+
+void BenchClient::handlePublish(const TcpConnectionPtr& conn, uint8_t type, const char* body, size_t len)
+{
+  int qos = (type >> 1) & 0x03;
+  if(len < 2)
+    return;
+  uint16_t topicLen = readUint16(body);
+  size_t pos = 2 + topicLen;
+  uint16_t mid = 0;
+  if(qos > 0)
+  {
+    if(len < pos + 2)
+      return;
+    mid = readUint16(body + pos);
+    pos += 2;
+  }
+  if(len >= pos + sizeof(int64_t))
+  {
+    int64_t sentAt = 0;
+    memcpy(&sentAt, body + pos, sizeof sentAt);
+    sentAt = static_cast<int64_t>(sockets::networkToHost64(static_cast<uint64_t>(sentAt)));
+    if(owner_->measuring(sentAt))
+    {
+      int64_t now = Timestamp::now().microSecondsSinceEpoch();
+      latency_.record(static_cast<uint64_t>(now > sentAt ? now - sentAt : 0));
+      ++measuredDelivered_;
+    }
+    owner_->delivered(sentAt);
+  }
+
+  //阻塞本线程但不占 CPU，像等待数据库的消费者，每个订阅者每秒最多处理约 1e6/work 条
+  if(owner_->options().work > 0)
+    ::usleep(static_cast<useconds_t>(owner_->options().work));
+
+  if(qos == 1)
+    sendAck(conn, PUBACK, mid);
+  else if(qos == 2)
+    sendAck(conn, PUBREC, mid);
+}
+
+void BenchClient::sendAck(const TcpConnectionPtr& conn, uint8_t type, uint16_t mid)
+{
+  std::string packet;
+  MqttTestClient::appendAck(&packet, type, mid);
+  conn->send(packet.data(), static_cast<int>(packet.size()));
+}
+
+void BenchClient::startPublishing()
+{
+  getLoop()->assertInLoopThread();
+  TcpConnectionPtr conn = client_.connection();
+  if(!conn || !conn->connected())
+    return;
+  publishing_ = true;
+  if(owner_->options().rate > 0)
+  {
+    lastTick_ = Timestamp::now();
+    ticker_ = getLoop()->runEvery(0.001, boost::bind(&BenchClient::onTick, this));
+  }
+  else
+  {
+    publishAllowed(conn);
+  }
+}
+
+void BenchClient::stopPublishing()
+{
+  getLoop()->assertInLoopThread();
+  if(publishing_ && owner_->options().rate > 0)
+    getLoop()->cancel(ticker_);
+  publishing_ = false;
+}
+
+//不限速时：QoS 0 每次写空输出缓冲区后再发一批，QoS 1/2 保持窗口内的未确认条数
+void BenchClient::publishAllowed(const TcpConnectionPtr& conn)
+{
+  const Options& options = owner_->options();
+  if(options.qos == 0)
+  {
+    for(int i = 0; i < 64 && conn->outputBytes() == 0; ++i)
+      publish(conn);
+  }
+  else
+  {
+    while(inflight_ < options.inflight)
+      publish(conn);
+  }
+}
+
+void BenchClient::onWriteComplete(const TcpConnectionPtr& conn)
+{
+  if(publishing_ && owner_->options().rate == 0 && owner_->options().qos == 0)
+    publishAllowed(conn);
+}
+
+//按流逝的时间补足应发的条数，未确认的报文标识符用尽时本次少发，不补发
+void BenchClient::onTick()
+{
+  TcpConnectionPtr conn = client_.connection();
+  if(!publishing_ || !conn)
+    return;
+  const Options& options = owner_->options();
+  Timestamp now(Timestamp::now());
+  credit_ += timeDifference(now, lastTick_) * options.rate;
+  lastTick_ = now;
+  while(credit_ >= 1)
+  {
+    credit_ -= 1;
+    if(options.qos > 0 && inflight_ >= 65535)
+      continue;
+    publish(conn);
+  }
+}
+
+void BenchClient::publish(const TcpConnectionPtr& conn)
+{
+  const Options& options = owner_->options();
+  int topic = static_cast<int>(next_++ % options.topics);
+  char topicName[32];
+  snprintf(topicName, sizeof topicName, "bench/%d", topic);
+
+  uint16_t mid = 0;
+  if(options.qos > 0)
+  {
+    if(++nextMid_ == 0)
+      nextMid_ = 1;
+    mid = nextMid_;
+    ++inflight_;
+  }
+  Buffer packet;
+  std::string header;
+  MqttTestClient::appendPublishHeader(&header, topicName, static_cast<uint8_t>(options.qos), mid,
+                                      static_cast<size_t>(options.payload));
+  packet.append(header.data(), header.size());
+  int64_t sentAt = Timestamp::now().microSecondsSinceEpoch();
+  packet.appendInt64(sentAt);
+  packet.ensureWritableBytes(static_cast<size_t>(options.payload) - sizeof sentAt);
+  memset(packet.beginWrite(), 'x', static_cast<size_t>(options.payload) - sizeof sentAt);
+  packet.hasWritten(static_cast<size_t>(options.payload) - sizeof sentAt);
+  conn->send(&packet);
+  owner_->published(topic, sentAt);
+}
+
+MqttBench::MqttBench(EventLoop* loop, const Options& options)
+  : loop_(loop),
+    options_(options),
+    threadPool_(loop, "mqtt-bench"),
+    fanout_(static_cast<size_t>(options.topics)),
+    measureStart_(kNever),
+    measureEnd_(kNever),
+    lastSent_(0),
+    lastReceived_(0),
+    finished_(false)
+{
+  threadPool_.setThreadNum(options.threads);
+}
+
+void MqttBench::start()
+{
+  threadPool_.start();
+  InetAddress serverAddr(options_.ip, options_.port);
+  int wildcards = options_.subscribers * options_.wildcardPercent / 100;
+  string prefix = options_.share.empty() ? string() : "$share/" + string(options_.share.c_str()) + "/";
+  for(int i = 0; i < options_.subscribers; ++i)
+  {
+    char clientId[32];
+    snprintf(clientId, sizeof clientId, "bench-%d-sub-%d", static_cast<int>(::getpid()), i);
+    char filter[32];
+    if(i < wildcards)
+    {
+      snprintf(filter, sizeof filter, "bench/+");
+      for(size_t k = 0; k < fanout_.size(); ++k)
+        ++fanout_[k];
+    }
+    else
+    {
+      snprintf(filter, sizeof filter, "bench/%d", i % options_.topics);
+      ++fanout_[static_cast<size_t>(i % options_.topics)];
+    }
+    clients_.push_back(new BenchClient(threadPool_.getNextLoop(), serverAddr, clientId, this, -1, prefix + filter));
+  }
+  //共享订阅每个过滤器只投递一份：bench/<k> 有订阅者时一份，bench/+ 有订阅者时再加一份
+  if(!options_.share.empty())
+  {
+    for(size_t k = 0; k < fanout_.size(); ++k)
+    {
+      int64_t exact = fanout_[k] - wildcards;
+      fanout_[k] = (exact > 0 ? 1 : 0) + (wildcards > 0 ? 1 : 0);
+    }
+  }
+  for(int i = 0; i < options_.publishers; ++i)
+  {
+    char clientId[32];
+    snprintf(clientId, sizeof clientId, "bench-%d-pub-%d", static_cast<int>(::getpid()), i);
+    clients_.push_back(new BenchClient(threadPool_.getNextLoop(), serverAddr, clientId, this, i, ""));
+  }
+
+  printf("%d publishers, %d subscribers (%d on bench/+), QoS %d, %d topics, %d byte payload, %s\n",
+         options_.publishers, options_.subscribers, wildcards, options_.qos, options_.topics, options_.payload,
+         options_.rate > 0 ? "rate limited" : "unlimited");
+  if(!options_.share.empty())
+    printf("shared subscription group %s, %d us of work per message\n", options_.share.c_str(), options_.work);
+  for(size_t i = 0; i < clients_.size(); ++i)
+    clients_[i].getLoop()->runInLoop(boost::bind(&BenchClient::start, &clients_[i]));
+  loop_->runAfter(30, boost::bind(&MqttBench::checkConnected, this));
+}
+
+void MqttBench::clientReady()
+{
+  if(ready_.incrementAndGet() == static_cast<int>(clients_.size()))
+    loop_->runInLoop(boost::bind(&MqttBench::allReady, this));
+}
+
+void MqttBench::clientClosed(const string& clientId)
+{
+  //计量结束前断开说明 broker 拒绝或踢掉了连接
+  if(__atomic_load_n(&measureEnd_, __ATOMIC_RELAXED) == kNever)
+    LOG_ERROR << clientId << " disconnected";
+  if(closed_.incrementAndGet() == static_cast<int>(clients_.size()))
+    loop_->queueInLoop(boost::bind(&MqttBench::quit, this));
+}
+
+void MqttBench::checkConnected()
+{
+  if(ready_.get() < static_cast<int>(clients_.size()))
+  {
+    fprintf(stderr, "only %d of %zu clients ready\n", ready_.get(), clients_.size());
+    stop();
+  }
+}
+
+void MqttBench::allReady()
+{
+  printf("%zu connections ready\n", clients_.size());
+  started_ = Timestamp::now();
+  for(size_t i = static_cast<size_t>(options_.subscribers); i < clients_.size(); ++i)
+    clients_[i].getLoop()->runInLoop(boost::bind(&BenchClient::startPublishing, &clients_[i]));
+  progress_ = loop_->runEvery(1, boost::bind(&MqttBench::progress, this));
+  loop_->runAfter(options_.warmup, boost::bind(&MqttBench::beginMeasure, this));
+  loop_->runAfter(options_.warmup + options_.duration, boost::bind(&MqttBench::endMeasure, this));
+  loop_->runAfter(options_.warmup + options_.duration + options_.drain, boost::bind(&MqttBench::report, this));
+}
+
+void MqttBench::beginMeasure()
+{
+  __atomic_store_n(&measureStart_, Timestamp::now().microSecondsSinceEpoch(), __ATOMIC_RELAXED);
+}
+
+void MqttBench::endMeasure()
+{
+  __atomic_store_n(&measureEnd_, Timestamp::now().microSecondsSinceEpoch(), __ATOMIC_RELAXED);
+  for(size_t i = static_cast<size_t>(options_.subscribers); i < clients_.size(); ++i)
+    clients_[i].getLoop()->runInLoop(boost::bind(&BenchClient::stopPublishing, &clients_[i]));
+}
+
+void MqttBench::published(int topic, int64_t sentAt)
+{
+  sent_.increment();
+  if(measuring(sentAt))
+  {
+    measuredSent_.increment();
+    expected_.add(fanout(topic));
+  }
+}
+
+void MqttBench::delivered(int64_t sentAt)
+{
+  received_.increment();
+  if(measuring(sentAt))
+    measuredDelivered_.increment();
+}
+
+void MqttBench::progress()
+{
+  //与 report 同一轮到期时可能已被取消
+  if(finished_)
+    return;
+  int64_t sent = sent_.get();
+  int64_t received = received_.get();
+  printf("%5.0f s  published %9lld/s  delivered %9lld/s\n", timeDifference(Timestamp::now(), started_),
+         static_cast<long long>(sent - lastSent_), static_cast<long long>(received - lastReceived_));
+  lastSent_ = sent;
+  lastReceived_ = received;
+}
+
+void merge(MutexLock* mutex, MqttHistogram* total, const BenchClient* client)
+{
+  MutexLockGuard lock(*mutex);
+  total->merge(client->latency());
+}
+
+void MqttBench::report()
+{
+  //各订阅者的直方图在所属线程合并进来；主线程等所有线程执行完
+  MutexLock mutex;
+  MqttHistogram latency;
+  for(size_t i = 0; i < static_cast<size_t>(options_.subscribers); ++i)
+    clients_[i].getLoop()->runInLoop(boost::bind(&merge, &mutex, &latency, &clients_[i]));
+  waitForLoops();
+  loop_->cancel(progress_);
+  finished_ = true;
+
+  double seconds = static_cast<double>(measureEnd_ - measureStart_) / 1e6;
+  int64_t sent = measuredSent_.get();
+  int64_t delivered = measuredDelivered_.get();
+  int64_t expected = expected_.get();
+  printf("\nmeasured %.2f s\n", seconds);
+  printf("published %12lld msg %12.0f msg/s\n", static_cast<long long>(sent), static_cast<double>(sent) / seconds);
+  if(options_.qos > 0)
+    printf("acked     %12lld msg in total\n", static_cast<long long>(acked_.get()));
+  printf("delivered %12lld msg %12.0f msg/s  (expected %lld, %.3f%% missing)\n",
+         static_cast<long long>(delivered), static_cast<double>(delivered) / seconds, static_cast<long long>(expected),
+         expected > 0 ? 100.0 * static_cast<double>(expected - delivered) / static_cast<double>(expected) : 0.0);
+  printf("latency us  p50 %llu  p99 %llu  p99.9 %llu  max %llu  mean %.1f\n",
+         static_cast<unsigned long long>(latency.percentile(50)),
+         static_cast<unsigned long long>(latency.percentile(99)),
+         static_cast<unsigned long long>(latency.percentile(99.9)),
+         static_cast<unsigned long long>(latency.max()), latency.mean());
+  //各订阅者的计数在所属线程写，waitForLoops 之后读
+  if(options_.subscribers > 0)
+  {
+    int64_t least = kNever;
+    int64_t most = 0;
+    for(size_t i = 0; i < static_cast<size_t>(options_.subscribers); ++i)
+    {
+      least = std::min(least, clients_[i].measuredDelivered());
+      most = std::max(most, clients_[i].measuredDelivered());
+    }
+    printf("per subscriber  min %.0f  max %.0f  mean %.0f msg/s\n",
+           static_cast<double>(least) / seconds, static_cast<double>(most) / seconds,
+           static_cast<double>(delivered) / seconds / options_.subscribers);
+  }
+  stop();
+}
+
+//全部断开后退出，析构时不再有连接回调
+void MqttBench::stop()
+{
+  for(size_t i = 0; i < clients_.size(); ++i)
+    clients_[i].getLoop()->runInLoop(boost::bind(&BenchClient::stop, &clients_[i]));
+  loop_->runAfter(5, boost::bind(&MqttBench::quit, this));
+}
+
+//各 loop 先处理完已排队的任务，包括连接断开时 TcpClient 自己的收尾
+void MqttBench::waitForLoops()
+{
+  std::vector<EventLoop*> loops = threadPool_.getAllLoops();
+  for(size_t i = 0; i < loops.size(); ++i)
+  {
+    CountDownLatch latch(1);
+    loops[i]->runInLoop(boost::bind(&CountDownLatch::countDown, &latch));
+    latch.wait();
+  }
+}
+
+void MqttBench::quit()
+{
+  waitForLoops();
+  loop_->quit();
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  Logger::setLogLevel(Logger::WARN);
+  Options options;
+  parseCommandLine(argc, argv, &options);
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  EventLoop loop;
+  MqttBench bench(&loop, options);
+  bench.start();
+  loop.loop();
+}
@@ -0,0 +1,206 @@
+#include <muduo/base/Atomic.h>
+#include <muduo/base/CountDownLatch.h>
+#include <muduo/base/Mutex.h>
+#include <muduo/base/Thread.h>
+#include <muduo/base/Timestamp.h>
+
+#include <boost/bind.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "MqttTestClient.h"
+
+using namespace muduo;
+
+//重连风暴：负载均衡切换后大量设备在几秒内同时重连。
+//每个线程尽快发起自己那份连接，连上后发 CONNECT，统计从 connect() 到收到 CONNACK 的时间。
+//对比 mqtt-server 默认的单线程 accept 与 -r 每个线程各自 accept。
+//连接数多时先调大 ulimit -n，单个源地址最多约 28000 个连接。
+namespace
+{
+
+struct Conn
+{
+  int fd;
+  int64_t startUs;
+  bool sent;
+};
+
+class Storm
+{
+public:
+  Storm(const char* ip, uint16_t port, int connections, int threads)
+    : connections_(connections),
+      latch_(1)
+  {
+    bzero(&addr_, sizeof addr_);
+    addr_.sin_family = AF_INET;
+    addr_.sin_port = htons(port);
+    ::inet_pton(AF_INET, ip, &addr_.sin_addr);
+
+    for(int i = 0; i < threads; ++i)
+    {
+      int n = connections / threads + (i < connections % threads ? 1 : 0);
+      threads_.push_back(new Thread(boost::bind(&Storm::threadFunc, this, n)));
+    }
+  }
+
+  void run()
+  {
+    for(size_t i = 0; i < threads_.size(); ++i)
+      threads_[i].start();
+
+    Timestamp start(Timestamp::now());
+    latch_.countDown();
+    for(size_t i = 0; i < threads_.size(); ++i)
+      threads_[i].join();
+    double seconds = timeDifference(Timestamp::now(), start);
+
+    std::sort(latencies_.begin(), latencies_.end());
+    size_t n = latencies_.size();
+    printf("%zd of %d connected in %.3f s, %.0f CONNACK/s, %lld failed\n",
+           n, connections_, seconds, static_cast<double>(n) / seconds,
+           static_cast<long long>(failed_.get()));
+    if(n > 0)
+    {
+      printf("connect to CONNACK ms: p50 %.1f p90 %.1f p99 %.1f max %.1f\n",
+             static_cast<double>(latencies_[n / 2]) / 1000,
+             static_cast<double>(latencies_[n * 9 / 10]) / 1000,
+             static_cast<double>(latencies_[n * 99 / 100]) / 1000,
+             static_cast<double>(latencies_[n - 1]) / 1000);
+    }
+  }
+
+private:
+  void threadFunc(int n)
+  {
+    std::vector<Conn> conns(n);
+    std::vector<int64_t> latencies;
+    latencies.reserve(n);
+    int epollfd = ::epoll_create1(EPOLL_CLOEXEC);
+
+    latch_.wait();
+    int pending = 0;
+    for(int i = 0; i < n; ++i)
+    {
+      Conn& c = conns[i];
+      c.sent = false;
+      c.startUs = Timestamp::now().microSecondsSinceEpoch();
+      c.fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if(c.fd < 0 ||
+         (::connect(c.fd, reinterpret_cast<struct sockaddr*>(&addr_), sizeof addr_) < 0 &&
+          errno != EINPROGRESS))
+      {
+        perror("connect");
+        failed_.increment();
+        continue;
+      }
+      struct epoll_event ev;
+      ev.events = EPOLLOUT;
+      ev.data.ptr = &c;
+      ::epoll_ctl(epollfd, EPOLL_CTL_ADD, c.fd, &ev);
+      ++pending;
+    }
+
+    std::vector<struct epoll_event> events(1024);
+    while(pending > 0)
+    {
+      int num = ::epoll_wait(epollfd, &events[0], static_cast<int>(events.size()), 10000);
+      if(num <= 0)
+      {
+        fprintf(stderr, "%d connections timed out\n", pending);
+        failed_.add(pending);
+        break;
+      }
+      for(int i = 0; i < num; ++i)
+      {
+        Conn& c = *static_cast<Conn*>(events[i].data.ptr);
+        if(events[i].events & (EPOLLERR | EPOLLHUP))
+        {
+          failed_.increment();
+          --pending;
+          ::epoll_ctl(epollfd, EPOLL_CTL_DEL, c.fd, NULL);
+        }
+        else if(!c.sent)
+        {
+          if(!sendConnect(c))
+          {
+            failed_.increment();
+            --pending;
+            ::epoll_ctl(epollfd, EPOLL_CTL_DEL, c.fd, NULL);
+            continue;
+          }
+          struct epoll_event ev;
+          ev.events = EPOLLIN;
+          ev.data.ptr = &c;
+          ::epoll_ctl(epollfd, EPOLL_CTL_MOD, c.fd, &ev);
+        }
+        else
+        {
+          unsigned char connack[4];
+          ssize_t nr = ::read(c.fd, connack, sizeof connack);
+          if(nr == 4 && connack[0] == 0x20 && connack[3] == 0)
+            latencies.push_back(Timestamp::now().microSecondsSinceEpoch() - c.startUs);
+          else
+            failed_.increment();
+          --pending;
+          ::epoll_ctl(epollfd, EPOLL_CTL_DEL, c.fd, NULL);
+        }
+      }
+    }
+
+    //全部连上之后再断开，风暴期间服务端一直持有这些连接
+    ::close(epollfd);
+    for(int i = 0; i < n; ++i)
+    {
+      if(conns[i].fd >= 0)
+        ::close(conns[i].fd);
+    }
+
+    MutexLockGuard lock(mutex_);
+    latencies_.insert(latencies_.end(), latencies.begin(), latencies.end());
+  }
+
+  bool sendConnect(Conn& c)
+  {
+    char clientId[32];
+    snprintf(clientId, sizeof clientId, "storm-%d", c.fd);
+    std::string packet;
+    MqttTestClient::appendConnect(&packet, clientId, true, 60);
+    c.sent = true;
+    return ::write(c.fd, packet.data(), packet.size()) == static_cast<ssize_t>(packet.size());
+  }
+
+  struct sockaddr_in addr_;
+  const int connections_;
+  CountDownLatch latch_;
+  boost::ptr_vector<Thread> threads_;
+  AtomicInt64 failed_;
+  MutexLock mutex_;
+  std::vector<int64_t> latencies_;
+};
+
+}
+
+int main(int argc, char* argv[])
+{
+  const char* ip = argc > 1 ? argv[1] : "127.0.0.1";
+  uint16_t port = static_cast<uint16_t>(argc > 2 ? atoi(argv[2]) : 1883);
+  int connections = argc > 3 ? atoi(argv[3]) : 10000;
+  int threads = argc > 4 ? atoi(argv[4]) : 4;
+  printf("%d connections from %d threads to %s:%d\n", connections, threads, ip, port);
+
+  Storm storm(ip, port, connections, threads);
+  storm.run();
+}
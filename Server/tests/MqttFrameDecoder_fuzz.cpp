@@ -0,0 +1,226 @@
+#include "MqttFrameDecoder.h"
+#include "MqttProtocol.h"
+
+#include <muduo/base/Timestamp.h>
+#include <muduo/net/Buffer.h>
+
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace muduo;
+using namespace muduo::net;
+
+//将随机生成的报文流按随机长度切片后逐片送入 Buffer，
+//用 MqttClientSession::onMessage 同样调用的 MqttFrameDecoder::drain 取出所有完整报文，并与原报文逐一比对。
+//处理函数随机只读报文的一部分，检查余下的字节被跳过。最后测量一次读到大量小报文时的解析吞吐。
+namespace
+{
+
+struct Frame
+{
+  uint8_t type;
+  string body;         // 处理函数读出的部分
+  uint32_t length;     // 剩余长度
+};
+
+void encodeFrame(const Frame& frame, string* out)
+{
+  out->push_back(static_cast<char>(frame.type));
+  size_t remainingLength = frame.body.size();
+  do
+  {
+    uint8_t byte = static_cast<uint8_t>(remainingLength % 128);
+    remainingLength /= 128;
+    if(remainingLength > 0)
+      byte = byte | 0x80;
+    out->push_back(static_cast<char>(byte));
+  }while(remainingLength > 0);
+  out->append(frame.body);
+}
+
+//剩余长度覆盖 1 到 3 个字节的编码
+size_t randomBodySize()
+{
+  switch(rand() % 8)
+  {
+    case 0:
+      return 0;
+    case 1:
+      return 128 + rand() % 16384;
+    case 2:
+      return 16384 + rand() % 100000;
+    default:
+      return rand() % 128;
+  }
+}
+
+Frame randomFrame()
+{
+  static const uint8_t types[] = { PUBLISH, PUBLISH | 0x02, PUBACK, PUBREC, PUBREL | 0x02,
+                                   PUBCOMP, SUBSCRIBE | 0x02, PINGREQ, DISCONNECT };
+  Frame frame;
+  frame.type = types[rand() % (sizeof types / sizeof types[0])];
+  frame.body.resize(randomBodySize());
+  for(size_t i = 0; i < frame.body.size(); ++i)
+    frame.body[i] = static_cast<char>(rand());
+  frame.length = static_cast<uint32_t>(frame.body.size());
+  return frame;
+}
+
+//记下每个报文；partial 为 true 时随机只读一部分，其余由 drain 跳过
+struct Collector
+{
+  Collector(std::vector<Frame>* out, bool partial)
+    : out_(out), partial_(partial)
+  { }
+
+  bool operator()(const MqttFixedHeader& header, Buffer* buffer) const
+  {
+    Frame frame;
+    frame.type = header.type;
+    frame.length = header.remainingLength;
+    size_t len = header.remainingLength;
+    if(partial_ && rand() % 2 == 0)
+      len = static_cast<size_t>(rand()) % (len + 1);
+    frame.body = buffer->retrieveAsString(len);
+    out_->push_back(frame);
+    return true;
+  }
+
+  std::vector<Frame>* out_;
+  bool partial_;
+};
+
+//多读一个字节的处理函数
+bool overRead(const MqttFixedHeader& header, Buffer* buffer)
+{
+  if(buffer->readableBytes() > header.remainingLength)
+    buffer->retrieve(header.remainingLength + 1);
+  return true;
+}
+
+bool fuzz(int rounds, int framesPerRound)
+{
+  for(int round = 0; round < rounds; ++round)
+  {
+    std::vector<Frame> frames;
+    string stream;
+    for(int i = 0; i < framesPerRound; ++i)
+    {
+      frames.push_back(randomFrame());
+      encodeFrame(frames.back(), &stream);
+    }
+
+    //切片长度从单字节到整段不等
+    size_t maxPiece = 1 + rand() % (round % 2 == 0 ? 16 : 65536);
+    bool partial = round % 3 == 0;
+    Buffer buffer;
+    std::vector<Frame> decoded;
+    size_t pos = 0;
+    while(pos < stream.size())
+    {
+      size_t piece = std::min(stream.size() - pos, 1 + rand() % maxPiece);
+      buffer.append(stream.data() + pos, piece);
+      pos += piece;
+      if(MqttFrameDecoder::drain(&buffer, Collector(&decoded, partial)) != MqttFrameDecoder::kIncomplete)
+      {
+        printf("round %d: malformed\n", round);
+        return false;
+      }
+    }
+
+    if(buffer.readableBytes() != 0 || decoded.size() != frames.size())
+    {
+      printf("round %d: decoded %zd of %zd frames, %zd bytes left\n",
+             round, decoded.size(), frames.size(), buffer.readableBytes());
+      return false;
+    }
+    for(size_t i = 0; i < frames.size(); ++i)
+    {
+      if(decoded[i].type != frames[i].type || decoded[i].length != frames[i].length ||
+         frames[i].body.compare(0, decoded[i].body.size(), decoded[i].body) != 0)
+      {
+        printf("round %d: frame %zd mismatch\n", round, i);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool malformed()
+{
+  //剩余长度超过4个字节
+  const char tooLong[] = { PUBLISH, '\xff', '\xff', '\xff', '\xff', '\x01' };
+  MqttFixedHeader header;
+  if(MqttFrameDecoder::peekFrame(tooLong, sizeof tooLong, &header) != MqttFrameDecoder::kMalformed)
+    return false;
+  //只到了部分剩余长度字节
+  if(MqttFrameDecoder::peekFrame(tooLong, 3, &header) != MqttFrameDecoder::kIncomplete)
+    return false;
+  //最大剩余长度 268435455
+  const char maxLen[] = { PUBLISH, '\xff', '\xff', '\xff', '\x7f' };
+  if(MqttFrameDecoder::peekFrame(maxLen, sizeof maxLen, &header) != MqttFrameDecoder::kIncomplete ||
+     header.remainingLength != MQTT_MAX_PAYLOAD || header.headerLength != 5)
+    return false;
+  //处理函数读过了报文边界
+  const char twoAcks[] = { PUBACK, '\x02', '\x00', '\x01', PUBACK, '\x02', '\x00', '\x02' };
+  Buffer buffer;
+  buffer.append(twoAcks, sizeof twoAcks);
+  if(MqttFrameDecoder::drain(&buffer, overRead) != MqttFrameDecoder::kMalformed)
+    return false;
+  //格式错误的报头之前的完整报文照常取出
+  std::vector<Frame> decoded;
+  buffer.retrieveAll();
+  buffer.append(twoAcks, 4);
+  buffer.append(tooLong, sizeof tooLong);
+  return MqttFrameDecoder::drain(&buffer, Collector(&decoded, false)) == MqttFrameDecoder::kMalformed &&
+         decoded.size() == 1;
+}
+
+void bench(int frames)
+{
+  Frame publish;
+  publish.type = PUBLISH | 0x02;
+  publish.body.assign("\x00\x0d" "sensors/1/tmp" "\x00\x01" "21.5", 2 + 13 + 2 + 4);
+  string stream;
+  for(int i = 0; i < frames; ++i)
+    encodeFrame(publish, &stream);
+
+  Buffer buffer;
+  std::vector<Frame> decoded;
+  decoded.reserve(frames);
+  Timestamp start(Timestamp::now());
+  buffer.append(stream);
+  MqttFrameDecoder::drain(&buffer, Collector(&decoded, false));
+  double seconds = timeDifference(Timestamp::now(), start);
+  printf("%zd pipelined frames in one buffer: %.3f s, %.0f frames/s\n",
+         decoded.size(), seconds, static_cast<double>(decoded.size()) / seconds);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  int rounds = argc > 1 ? atoi(argv[1]) : 100;
+  int frames = argc > 2 ? atoi(argv[2]) : 1000000;
+  unsigned seed = argc > 3 ? static_cast<unsigned>(atoi(argv[3])) : static_cast<unsigned>(time(NULL));
+  srand(seed);
+  printf("seed %u\n", seed);
+
+  if(!malformed())
+  {
+    printf("malformed length check FAILED\n");
+    return 1;
+  }
+  if(!fuzz(rounds, 200))
+  {
+    printf("fuzz FAILED\n");
+    return 1;
+  }
+  printf("%d rounds of random fragmentation OK\n", rounds);
+
+  bench(frames);
+  return 0;
+}
@@ -0,0 +1,74 @@
+#include "MqttInflightWindow.h"
+
+#include <muduo/base/Timestamp.h>
+
+#include <boost/shared_ptr.hpp>
+#include <deque>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace muduo;
+
+//QoS 1 投递的稳态：窗口保持满，每收到一个 PUBACK 就再发一条。
+//对比原先每次投递插入一个 std::map 节点与按报文标识符定位的槽位表。
+namespace
+{
+
+typedef std::map<uint16_t,boost::shared_ptr<MqttMessage> > LegacyList;
+
+double benchLegacy(const boost::shared_ptr<MqttMessage>& msg, int window, int times)
+{
+  LegacyList msgs;
+  std::deque<uint16_t> inflight;
+  uint16_t nextMid = 0;
+  Timestamp start(Timestamp::now());
+  for(int i = 0; i < times; ++i)
+  {
+    if(static_cast<int>(inflight.size()) == window)
+    {
+      msgs.erase(inflight.front());
+      inflight.pop_front();
+    }
+    do
+    {
+      ++nextMid;
+    } while(nextMid == 0 || msgs.count(nextMid) > 0);
+    msgs[nextMid] = msg;
+    inflight.push_back(nextMid);
+  }
+  return timeDifference(Timestamp::now(), start);
+}
+
+double benchWindow(const boost::shared_ptr<MqttMessage>& msg, int window, int times)
+{
+  MqttInflightWindow msgs(static_cast<uint16_t>(window));
+  std::deque<uint16_t> inflight;
+  Timestamp start(Timestamp::now());
+  for(int i = 0; i < times; ++i)
+  {
+    if(msgs.full())
+    {
+      msgs.remove(inflight.front());
+      inflight.pop_front();
+    }
+    inflight.push_back(msgs.add(msg, MqttMessage::ms_wait_for_puback));
+  }
+  return timeDifference(Timestamp::now(), start);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  int window = argc > 1 ? atoi(argv[1]) : 20;
+  int times = argc > 2 ? atoi(argv[2]) : 10000000;
+  boost::shared_ptr<MqttMessage> msg(new MqttMessage);
+  msg->qos = 1;
+
+  double legacy = benchLegacy(msg, window, times);
+  double slots = benchWindow(msg, window, times);
+  printf("window %d, %d deliveries\n", window, times);
+  printf("std::map:     %.1f ns/delivery\n", legacy * 1e9 / times);
+  printf("slot table:   %.1f ns/delivery\n", slots * 1e9 / times);
+}
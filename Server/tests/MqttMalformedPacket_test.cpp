@@ -0,0 +1,308 @@
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "MqttProtocol.h"
+#include "MqttTestClient.h"
+
+//畸形报文：每个用例新开一条连接发出一段违反协议的字节流，服务端必须关闭这条连接，
+//且在关闭前除 CONNACK 外不回任何报文，字符串越过报文末尾时也不能先回 SUBACK 等应答。
+//另有一个订阅 # 的观察者，所有用例结束后由新连接发布一条探测消息：观察者收到的
+//第一条就是它，说明服务端仍然存活，畸形的发布也没有被投递。最后再订阅一次，
+//确认没有畸形的保留消息留下。
+namespace
+{
+
+const char* kProbeTopic = "malformed/alive";
+
+void appendUint16(std::string* out, uint16_t value)
+{
+  *out += static_cast<char>(value >> 8);
+  *out += static_cast<char>(value & 0xFF);
+}
+
+void appendString(std::string* out, const std::string& s)
+{
+  appendUint16(out, static_cast<uint16_t>(s.size()));
+  *out += s;
+}
+
+std::string connectPacket(const char* clientId)
+{
+  std::string out;
+  MqttTestClient::appendConnect(&out, clientId, true, 0);
+  return out;
+}
+
+std::string wildcardPublishQos0(const char* clientId)
+{
+  std::string out(connectPacket(clientId));
+  MqttTestClient::appendFixedHeader(&out, PUBLISH | 0x01, 2 + 12 + 3);
+  appendString(&out, "malformed/+/");
+  out += "bad";
+  return out;
+}
+
+std::string wildcardPublishQos2(const char* clientId)
+{
+  std::string out(connectPacket(clientId));
+  MqttTestClient::appendPublishHeader(&out, "malformed/#", 2, 1, 3);
+  out += "bad";
+  MqttTestClient::appendAck(&out, PUBREL | 0x02, 1);
+  return out;
+}
+
+std::string wildcardWillTopic(const char* clientId)
+{
+  std::string body;
+  appendString(&body, PROTOCOL_NAME_v311);
+  body += static_cast<char>(PROTOCOL_VERSION_v311);
+  body += static_cast<char>(0x02 | 0x04 | 0x20);
+  appendUint16(&body, 0);
+  appendString(&body, clientId);
+  appendString(&body, "malformed/#");
+  appendString(&body, "bad");
+
+  std::string out;
+  MqttTestClient::appendFixedHeader(&out, CONNECT, body.size());
+  out += body;
+  return out;
+}
+
+//长度字段越过报文末尾的字符串：只带 "malformed/"，声明的长度却是 24，
+//其余字节是后面紧跟着的另一个报文
+void appendCrossingString(std::string* out)
+{
+  appendUint16(out, 24);
+  *out += "malformed/";
+}
+
+void appendNextPacket(std::string* out)
+{
+  MqttTestClient::appendPublishHeader(out, "malformed/next", 0, 0, 16);
+  out->append(16, 'x');
+}
+
+std::string subscribeCrossingFrame(const char* clientId)
+{
+  std::string body;
+  appendUint16(&body, 1);
+  appendString(&body, "malformed/sub");
+  body += '\0';
+  appendCrossingString(&body);
+
+  std::string out(connectPacket(clientId));
+  MqttTestClient::appendFixedHeader(&out, SUBSCRIBE | 0x02, body.size());
+  out += body;
+  appendNextPacket(&out);
+  return out;
+}
+
+std::string unsubscribeCrossingFrame(const char* clientId)
+{
+  std::string body;
+  appendUint16(&body, 1);
+  appendString(&body, "malformed/sub");
+  appendCrossingString(&body);
+
+  std::string out(connectPacket(clientId));
+  MqttTestClient::appendFixedHeader(&out, UNSUBSCRIBE | 0x02, body.size());
+  out += body;
+  appendNextPacket(&out);
+  return out;
+}
+
+std::string willTopicCrossingFrame(const char* clientId)
+{
+  std::string body;
+  appendString(&body, PROTOCOL_NAME_v311);
+  body += static_cast<char>(PROTOCOL_VERSION_v311);
+  body += static_cast<char>(0x02 | 0x04);
+  appendUint16(&body, 0);
+  appendString(&body, clientId);
+  appendCrossingString(&body);
+
+  std::string out;
+  MqttTestClient::appendFixedHeader(&out, CONNECT, body.size());
+  out += body;
+  //凑出越界读时看似完整的遗嘱主题和负载
+  out.append(14, 'x');
+  appendString(&out, "bad");
+  return out;
+}
+
+std::string connectTrailingBytes(const char* clientId)
+{
+  std::string out(connectPacket(clientId));
+  out[1] = static_cast<char>(out[1] + 2);
+  appendString(&out, "");
+  return out;
+}
+
+struct Case
+{
+  const char* name;
+  std::string (*build)(const char* clientId);
+  bool connack;
+};
+
+const Case kCases[] =
+{
+  { "QoS 0 retained PUBLISH to a wildcard topic", &wildcardPublishQos0, true },
+  { "QoS 2 PUBLISH to a wildcard topic, then PUBREL", &wildcardPublishQos2, true },
+  { "CONNECT with a wildcard will topic", &wildcardWillTopic, false },
+  { "SUBSCRIBE filter crossing the frame end", &subscribeCrossingFrame, true },
+  { "UNSUBSCRIBE filter crossing the frame end", &unsubscribeCrossingFrame, true },
+  { "CONNECT will topic crossing the frame end", &willTopicCrossingFrame, false },
+  { "CONNECT with bytes after the last field", &connectTrailingBytes, false },
+};
+
+bool writeAll(int fd, const std::string& data)
+{
+  size_t written = 0;
+  while(written < data.size())
+  {
+    ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+    if(n <= 0)
+      return false;
+    written += static_cast<size_t>(n);
+  }
+  return true;
+}
+
+//读到对端关闭为止，收到的报文类型放进 types；超时仍未关闭返回 false
+bool readUntilClosed(int fd, std::vector<unsigned char>* types)
+{
+  struct timeval tv = { 3, 0 };
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+  std::string buf;
+  bool closed = false;
+  for(;;)
+  {
+    char tmp[4096];
+    ssize_t n = ::read(fd, tmp, sizeof tmp);
+    if(n > 0)
+    {
+      buf.append(tmp, static_cast<size_t>(n));
+      continue;
+    }
+    closed = n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+    break;
+  }
+
+  //fd 为 -1 时 readPacket 只解析已有字节
+  unsigned char type;
+  std::string body;
+  while(MqttTestClient::readPacket(-1, &buf, &type, &body))
+    types->push_back(type);
+  return closed;
+}
+
+bool runCase(const struct sockaddr_in& addr, const Case& c, int index)
+{
+  char clientId[32];
+  snprintf(clientId, sizeof clientId, "malformed-%d", index);
+  int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(::connect(fd, reinterpret_cast<const struct sockaddr*>(&addr), sizeof addr) < 0)
+  {
+    perror("connect");
+    exit(1);
+  }
+
+  std::vector<unsigned char> types;
+  bool closed = writeAll(fd, c.build(clientId)) && readUntilClosed(fd, &types);
+  ::close(fd);
+
+  bool ok = closed;
+  size_t expected = c.connack ? 1 : 0;
+  if(types.size() != expected || (expected == 1 && types[0] != CONNACK))
+    ok = false;
+  printf("%-50s %s", c.name, ok ? "closed" : "FAILED");
+  if(!closed)
+    printf(" (connection still open)");
+  for(size_t i = 0; i < types.size(); ++i)
+    printf(" %02x", types[i]);
+  printf("\n");
+  return ok;
+}
+
+//订阅后由另一个连接发布探测消息，返回收到的第一条 PUBLISH 的主题
+std::string firstTopicAfterProbe(const struct sockaddr_in& addr, int fd, std::string* buf)
+{
+  int pub = MqttTestClient::connectTo(addr, "malformed-probe");
+  std::string packet;
+  MqttTestClient::appendPublishHeader(&packet, kProbeTopic, 0, 0, 0);
+  writeAll(pub, packet);
+
+  struct timeval tv = { 3, 0 };
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+  std::string topic;
+  unsigned char type;
+  std::string body;
+  while(MqttTestClient::readPacket(fd, buf, &type, &body))
+  {
+    if((type & 0xF0) != PUBLISH || body.size() < 2)
+      continue;
+    size_t len = (static_cast<unsigned char>(body[0]) << 8) | static_cast<unsigned char>(body[1]);
+    topic.assign(body, 2, len);
+    break;
+  }
+  ::close(pub);
+  return topic;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  const char* ip = argc > 1 ? argv[1] : "127.0.0.1";
+  uint16_t port = static_cast<uint16_t>(argc > 2 ? atoi(argv[2]) : 1883);
+
+  struct sockaddr_in addr;
+  bzero(&addr, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  ::inet_pton(AF_INET, ip, &addr.sin_addr);
+
+  std::string buf;
+  int watcher = MqttTestClient::connectTo(addr, "malformed-watcher");
+  MqttTestClient::subscribe(watcher, &buf, "#", 0);
+
+  int failed = 0;
+  const int cases = static_cast<int>(sizeof kCases / sizeof kCases[0]);
+  for(int i = 0; i < cases; ++i)
+  {
+    if(!runCase(addr, kCases[i], i))
+      ++failed;
+  }
+
+  std::string topic = firstTopicAfterProbe(addr, watcher, &buf);
+  bool alive = topic == kProbeTopic;
+  printf("%-50s %s\n", "server alive, nothing malformed delivered",
+         alive ? "ok" : ("FAILED, got '" + topic + "'").c_str());
+  if(!alive)
+    ++failed;
+  ::close(watcher);
+
+  std::string lateBuf;
+  int late = MqttTestClient::connectTo(addr, "malformed-late");
+  MqttTestClient::subscribe(late, &lateBuf, "malformed/#", 0);
+  topic = firstTopicAfterProbe(addr, late, &lateBuf);
+  bool noRetain = topic == kProbeTopic;
+  printf("%-50s %s\n", "no malformed retained message",
+         noRetain ? "ok" : ("FAILED, got '" + topic + "'").c_str());
+  if(!noRetain)
+    ++failed;
+  ::close(late);
+
+  printf("%d of %d checks failed\n", failed, cases + 2);
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,136 @@
+#include "MqttMessage.h"
+#include "MqttMessagePool.h"
+#include "MqttPublishFrame.h"
+
+#include <muduo/base/BlockingQueue.h>
+#include <muduo/base/Thread.h>
+#include <muduo/base/Timestamp.h>
+
+#include <boost/bind.hpp>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace muduo;
+
+//收到一条小负载 PUBLISH 时的分配开销：逐个 new 对比从池中分配。
+//替换 malloc 以统计调用次数；跨线程一项在一个线程创建、另一个线程释放，
+//对应发布者与订阅者分属不同 IO 线程的情形。
+extern "C" void* __libc_malloc(size_t size);
+
+namespace
+{
+  __thread int64_t t_mallocs = 0;
+}
+
+extern "C" void* malloc(size_t size)
+{
+  ++t_mallocs;
+  return __libc_malloc(size);
+}
+
+namespace
+{
+
+typedef std::vector<boost::shared_ptr<MqttMessage> > Batch;
+
+const char kTopic[] = "sensors/building-7/floor-3/temperature";
+
+boost::shared_ptr<MqttMessage> heapMessage(const string& topic, const string& payload)
+{
+  boost::shared_ptr<MqttMessage> msg(new MqttMessage());
+  msg->qos = 1;
+  msg->topic = MqttTopic::intern(topic);
+  msg->payload = net::BufferChunk(payload);
+  msg->frame.reset(new MqttPublishFrame(*msg));
+  return msg;
+}
+
+boost::shared_ptr<MqttMessage> pooledMessage(const string& topic, const string& payload)
+{
+  boost::shared_ptr<MqttMessage> msg = newMqttMessage();
+  msg->qos = 1;
+  msg->topic = MqttTopic::intern(topic);
+  msg->payload = newMqttPayload(payload.data(), payload.size());
+  msg->frame = newMqttPublishFrame(*msg);
+  return msg;
+}
+
+typedef boost::shared_ptr<MqttMessage> (*Factory)(const string&, const string&);
+
+//同一线程：保持 batch 条消息存活，整体释放后再分配，模拟稳定状态
+void benchLocal(const char* name, Factory factory, int messages, int batch, const string& payload)
+{
+  string topic(kTopic);
+  Batch live;
+  live.reserve(static_cast<size_t>(batch));
+  int64_t mallocs = t_mallocs;
+  Timestamp start(Timestamp::now());
+  for(int i = 0; i < messages; ++i)
+  {
+    if(live.size() == static_cast<size_t>(batch))
+      live.clear();
+    live.push_back(factory(topic, payload));
+  }
+  live.clear();
+  double seconds = timeDifference(Timestamp::now(), start);
+  printf("%-8s same thread:  %6.1f ns/msg, %.2f mallocs/msg\n", name,
+         seconds * 1e9 / messages, static_cast<double>(t_mallocs - mallocs) / messages);
+}
+
+void release(BlockingQueue<Batch*>* queue)
+{
+  for(;;)
+  {
+    Batch* batch = queue->take();
+    if(!batch)
+      break;
+    delete batch;
+  }
+}
+
+void benchCrossThread(const char* name, Factory factory, int messages, int batch, const string& payload)
+{
+  string topic(kTopic);
+  BlockingQueue<Batch*> queue;
+  Thread releaser(boost::bind(&release, &queue));
+  releaser.start();
+
+  int64_t mallocs = t_mallocs;
+  Timestamp start(Timestamp::now());
+  for(int i = 0; i < messages; i += batch)
+  {
+    Batch* live = new Batch;
+    live->reserve(static_cast<size_t>(batch));
+    for(int j = 0; j < batch; ++j)
+      live->push_back(factory(topic, payload));
+    queue.put(live);
+  }
+  queue.put(NULL);
+  releaser.join();
+  double seconds = timeDifference(Timestamp::now(), start);
+  printf("%-8s cross thread: %6.1f ns/msg, %.2f mallocs/msg on the publishing thread\n", name,
+         seconds * 1e9 / messages, static_cast<double>(t_mallocs - mallocs) / messages);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  int messages = argc > 1 ? atoi(argv[1]) : 3000000;
+  int payloadSize = argc > 2 ? atoi(argv[2]) : 64;
+  int batch = argc > 3 ? atoi(argv[3]) : 1024;
+  string payload(static_cast<size_t>(payloadSize), 'p');
+  printf("%d messages, %d byte payload, topic %zu bytes\n", messages, payloadSize, sizeof kTopic - 1);
+
+  benchLocal("new", &heapMessage, messages, batch, payload);
+  benchLocal("pool", &pooledMessage, messages, batch, payload);
+  benchCrossThread("new", &heapMessage, messages, batch, payload);
+  benchCrossThread("pool", &pooledMessage, messages, batch, payload);
+
+  MqttMessagePool::Stats stats = MqttMessagePool::stats();
+  printf("pool: %lld allocations, %lld freed by other threads, %lld outstanding, %lld slabs, %lld fallbacks\n",
+         static_cast<long long>(stats.allocations), static_cast<long long>(stats.remoteFrees),
+         static_cast<long long>(stats.outstanding), static_cast<long long>(stats.slabs),
+         static_cast<long long>(stats.fallbacks));
+}
@@ -0,0 +1,178 @@
+#include <muduo/base/Atomic.h>
+#include <muduo/base/CountDownLatch.h>
+#include <muduo/base/Thread.h>
+#include <muduo/base/Timestamp.h>
+
+#include <boost/bind.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "MqttProtocol.h"
+#include "MqttTestClient.h"
+
+using namespace muduo;
+
+//多线程 QoS 1 吞吐：若干发布者各自发往 bench/<n>，每个订阅者以 QoS 1 订阅 bench/+，
+//收到即回 PUBACK。投递与 PUBACK 原先分别在发布者与订阅者的线程上修改同一会话的未确认表，
+//会话按线程归属是为了消除这里的数据竞争，不是为了提速：投递要转交到所属线程，多一次排队。
+//用来确认改动前后吞吐没有明显下降。
+namespace
+{
+
+class Bench
+{
+public:
+  Bench(const char* ip, uint16_t port, int publishers, int subscribers,
+        int messages, int window, int payloadSize)
+    : publishers_(publishers),
+      subscribers_(subscribers),
+      messages_(messages),
+      window_(window),
+      payload_(payloadSize, 'x'),
+      subscribed_(subscribers),
+      start_(1)
+  {
+    bzero(&addr_, sizeof addr_);
+    addr_.sin_family = AF_INET;
+    addr_.sin_port = htons(port);
+    ::inet_pton(AF_INET, ip, &addr_.sin_addr);
+  }
+
+  void run()
+  {
+    boost::ptr_vector<Thread> threads;
+    for(int i = 0; i < subscribers_; ++i)
+      threads.push_back(new Thread(boost::bind(&Bench::subscriber, this, i)));
+    for(int i = 0; i < publishers_; ++i)
+      threads.push_back(new Thread(boost::bind(&Bench::publisher, this, i)));
+
+    for(size_t i = 0; i < threads.size(); ++i)
+      threads[i].start();
+    subscribed_.wait();
+    Timestamp start(Timestamp::now());
+    start_.countDown();
+    for(size_t i = 0; i < threads.size(); ++i)
+      threads[i].join();
+    double seconds = timeDifference(Timestamp::now(), start);
+
+    int64_t expected = static_cast<int64_t>(publishers_) * messages_ * subscribers_;
+    printf("%lld of %lld deliveries in %.3f s, %.0f deliveries/s\n",
+           static_cast<long long>(delivered_.get()), static_cast<long long>(expected),
+           seconds, static_cast<double>(delivered_.get()) / seconds);
+  }
+
+private:
+  void publisher(int id)
+  {
+    char clientId[32];
+    snprintf(clientId, sizeof clientId, "bench-pub-%d", id);
+    int fd = MqttTestClient::connectTo(addr_, clientId);
+    char topic[32];
+    snprintf(topic, sizeof topic, "bench/%d", id);
+
+    start_.wait();
+    std::string buf;
+    std::string body;
+    unsigned char type;
+    int sent = 0;
+    while(sent < messages_)
+    {
+      //一次写出一个窗口，再等齐对应的 PUBACK
+      std::string packets;
+      int batch = std::min(window_, messages_ - sent);
+      for(int i = 0; i < batch; ++i)
+      {
+        uint16_t mid = static_cast<uint16_t>((sent + i) % 65535 + 1);
+        MqttTestClient::appendPublishHeader(&packets, topic, 1, mid, payload_.size());
+        packets += payload_;
+      }
+      ::write(fd, packets.data(), packets.size());
+      for(int i = 0; i < batch; ++i)
+      {
+        if(!MqttTestClient::readPacket(fd, &buf, &type, &body) || (type & 0xF0) != PUBACK)
+        {
+          fprintf(stderr, "publisher %d: no PUBACK\n", id);
+          ::close(fd);
+          return;
+        }
+      }
+      sent += batch;
+    }
+    ::close(fd);
+  }
+
+  void subscriber(int id)
+  {
+    char clientId[32];
+    snprintf(clientId, sizeof clientId, "bench-sub-%d", id);
+    int fd = MqttTestClient::connectTo(addr_, clientId);
+
+    std::string buf;
+    std::string body;
+    unsigned char type;
+    MqttTestClient::subscribe(fd, &buf, "bench/+", 1);
+    subscribed_.countDown();
+
+    int64_t expected = static_cast<int64_t>(publishers_) * messages_;
+    int64_t received = 0;
+    std::string acks;
+    while(received < expected)
+    {
+      if(!MqttTestClient::readPacket(fd, &buf, &type, &body))
+        break;
+      if((type & 0xF0) != PUBLISH)
+        continue;
+      size_t topicLen = (static_cast<unsigned char>(body[0]) << 8) | static_cast<unsigned char>(body[1]);
+      uint16_t mid = static_cast<uint16_t>((static_cast<unsigned char>(body[2 + topicLen]) << 8) |
+                                           static_cast<unsigned char>(body[3 + topicLen]));
+      MqttTestClient::appendAck(&acks, PUBACK, mid);
+      ++received;
+      //本次读到的报文处理完再一起回 PUBACK
+      if(buf.size() < 2)
+      {
+        ::write(fd, acks.data(), acks.size());
+        acks.clear();
+      }
+    }
+    if(!acks.empty())
+      ::write(fd, acks.data(), acks.size());
+    delivered_.add(received);
+    ::close(fd);
+  }
+
+  struct sockaddr_in addr_;
+  const int publishers_;
+  const int subscribers_;
+  const int messages_;
+  const int window_;
+  const std::string payload_;
+  CountDownLatch subscribed_;
+  CountDownLatch start_;
+  AtomicInt64 delivered_;
+};
+
+}
+
+int main(int argc, char* argv[])
+{
+  const char* ip = argc > 1 ? argv[1] : "127.0.0.1";
+  uint16_t port = static_cast<uint16_t>(argc > 2 ? atoi(argv[2]) : 1883);
+  int publishers = argc > 3 ? atoi(argv[3]) : 4;
+  int subscribers = argc > 4 ? atoi(argv[4]) : 4;
+  int messages = argc > 5 ? atoi(argv[5]) : 20000;
+  int window = argc > 6 ? atoi(argv[6]) : 100;
+  int payloadSize = argc > 7 ? atoi(argv[7]) : 64;
+  printf("%d publishers x %d QoS 1 messages of %d bytes, %d subscribers, window %d\n",
+         publishers, messages, payloadSize, subscribers, window);
+
+  Bench bench(ip, port, publishers, subscribers, messages, window, payloadSize);
+  bench.run();
+}
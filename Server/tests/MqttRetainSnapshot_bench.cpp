@@ -0,0 +1,117 @@
+#include "MqttRetainSnapshot.h"
+#include "MqttTopicTree.h"
+
+#include <muduo/base/Timestamp.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace muduo;
+
+//大量保留消息的启动开销：映射快照按需读取，对比逐条重新写入主题树。
+namespace
+{
+
+long residentKB()
+{
+  long pages = 0, resident = 0;
+  FILE* fp = fopen("/proc/self/statm", "r");
+  if(fp)
+  {
+    if(fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+      resident = 0;
+    fclose(fp);
+  }
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+string topicOf(int i)
+{
+  char topic[64];
+  snprintf(topic, sizeof topic, "shadow/device-%08d/state", i);
+  return topic;
+}
+
+void writeSnapshot(const string& path, int topics, const string& payload)
+{
+  std::vector<string> names;
+  names.reserve(static_cast<size_t>(topics));
+  for(int i = 0; i < topics; ++i)
+    names.push_back(topicOf(i));
+
+  std::vector<MqttRetainSnapshot::Entry> entries(names.size());
+  for(size_t i = 0; i < names.size(); ++i)
+  {
+    entries[i].topic = names[i];
+    entries[i].qos = 1;
+    entries[i].payload = payload;
+    entries[i].deleted = false;
+  }
+
+  Timestamp start(Timestamp::now());
+  size_t written = 0;
+  MqttRetainSnapshot::write(path, NULL, entries, &written);
+  printf("write snapshot: %zu topics in %.3f s\n", written, timeDifference(Timestamp::now(), start));
+}
+
+void benchMapped(const string& path, int topics, int lookups)
+{
+  long rss = residentKB();
+  Timestamp start(Timestamp::now());
+  MqttRetainSnapshot snapshot;
+  if(!snapshot.open(path))
+    return;
+  printf("mmap snapshot: %.6f s, +%ld KB resident\n",
+         timeDifference(Timestamp::now(), start), residentKB() - rss);
+
+  start = Timestamp::now();
+  size_t found = 0;
+  for(int i = 0; i < lookups; ++i)
+  {
+    size_t index = snapshot.find(topicOf(rand() % topics));
+    if(index != snapshot.size() && snapshot.message(index))
+      ++found;
+  }
+  double seconds = timeDifference(Timestamp::now(), start);
+  printf("  %d random lookups: %.0f ns each, %zu found, +%ld KB resident\n",
+         lookups, seconds * 1e9 / lookups, found, residentKB() - rss);
+}
+
+void benchIngest(int topics, const string& payload)
+{
+  long rss = residentKB();
+  Timestamp start(Timestamp::now());
+  MqttTopicTree* tree = new MqttTopicTree;
+  for(int i = 0; i < topics; ++i)
+  {
+    boost::shared_ptr<MqttMessage> msg(new MqttMessage);
+    msg->qos = 1;
+    msg->retain = true;
+    msg->topic = MqttTopic::intern(topicOf(i));
+    msg->payload = net::BufferChunk(payload);
+    tree->addRetainMsg(msg);
+  }
+  printf("re-ingest into topic tree: %.3f s, +%ld KB resident\n",
+         timeDifference(Timestamp::now(), start), residentKB() - rss);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  if(argc < 2)
+  {
+    printf("Usage: %s snapshot-file [topics] [payload] [lookups]\n", argv[0]);
+    return 1;
+  }
+  string path = argv[1];
+  int topics = argc > 2 ? atoi(argv[2]) : 1000000;
+  int payloadSize = argc > 3 ? atoi(argv[3]) : 64;
+  int lookups = argc > 4 ? atoi(argv[4]) : 100000;
+  string payload(static_cast<size_t>(payloadSize), 'p');
+
+  writeSnapshot(path, topics, payload);
+  benchMapped(path, topics, lookups);
+  benchIngest(topics, payload);
+}
@@ -0,0 +1,122 @@
+#include "MqttTopicTrie.h"
+#include "MqttPersistentMap.h"
+
+#include <muduo/base/Timestamp.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace muduo;
+
+//通配符订阅取保留消息：按层级索引的游标对比扫描全部主题逐个匹配。
+namespace
+{
+
+typedef MqttTopicTrie<string> RetainTrie;
+typedef MqttPersistentMap<string> RetainMap;
+
+//与 MqttTopicTree::matchingWildcard 语义一致
+bool matches(const string& filter, const string& topic)
+{
+  if(!topic.empty() && topic[0] == '$' && !filter.empty() && (filter[0] == '+' || filter[0] == '#'))
+    return false;
+  size_t fpos = 0, pos = 0;
+  while(fpos <= filter.size())
+  {
+    size_t fend = filter.find('/', fpos);
+    if(fend == string::npos)
+      fend = filter.size();
+    if(fend - fpos == 1 && filter[fpos] == '#')
+      return true;
+    if(pos > topic.size())
+      return false;
+    size_t end = topic.find('/', pos);
+    if(end == string::npos)
+      end = topic.size();
+    if(!(fend - fpos == 1 && filter[fpos] == '+') &&
+       (fend - fpos != end - pos || filter.compare(fpos, fend - fpos, topic, pos, end - pos) != 0))
+      return false;
+    fpos = fend + 1;
+    pos = end + 1;
+  }
+  return pos > topic.size();
+}
+
+struct Scan
+{
+  Scan(const string& filter) : filter_(filter), count_(0) { }
+  void operator()(const string& topic, const string&)
+  {
+    if(matches(filter_, topic))
+      ++count_;
+  }
+  const string& filter_;
+  size_t count_;
+};
+
+void bench(const RetainTrie& trie, const RetainMap& map, const string& filter)
+{
+  Timestamp start(Timestamp::now());
+  Scan scan(filter);
+  map.forEach(scan);
+  double scanSeconds = timeDifference(Timestamp::now(), start);
+
+  start = Timestamp::now();
+  RetainTrie::Cursor cursor(trie, filter);
+  std::vector<string> page;
+  size_t found = 0, pages = 0;
+  bool more = true;
+  double firstPage = 0;
+  while(more)
+  {
+    page.clear();
+    more = cursor.next(256, &page);
+    if(pages++ == 0)
+      firstPage = timeDifference(Timestamp::now(), start);
+    for(size_t i = 0; i < page.size(); ++i)
+    {
+      if(!matches(filter, page[i]))
+        printf("  MISMATCH %s\n", page[i].c_str());
+    }
+    found += page.size();
+  }
+  double trieSeconds = timeDifference(Timestamp::now(), start);
+
+  printf("%-28s full scan %8.3f ms (%zu) | trie %8.3f ms (%zu), first page %.3f ms%s\n",
+         filter.c_str(), scanSeconds * 1e3, scan.count_, trieSeconds * 1e3, found,
+         firstPage * 1e3, scan.count_ == found ? "" : "  COUNT MISMATCH");
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  int sites = argc > 1 ? atoi(argv[1]) : 10000;
+  int devices = argc > 2 ? atoi(argv[2]) : 100;
+
+  RetainTrie trie;
+  RetainMap map;
+  char topic[128];
+  for(int s = 0; s < sites; ++s)
+  {
+    for(int d = 0; d < devices; ++d)
+    {
+      snprintf(topic, sizeof topic, "site/%d/dev/%d/status", s, d);
+      trie.set(topic, topic);
+      map.set(topic, topic);
+    }
+    snprintf(topic, sizeof topic, "site/%d/status", s);
+    trie.set(topic, topic);
+    map.set(topic, topic);
+  }
+  trie.set("$SYS/broker/uptime", "$SYS/broker/uptime");
+  map.set("$SYS/broker/uptime", "$SYS/broker/uptime");
+  printf("%zu retained topics\n", map.size());
+
+  bench(trie, map, "site/+/status");
+  bench(trie, map, "site/42/dev/+/status");
+  bench(trie, map, "site/42/#");
+  bench(trie, map, "site/+/dev/7/status");
+  bench(trie, map, "$SYS/#");
+  bench(trie, map, "#");
+}
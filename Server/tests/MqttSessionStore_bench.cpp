@@ -0,0 +1,147 @@
+#include "MqttLogSessionStore.h"
+
+#include <muduo/base/Thread.h>
+#include <muduo/base/Timestamp.h>
+
+#include <boost/bind.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <algorithm>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace muduo;
+
+//离线消息写入吞吐：多个 IO 线程同时追加，后台线程组提交；
+//对比每条记录各自 write + fdatasync，最后测重启恢复的耗时。
+namespace
+{
+
+const int kSessions = 1000;
+
+void enqueueThread(MqttLogSessionStore* store, int id, int records, const MqttMessage* msg)
+{
+  char clientID[32];
+  for(int i = 0; i < records; ++i)
+  {
+    snprintf(clientID, sizeof clientID, "client-%d", (id + i * 7) % kSessions);
+    store->enqueue(clientID, *msg);
+  }
+}
+
+void flushThread(MqttLogSessionStore* store, const bool* done, double* maxFlush)
+{
+  while(!__atomic_load_n(done, __ATOMIC_ACQUIRE))
+  {
+    Timestamp start(Timestamp::now());
+    store->flush();
+    *maxFlush = std::max(*maxFlush, timeDifference(Timestamp::now(), start));
+    ::usleep(10*1000);
+  }
+}
+
+double benchGroupCommit(const string& dir, int threads, int records, const MqttMessage& msg)
+{
+  MqttLogSessionStore store(dir);
+  std::vector<MqttSessionStore::StoredSession> sessions;
+  store.recover(&sessions);
+  store.start();
+
+  std::list<MqttTopic> topics;
+  topics.push_back(MqttTopic::intern("bench/topic"));
+  char clientID[32];
+  for(int i = 0; i < kSessions; ++i)
+  {
+    snprintf(clientID, sizeof clientID, "client-%d", i);
+    store.saveSession(clientID, topics);
+  }
+
+  //另一个线程不停 flush，记下最长一次等待；压缩期间组提交若停下，这里会变长
+  bool done = false;
+  double maxFlush = 0;
+  Thread flusher(boost::bind(&flushThread, &store, &done, &maxFlush));
+  flusher.start();
+
+  Timestamp start(Timestamp::now());
+  boost::ptr_vector<Thread> workers;
+  for(int i = 0; i < threads; ++i)
+  {
+    workers.push_back(new Thread(
+          boost::bind(&enqueueThread, &store, i, records / threads, &msg)));
+    workers.back().start();
+  }
+  for(int i = 0; i < threads; ++i)
+    workers[i].join();
+  store.flush();
+  double seconds = timeDifference(Timestamp::now(), start);
+  __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+  flusher.join();
+
+  printf("group commit: %lld records, %lld fdatasync, %.0f records/s, longest flush %.3f s\n",
+         static_cast<long long>(store.records()), static_cast<long long>(store.syncs()),
+         static_cast<double>(store.records()) / seconds, maxFlush);
+  return seconds;
+}
+
+void benchSyncEach(const string& dir, int records, size_t recordSize)
+{
+  string path = dir + "/sync-each.tmp";
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  if(fd < 0)
+  {
+    perror("open");
+    return;
+  }
+  string record(recordSize, 'x');
+  Timestamp start(Timestamp::now());
+  for(int i = 0; i < records; ++i)
+  {
+    if(::write(fd, record.data(), record.size()) < 0 || ::fdatasync(fd) != 0)
+      perror("write");
+  }
+  double seconds = timeDifference(Timestamp::now(), start);
+  ::close(fd);
+  ::unlink(path.c_str());
+  printf("fdatasync each: %d records, %.0f records/s\n", records, records / seconds);
+}
+
+void benchRecover(const string& dir)
+{
+  Timestamp start(Timestamp::now());
+  MqttLogSessionStore store(dir);
+  std::vector<MqttSessionStore::StoredSession> sessions;
+  store.recover(&sessions);
+  double seconds = timeDifference(Timestamp::now(), start);
+
+  size_t msgs = 0;
+  for(size_t i = 0; i < sessions.size(); ++i)
+    msgs += sessions[i].msgs.size();
+  printf("recover: %zu sessions, %zu messages in %.3f s\n", sessions.size(), msgs, seconds);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  if(argc < 2)
+  {
+    printf("Usage: %s dir [threads] [records] [payload] [sync-each records]\n", argv[0]);
+    return 1;
+  }
+  string dir = argv[1];
+  int threads = argc > 2 ? atoi(argv[2]) : 4;
+  int records = argc > 3 ? atoi(argv[3]) : 1000000;
+  int payload = argc > 4 ? atoi(argv[4]) : 64;
+  int syncEach = argc > 5 ? atoi(argv[5]) : 2000;
+
+  MqttMessage msg;
+  msg.qos = 1;
+  msg.retain = false;
+  msg.topic = MqttTopic::intern("bench/topic");
+  msg.payload = net::BufferChunk(string(static_cast<size_t>(payload), 'p'));
+
+  benchGroupCommit(dir, threads, records, msg);
+  benchSyncEach(dir, syncEach, msg.topic.size() + static_cast<size_t>(payload) + 32);
+  benchRecover(dir);
+}
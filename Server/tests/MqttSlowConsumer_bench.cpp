@@ -0,0 +1,119 @@
+#include <muduo/base/CountDownLatch.h>
+#include <muduo/base/Thread.h>
+#include <muduo/base/Timestamp.h>
+
+#include <boost/bind.hpp>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "MqttTestClient.h"
+
+using namespace muduo;
+
+//慢消费者：若干订阅者订阅 slow/# 后再也不读，另有一个正常订阅者和一个 QoS 0 发布者。
+//没有出站上限时停滞订阅者的输出缓冲随发布量无限增长；有上限时服务端内存保持平稳，
+//正常订阅者的吞吐不受影响。给出服务端 pid 时每秒打印一次其常驻内存。
+namespace
+{
+
+long residentKB(int pid)
+{
+  char path[64];
+  snprintf(path, sizeof path, "/proc/%d/status", pid);
+  FILE* fp = fopen(path, "r");
+  if(!fp)
+    return -1;
+  char line[256];
+  long kb = -1;
+  while(fgets(line, sizeof line, fp))
+  {
+    if(sscanf(line, "VmRSS: %ld", &kb) == 1)
+      break;
+  }
+  fclose(fp);
+  return kb;
+}
+
+//正常订阅者：只数字节，直到发布者结束且一段时间没有新数据
+void drain(int fd, int64_t* received)
+{
+  struct timeval timeout = { 1, 0 };
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+  char buf[65536];
+  ssize_t n;
+  while((n = ::read(fd, buf, sizeof buf)) > 0)
+    *received += n;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  const char* ip = argc > 1 ? argv[1] : "127.0.0.1";
+  uint16_t port = static_cast<uint16_t>(argc > 2 ? atoi(argv[2]) : 1883);
+  int stalled = argc > 3 ? atoi(argv[3]) : 8;
+  int messages = argc > 4 ? atoi(argv[4]) : 20000;
+  int payloadSize = argc > 5 ? atoi(argv[5]) : 4096;
+  int serverPid = argc > 6 ? atoi(argv[6]) : 0;
+  printf("%d stalled subscribers, %d QoS 0 messages of %d bytes\n", stalled, messages, payloadSize);
+
+  struct sockaddr_in addr;
+  bzero(&addr, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  ::inet_pton(AF_INET, ip, &addr.sin_addr);
+
+  std::vector<int> stalledFds;
+  std::string buf;
+  for(int i = 0; i < stalled; ++i)
+  {
+    char clientId[32];
+    snprintf(clientId, sizeof clientId, "bench-stalled-%d", i);
+    int fd = MqttTestClient::connectTo(addr, clientId, 4096);
+    MqttTestClient::subscribe(fd, &buf, "slow/#", 0);
+    stalledFds.push_back(fd);
+  }
+  int fast = MqttTestClient::connectTo(addr, "bench-fast");
+  MqttTestClient::subscribe(fast, &buf, "slow/#", 0);
+  int64_t received = 0;
+  Thread reader(boost::bind(&drain, fast, &received));
+  reader.start();
+
+  int pub = MqttTestClient::connectTo(addr, "bench-pub");
+  std::string packet;
+  MqttTestClient::appendPublishHeader(&packet, "slow/data", 0, 0, static_cast<size_t>(payloadSize));
+  packet.append(static_cast<size_t>(payloadSize), 'x');
+
+  Timestamp start(Timestamp::now());
+  Timestamp lastReport(start);
+  long baseKB = serverPid > 0 ? residentKB(serverPid) : -1;
+  for(int i = 0; i < messages; ++i)
+  {
+    ::write(pub, packet.data(), packet.size());
+    if(serverPid > 0 && timeDifference(Timestamp::now(), lastReport) >= 1.0)
+    {
+      lastReport = Timestamp::now();
+      printf("  %d published, server +%ld KB resident\n", i, residentKB(serverPid) - baseKB);
+    }
+  }
+  double seconds = timeDifference(Timestamp::now(), start);
+  reader.join();
+
+  int64_t expected = static_cast<int64_t>(messages) * static_cast<int64_t>(packet.size());
+  printf("published in %.3f s, fast subscriber got %lld of %lld bytes\n",
+         seconds, static_cast<long long>(received), static_cast<long long>(expected));
+  if(serverPid > 0)
+    printf("server +%ld KB resident\n", residentKB(serverPid) - baseKB);
+
+  ::close(pub);
+  ::close(fast);
+  for(size_t i = 0; i < stalledFds.size(); ++i)
+    ::close(stalledFds[i]);
+}
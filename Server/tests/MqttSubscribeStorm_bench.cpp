@@ -0,0 +1,287 @@
+#include "MqttPersistentMap.h"
+#include "MqttSubscriberSet.h"
+#include "MqttTopicIndex.h"
+#include "MqttTopicTrie.h"
+
+#include <muduo/base/Atomic.h>
+#include <muduo/base/Mutex.h>
+#include <muduo/base/Thread.h>
+#include <muduo/base/Timestamp.h>
+
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <list>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace muduo;
+
+//重连风暴：大量客户端在发布者持续持有快照的同时重新订阅。
+//对比原先整表写时复制的 std::map、按路径复制的持久化结构（值为订阅者列表，增加订阅者时整份复制），
+//以及现在 MqttTopicTree 的做法（表里只放各自加锁的 MqttSubscriberSet）。
+//分别测每个客户端订阅自己的主题，以及所有客户端订阅同一个主题：
+//后者只有订阅者集合不随订阅者数增长，另外两种每次订阅都复制整个列表，总共 O(N^2)。
+//只换成按路径复制并不改善重连风暴，反而是退步：每个客户端一个主题时约慢一倍，
+//同一主题时慢两到三个数量级。引入按路径复制之后、引入订阅者集合之前的版本都有这个退步，
+//二分查找时不要把它当成别处引入的问题；改善来自订阅者集合。
+//写时复制的 std::map 只在发布者恰好持有快照时才复制，单核机器上很少发生，要在多核上看它的代价。
+namespace
+{
+
+typedef std::list<int> Subscribers;
+
+string makeTopic(int i)
+{
+  char buf[64];
+  snprintf(buf, sizeof buf, "clients/%d/cmd", i);
+  return buf;
+}
+
+string makeFilter(int i)
+{
+  char buf[64];
+  snprintf(buf, sizeof buf, "clients/%d/+", i);
+  return buf;
+}
+
+//原先 MqttTopicTree 的做法
+class LegacyTree
+{
+public:
+  typedef std::map<string,Subscribers> Map;
+  typedef boost::shared_ptr<Map> MapPtr;
+
+  LegacyTree()
+    : mapPtr_(new Map())
+  { }
+
+  void subscribe(const string& topic, int client)
+  {
+    MutexLockGuard lock(mutex_);
+    if(!mapPtr_.unique())
+    {
+      MapPtr newMapPtr(new Map(*mapPtr_));
+      mapPtr_.swap(newMapPtr);
+    }
+    (*mapPtr_)[topic].push_back(client);
+  }
+
+  size_t lookup(const string& topic)
+  {
+    MapPtr ptr;
+    {
+      MutexLockGuard lock(mutex_);
+      ptr = mapPtr_;
+    }
+    Map::iterator it = ptr->find(topic);
+    return it != ptr->end() ? it->second.size() : 0;
+  }
+
+private:
+  MapPtr mapPtr_;
+  MutexLock mutex_;
+};
+
+class PersistentTree
+{
+public:
+  void subscribe(const string& topic, int client)
+  {
+    MutexLockGuard lock(mutex_);
+    const Subscribers* old = map_.find(topic);
+    Subscribers subscribers = old ? *old : Subscribers();
+    subscribers.push_back(client);
+    map_.set(topic, subscribers);
+  }
+
+  void subscribeWildcard(const string& filter, int client)
+  {
+    MutexLockGuard lock(mutex_);
+    const Subscribers* old = trie_.find(filter);
+    Subscribers subscribers = old ? *old : Subscribers();
+    subscribers.push_back(client);
+    trie_.set(filter, subscribers);
+  }
+
+  size_t lookup(const string& topic)
+  {
+    MqttPersistentMap<Subscribers> map;
+    MqttTopicTrie<Subscribers> trie;
+    {
+      MutexLockGuard lock(mutex_);
+      map = map_;
+      trie = trie_;
+    }
+    const Subscribers* subscribers = map.find(topic);
+    std::vector<const Subscribers*> matched;
+    trie.match(MqttTopic::intern(topic), &matched);
+    return (subscribers ? subscribers->size() : 0) + matched.size();
+  }
+
+private:
+  MqttPersistentMap<Subscribers> map_;
+  MqttTopicTrie<Subscribers> trie_;
+  MutexLock mutex_;
+};
+
+//现在的 MqttTopicTree：精确主题的一个分片
+class SetTree
+{
+public:
+  explicit SetTree(int clients)
+  {
+    subscriptions_.reserve(clients);
+  }
+
+  void subscribe(const string& topic, int)
+  {
+    MqttTopic interned = MqttTopic::intern(topic);
+    subscriptions_.push_back(MqttSubscription(interned));
+    MutexLockGuard lock(mutex_);
+    const boost::shared_ptr<MqttSubscriberSet>* subscribers = index_.find(interned);
+    if(subscribers)
+    {
+      (*subscribers)->add(boost::shared_ptr<MqttClientSession>(), &subscriptions_.back());
+    }
+    else
+    {
+      boost::shared_ptr<MqttSubscriberSet> created(new MqttSubscriberSet);
+      created->add(boost::shared_ptr<MqttClientSession>(), &subscriptions_.back());
+      index_.set(interned, created);
+    }
+  }
+
+  size_t lookup(const string& topic)
+  {
+    MqttTopic interned = MqttTopic::intern(topic);
+    boost::shared_ptr<MqttSubscriberSet> subscribers;
+    {
+      MutexLockGuard lock(mutex_);
+      const boost::shared_ptr<MqttSubscriberSet>* found = index_.find(interned);
+      if(found)
+        subscribers = *found;
+    }
+    return subscribers ? subscribers->size() : 0;
+  }
+
+private:
+  MqttTopicIndex<boost::shared_ptr<MqttSubscriberSet> > index_;
+  std::vector<MqttSubscription> subscriptions_;  // 只在订阅线程追加，预留后地址不变
+  MutexLock mutex_;
+};
+
+//每个线程模拟一个不停发布的 IO 线程
+template<typename Tree>
+class Publishers
+{
+public:
+  Publishers(Tree* tree, int topics, int numThreads)
+    : tree_(tree),
+      topics_(topics)
+  {
+    for(int i = 0; i < numThreads; ++i)
+    {
+      threads_.push_back(boost::shared_ptr<Thread>(
+            new Thread(boost::bind(&Publishers::threadFunc, this), "publisher")));
+      threads_.back()->start();
+    }
+  }
+
+  int64_t stop()
+  {
+    stopping_.getAndSet(1);
+    for(size_t i = 0; i < threads_.size(); ++i)
+      threads_[i]->join();
+    return lookups_.get();
+  }
+
+private:
+  void threadFunc()
+  {
+    int i = 0;
+    while(stopping_.get() == 0)
+    {
+      tree_->lookup(makeTopic(i++ % topics_));
+      lookups_.increment();
+    }
+  }
+
+  Tree* tree_;
+  int topics_;
+  std::vector<boost::shared_ptr<Thread> > threads_;
+  AtomicInt32 stopping_;
+  AtomicInt64 lookups_;
+};
+
+//sameTopic 为 true 时所有客户端订阅同一个主题
+template<typename Tree>
+double subscribeAll(Tree* tree, int clients, bool sameTopic)
+{
+  Timestamp start(Timestamp::now());
+  for(int i = 0; i < clients; ++i)
+    tree->subscribe(makeTopic(sameTopic ? 0 : i), i);
+  return timeDifference(Timestamp::now(), start);
+}
+
+//返回用时，baseline 大于 0 时同时打印相对它的倍数
+template<typename Tree>
+double run(const char* name, Tree* tree, int clients, int threads, bool sameTopic, double baseline)
+{
+  Publishers<Tree> publisher(tree, sameTopic ? 1 : clients, threads);
+  double seconds = subscribeAll(tree, clients, sameTopic);
+  int64_t lookups = publisher.stop();
+  printf("  %-18s %.3f s, %.2f us/subscribe, %lld lookups",
+         name, seconds, seconds * 1e6 / clients, static_cast<long long>(lookups));
+  if(baseline > 0)
+    printf(", %.1fx map copy-on-write", seconds / baseline);
+  printf("\n");
+  return seconds;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  int clients = argc > 1 ? atoi(argv[1]) : 20000;
+  int threads = argc > 2 ? atoi(argv[2]) : 4;
+  bool legacy = argc > 3 ? atoi(argv[3]) != 0 : true;
+  //同一主题时按路径复制是平方级的，默认少一些客户端
+  int sameTopicClients = argc > 4 ? atoi(argv[4]) : 5000;
+  printf("%d clients resubscribing while %d publishers hold snapshots\n", clients, threads);
+
+  for(int same = 0; same < 2; ++same)
+  {
+    bool sameTopic = same != 0;
+    int n = sameTopic ? sameTopicClients : clients;
+    if(sameTopic)
+      printf("%d clients on one shared topic:\n", n);
+    else
+      printf("one topic per client:\n");
+    double baseline = 0;
+    if(legacy)
+    {
+      LegacyTree tree;
+      baseline = run("map copy-on-write:", &tree, n, threads, sameTopic, 0);
+    }
+    {
+      PersistentTree tree;
+      run("path copying:", &tree, n, threads, sameTopic, baseline);
+    }
+    {
+      SetTree tree(n);
+      run("subscriber sets:", &tree, n, threads, sameTopic, baseline);
+    }
+  }
+
+  //通配符订阅走前缀树，值同样是按路径复制的订阅者列表
+  PersistentTree tree;
+  Publishers<PersistentTree> publisher(&tree, clients, threads);
+  Timestamp start(Timestamp::now());
+  for(int i = 0; i < clients; ++i)
+    tree.subscribeWildcard(makeFilter(i), i);
+  double seconds = timeDifference(Timestamp::now(), start);
+  int64_t lookups = publisher.stop();
+  printf("wildcard, one filter per client:\n  %-18s %.3f s, %.2f us/subscribe, %lld lookups\n",
+         "path copying:", seconds, seconds * 1e6 / clients, static_cast<long long>(lookups));
+}
@@ -0,0 +1,202 @@
+#include "MqttClient.h"
+#include "MqttSubscriberSet.h"
+
+#include <muduo/base/Timestamp.h>
+
+#include <boost/weak_ptr.hpp>
+#include <algorithm>
+#include <list>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace muduo;
+
+//一个主题有大量订阅者（广播配置频道）时的退订与发布开销：
+//原先的写时复制 weak_ptr 链表（退订复制整表后逐个 lock 查找，发布复制整表后逐个 lock），
+//对比按下标存放、以会话订阅表中的句柄 O(1) 删除的订阅者集合。
+//最后是共享订阅组：每次发布只从组内选一个成员，耗时与组的大小无关。
+//用法：mqttsubscriberset_bench [subscribers] [unsubscribes] [publishes]
+namespace
+{
+
+typedef boost::shared_ptr<MqttClientSession> SessionPtr;
+typedef std::vector<SessionPtr> Collected;
+
+struct findSubscriber
+{
+  explicit findSubscriber(const SessionPtr& subscriber)
+    :subscriber_(subscriber)
+  { }
+  bool operator ()(const boost::weak_ptr<MqttClientSession>& subscriber) const
+  { return subscriber.lock() == subscriber_; }
+  const SessionPtr& subscriber_;
+};
+
+struct Legacy
+{
+  typedef std::list<boost::weak_ptr<MqttClientSession> > List;
+
+  void add(const SessionPtr& session, MqttSubscription*)
+  {
+    boost::shared_ptr<List> subscribers(list_ ? new List(*list_) : new List);
+    subscribers->push_back(session);
+    list_ = subscribers;
+  }
+
+  //建表时不复制，否则十万订阅者的建表本身就是平方级
+  void append(const SessionPtr& session)
+  {
+    if(!list_)
+      list_.reset(new List);
+    list_->push_back(session);
+  }
+
+  void remove(const SessionPtr& session, MqttSubscription*)
+  {
+    boost::shared_ptr<List> subscribers(new List(*list_));
+    subscribers->erase(std::find_if(subscribers->begin(), subscribers->end(), findSubscriber(session)));
+    list_ = subscribers;
+  }
+
+  void collect(Collected* out) const
+  {
+    List subscribers(*list_);
+    for(List::iterator it = subscribers.begin(); it != subscribers.end(); ++it)
+    {
+      SessionPtr ptr = it->lock();
+      if(ptr)
+        out->push_back(ptr);
+    }
+  }
+
+  boost::shared_ptr<List> list_;
+};
+
+struct Collector
+{
+  explicit Collector(Collected* out)
+    :out_(out)
+  { }
+  void operator ()(const SessionPtr& session)
+  { out_->push_back(session); }
+  Collected* out_;
+};
+
+struct Set
+{
+  void add(const SessionPtr& session, MqttSubscription* subscription)
+  { set_.add(session, subscription); }
+
+  void remove(const SessionPtr&, MqttSubscription* subscription)
+  { set_.remove(subscription); }
+
+  void collect(Collected* out) const
+  {
+    Collector collector(out);
+    set_.forEach(collector);
+  }
+
+  MqttSubscriberSet set_;
+};
+
+void build(Legacy* legacy, const std::vector<SessionPtr>& sessions, std::vector<MqttSubscription>*)
+{
+  for(size_t i = 0; i < sessions.size(); ++i)
+    legacy->append(sessions[i]);
+}
+
+void build(Set* set, const std::vector<SessionPtr>& sessions, std::vector<MqttSubscription>* subscriptions)
+{
+  for(size_t i = 0; i < sessions.size(); ++i)
+    set->add(sessions[i], &(*subscriptions)[i]);
+}
+
+template<typename T>
+void bench(const char* name, const std::vector<SessionPtr>& sessions, int unsubscribes, int publishes)
+{
+  MqttTopic topic = MqttTopic::intern("config/broadcast");
+  std::vector<MqttSubscription> subscriptions(sessions.size(), MqttSubscription(topic));
+  T subscribers;
+  build(&subscribers, sessions, &subscriptions);
+
+  //发布：取出全部订阅者，与 Publish 按 loop 分组前一致
+  Collected collected;
+  collected.reserve(sessions.size());
+  Timestamp start(Timestamp::now());
+  for(int i = 0; i < publishes; ++i)
+  {
+    collected.clear();
+    subscribers.collect(&collected);
+  }
+  double publishSeconds = timeDifference(Timestamp::now(), start);
+  collected.clear();
+
+  //随机退订后重新订阅，订阅者数保持不变
+  srand(1);
+  start = Timestamp::now();
+  for(int i = 0; i < unsubscribes; ++i)
+  {
+    size_t n = static_cast<size_t>(rand()) % sessions.size();
+    subscribers.remove(sessions[n], &subscriptions[n]);
+    subscribers.add(sessions[n], &subscriptions[n]);
+  }
+  double unsubscribeSeconds = timeDifference(Timestamp::now(), start);
+
+  printf("%-6s publish %8.2f ns/subscriber | unsubscribe+subscribe %12.1f ns\n", name,
+         publishSeconds * 1e9 / static_cast<double>(publishes) / static_cast<double>(sessions.size()),
+         unsubscribeSeconds * 1e9 / unsubscribes);
+}
+
+//一个共享组、各选法下每次发布的耗时。这里的会话都没有连接，
+//轮询与哈希每次都要多探查几个成员，是最坏的情况
+void benchShared(const std::vector<SessionPtr>& sessions, size_t members)
+{
+  MqttTopic topic = MqttTopic::intern("$share/workers/jobs/+");
+  std::vector<MqttSubscription> subscriptions(members, MqttSubscription(topic));
+  MqttSubscriberSet set;
+  for(size_t i = 0; i < members; ++i)
+    set.add(sessions[i], &subscriptions[i]);
+
+  const int kPublishes = 1000000;
+  const MqttShareStrategy strategies[] = { kShareRoundRobin, kShareLeastInflight, kShareStickyHash };
+  const char* names[] = { "round robin", "least inflight", "sticky" };
+  Collected collected;
+  collected.reserve(1);
+  printf("shared group of %6zu:", members);
+  for(int k = 0; k < 3; ++k)
+  {
+    Collector collector(&collected);
+    Timestamp start(Timestamp::now());
+    for(int i = 0; i < kPublishes; ++i)
+    {
+      collected.clear();
+      set.forEach(collector, strategies[k], static_cast<uint64_t>(i) * 0x9E3779B97F4A7C15ULL);
+    }
+    double seconds = timeDifference(Timestamp::now(), start);
+    printf("  %s %6.1f ns", names[k], seconds * 1e9 / kPublishes);
+  }
+  printf("  per publish\n");
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  int count = argc > 1 ? atoi(argv[1]) : 100000;
+  int unsubscribes = argc > 2 ? atoi(argv[2]) : 200;
+  int publishes = argc > 3 ? atoi(argv[3]) : 50;
+  printf("%d subscribers on one topic, %d unsubscribes, %d publishes\n", count, unsubscribes, publishes);
+
+  MqttSessionConfig config;
+  std::vector<SessionPtr> sessions;
+  sessions.reserve(static_cast<size_t>(count));
+  for(int i = 0; i < count; ++i)
+    sessions.push_back(SessionPtr(new MqttClientSession(NULL, &config)));
+
+  bench<Legacy>("list", sessions, unsubscribes, publishes);
+  bench<Set>("set", sessions, unsubscribes, publishes);
+
+  for(size_t members = 10; members <= sessions.size(); members *= 100)
+    benchShared(sessions, members);
+}
@@ -0,0 +1,169 @@
+#include "MqttTestClient.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "MqttProtocol.h"
+
+namespace MqttTestClient
+{
+
+namespace
+{
+
+void appendUint16(std::string* out, uint16_t value)
+{
+  *out += static_cast<char>(value >> 8);
+  *out += static_cast<char>(value & 0xFF);
+}
+
+void appendString(std::string* out, const std::string& s)
+{
+  appendUint16(out, static_cast<uint16_t>(s.size()));
+  *out += s;
+}
+
+bool writeAll(int fd, const std::string& data)
+{
+  size_t written = 0;
+  while(written < data.size())
+  {
+    ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+    if(n <= 0)
+      return false;
+    written += static_cast<size_t>(n);
+  }
+  return true;
+}
+
+}
+
+void appendFixedHeader(std::string* out, uint8_t type, size_t remaining)
+{
+  *out += static_cast<char>(type);
+  do
+  {
+    char byte = static_cast<char>(remaining % 128);
+    remaining /= 128;
+    if(remaining > 0)
+      byte = static_cast<char>(byte | 0x80);
+    *out += byte;
+  } while(remaining > 0);
+}
+
+void appendConnect(std::string* out, const std::string& clientId, bool cleanSession, uint16_t keepalive)
+{
+  appendFixedHeader(out, CONNECT, 12 + clientId.size());
+  appendString(out, PROTOCOL_NAME_v311);
+  *out += static_cast<char>(PROTOCOL_VERSION_v311);
+  *out += static_cast<char>(cleanSession ? 0x02 : 0);
+  appendUint16(out, keepalive);
+  appendString(out, clientId);
+}
+
+void appendSubscribe(std::string* out, uint16_t mid, const std::string& filter, uint8_t qos)
+{
+  appendFixedHeader(out, SUBSCRIBE | 0x02, 5 + filter.size());
+  appendUint16(out, mid);
+  appendString(out, filter);
+  *out += static_cast<char>(qos);
+}
+
+void appendPublishHeader(std::string* out, const std::string& topic, uint8_t qos, uint16_t mid,
+                         size_t payloadLen)
+{
+  appendFixedHeader(out, static_cast<uint8_t>(PUBLISH | (qos << 1)),
+                    2 + topic.size() + (qos > 0 ? 2 : 0) + payloadLen);
+  appendString(out, topic);
+  if(qos > 0)
+    appendUint16(out, mid);
+}
+
+void appendAck(std::string* out, uint8_t type, uint16_t mid)
+{
+  *out += static_cast<char>(type);
+  *out += '\x02';
+  appendUint16(out, mid);
+}
+
+int connectTo(const struct sockaddr_in& addr, const std::string& clientId, int rcvbuf)
+{
+  int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(rcvbuf > 0)
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof rcvbuf);
+  if(::connect(fd, reinterpret_cast<const struct sockaddr*>(&addr), sizeof addr) < 0)
+  {
+    perror("connect");
+    exit(1);
+  }
+  int one = 1;
+  ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+  std::string packet;
+  appendConnect(&packet, clientId, true, 0);
+  std::string buf;
+  std::string body;
+  unsigned char type;
+  if(!writeAll(fd, packet) || !readPacket(fd, &buf, &type, &body) ||
+     type != CONNACK || body.size() != 2 || body[1] != CONNACK_ACCEPTED)
+  {
+    fprintf(stderr, "%s: CONNECT refused\n", clientId.c_str());
+    exit(1);
+  }
+  return fd;
+}
+
+void subscribe(int fd, std::string* buf, const std::string& filter, uint8_t qos)
+{
+  std::string packet;
+  appendSubscribe(&packet, 1, filter, qos);
+  std::string body;
+  unsigned char type;
+  if(!writeAll(fd, packet) || !readPacket(fd, buf, &type, &body) || type != SUBACK)
+  {
+    fprintf(stderr, "subscribe %s: no SUBACK\n", filter.c_str());
+    exit(1);
+  }
+}
+
+bool readPacket(int fd, std::string* buf, unsigned char* type, std::string* body)
+{
+  for(;;)
+  {
+    size_t pos = 1;
+    uint32_t length = 0;
+    uint32_t multiplier = 1;
+    bool haveLength = false;
+    while(pos < buf->size() && pos < 5)
+    {
+      unsigned char byte = static_cast<unsigned char>((*buf)[pos++]);
+      length += (byte & 127) * multiplier;
+      multiplier *= 128;
+      if((byte & 128) == 0)
+      {
+        haveLength = true;
+        break;
+      }
+    }
+    if(haveLength && buf->size() >= pos + length)
+    {
+      *type = static_cast<unsigned char>((*buf)[0]);
+      body->assign(*buf, pos, length);
+      buf->erase(0, pos + length);
+      return true;
+    }
+
+    char tmp[65536];
+    ssize_t n = ::read(fd, tmp, sizeof tmp);
+    if(n <= 0)
+      return false;
+    buf->append(tmp, static_cast<size_t>(n));
+  }
+}
+
+}
@@ -0,0 +1,41 @@
+#ifndef MQTTTESTCLIENT_H
+#define MQTTTESTCLIENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+struct sockaddr_in;
+
+//各个 bench 共用的客户端报文编码，以及阻塞 socket 上的连接、订阅和读报文
+namespace MqttTestClient
+{
+
+//追加固定报头：类型字节与按变长编码的剩余长度
+void appendFixedHeader(std::string* out, uint8_t type, size_t remaining);
+
+//MQTT 3.1.1 CONNECT，不带遗嘱和用户名密码
+void appendConnect(std::string* out, const std::string& clientId, bool cleanSession, uint16_t keepalive);
+
+//订阅一个过滤器
+void appendSubscribe(std::string* out, uint16_t mid, const std::string& filter, uint8_t qos);
+
+//PUBLISH 的报头，调用方接着追加 payloadLen 字节负载；qos 为 0 时忽略 mid
+void appendPublishHeader(std::string* out, const std::string& topic, uint8_t qos, uint16_t mid,
+                         size_t payloadLen);
+
+//PUBACK、PUBREC、PUBREL、PUBCOMP 这类只带报文标识符的报文
+void appendAck(std::string* out, uint8_t type, uint16_t mid);
+
+//阻塞连接并以 clean session 完成 CONNECT，失败时退出进程。rcvbuf 大于 0 时先设置接收缓冲区
+int connectTo(const struct sockaddr_in& addr, const std::string& clientId, int rcvbuf = 0);
+
+//阻塞订阅并等到 SUBACK，失败时退出进程；buf 同 readPacket
+void subscribe(int fd, std::string* buf, const std::string& filter, uint8_t qos);
+
+//阻塞读，凑齐一个完整报文；buf 里可能留有下一个报文的开头，连接关闭时返回 false
+bool readPacket(int fd, std::string* buf, unsigned char* type, std::string* body);
+
+}
+
+#endif // MQTTTESTCLIENT_H
@@ -0,0 +1,132 @@
+#include "MqttTopicIndex.h"
+#include "MqttPersistentMap.h"
+
+#include <muduo/base/Timestamp.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace muduo;
+
+//精确主题查找：std::map、持久化 HAMT（此前的实现）与 Swiss table 式哈希表。
+//主题事先驻留好，与服务端读出 PUBLISH 时一致；查找一半命中、一半不存在（不存在的最多 1M 个）。
+//用法：mqtttopicindex_bench [topics] [lookups] [map,hamt,index]
+namespace
+{
+
+long residentKB()
+{
+  long pages = 0, resident = 0;
+  FILE* fp = fopen("/proc/self/statm", "r");
+  if(fp)
+  {
+    if(fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+      resident = 0;
+    fclose(fp);
+  }
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+MqttTopic topicOf(int i)
+{
+  char topic[64];
+  snprintf(topic, sizeof topic, "site/%d/device/%08d/telemetry", i % 1000, i);
+  return MqttTopic::intern(topic);
+}
+
+typedef int Value;
+
+struct StdMap
+{
+  void set(const MqttTopic& topic, Value v)
+  { map_[topic.str()] = v; }
+  const Value* find(const MqttTopic& topic) const
+  {
+    std::map<string, Value>::const_iterator it = map_.find(topic.str());
+    return it == map_.end() ? NULL : &it->second;
+  }
+  std::map<string, Value> map_;
+};
+
+struct Hamt
+{
+  void set(const MqttTopic& topic, Value v)
+  { map_.set(topic.str(), topic.hash(), v); }
+  const Value* find(const MqttTopic& topic) const
+  { return map_.find(topic.str(), topic.hash()); }
+  MqttPersistentMap<Value> map_;
+};
+
+struct Index
+{
+  void set(const MqttTopic& topic, Value v)
+  { index_.set(topic, v); }
+  const Value* find(const MqttTopic& topic) const
+  { return index_.find(topic); }
+  MqttTopicIndex<Value> index_;
+};
+
+template<typename T>
+void bench(const char* name, const std::vector<MqttTopic>& topics,
+           const std::vector<MqttTopic>& probes, int count)
+{
+  long rss = residentKB();
+  Timestamp start(Timestamp::now());
+  T* index = new T;
+  for(int i = 0; i < count; ++i)
+    index->set(topics[static_cast<size_t>(i)], i);
+  double buildSeconds = timeDifference(Timestamp::now(), start);
+  long grown = residentKB() - rss;
+
+  start = Timestamp::now();
+  size_t hits = 0;
+  for(size_t i = 0; i < probes.size(); ++i)
+  {
+    if(index->find(probes[i]))
+      ++hits;
+  }
+  double lookupSeconds = timeDifference(Timestamp::now(), start);
+  printf("%-6s build %7.3f s, +%8ld KB | lookup %7.1f ns (%zu hits)\n",
+         name, buildSeconds, grown, lookupSeconds * 1e9 / static_cast<double>(probes.size()), hits);
+  delete index;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  int count = argc > 1 ? atoi(argv[1]) : 1000000;
+  int lookups = argc > 2 ? atoi(argv[2]) : 2000000;
+  const char* kinds = argc > 3 ? argv[3] : "map,hamt,index";
+
+  //count 之后的主题只驻留不插入，用作不命中的查找
+  int absent = std::min(count, 1000000);
+  long rss = residentKB();
+  std::vector<MqttTopic> topics;
+  topics.reserve(static_cast<size_t>(count + absent));
+  for(int i = 0; i < count + absent; ++i)
+    topics.push_back(topicOf(i));
+  printf("%d topics (+%d absent) interned, +%ld KB\n", count, absent, residentKB() - rss);
+
+  std::vector<MqttTopic> probes;
+  probes.reserve(static_cast<size_t>(lookups));
+  srand(1);
+  for(int i = 0; i < lookups; ++i)
+  {
+    size_t n = static_cast<size_t>(rand());
+    probes.push_back(i % 2 == 0 ? topics[n % static_cast<size_t>(count)]
+                                : topics[static_cast<size_t>(count) + n % static_cast<size_t>(absent)]);
+  }
+
+  if(strstr(kinds, "map"))
+    bench<StdMap>("map", topics, probes, count);
+  if(strstr(kinds, "hamt"))
+    bench<Hamt>("hamt", topics, probes, count);
+  if(strstr(kinds, "index"))
+    bench<Index>("index", topics, probes, count);
+}
@@ -0,0 +1,123 @@
+#include "MqttTopicTrie.h"
+
+#include <muduo/base/Timestamp.h>
+
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <map>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace muduo;
+
+namespace
+{
+
+//原先 MqttTopicTree 的做法：逐个遍历通配符订阅，boost::split 后逐层比较
+bool legacyMatchingWildcard(const string& wildcardTopic, const string& topic)
+{
+  std::vector<string> vWildcardTopic;
+  boost::split(vWildcardTopic, wildcardTopic, boost::is_any_of( "/" ));
+  std::vector<string> vTopic;
+  boost::split(vTopic, topic, boost::is_any_of( "/" ));
+
+  typedef std::vector<string>::iterator Viterator;
+  for(Viterator Wit=vWildcardTopic.begin(),it=vTopic.begin();
+      Wit!=vWildcardTopic.end() && it!=vTopic.end();
+      ++Wit, ++it)
+  {
+    if(*Wit == *it || *Wit == "+")
+      continue;
+    else if(*Wit == "#")
+      return true;
+    else
+      return false;
+  }
+
+  return vWildcardTopic.size() == vTopic.size();
+}
+
+string makeFilter(int i, int devices)
+{
+  char buf[128];
+  int device = i % devices;
+  switch(i % 4)
+  {
+    case 0:
+      snprintf(buf, sizeof buf, "fleet/site%d/+/telemetry", (i / 4) % devices);
+      break;
+    case 1:
+      snprintf(buf, sizeof buf, "fleet/site%d/device%d/#", device, i);
+      break;
+    case 2:
+      snprintf(buf, sizeof buf, "fleet/+/device%d/status", i);
+      break;
+    default:
+      snprintf(buf, sizeof buf, "fleet/site%d/device%d/+", device, i);
+      break;
+  }
+  return buf;
+}
+
+string makeTopic(int i, int devices, int filters)
+{
+  char buf[128];
+  int device = static_cast<int>((i * 7919L) % filters);
+  snprintf(buf, sizeof buf, "fleet/site%d/device%d/telemetry",
+           device % devices, device);
+  return buf;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  int filters = argc > 1 ? atoi(argv[1]) : 40000;
+  int publishes = argc > 2 ? atoi(argv[2]) : 200;
+  int devices = 1000;
+
+  std::map<string,int> legacy;
+  MqttTopicTrie<int> trie;
+  for(int i = 0; i < filters; ++i)
+  {
+    string filter = makeFilter(i, devices);
+    legacy[filter] = i;
+    trie.set(filter, i);
+  }
+  printf("%d wildcard filters, %d publishes\n", filters, publishes);
+
+  size_t legacyMatched = 0;
+  Timestamp start(Timestamp::now());
+  for(int i = 0; i < publishes; ++i)
+  {
+    string topic = makeTopic(i, devices, filters);
+    for(std::map<string,int>::iterator it = legacy.begin(); it != legacy.end(); ++it)
+    {
+      if(legacyMatchingWildcard(it->first, topic))
+        ++legacyMatched;
+    }
+  }
+  double legacyTime = timeDifference(Timestamp::now(), start);
+
+  size_t trieMatched = 0;
+  std::vector<const int*> matched;
+  start = Timestamp::now();
+  for(int i = 0; i < publishes; ++i)
+  {
+    //服务端在读出 PUBLISH 时驻留主题，这里一并计入
+    MqttTopic topic = MqttTopic::intern(makeTopic(i, devices, filters));
+    matched.clear();
+    trie.match(topic, &matched);
+    trieMatched += matched.size();
+  }
+  double trieTime = timeDifference(Timestamp::now(), start);
+
+  printf("map+split: %zd matches, %.3f us/publish\n",
+         legacyMatched, legacyTime * 1e6 / publishes);
+  printf("trie:      %zd matches, %.3f us/publish\n",
+         trieMatched, trieTime * 1e6 / publishes);
+  printf("speedup:   %.1fx\n", legacyTime / trieTime);
+
+  return legacyMatched == trieMatched ? 0 : 1;
+}
@@ -0,0 +1,98 @@
+#include "MqttTopic.h"
+
+#include <muduo/base/Timestamp.h>
+
+#include <algorithm>
+#include <list>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace muduo;
+
+//长主题反复出现时的内存与比较开销：每个会话的订阅表与排队消息各自保存主题副本，
+//对比只保存驻留主题的引用。主题形如 org/<uuid>/site/<uuid>/device/<uuid>/telemetry。
+namespace
+{
+
+long residentKB()
+{
+  long pages = 0, resident = 0;
+  FILE* fp = fopen("/proc/self/statm", "r");
+  if(fp)
+  {
+    if(fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+      resident = 0;
+    fclose(fp);
+  }
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+string uuid(unsigned n)
+{
+  char buf[40];
+  snprintf(buf, sizeof buf, "%08x-%04x-4%03x-8%03x-%012x", n * 2654435761u, n & 0xffff,
+           n & 0xfff, (n >> 12) & 0xfff, n);
+  return buf;
+}
+
+string topicOf(int i)
+{
+  return "org/" + uuid(static_cast<unsigned>(i / 1000)) + "/site/" + uuid(static_cast<unsigned>(i / 10)) +
+         "/device/" + uuid(static_cast<unsigned>(i)) + "/telemetry";
+}
+
+//sessions 个会话，每个订阅 perSession 个主题，主题从 topics 个中轮流取
+template<typename T, typename Make>
+void bench(const char* name, Make make, int sessions, int perSession, int topics)
+{
+  long rss = residentKB();
+  Timestamp start(Timestamp::now());
+  //不释放，免得后一项复用这部分内存而测不出增长
+  std::vector<std::list<T> >& subscriptions = *new std::vector<std::list<T> >(static_cast<size_t>(sessions));
+  for(int s = 0; s < sessions; ++s)
+  {
+    for(int k = 0; k < perSession; ++k)
+      subscriptions[static_cast<size_t>(s)].push_back(make(topicOf((s * 7 + k) % topics)));
+  }
+  double buildSeconds = timeDifference(Timestamp::now(), start);
+  long grown = residentKB() - rss;
+
+  //重复订阅检查：在会话的订阅表里找同一主题
+  start = Timestamp::now();
+  size_t found = 0;
+  for(int s = 0; s < sessions; ++s)
+  {
+    const std::list<T>& list = subscriptions[static_cast<size_t>(s)];
+    for(typename std::list<T>::const_iterator it = list.begin(); it != list.end(); ++it)
+    {
+      if(std::find(list.begin(), list.end(), *it) != list.end())
+        ++found;
+    }
+  }
+  double findSeconds = timeDifference(Timestamp::now(), start);
+
+  long total = static_cast<long>(sessions) * perSession;
+  printf("%-8s build %.3f s, +%ld KB (%.0f bytes/subscription), find %.1f ns/compare (%zu)\n",
+         name, buildSeconds, grown, static_cast<double>(grown) * 1024 / static_cast<double>(total),
+         findSeconds * 1e9 / static_cast<double>(total * perSession), found);
+}
+
+string copyTopic(const string& topic)
+{ return topic; }
+
+}
+
+int main(int argc, char* argv[])
+{
+  int sessions = argc > 1 ? atoi(argv[1]) : 100000;
+  int perSession = argc > 2 ? atoi(argv[2]) : 10;
+  int topics = argc > 3 ? atoi(argv[3]) : 10000;
+  printf("%d sessions x %d subscriptions over %d topics of %zu bytes\n",
+         sessions, perSession, topics, topicOf(0).size());
+
+  bench<string>("string", &copyTopic, sessions, perSession, topics);
+  bench<MqttTopic>("interned", &MqttTopic::intern, sessions, perSession, topics);
+  printf("%zu interned topics\n", MqttTopic::internedCount());
+}